@@ -49,6 +49,13 @@ class BlockchainTest(BitcoinTestFramework):
         assert_equal(res[u'bytes_serialized'], 11724),
         assert_equal(len(res[u'bestblock']), 64)
         assert_equal(len(res[u'hash_serialized']), 64)
+        assert_equal(len(res[u'muhash']), 64)
+
+        # the running statistics agree with the full scan
+        running = node.gettxoutsetinfo("muhash")
+        assert('hash_serialized' not in running)
+        for field in (u'total_amount', u'transactions', u'height', u'txouts', u'bytes_serialized', u'bestblock', u'muhash'):
+            assert_equal(running[field], res[field])
 
 
 if __name__ == '__main__':
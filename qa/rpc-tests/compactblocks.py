@@ -0,0 +1,213 @@
+#!/usr/bin/env python
+# Copyright (c) 2018 The Pastel developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#
+# Relay blocks with and without compact blocks and compare how long it takes
+# the peers to accept them. Node 0 mines; node 1 gets compact blocks from it,
+# node 2 runs with -compactblocks=0 and gets full blocks. The message counters
+# of getnetmsgstats show which way each block went. Two p2p connections then
+# check that only a peer asking for high-bandwidth mode gets new blocks pushed
+# as unsolicited compact blocks.
+#
+
+import sys; assert sys.version_info < (3,), ur"This script does not run under Python 3. Please use Python 2.7.x."
+
+from test_framework.mininode import NodeConn, NodeConnCB, NetworkThread, \
+    msg_ping, msg_pong, msg_sendcmpct, mininode_lock
+from test_framework.test_framework import BitcoinTestFramework
+from test_framework.util import (
+    assert_equal,
+    connect_nodes_bi,
+    p2p_port,
+    start_node,
+    sync_blocks,
+    sync_mempools,
+)
+import time
+
+class CmpctBlockNode(NodeConnCB):
+    """Records the block announcements of the node, never asks for anything"""
+    def __init__(self):
+        NodeConnCB.__init__(self)
+        self.create_callback_map()
+        self.connection = None
+        self.ping_counter = 1
+        self.last_pong = msg_pong()
+        self.block_invs = []
+        self.cmpctblocks = 0
+
+    def add_connection(self, conn):
+        self.connection = conn
+
+    def send_message(self, message):
+        self.connection.send_message(message)
+
+    def on_inv(self, conn, message):
+        self.block_invs.extend(i.hash for i in message.inv if i.type == 2)
+
+    def on_cmpctblock(self, conn, message):
+        self.cmpctblocks += 1
+
+    def on_pong(self, conn, message):
+        self.last_pong = message
+
+    def wait_for_verack(self):
+        while True:
+            with mininode_lock:
+                if self.verack_received:
+                    return
+            time.sleep(0.05)
+
+    def sync_with_ping(self, timeout=30):
+        self.connection.send_message(msg_ping(nonce=self.ping_counter))
+        start = time.time()
+        while time.time() - start < timeout:
+            with mininode_lock:
+                if self.last_pong.nonce == self.ping_counter:
+                    break
+            time.sleep(0.05)
+        self.ping_counter += 1
+        with mininode_lock:
+            assert_equal(self.last_pong.nonce, self.ping_counter - 1)
+
+
+class CompactBlocksTest(BitcoinTestFramework):
+
+    def setup_nodes(self):
+        args = ["-debug=cmpctblock", "-debug=net"]
+        return [start_node(0, self.options.tmpdir, args),
+                start_node(1, self.options.tmpdir, args),
+                start_node(2, self.options.tmpdir, args + ["-compactblocks=0"])]
+
+    def setup_network(self):
+        self.nodes = self.setup_nodes()
+        connect_nodes_bi(self.nodes, 0, 1)
+        connect_nodes_bi(self.nodes, 0, 2)
+        self.is_network_split = False
+        self.sync_all()
+
+    def msgcount(self, n, command, counter):
+        totals = self.nodes[n].getnetmsgstats()['totals']
+        return totals[command][counter] if command in totals else 0
+
+    def msgcounts(self):
+        return dict(((n, command, counter), self.msgcount(n, command, counter))
+                    for n in (1, 2)
+                    for command, counter in (("cmpctblock", "recvmsgs"), ("block", "recvmsgs"),
+                                             ("getblocktxn", "sentmsgs"), ("blocktxn", "recvmsgs")))
+
+    def assert_msgs(self, before, n, command, counter, expected, timeout=10):
+        # a message is counted once it's processed, which may be just after the tip moved
+        start = time.time()
+        while True:
+            after = self.msgcount(n, command, counter)
+            if after - before[(n, command, counter)] == expected or time.time() - start > timeout:
+                break
+            time.sleep(0.1)
+        assert_equal(after - before[(n, command, counter)], expected)
+
+    def wait_for_tips(self, blockhash, timeout=60):
+        """Seconds until nodes 1 and 2 have blockhash as their tip, polled in turn"""
+        start = time.time()
+        latency = {}
+        while len(latency) < 2:
+            if time.time() - start > timeout:
+                raise AssertionError("block %s not relayed in time" % blockhash)
+            for n in (1, 2):
+                if n not in latency and self.nodes[n].getbestblockhash() == blockhash:
+                    latency[n] = time.time() - start
+            time.sleep(0.005)
+        return latency
+
+    def run_test(self):
+        print "Mining a block to leave IBD"
+        self.nodes[0].generate(1)
+        self.sync_all()
+
+        latency = {1: [], 2: []}
+        rounds = 5
+        before = self.msgcounts()
+        for round in range(rounds):
+            # fill the mempools, so the compact block can be rebuilt without a round trip
+            address = self.nodes[1].getnewaddress()
+            for i in range(20):
+                self.nodes[0].sendtoaddress(address, 0.01)
+            sync_mempools(self.nodes)
+
+            blockhash = self.nodes[0].generate(1)[0]
+            round_latency = self.wait_for_tips(blockhash)
+            for n in (1, 2):
+                latency[n].append(round_latency[n])
+            sync_blocks(self.nodes)
+            for n in (1, 2):
+                assert_equal(self.nodes[n].getrawmempool(), [])
+
+        # node 1 rebuilt every block from its mempool, node 2 downloaded them in full
+        self.assert_msgs(before, 1, "cmpctblock", "recvmsgs", rounds)
+        self.assert_msgs(before, 1, "block", "recvmsgs", 0)
+        self.assert_msgs(before, 1, "getblocktxn", "sentmsgs", 0)
+        self.assert_msgs(before, 2, "cmpctblock", "recvmsgs", 0)
+        self.assert_msgs(before, 2, "block", "recvmsgs", rounds)
+
+        print "Relaying a block whose transactions node 1 hasn't seen"
+        self.nodes[0].disconnectnode("127.0.0.1:%d" % p2p_port(1))
+        self.nodes[1].disconnectnode("127.0.0.1:%d" % p2p_port(0))
+        while self.nodes[1].getpeerinfo():
+            time.sleep(0.1)
+        address = self.nodes[2].getnewaddress()
+        for i in range(5):
+            self.nodes[0].sendtoaddress(address, 0.01)
+        sync_mempools([self.nodes[0], self.nodes[2]])
+        connect_nodes_bi(self.nodes, 0, 1)
+        assert_equal(self.nodes[1].getrawmempool(), [])
+
+        before = self.msgcounts()
+        blockhash = self.nodes[0].generate(1)[0]
+        self.wait_for_tips(blockhash)
+        sync_blocks(self.nodes)
+        # the missing transactions came in one round trip, not with the whole block
+        self.assert_msgs(before, 1, "cmpctblock", "recvmsgs", 1)
+        self.assert_msgs(before, 1, "getblocktxn", "sentmsgs", 1)
+        self.assert_msgs(before, 1, "blocktxn", "recvmsgs", 1)
+        self.assert_msgs(before, 1, "block", "recvmsgs", 0)
+
+        print "Pushing a block to a peer in high-bandwidth mode"
+        hb_node = CmpctBlockNode()
+        lb_node = CmpctBlockNode()
+        connections = [NodeConn('127.0.0.1', p2p_port(0), self.nodes[0], hb_node),
+                       NodeConn('127.0.0.1', p2p_port(0), self.nodes[0], lb_node)]
+        hb_node.add_connection(connections[0])
+        lb_node.add_connection(connections[1])
+        NetworkThread().start()
+        hb_node.wait_for_verack()
+        lb_node.wait_for_verack()
+        hb_node.send_message(msg_sendcmpct(True, 1))
+        lb_node.send_message(msg_sendcmpct(False, 1))
+        hb_node.sync_with_ping()
+        lb_node.sync_with_ping()
+
+        blockhash = self.nodes[0].generate(1)[0]
+        start = time.time()
+        while time.time() - start < 10:
+            with mininode_lock:
+                if hb_node.cmpctblocks and lb_node.block_invs:
+                    break
+            time.sleep(0.1)
+        hb_node.sync_with_ping()
+        lb_node.sync_with_ping()
+        with mininode_lock:
+            # the compact block came without an inv or getdata, the other peer only got the inv
+            assert_equal(hb_node.cmpctblocks, 1)
+            assert_equal(hb_node.block_invs, [])
+            assert_equal(lb_node.cmpctblocks, 0)
+            assert_equal(lb_node.block_invs, [int(blockhash, 16)])
+        for conn in connections:
+            conn.disconnect_node()
+
+        print "Average relay latency with compact blocks:    %.3fs" % (sum(latency[1]) / len(latency[1]))
+        print "Average relay latency without compact blocks: %.3fs" % (sum(latency[2]) / len(latency[2]))
+
+if __name__ == '__main__':
+    CompactBlocksTest().main()
@@ -1308,6 +1308,44 @@ class msg_filterclear(object):
         return "msg_filterclear()"
 
 
+class msg_sendcmpct(object):
+    command = "sendcmpct"
+
+    def __init__(self, announce=False, version=1):
+        self.announce = announce
+        self.version = version
+
+    def deserialize(self, f):
+        self.announce = struct.unpack("<?", f.read(1))[0]
+        self.version = struct.unpack("<Q", f.read(8))[0]
+
+    def serialize(self):
+        r = ""
+        r += struct.pack("<?", self.announce)
+        r += struct.pack("<Q", self.version)
+        return r
+
+    def __repr__(self):
+        return "msg_sendcmpct(announce=%s, version=%lu)" % (self.announce, self.version)
+
+
+# The compact block is kept serialized, its header layout differs from CBlockHeader
+class msg_cmpctblock(object):
+    command = "cmpctblock"
+
+    def __init__(self):
+        self.data = ""
+
+    def deserialize(self, f):
+        self.data = f.read()
+
+    def serialize(self):
+        return self.data
+
+    def __repr__(self):
+        return "msg_cmpctblock(len=%d)" % len(self.data)
+
+
 # This is what a callback should look like for NodeConn
 # Reimplement the on_* functions to provide handling for events
 class NodeConnCB(object):
@@ -1334,7 +1372,9 @@ class NodeConnCB(object):
             "headers": self.on_headers,
             "getheaders": self.on_getheaders,
             "reject": self.on_reject,
-            "mempool": self.on_mempool
+            "mempool": self.on_mempool,
+            "sendcmpct": self.on_sendcmpct,
+            "cmpctblock": self.on_cmpctblock
         }
 
     def deliver(self, conn, message):
@@ -1381,6 +1421,8 @@ class NodeConnCB(object):
     def on_close(self, conn): pass
     def on_mempool(self, conn): pass
     def on_pong(self, conn, message): pass
+    def on_sendcmpct(self, conn, message): pass
+    def on_cmpctblock(self, conn, message): pass
 
 
 # The actual NodeConn class
@@ -1403,7 +1445,9 @@ class NodeConn(asyncore.dispatcher):
         "headers": msg_headers,
         "getheaders": msg_getheaders,
         "reject": msg_reject,
-        "mempool": msg_mempool
+        "mempool": msg_mempool,
+        "sendcmpct": msg_sendcmpct,
+        "cmpctblock": msg_cmpctblock
     }
     MAGIC_BYTES = {
         "mainnet": "\x24\xe9\x27\x64",   # mainnet
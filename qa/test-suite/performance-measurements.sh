@@ -215,6 +215,9 @@ case "$1" in
             listunspent)
                 zcash_rpc zcbenchmark listunspent 10
                 ;;
+            verifysaplingblock)
+                zcash_rpc_slow zcbenchmark verifysaplingblock 10 "${@:3}"
+                ;;
             *)
                 pasteld_stop
                 echo "Bad arguments to time."
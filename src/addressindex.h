@@ -0,0 +1,207 @@
+// Copyright (c) 2018 The Pastel developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_ADDRESSINDEX_H
+#define BITCOIN_ADDRESSINDEX_H
+
+#include "amount.h"
+#include "script/script.h"
+#include "serialize.h"
+#include "uint256.h"
+
+#include <vector>
+
+/** Address types stored in the address and spent indexes */
+enum AddressIndexType : uint8_t
+{
+    ADDRESS_INDEX_NONE = 0,
+    ADDRESS_INDEX_P2PKH = 1,
+    ADDRESS_INDEX_P2SH = 2,
+};
+
+/**
+ * Extract the indexed address of a transparent output script.
+ * Only P2PKH and P2SH outputs are indexed, anything else yields
+ * ADDRESS_INDEX_NONE.
+ */
+inline AddressIndexType GetAddressIndexType(const CScript& script, uint160& hashBytes)
+{
+    if (script.IsPayToScriptHash()) {
+        hashBytes = uint160(std::vector<unsigned char>(script.begin() + 2, script.begin() + 22));
+        return ADDRESS_INDEX_P2SH;
+    }
+    if (script.size() == 25 && script[0] == OP_DUP && script[1] == OP_HASH160 && script[2] == 20 &&
+        script[23] == OP_EQUALVERIFY && script[24] == OP_CHECKSIG) {
+        hashBytes = uint160(std::vector<unsigned char>(script.begin() + 3, script.begin() + 23));
+        return ADDRESS_INDEX_P2PKH;
+    }
+    return ADDRESS_INDEX_NONE;
+}
+
+/**
+ * Key of an address delta: every credit (output) and debit (spent input)
+ * of an address. Height and position in the block are stored big-endian so
+ * that LevelDB iterates the history of an address in chain order.
+ */
+struct CAddressIndexKey
+{
+    uint8_t type;
+    uint160 hashBytes;
+    int blockHeight;
+    unsigned int txindex;
+    uint256 txhash;
+    unsigned int index;
+    bool spending;
+
+    CAddressIndexKey() { SetNull(); }
+
+    CAddressIndexKey(uint8_t addressType, const uint160& addressHash, int height, unsigned int blockindex,
+                     const uint256& txid, unsigned int indexValue, bool isSpending) :
+        type(addressType), hashBytes(addressHash), blockHeight(height), txindex(blockindex),
+        txhash(txid), index(indexValue), spending(isSpending) {}
+
+    void SetNull()
+    {
+        type = ADDRESS_INDEX_NONE;
+        hashBytes.SetNull();
+        blockHeight = 0;
+        txindex = 0;
+        txhash.SetNull();
+        index = 0;
+        spending = false;
+    }
+
+    template<typename Stream>
+    void Serialize(Stream& s) const
+    {
+        ser_writedata8(s, type);
+        hashBytes.Serialize(s);
+        ser_writedata32be(s, blockHeight);
+        ser_writedata32be(s, txindex);
+        txhash.Serialize(s);
+        ser_writedata32(s, index);
+        ser_writedata8(s, spending);
+    }
+
+    template<typename Stream>
+    void Unserialize(Stream& s)
+    {
+        type = ser_readdata8(s);
+        hashBytes.Unserialize(s);
+        blockHeight = ser_readdata32be(s);
+        txindex = ser_readdata32be(s);
+        txhash.Unserialize(s);
+        index = ser_readdata32(s);
+        spending = ser_readdata8(s) != 0;
+    }
+};
+
+/** Prefix of CAddressIndexKey used to seek to the history of an address */
+struct CAddressIndexIteratorKey
+{
+    uint8_t type;
+    uint160 hashBytes;
+
+    CAddressIndexIteratorKey(uint8_t addressType, const uint160& addressHash) :
+        type(addressType), hashBytes(addressHash) {}
+
+    template<typename Stream>
+    void Serialize(Stream& s) const
+    {
+        ser_writedata8(s, type);
+        hashBytes.Serialize(s);
+    }
+};
+
+/** Prefix of CAddressIndexKey used to seek to a height in the history of an address */
+struct CAddressIndexIteratorHeightKey
+{
+    uint8_t type;
+    uint160 hashBytes;
+    int blockHeight;
+
+    CAddressIndexIteratorHeightKey(uint8_t addressType, const uint160& addressHash, int height) :
+        type(addressType), hashBytes(addressHash), blockHeight(height) {}
+
+    template<typename Stream>
+    void Serialize(Stream& s) const
+    {
+        ser_writedata8(s, type);
+        hashBytes.Serialize(s);
+        ser_writedata32be(s, blockHeight);
+    }
+};
+
+/** Key of an unspent output of an address */
+struct CAddressUnspentKey
+{
+    uint8_t type;
+    uint160 hashBytes;
+    uint256 txhash;
+    unsigned int index;
+
+    CAddressUnspentKey() { SetNull(); }
+
+    CAddressUnspentKey(uint8_t addressType, const uint160& addressHash, const uint256& txid, unsigned int indexValue) :
+        type(addressType), hashBytes(addressHash), txhash(txid), index(indexValue) {}
+
+    void SetNull()
+    {
+        type = ADDRESS_INDEX_NONE;
+        hashBytes.SetNull();
+        txhash.SetNull();
+        index = 0;
+    }
+
+    template<typename Stream>
+    void Serialize(Stream& s) const
+    {
+        ser_writedata8(s, type);
+        hashBytes.Serialize(s);
+        txhash.Serialize(s);
+        ser_writedata32(s, index);
+    }
+
+    template<typename Stream>
+    void Unserialize(Stream& s)
+    {
+        type = ser_readdata8(s);
+        hashBytes.Unserialize(s);
+        txhash.Unserialize(s);
+        index = ser_readdata32(s);
+    }
+};
+
+/** Value of an unspent output of an address; a null value erases the entry */
+struct CAddressUnspentValue
+{
+    CAmount satoshis;
+    CScript script;
+    int blockHeight;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(satoshis);
+        READWRITE(*(CScriptBase*)(&script));
+        READWRITE(blockHeight);
+    }
+
+    CAddressUnspentValue() { SetNull(); }
+
+    CAddressUnspentValue(CAmount sats, const CScript& scriptPubKey, int height) :
+        satoshis(sats), script(scriptPubKey), blockHeight(height) {}
+
+    void SetNull()
+    {
+        satoshis = -1;
+        script.clear();
+        blockHeight = 0;
+    }
+
+    bool IsNull() const { return satoshis == -1; }
+};
+
+#endif // BITCOIN_ADDRESSINDEX_H
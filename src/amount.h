@@ -57,6 +57,7 @@ public:
     friend bool operator==(const CFeeRate& a, const CFeeRate& b) { return a.nPatoshisPerK == b.nPatoshisPerK; }
     friend bool operator<=(const CFeeRate& a, const CFeeRate& b) { return a.nPatoshisPerK <= b.nPatoshisPerK; }
     friend bool operator>=(const CFeeRate& a, const CFeeRate& b) { return a.nPatoshisPerK >= b.nPatoshisPerK; }
+    CFeeRate& operator+=(const CFeeRate& a) { nPatoshisPerK += a.nPatoshisPerK; return *this; }
     std::string ToString() const;
 
     ADD_SERIALIZE_METHODS;
@@ -0,0 +1,213 @@
+// Copyright (c) 2018 The Pastel developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockcache.h"
+
+#include "clientversion.h"
+#include "main.h"
+#include "serialize.h"
+#include "util.h"
+
+#include <ios>
+#include <string.h>
+
+#ifndef WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+void CBlockCache::SetMaxSize(size_t nMaxSizeIn)
+{
+    LOCK(cs);
+    nMaxSize = nMaxSizeIn;
+    while (listBlocks.size() > nMaxSize) {
+        mapBlocks.erase(listBlocks.back().first);
+        listBlocks.pop_back();
+    }
+}
+
+size_t CBlockCache::Size() const
+{
+    LOCK(cs);
+    return listBlocks.size();
+}
+
+std::shared_ptr<const CBlock> CBlockCache::Get(const uint256& hash)
+{
+    LOCK(cs);
+    std::map<uint256, BlockList::iterator>::iterator it = mapBlocks.find(hash);
+    if (it == mapBlocks.end())
+        return std::shared_ptr<const CBlock>();
+    listBlocks.splice(listBlocks.begin(), listBlocks, it->second);
+    return it->second->second;
+}
+
+void CBlockCache::Insert(const uint256& hash, const std::shared_ptr<const CBlock>& pblock)
+{
+    LOCK(cs);
+    if (nMaxSize == 0 || mapBlocks.count(hash))
+        return;
+    listBlocks.push_front(std::make_pair(hash, pblock));
+    mapBlocks[hash] = listBlocks.begin();
+    while (listBlocks.size() > nMaxSize) {
+        mapBlocks.erase(listBlocks.back().first);
+        listBlocks.pop_back();
+    }
+}
+
+void CBlockCache::Clear()
+{
+    LOCK(cs);
+    mapBlocks.clear();
+    listBlocks.clear();
+}
+
+class CMappedBlockFiles::CMappedFile
+{
+public:
+    const char* pData;
+    size_t nSize;
+
+    CMappedFile(const char* pDataIn, size_t nSizeIn) : pData(pDataIn), nSize(nSizeIn) {}
+    ~CMappedFile()
+    {
+#ifndef WIN32
+        munmap(const_cast<char*>(pData), nSize);
+#endif
+    }
+
+private:
+    CMappedFile(const CMappedFile&);
+    CMappedFile& operator=(const CMappedFile&);
+};
+
+namespace {
+
+/** Stream subset deserializing from a mapped block file */
+class CMappedFileReader
+{
+private:
+    const int nType;
+    const int nVersion;
+    const char* pcur;
+    const char* pend;
+
+public:
+    CMappedFileReader(const char* pbegin, const char* pendIn, int nTypeIn, int nVersionIn) :
+        nType(nTypeIn), nVersion(nVersionIn), pcur(pbegin), pend(pendIn) {}
+
+    int GetType() const          { return nType; }
+    int GetVersion() const       { return nVersion; }
+
+    void read(char* pch, size_t nSize)
+    {
+        if (nSize > (size_t)(pend - pcur))
+            throw std::ios_base::failure("CMappedFileReader::read: end of file");
+        memcpy(pch, pcur, nSize);
+        pcur += nSize;
+    }
+
+    void ignore(size_t nSize)
+    {
+        if (nSize > (size_t)(pend - pcur))
+            throw std::ios_base::failure("CMappedFileReader::ignore: end of file");
+        pcur += nSize;
+    }
+
+    template<typename T>
+    CMappedFileReader& operator>>(T& obj)
+    {
+        ::Unserialize(*this, obj);
+        return (*this);
+    }
+};
+
+}
+
+CMappedBlockFiles::~CMappedBlockFiles()
+{
+    Clear();
+}
+
+std::shared_ptr<const CMappedBlockFiles::CMappedFile> CMappedBlockFiles::GetFile(int nFile)
+{
+    LOCK(cs);
+    std::map<int, FileList::iterator>::iterator it = mapFiles.find(nFile);
+    if (it != mapFiles.end()) {
+        listFiles.splice(listFiles.begin(), listFiles, it->second);
+        return it->second->second;
+    }
+
+#ifdef WIN32
+    // Mapped files can't be deleted on Windows, which would break pruning
+    return std::shared_ptr<const CMappedFile>();
+#else
+    boost::filesystem::path path = GetBlockPosFilename(CDiskBlockPos(nFile, 0), "blk");
+    int fd = open(path.string().c_str(), O_RDONLY);
+    if (fd == -1)
+        return std::shared_ptr<const CMappedFile>();
+    struct stat st;
+    void* pData = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size > 0)
+        pData = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (pData == MAP_FAILED) {
+        LogPrint("db", "%s: unable to map %s\n", __func__, path.string());
+        return std::shared_ptr<const CMappedFile>();
+    }
+
+    std::shared_ptr<const CMappedFile> pfile = std::make_shared<const CMappedFile>((const char*)pData, (size_t)st.st_size);
+    listFiles.push_front(std::make_pair(nFile, pfile));
+    mapFiles[nFile] = listFiles.begin();
+    while (listFiles.size() > MAX_MAPPED_BLOCK_FILES) {
+        mapFiles.erase(listFiles.back().first);
+        listFiles.pop_back();
+    }
+    return pfile;
+#endif
+}
+
+bool CMappedBlockFiles::ReadBlock(const CDiskBlockPos& pos, CBlock& block)
+{
+    std::shared_ptr<const CMappedFile> pfile = GetFile(pos.nFile);
+    if (!pfile)
+        return false;
+    if (pos.nPos >= pfile->nSize)
+        throw std::ios_base::failure("CMappedBlockFiles::ReadBlock: position beyond end of file");
+
+    CMappedFileReader reader(pfile->pData + pos.nPos, pfile->pData + pfile->nSize, SER_DISK, CLIENT_VERSION);
+    reader >> block;
+    return true;
+}
+
+bool CMappedBlockFiles::Read(const CDiskBlockPos& pos, char* pch, size_t nSize)
+{
+    std::shared_ptr<const CMappedFile> pfile = GetFile(pos.nFile);
+    if (!pfile)
+        return false;
+    if (pos.nPos > pfile->nSize || nSize > pfile->nSize - pos.nPos)
+        throw std::ios_base::failure("CMappedBlockFiles::Read: end of file");
+
+    memcpy(pch, pfile->pData + pos.nPos, nSize);
+    return true;
+}
+
+void CMappedBlockFiles::Release(int nFile)
+{
+    LOCK(cs);
+    std::map<int, FileList::iterator>::iterator it = mapFiles.find(nFile);
+    if (it == mapFiles.end())
+        return;
+    listFiles.erase(it->second);
+    mapFiles.erase(it);
+}
+
+void CMappedBlockFiles::Clear()
+{
+    LOCK(cs);
+    mapFiles.clear();
+    listFiles.clear();
+}
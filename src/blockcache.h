@@ -0,0 +1,86 @@
+// Copyright (c) 2018 The Pastel developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_BLOCKCACHE_H
+#define BITCOIN_BLOCKCACHE_H
+
+#include "primitives/block.h"
+#include "sync.h"
+#include "uint256.h"
+
+#include <list>
+#include <map>
+#include <memory>
+
+struct CDiskBlockPos;
+
+//! -blockcache default, number of deserialized blocks kept in memory
+static const unsigned int DEFAULT_BLOCK_CACHE_SIZE = 16;
+//! Maximum number of block files mapped into memory at the same time
+static const unsigned int MAX_MAPPED_BLOCK_FILES = sizeof(void*) > 4 ? 64 : 4;
+
+/**
+ * LRU cache of recently read blocks. Blocks on disk never change once
+ * written, so entries are shared read-only between P2P, REST and RPC
+ * readers and never need to be invalidated.
+ */
+class CBlockCache
+{
+private:
+    typedef std::list<std::pair<uint256, std::shared_ptr<const CBlock> > > BlockList;
+
+    mutable CCriticalSection cs;
+    BlockList listBlocks;   //! most recently used first
+    std::map<uint256, BlockList::iterator> mapBlocks;
+    size_t nMaxSize;
+
+public:
+    explicit CBlockCache(size_t nMaxSizeIn = DEFAULT_BLOCK_CACHE_SIZE) : nMaxSize(nMaxSizeIn) {}
+
+    void SetMaxSize(size_t nMaxSizeIn);
+    size_t Size() const;
+
+    /** Return the cached block or an empty pointer */
+    std::shared_ptr<const CBlock> Get(const uint256& hash);
+    void Insert(const uint256& hash, const std::shared_ptr<const CBlock>& pblock);
+    void Clear();
+};
+
+/**
+ * Read-only memory maps of finalized block files, i.e. the ones below the
+ * file blocks are currently appended to. Reading a block from a mapping
+ * saves the open, seek and buffered read of every ReadBlockFromDisk().
+ * The least recently used mappings are dropped beyond
+ * MAX_MAPPED_BLOCK_FILES; readers hold a reference, so a mapping stays
+ * valid until they are done with it.
+ */
+class CMappedBlockFiles
+{
+private:
+    class CMappedFile;
+    typedef std::list<std::pair<int, std::shared_ptr<const CMappedFile> > > FileList;
+
+    CCriticalSection cs;
+    FileList listFiles;     //! most recently used first
+    std::map<int, FileList::iterator> mapFiles;
+
+    std::shared_ptr<const CMappedFile> GetFile(int nFile);
+
+public:
+    ~CMappedBlockFiles();
+
+    /**
+     * Deserialize the block at pos from its mapped file. Returns false if the
+     * file can't be mapped and has to be read normally, and throws like a
+     * file stream on corrupt or truncated data.
+     */
+    bool ReadBlock(const CDiskBlockPos& pos, CBlock& block);
+    /** Copy nSize raw bytes at pos from its mapped file, same semantics as ReadBlock() */
+    bool Read(const CDiskBlockPos& pos, char* pch, size_t nSize);
+    /** Unmap a file that is about to be deleted */
+    void Release(int nFile);
+    void Clear();
+};
+
+#endif // BITCOIN_BLOCKCACHE_H
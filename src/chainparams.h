@@ -32,6 +32,10 @@ struct CCheckpointData {
     double fTransactionsPerDay;
 };
 
+//! UTXO snapshot hashes known to be good, by the hash of the block they were taken at.
+//! Only verifytxoutset checks against them, nothing loads a snapshot as the chainstate.
+typedef std::map<uint256, uint256> MapCoinsSnapshots;
+
 /**
  * CChainParams defines various tweakable parameters of a given instance of the
  * Bitcoin system. There are three: the main network on which people trade goods
@@ -93,6 +97,7 @@ public:
     const std::string& Bech32HRP(Bech32Type type) const { return bech32HRPs[type]; }
     const std::vector<SeedSpec6>& FixedSeeds() const { return vFixedSeeds; }
     const CCheckpointData& Checkpoints() const { return checkpointData; }
+    const MapCoinsSnapshots& CoinsSnapshots() const { return mapCoinsSnapshots; }
 
     bool IsMainNet() const {return network == CBaseChainParams::MAIN;}
     bool IsTestNet() const {return network == CBaseChainParams::TESTNET;}
@@ -124,6 +129,7 @@ protected:
     bool fMineBlocksOnDemand = false;
     bool fTestnetToBeDeprecatedFieldRPC = false;
     CCheckpointData checkpointData;
+    MapCoinsSnapshots mapCoinsSnapshots;
 };
 
 /**
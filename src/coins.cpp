@@ -6,6 +6,7 @@
 
 #include "memusage.h"
 #include "random.h"
+#include "streams.h"
 #include "version.h"
 #include "policy/fees.h"
 
@@ -42,6 +43,56 @@ bool CCoins::Spend(uint32_t nPos)
     Cleanup();
     return true;
 }
+
+void CCoinsRunningStats::Add(const uint256 &txid, const CCoins &coins)
+{
+    CDataStream ss(SER_GETHASH, PROTOCOL_VERSION);
+    ss << txid << coins;
+    muhash.Insert((const unsigned char*)&ss[0], ss.size());
+    nTransactions++;
+    BOOST_FOREACH(const CTxOut &out, coins.vout) {
+        if (!out.IsNull()) {
+            nTransactionOutputs++;
+            nTotalAmount += out.nValue;
+        }
+    }
+    nSerializedSize += ss.size();
+}
+
+void CCoinsRunningStats::Remove(const uint256 &txid, const CCoins &coins)
+{
+    CDataStream ss(SER_GETHASH, PROTOCOL_VERSION);
+    ss << txid << coins;
+    muhash.Remove((const unsigned char*)&ss[0], ss.size());
+    nTransactions--;
+    BOOST_FOREACH(const CTxOut &out, coins.vout) {
+        if (!out.IsNull()) {
+            nTransactionOutputs--;
+            nTotalAmount -= out.nValue;
+        }
+    }
+    nSerializedSize -= ss.size();
+}
+
+void CCoinsRunningStats::Remove(const CCoinsRunningStats &removed)
+{
+    muhash /= removed.muhash;
+    nTransactions -= removed.nTransactions;
+    nTransactionOutputs -= removed.nTransactionOutputs;
+    nSerializedSize -= removed.nSerializedSize;
+    nTotalAmount -= removed.nTotalAmount;
+}
+
+void CCoinsRunningStats::GetStats(CCoinsStats &stats) const
+{
+    stats.nTransactions = nTransactions;
+    stats.nTransactionOutputs = nTransactionOutputs;
+    stats.nSerializedSize = nSerializedSize;
+    stats.nTotalAmount = nTotalAmount;
+    MuHash3072 hash = muhash;
+    hash.Finalize(stats.hashMuHash.begin());
+}
+
 bool CCoinsView::GetSproutAnchorAt(const uint256 &rt, SproutMerkleTree &tree) const { return false; }
 bool CCoinsView::GetSaplingAnchorAt(const uint256 &rt, SaplingMerkleTree &tree) const { return false; }
 bool CCoinsView::GetNullifier(const uint256 &nullifier, ShieldedType type) const { return false; }
@@ -56,8 +107,12 @@ bool CCoinsView::BatchWrite(CCoinsMap &mapCoins,
                             CAnchorsSproutMap &mapSproutAnchors,
                             CAnchorsSaplingMap &mapSaplingAnchors,
                             CNullifiersMap &mapSproutNullifiers,
-                            CNullifiersMap &mapSaplingNullifiers) { return false; }
+                            CNullifiersMap &mapSaplingNullifiers,
+                            const CCoinsRunningStats *pstatsRemoved) { return false; }
 bool CCoinsView::GetStats(CCoinsStats &stats) const { return false; }
+bool CCoinsView::GetRunningStats(CCoinsStats &stats) const { return false; }
+bool CCoinsView::HasRunningStats() const { return false; }
+CCoinsSnapshotWriter* CCoinsView::NewSnapshotWriter() const { return NULL; }
 
 
 CCoinsViewBacked::CCoinsViewBacked(CCoinsView *viewIn) : base(viewIn) { }
@@ -77,12 +132,18 @@ bool CCoinsViewBacked::BatchWrite(CCoinsMap &mapCoins,
                                   CAnchorsSproutMap &mapSproutAnchors,
                                   CAnchorsSaplingMap &mapSaplingAnchors,
                                   CNullifiersMap &mapSproutNullifiers,
-                                  CNullifiersMap &mapSaplingNullifiers) { return base->BatchWrite(mapCoins, hashBlock, hashSproutAnchor, hashSaplingAnchor, mapSproutAnchors, mapSaplingAnchors, mapSproutNullifiers, mapSaplingNullifiers); }
+                                  CNullifiersMap &mapSaplingNullifiers,
+                                  const CCoinsRunningStats *pstatsRemoved) { return base->BatchWrite(mapCoins, hashBlock, hashSproutAnchor, hashSaplingAnchor, mapSproutAnchors, mapSaplingAnchors, mapSproutNullifiers, mapSaplingNullifiers, pstatsRemoved); }
 bool CCoinsViewBacked::GetStats(CCoinsStats &stats) const { return base->GetStats(stats); }
+bool CCoinsViewBacked::GetRunningStats(CCoinsStats &stats) const { return base->GetRunningStats(stats); }
+bool CCoinsViewBacked::HasRunningStats() const { return base->HasRunningStats(); }
+CCoinsSnapshotWriter* CCoinsViewBacked::NewSnapshotWriter() const { return base->NewSnapshotWriter(); }
 
 CCoinsKeyHasher::CCoinsKeyHasher() : salt(GetRandHash()) {}
 
-CCoinsViewCache::CCoinsViewCache(CCoinsView *baseIn) : CCoinsViewBacked(baseIn), hasModifier(false), cachedCoinsUsage(0) { }
+CCoinsViewCache::CCoinsViewCache(CCoinsView *baseIn) : CCoinsViewBacked(baseIn), hasModifier(false),
+    cacheCoins(0, CCoinsKeyHasher(), std::equal_to<uint256>(), CCoinsMapAllocator(&cacheCoinsMemoryResource)),
+    cachedCoinsUsage(0), fTrackRemoved(baseIn->HasRunningStats()) { }
 
 CCoinsViewCache::~CCoinsViewCache()
 {
@@ -98,6 +159,12 @@ size_t CCoinsViewCache::DynamicMemoryUsage() const {
            cachedCoinsUsage;
 }
 
+void CCoinsViewCache::TrackRemoved(const uint256 &txid, const CCoinsCacheEntry &entry) {
+    // a clean entry that isn't fresh still holds what the base has
+    if (fTrackRemoved && !(entry.flags & (CCoinsCacheEntry::DIRTY | CCoinsCacheEntry::FRESH)) && !entry.coins.IsPruned())
+        statsRemoved.Add(txid, entry.coins);
+}
+
 CCoinsMap::const_iterator CCoinsViewCache::FetchCoins(const uint256 &txid) const {
     CCoinsMap::iterator it = cacheCoins.find(txid);
     if (it != cacheCoins.end())
@@ -355,6 +422,7 @@ CCoinsModifier CCoinsViewCache::ModifyCoins(const uint256 &txid) {
     } else {
         cachedCoinUsage = ret.first->second.coins.DynamicMemoryUsage();
     }
+    TrackRemoved(txid, ret.first->second);
     // Assume that whenever ModifyCoins is called, the entry will be modified.
     ret.first->second.flags |= CCoinsCacheEntry::DIRTY;
     return CCoinsModifier(*this, ret.first, cachedCoinUsage);
@@ -477,7 +545,8 @@ bool CCoinsViewCache::BatchWrite(CCoinsMap &mapCoins,
                                  CAnchorsSproutMap &mapSproutAnchors,
                                  CAnchorsSaplingMap &mapSaplingAnchors,
                                  CNullifiersMap &mapSproutNullifiers,
-                                 CNullifiersMap &mapSaplingNullifiers) {
+                                 CNullifiersMap &mapSaplingNullifiers,
+                                 const CCoinsRunningStats *pstatsRemoved) {
     assert(!hasModifier);
     for (CCoinsMap::iterator it = mapCoins.begin(); it != mapCoins.end();) {
         if (it->second.flags & CCoinsCacheEntry::DIRTY) { // Ignore non-dirty entries (optimization).
@@ -503,6 +572,7 @@ bool CCoinsViewCache::BatchWrite(CCoinsMap &mapCoins,
                     cacheCoins.erase(itUs);
                 } else {
                     // A normal modification.
+                    TrackRemoved(itUs->first, itUs->second);
                     cachedCoinsUsage -= itUs->second.coins.DynamicMemoryUsage();
                     itUs->second.coins.swap(it->second.coins);
                     cachedCoinsUsage += itUs->second.coins.DynamicMemoryUsage();
@@ -527,16 +597,29 @@ bool CCoinsViewCache::BatchWrite(CCoinsMap &mapCoins,
 }
 
 bool CCoinsViewCache::Flush() {
-    bool fOk = base->BatchWrite(cacheCoins, hashBlock, hashSproutAnchor, hashSaplingAnchor, cacheSproutAnchors, cacheSaplingAnchors, cacheSproutNullifiers, cacheSaplingNullifiers);
+    bool fOk = base->BatchWrite(cacheCoins, hashBlock, hashSproutAnchor, hashSaplingAnchor, cacheSproutAnchors, cacheSaplingAnchors, cacheSproutNullifiers, cacheSaplingNullifiers,
+                                fTrackRemoved ? &statsRemoved : NULL);
     cacheCoins.clear();
     cacheSproutAnchors.clear();
     cacheSaplingAnchors.clear();
     cacheSproutNullifiers.clear();
     cacheSaplingNullifiers.clear();
     cachedCoinsUsage = 0;
+    ReallocateCache();
+    statsRemoved = CCoinsRunningStats();
+    fTrackRemoved = base->HasRunningStats();
     return fOk;
 }
 
+void CCoinsViewCache::ReallocateCache() {
+    // the pool never frees its chunks, start over with a new one
+    assert(cacheCoins.empty());
+    cacheCoins.~CCoinsMap();
+    cacheCoinsMemoryResource.~CCoinsMapMemoryResource();
+    ::new (&cacheCoinsMemoryResource) CCoinsMapMemoryResource();
+    ::new (&cacheCoins) CCoinsMap(0, CCoinsKeyHasher(), std::equal_to<uint256>(), CCoinsMapAllocator(&cacheCoinsMemoryResource));
+}
+
 unsigned int CCoinsViewCache::GetCacheSize() const {
     return cacheCoins.size();
 }
@@ -7,6 +7,7 @@
 #define BITCOIN_COINS_H
 
 #include "compressor.h"
+#include "crypto/muhash.h"
 #include "core_memusage.h"
 #include "memusage.h"
 #include "serialize.h"
@@ -317,7 +318,15 @@ enum ShieldedType
     SAPLING,
 };
 
-typedef boost::unordered_map<uint256, CCoinsCacheEntry, CCoinsKeyHasher> CCoinsMap;
+/**
+ * The coins cache map takes its nodes from a pool. The largest block it
+ * serves itself is sized for the map's nodes, a value plus a few pointers of
+ * bookkeeping; bucket arrays are bigger and come from the heap.
+ */
+static const size_t COINS_MAP_POOL_BLOCK_SIZE = sizeof(std::pair<const uint256, CCoinsCacheEntry>) + 4 * sizeof(void*);
+typedef PoolAllocator<std::pair<const uint256, CCoinsCacheEntry>, COINS_MAP_POOL_BLOCK_SIZE, alignof(void*)> CCoinsMapAllocator;
+typedef CCoinsMapAllocator::ResourceType CCoinsMapMemoryResource;
+typedef boost::unordered_map<uint256, CCoinsCacheEntry, CCoinsKeyHasher, std::equal_to<uint256>, CCoinsMapAllocator> CCoinsMap;
 typedef boost::unordered_map<uint256, CAnchorsSproutCacheEntry, CCoinsKeyHasher> CAnchorsSproutMap;
 typedef boost::unordered_map<uint256, CAnchorsSaplingCacheEntry, CCoinsKeyHasher> CAnchorsSaplingMap;
 typedef boost::unordered_map<uint256, CNullifiersCacheEntry, CCoinsKeyHasher> CNullifiersMap;
@@ -330,11 +339,86 @@ struct CCoinsStats
     uint64_t nTransactionOutputs;
     uint64_t nSerializedSize;
     uint256 hashSerialized;
+    uint256 hashMuHash;
     CAmount nTotalAmount;
 
     CCoinsStats() : nHeight(0), nTransactions(0), nTransactionOutputs(0), nSerializedSize(0), nTotalAmount(0) {}
 };
 
+/**
+ * Statistics of the coins database that are updated with every write to it
+ * instead of being computed by a scan. The hash is a MuHash3072 over the
+ * serialized (txid, coins) of every transaction with unspent outputs, so it
+ * only depends on the set and not on the order it was built in.
+ */
+struct CCoinsRunningStats
+{
+    uint64_t nTransactions;
+    uint64_t nTransactionOutputs;
+    uint64_t nSerializedSize;
+    CAmount nTotalAmount;
+    MuHash3072 muhash;
+
+    CCoinsRunningStats() : nTransactions(0), nTransactionOutputs(0), nSerializedSize(0), nTotalAmount(0) {}
+
+    void Add(const uint256 &txid, const CCoins &coins);
+    void Remove(const uint256 &txid, const CCoins &coins);
+    //! Remove every record that was added to removed
+    void Remove(const CCoinsRunningStats &removed);
+    //! Fill in everything but the height and block of stats
+    void GetStats(CCoinsStats &stats) const;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(nTransactions);
+        READWRITE(nTransactionOutputs);
+        READWRITE(nSerializedSize);
+        READWRITE(nTotalAmount);
+        unsigned char data[MuHash3072::SERIALIZED_SIZE];
+        if (!ser_action.ForRead())
+            muhash.ToBytes(data);
+        READWRITE(FLATDATA(data));
+        if (ser_action.ForRead())
+            muhash.FromBytes(data);
+    }
+};
+
+/** Contents of a UTXO snapshot written by dumptxoutset */
+struct CCoinsSnapshotStats
+{
+    uint256 hashBlock;
+    uint256 hashSproutAnchor;
+    uint256 hashSaplingAnchor;
+    uint64_t nCoins;
+    uint64_t nSproutAnchors;
+    uint64_t nSaplingAnchors;
+    uint64_t nSproutNullifiers;
+    uint64_t nSaplingNullifiers;
+    //! Hash of the snapshot records, independent of how they are chunked in the file
+    uint256 hashSnapshot;
+    //! The MuHash of the coins records, comparable to CCoinsStats::hashMuHash
+    uint256 hashCoinsMuHash;
+
+    CCoinsSnapshotStats() : nCoins(0), nSproutAnchors(0), nSaplingAnchors(0), nSproutNullifiers(0), nSaplingNullifiers(0) {}
+};
+
+class CAutoFile;
+
+/**
+ * A UTXO snapshot of a view as it was when the writer was created, see
+ * CCoinsView::NewSnapshotWriter(). Writing it needs no lock, the view may
+ * move on meanwhile.
+ */
+class CCoinsSnapshotWriter
+{
+public:
+    //! Write the coins, anchors and nullifiers as a snapshot to file
+    virtual bool Write(CAutoFile &file, CCoinsSnapshotStats &stats) = 0;
+
+    virtual ~CCoinsSnapshotWriter() {}
+};
 
 /** Abstract view on the open txout dataset. */
 class CCoinsView
@@ -363,7 +447,8 @@ public:
     virtual uint256 GetBestAnchor(ShieldedType type) const;
 
     //! Do a bulk modification (multiple CCoins changes + BestBlock change).
-    //! The passed mapCoins can be modified.
+    //! The passed mapCoins can be modified. pstatsRemoved, if not NULL, holds
+    //! this view's version of every non-FRESH entry of mapCoins (see HasRunningStats()).
     virtual bool BatchWrite(CCoinsMap &mapCoins,
                             const uint256 &hashBlock,
                             const uint256 &hashSproutAnchor,
@@ -371,11 +456,22 @@ public:
                             CAnchorsSproutMap &mapSproutAnchors,
                             CAnchorsSaplingMap &mapSaplingAnchors,
                             CNullifiersMap &mapSproutNullifiers,
-                            CNullifiersMap &mapSaplingNullifiers);
+                            CNullifiersMap &mapSaplingNullifiers,
+                            const CCoinsRunningStats *pstatsRemoved);
 
     //! Calculate statistics about the unspent transaction output set
     virtual bool GetStats(CCoinsStats &stats) const;
 
+    //! Statistics kept up to date on every write, without the legacy hash_serialized
+    virtual bool GetRunningStats(CCoinsStats &stats) const;
+
+    //! Whether BatchWrite() currently keeps running statistics, so a writer
+    //! should pass the statistics of the entries it replaces
+    virtual bool HasRunningStats() const;
+
+    //! Take a snapshot of the view to be written without holding the view's lock, NULL if unsupported
+    virtual CCoinsSnapshotWriter* NewSnapshotWriter() const;
+
     //! As we use CCoinsViews polymorphically, have a virtual destructor
     virtual ~CCoinsView() {}
 };
@@ -404,8 +500,12 @@ public:
                     CAnchorsSproutMap &mapSproutAnchors,
                     CAnchorsSaplingMap &mapSaplingAnchors,
                     CNullifiersMap &mapSproutNullifiers,
-                    CNullifiersMap &mapSaplingNullifiers);
+                    CNullifiersMap &mapSaplingNullifiers,
+                    const CCoinsRunningStats *pstatsRemoved);
     bool GetStats(CCoinsStats &stats) const;
+    bool GetRunningStats(CCoinsStats &stats) const;
+    bool HasRunningStats() const;
+    CCoinsSnapshotWriter* NewSnapshotWriter() const;
 };
 
 
@@ -444,6 +544,8 @@ protected:
      * declared as "const".  
      */
     mutable uint256 hashBlock;
+    //! Must be declared before cacheCoins, which allocates from it
+    mutable CCoinsMapMemoryResource cacheCoinsMemoryResource;
     mutable CCoinsMap cacheCoins;
     mutable uint256 hashSproutAnchor;
     mutable uint256 hashSaplingAnchor;
@@ -455,6 +557,15 @@ protected:
     /* Cached dynamic memory usage for the inner CCoins objects. */
     mutable size_t cachedCoinsUsage;
 
+    /**
+     * Whether the base keeps running statistics, checked whenever the cache
+     * is empty. statsRemoved then collects the base's version of every entry
+     * as it becomes dirty, so the base doesn't have to look them up again
+     * when the cache is flushed.
+     */
+    bool fTrackRemoved;
+    CCoinsRunningStats statsRemoved;
+
 public:
     CCoinsViewCache(CCoinsView *baseIn);
     ~CCoinsViewCache();
@@ -475,7 +586,10 @@ public:
                     CAnchorsSproutMap &mapSproutAnchors,
                     CAnchorsSaplingMap &mapSaplingAnchors,
                     CNullifiersMap &mapSproutNullifiers,
-                    CNullifiersMap &mapSaplingNullifiers);
+                    CNullifiersMap &mapSaplingNullifiers,
+                    const CCoinsRunningStats *pstatsRemoved);
+    //! A cache only passes the statistics on when it's flushed
+    bool HasRunningStats() const { return false; }
 
 
     // Adds the tree to mapSproutAnchors (or mapSaplingAnchors based on the type of tree)
@@ -550,9 +664,15 @@ public:
     friend class CCoinsModifier;
 
 private:
+    //! Called before an entry is marked dirty, with the base's version if it isn't yet
+    void TrackRemoved(const uint256 &txid, const CCoinsCacheEntry &entry);
+
     CCoinsMap::iterator FetchCoins(const uint256 &txid);
     CCoinsMap::const_iterator FetchCoins(const uint256 &txid) const;
 
+    //! Replace the empty coins map and its pool, giving the pool's memory back
+    void ReallocateCache();
+
     /**
      * By making the copy constructor private, we prevent accidentally using it when one intends to create a cache on top of a base cache.
      */
@@ -0,0 +1,190 @@
+// Copyright (c) 2018 The Pastel developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "crypto/muhash.h"
+
+#include "crypto/common.h"
+#include "crypto/sha256.h"
+
+#include <string.h>
+
+namespace
+{
+/** The modulus is 2^3072 - MAX_PRIME_DIFF, the largest 3072 bit safe prime */
+const uint32_t MAX_PRIME_DIFF = 1103717;
+}
+
+Num3072::Num3072(const unsigned char data[BYTE_SIZE])
+{
+    for (size_t i = 0; i < LIMBS; i++)
+        limbs[i] = ReadLE32(data + 4 * i);
+    // numbers in [p, 2^3072) have a second representation, keep only one
+    if (IsOverflow())
+        FullReduce();
+}
+
+void Num3072::SetToOne()
+{
+    limbs[0] = 1;
+    for (size_t i = 1; i < LIMBS; i++)
+        limbs[i] = 0;
+}
+
+bool Num3072::IsOverflow() const
+{
+    if (limbs[0] < 0xFFFFFFFF - MAX_PRIME_DIFF + 1)
+        return false;
+    for (size_t i = 1; i < LIMBS; i++) {
+        if (limbs[i] != 0xFFFFFFFF)
+            return false;
+    }
+    return true;
+}
+
+void Num3072::FullReduce()
+{
+    // subtracting p is adding MAX_PRIME_DIFF modulo 2^3072
+    uint64_t cur = MAX_PRIME_DIFF;
+    for (size_t i = 0; i < LIMBS; i++) {
+        cur += limbs[i];
+        limbs[i] = (uint32_t)cur;
+        cur >>= 32;
+    }
+}
+
+void Num3072::Multiply(const Num3072& a)
+{
+    // Schoolbook product. Only t is written until the end, so a may be *this.
+    uint32_t t[2 * LIMBS];
+    memset(t, 0, sizeof(t));
+    for (size_t i = 0; i < LIMBS; i++) {
+        uint64_t carry = 0;
+        for (size_t j = 0; j < LIMBS; j++) {
+            uint64_t cur = (uint64_t)limbs[i] * a.limbs[j] + t[i + j] + carry;
+            t[i + j] = (uint32_t)cur;
+            carry = cur >> 32;
+        }
+        t[i + LIMBS] = (uint32_t)carry;
+    }
+
+    // 2^3072 is MAX_PRIME_DIFF modulo p, fold the high half into the low one
+    uint64_t carry = 0;
+    for (size_t i = 0; i < LIMBS; i++) {
+        uint64_t cur = (uint64_t)t[i + LIMBS] * MAX_PRIME_DIFF + t[i] + carry;
+        limbs[i] = (uint32_t)cur;
+        carry = cur >> 32;
+    }
+    // and the bits that are still left over, at most twice
+    while (carry) {
+        uint64_t cur = carry * MAX_PRIME_DIFF;
+        size_t i = 0;
+        for (; i < LIMBS && cur; i++) {
+            cur += limbs[i];
+            limbs[i] = (uint32_t)cur;
+            cur >>= 32;
+        }
+        carry = cur;
+    }
+    if (IsOverflow())
+        FullReduce();
+}
+
+Num3072 Num3072::GetInverse() const
+{
+    // Fermat: a^(p-2) is the inverse of a. p - 2 is 3040 one bits followed
+    // by the 32 bits of 2^32 - MAX_PRIME_DIFF - 2.
+    Num3072 ret;
+    for (size_t i = 0; i < (LIMBS - 1) * 32; i++) {
+        ret.Multiply(ret);
+        ret.Multiply(*this);
+    }
+    const uint32_t nLow = 0xFFFFFFFF - MAX_PRIME_DIFF - 1;
+    for (int i = 31; i >= 0; i--) {
+        ret.Multiply(ret);
+        if ((nLow >> i) & 1)
+            ret.Multiply(*this);
+    }
+    return ret;
+}
+
+void Num3072::Divide(const Num3072& a)
+{
+    Multiply(a.GetInverse());
+}
+
+void Num3072::ToBytes(unsigned char out[BYTE_SIZE]) const
+{
+    for (size_t i = 0; i < LIMBS; i++)
+        WriteLE32(out + 4 * i, limbs[i]);
+}
+
+namespace
+{
+/** Expand the SHA256 of data to a 3072 bit number */
+Num3072 ToNum3072(const unsigned char* data, size_t len)
+{
+    unsigned char seed[CSHA256::OUTPUT_SIZE];
+    CSHA256().Write(data, len).Finalize(seed);
+
+    unsigned char tmp[Num3072::BYTE_SIZE];
+    for (uint32_t i = 0; i < Num3072::BYTE_SIZE / CSHA256::OUTPUT_SIZE; i++) {
+        unsigned char counter[4];
+        WriteLE32(counter, i);
+        CSHA256().Write(seed, sizeof(seed)).Write(counter, sizeof(counter)).Finalize(tmp + i * CSHA256::OUTPUT_SIZE);
+    }
+    return Num3072(tmp);
+}
+}
+
+MuHash3072::MuHash3072(const unsigned char* data, size_t len) : numerator(ToNum3072(data, len))
+{
+}
+
+MuHash3072& MuHash3072::Insert(const unsigned char* data, size_t len)
+{
+    numerator.Multiply(ToNum3072(data, len));
+    return *this;
+}
+
+MuHash3072& MuHash3072::Remove(const unsigned char* data, size_t len)
+{
+    denominator.Multiply(ToNum3072(data, len));
+    return *this;
+}
+
+MuHash3072& MuHash3072::operator*=(const MuHash3072& mul)
+{
+    numerator.Multiply(mul.numerator);
+    denominator.Multiply(mul.denominator);
+    return *this;
+}
+
+MuHash3072& MuHash3072::operator/=(const MuHash3072& div)
+{
+    numerator.Multiply(div.denominator);
+    denominator.Multiply(div.numerator);
+    return *this;
+}
+
+void MuHash3072::Finalize(unsigned char hash[OUTPUT_SIZE])
+{
+    numerator.Divide(denominator);
+    denominator.SetToOne();
+
+    unsigned char data[Num3072::BYTE_SIZE];
+    numerator.ToBytes(data);
+    CSHA256().Write(data, sizeof(data)).Finalize(hash);
+}
+
+void MuHash3072::ToBytes(unsigned char out[SERIALIZED_SIZE]) const
+{
+    numerator.ToBytes(out);
+    denominator.ToBytes(out + Num3072::BYTE_SIZE);
+}
+
+void MuHash3072::FromBytes(const unsigned char data[SERIALIZED_SIZE])
+{
+    numerator = Num3072(data);
+    denominator = Num3072(data + Num3072::BYTE_SIZE);
+}
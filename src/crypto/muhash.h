@@ -0,0 +1,72 @@
+// Copyright (c) 2018 The Pastel developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_CRYPTO_MUHASH_H
+#define BITCOIN_CRYPTO_MUHASH_H
+
+#include <stdint.h>
+#include <stdlib.h>
+
+/** An element of the multiplicative group of integers modulo 2^3072 - 1103717. */
+class Num3072
+{
+private:
+    bool IsOverflow() const;
+    void FullReduce();
+
+public:
+    static const size_t LIMBS = 96;
+    static const size_t BYTE_SIZE = LIMBS * 4;
+
+    uint32_t limbs[LIMBS];
+
+    Num3072() { SetToOne(); }
+    /** Read a 384 byte little endian number */
+    explicit Num3072(const unsigned char data[BYTE_SIZE]);
+
+    void SetToOne();
+    void Multiply(const Num3072& a);
+    /** Multiply by the inverse of a, which must not be zero */
+    void Divide(const Num3072& a);
+    Num3072 GetInverse() const;
+    void ToBytes(unsigned char out[BYTE_SIZE]) const;
+};
+
+/**
+ * A rolling hash of a set of byte strings. Every element is hashed to a
+ * number modulo a 3072 bit prime and the set hash is their product, so
+ * elements can be added and removed in any order and the hashes of disjoint
+ * sets combine by multiplication. Removals are collected in a separate
+ * denominator that is only inverted when the hash is finalized.
+ */
+class MuHash3072
+{
+private:
+    Num3072 numerator;
+    Num3072 denominator;
+
+public:
+    static const size_t OUTPUT_SIZE = 32;
+    static const size_t SERIALIZED_SIZE = 2 * Num3072::BYTE_SIZE;
+
+    /** The hash of the empty set */
+    MuHash3072() {}
+    /** The hash of the set holding a single element */
+    MuHash3072(const unsigned char* data, size_t len);
+
+    MuHash3072& Insert(const unsigned char* data, size_t len);
+    MuHash3072& Remove(const unsigned char* data, size_t len);
+    /** Union with another set */
+    MuHash3072& operator*=(const MuHash3072& mul);
+    /** Difference from another set that is a subset of this one */
+    MuHash3072& operator/=(const MuHash3072& div);
+
+    /** SHA256 of the 384 byte number the set hashes to */
+    void Finalize(unsigned char hash[OUTPUT_SIZE]);
+
+    void ToBytes(unsigned char out[SERIALIZED_SIZE]) const;
+    void FromBytes(const unsigned char data[SERIALIZED_SIZE]);
+};
+
+#endif // BITCOIN_CRYPTO_MUHASH_H
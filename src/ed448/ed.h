@@ -4,6 +4,7 @@
 #include <iostream>
 #include <fstream>
 #include <memory>
+#include <vector>
 
 #include <openssl/ec.h>
 #include <openssl/evp.h>
@@ -112,6 +113,16 @@ namespace ed_crypto {
             return key;
         }
 
+        static key create_from_raw_private(const unsigned char *rawkey, size_t keylen)
+        {
+            unique_key_ptr uniqueKeyPtr(EVP_PKEY_new_raw_private_key(type, nullptr, rawkey, keylen));
+            if (!uniqueKeyPtr)
+                throw (crypto_exception("Cannot read private key from raw key", std::string(), "EVP_PKEY_new_raw_private_key"));
+
+            key key(std::move(uniqueKeyPtr));
+            return key;
+        }
+
         static key create_from_raw_public_hex(const std::string& rawPublicKey)
         {
             std::vector<unsigned char > vec = Hex_Decode(rawPublicKey);
@@ -227,6 +238,23 @@ namespace ed_crypto {
             return rawkey;
         }
 
+        // Copy the raw private key straight into out, e.g. a vector with a secure allocator
+        template <typename Alloc>
+        void copy_private_key_raw(std::vector<unsigned char, Alloc>& out) const
+        {
+            std::size_t raw_key_len = 0;
+            if (OK != EVP_PKEY_get_raw_private_key(key_.get(), nullptr, &raw_key_len)) {
+                throw (crypto_exception("Cannot get length of raw private key", std::string(), "EVP_PKEY_get_raw_private_key"));
+            }
+            if (0 == raw_key_len) {
+                throw (crypto_exception("Returned length is 0!", std::string(), "EVP_PKEY_get_raw_private_key"));
+            }
+
+            out.resize(raw_key_len);
+            if (OK != EVP_PKEY_get_raw_private_key(key_.get(), out.data(), &raw_key_len))
+                throw (crypto_exception("Cannot get raw private key", std::string(), "EVP_PKEY_get_raw_private_key"));
+        }
+
         std::string private_key_raw_hex() const
         {
             return private_key_raw().Hex();
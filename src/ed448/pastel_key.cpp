@@ -2,4 +2,199 @@
 // Distributed under the MIT/X11 software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
-#include "pastel_key.h"
+#include "checkqueue.h"
+#include "sync.h"
+#include "util.h"
+#include "utiltime.h"
+
+#include "ed448/pastel_key.h"
+
+#include <map>
+
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+
+namespace {
+
+struct CUnlockedPastelKey
+{
+    std::vector<unsigned char, secure_allocator<unsigned char> > vchRawKey;
+    int64_t nUnlockTime;
+};
+
+CCriticalSection cs_unlockedPastelKeys;
+// Decrypted keys by PastelID, the raw keys live in locked memory and are wiped when erased
+std::map<std::string, CUnlockedPastelKey> mapUnlockedPastelKeys;
+
+}
+
+ed_crypto::key_dsa448 CPastelID::GetSigningKey(const std::string& pastelID, const SecureString& passPhrase)
+{
+    if (!passPhrase.empty())
+        return ed_crypto::key_dsa448::read_private_key_from_PKCS8_file(GetKeyFilePath(pastelID), passPhrase.c_str());
+
+    LOCK(cs_unlockedPastelKeys);
+    auto it = mapUnlockedPastelKeys.find(pastelID);
+    if (it != mapUnlockedPastelKeys.end() && it->second.nUnlockTime <= GetTime()) {
+        mapUnlockedPastelKeys.erase(it);
+        it = mapUnlockedPastelKeys.end();
+    }
+    if (it == mapUnlockedPastelKeys.end())
+        throw std::runtime_error("PastelID " + pastelID + " is locked, unlock it first or provide the passphrase");
+    return ed_crypto::key_dsa448::create_from_raw_private(it->second.vchRawKey.data(), it->second.vchRawKey.size());
+}
+
+std::vector<std::string> CPastelID::SignMany(const std::vector<std::string>& texts, const std::string& pastelID, const SecureString& passPhrase)
+{
+    std::vector<std::string> vSignatures;
+    vSignatures.reserve(texts.size());
+    try {
+        ed_crypto::key_dsa448 key = GetSigningKey(pastelID, passPhrase);
+        for (const std::string& text : texts)
+            vSignatures.push_back(ed_crypto::crypto_sign::sign(text, key).Base64());
+    } catch (ed_crypto::crypto_exception& ex) {
+        throw std::runtime_error(ex.what());
+    }
+    return vSignatures;
+}
+
+void CPastelID::Unlock(const std::string& pastelID, const SecureString& passPhrase, int64_t nUnlockTime)
+{
+    CUnlockedPastelKey unlocked;
+    unlocked.nUnlockTime = nUnlockTime;
+    try {
+        // decrypting the key file also checks the passphrase
+        ed_crypto::key_dsa448 key = ed_crypto::key_dsa448::read_private_key_from_PKCS8_file(GetKeyFilePath(pastelID), passPhrase.c_str());
+        key.copy_private_key_raw(unlocked.vchRawKey);
+    } catch (ed_crypto::crypto_exception& ex) {
+        throw std::runtime_error(ex.what());
+    }
+
+    LOCK(cs_unlockedPastelKeys);
+    CUnlockedPastelKey& entry = mapUnlockedPastelKeys[pastelID];
+    entry.vchRawKey.swap(unlocked.vchRawKey);
+    entry.nUnlockTime = unlocked.nUnlockTime;
+}
+
+void CPastelID::Lock(const std::string& pastelID)
+{
+    LOCK(cs_unlockedPastelKeys);
+    if (pastelID.empty())
+        mapUnlockedPastelKeys.clear();
+    else
+        mapUnlockedPastelKeys.erase(pastelID);
+}
+
+void CPastelID::LockExpired()
+{
+    const int64_t nNow = GetTime();
+    LOCK(cs_unlockedPastelKeys);
+    for (auto it = mapUnlockedPastelKeys.begin(); it != mapUnlockedPastelKeys.end();) {
+        if (it->second.nUnlockTime <= nNow)
+            it = mapUnlockedPastelKeys.erase(it);
+        else
+            ++it;
+    }
+}
+
+int64_t CPastelID::GetUnlockTime(const std::string& pastelID)
+{
+    LOCK(cs_unlockedPastelKeys);
+    auto it = mapUnlockedPastelKeys.find(pastelID);
+    if (it == mapUnlockedPastelKeys.end() || it->second.nUnlockTime <= GetTime())
+        return 0;
+    return it->second.nUnlockTime;
+}
+
+namespace {
+
+CCriticalSection cs_pastelIDPubKeys;
+std::map<std::string, std::shared_ptr<const ed_crypto::key_dsa448> > mapPastelIDPubKeys;
+
+/** Check of one signature for the verification thread pool, the result goes to *pfValid */
+class CPastelIDVerifyCheck
+{
+private:
+    const CPastelIDSignature* pSig;
+    char* pfValid;
+
+public:
+    CPastelIDVerifyCheck() : pSig(NULL), pfValid(NULL) {}
+    CPastelIDVerifyCheck(const CPastelIDSignature* pSigIn, char* pfValidIn) : pSig(pSigIn), pfValid(pfValidIn) {}
+
+    bool operator()()
+    {
+        try {
+            *pfValid = CPastelID::Verify(pSig->text, pSig->signature, pSig->pastelID);
+        } catch (const std::exception&) {
+            *pfValid = false;
+        }
+        // a bad signature must not stop the queue from checking the others
+        return true;
+    }
+
+    void swap(CPastelIDVerifyCheck& check)
+    {
+        std::swap(pSig, check.pSig);
+        std::swap(pfValid, check.pfValid);
+    }
+};
+
+}
+
+std::shared_ptr<const ed_crypto::key_dsa448> CPastelID::GetPublicKey(const std::string& pastelID)
+{
+    {
+        LOCK(cs_pastelIDPubKeys);
+        auto it = mapPastelIDPubKeys.find(pastelID);
+        if (it != mapPastelIDPubKeys.end())
+            return it->second;
+    }
+
+    // decode outside the lock, invalid PastelIDs throw and are not cached
+    std::vector<unsigned char> rawPubKey = DecodePastelID(pastelID);
+    std::shared_ptr<const ed_crypto::key_dsa448> key = std::make_shared<const ed_crypto::key_dsa448>(
+        ed_crypto::key_dsa448::create_from_raw_public(rawPubKey.data(), rawPubKey.size()));
+
+    LOCK(cs_pastelIDPubKeys);
+    if (mapPastelIDPubKeys.size() >= MAX_PASTELID_PUBKEY_CACHE_SIZE)
+        mapPastelIDPubKeys.erase(mapPastelIDPubKeys.begin());
+    mapPastelIDPubKeys.emplace(pastelID, key);
+    return key;
+}
+
+size_t CPastelID::GetPublicKeyCacheSize()
+{
+    LOCK(cs_pastelIDPubKeys);
+    return mapPastelIDPubKeys.size();
+}
+
+std::vector<bool> CPastelID::VerifyMany(const std::vector<CPastelIDSignature>& vSigs, int nThreads)
+{
+    if (nThreads <= 0)
+        nThreads += GetNumCores();
+    nThreads = std::max(1, std::min(nThreads, (int)vSigs.size()));
+
+    // chars rather than a vector<bool> so the threads write separate bytes
+    std::vector<char> vValid(vSigs.size(), false);
+    std::vector<CPastelIDVerifyCheck> vChecks;
+    vChecks.reserve(vSigs.size());
+    for (size_t i = 0; i < vSigs.size(); i++)
+        vChecks.push_back(CPastelIDVerifyCheck(&vSigs[i], &vValid[i]));
+
+    if (nThreads == 1) {
+        for (CPastelIDVerifyCheck& check : vChecks)
+            check();
+    } else {
+        CCheckQueue<CPastelIDVerifyCheck> queue(8);
+        boost::thread_group threadGroup;
+        // the calling thread is the last worker
+        for (int i = 1; i < nThreads; i++)
+            threadGroup.create_thread(boost::bind(&CCheckQueue<CPastelIDVerifyCheck>::Thread, &queue));
+        queue.Add(vChecks);
+        queue.Wait();
+        threadGroup.interrupt_all();
+        threadGroup.join_all();
+    }
+    return std::vector<bool>(vValid.begin(), vValid.end());
+}
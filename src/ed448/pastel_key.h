@@ -9,10 +9,26 @@
 #include <base58.h>
 #include "support/allocators/secure.h"
 
+#include <boost/filesystem.hpp>
+
+//! Decoded public keys are kept for this many PastelIDs, so verifying arbitrary PastelIDs can't grow the cache without limit
+static const size_t MAX_PASTELID_PUBKEY_CACHE_SIZE = 10000;
+
+/** A signature of text made with the key of a PastelID */
+struct CPastelIDSignature
+{
+    std::string text;
+    std::string signature;
+    std::string pastelID;
+};
+
 class CPastelID {
     static constexpr int PubKeySize = 57;
 
 public:
+    //! Longest time a PastelID can be unlocked for, in seconds
+    static constexpr int64_t MaxUnlockTimeout = 100000000;
+
     static std::string CreateNewLocalKey(const SecureString& passPhrase)
     {
         try {
@@ -21,35 +37,71 @@ public:
             key.write_private_key_to_PKCS8_file(GetKeyFilePath(pastelID), passPhrase.c_str());
             return pastelID;
         } catch (ed_crypto::crypto_exception& ex) {
-            throw runtime_error(ex.what());
+            throw std::runtime_error(ex.what());
         }
         return std::string{};
     }
 
+    /**
+     * Sign "text" with the stored key of the PastelID. With an empty "passPhrase"
+     * the key must have been unlocked, which saves reading and decrypting the key file.
+     */
     static std::string Sign(const std::string& text, const std::string& pastelID, const SecureString& passPhrase)
     {
         try {
-            ed_crypto::key_dsa448 key = ed_crypto::key_dsa448::read_private_key_from_PKCS8_file(GetKeyFilePath(pastelID), passPhrase.c_str());
+            ed_crypto::key_dsa448 key = GetSigningKey(pastelID, passPhrase);
             ed_crypto::buffer sigBuf = ed_crypto::crypto_sign::sign(text, key);
             return sigBuf.Base64(); //!!!
         } catch (ed_crypto::crypto_exception& ex) {
-            throw runtime_error(ex.what());
+            throw std::runtime_error(ex.what());
         }
         return std::string{};
     }
 
+    // Sign every text with a single load of the key, same rules as Sign()
+    static std::vector<std::string> SignMany(const std::vector<std::string>& texts, const std::string& pastelID, const SecureString& passPhrase);
+
+    // Keep the decrypted key of the PastelID in locked memory until nUnlockTime
+    static void Unlock(const std::string& pastelID, const SecureString& passPhrase, int64_t nUnlockTime);
+    // Forget the decrypted key of the PastelID, or all of them if pastelID is empty
+    static void Lock(const std::string& pastelID = std::string());
+    // Forget the keys whose unlock time has passed
+    static void LockExpired();
+    // Time the PastelID stays unlocked until, 0 if it is locked
+    static int64_t GetUnlockTime(const std::string& pastelID);
+
     static bool Verify(const std::string& text, const std::string& signature, const std::string& pastelID)
     {
         try {
-            std::vector<unsigned char> rawPubKey = DecodePastelID(pastelID);
-            ed_crypto::key_dsa448 key = ed_crypto::key_dsa448::create_from_raw_public(rawPubKey.data(), rawPubKey.size());
-            return ed_crypto::crypto_sign::verify_base64(text, signature, key);
+            std::shared_ptr<const ed_crypto::key_dsa448> key = GetPublicKey(pastelID);
+            return ed_crypto::crypto_sign::verify_base64(text, signature, *key);
         } catch (ed_crypto::crypto_exception& ex) {
-            throw runtime_error(ex.what());
+            throw std::runtime_error(ex.what());
         }
         return false;
     }
 
+    /**
+     * Verify the signatures on up to nThreads threads (0 = one per core, <0 = leave that many
+     * cores free). A bad PastelID or signature only fails its own entry.
+     */
+    static std::vector<bool> VerifyMany(const std::vector<CPastelIDSignature>& vSigs, int nThreads = 0);
+
+    // The public key of the PastelID, decoded once and then served from a cache
+    static std::shared_ptr<const ed_crypto::key_dsa448> GetPublicKey(const std::string& pastelID);
+    // Number of PastelIDs whose public key is cached
+    static size_t GetPublicKeyCacheSize();
+
+    static std::string EncodePastelID(const std::vector<unsigned char>& key)
+    {
+        std::vector<unsigned char> data {0xA1,0xDE};
+        data.insert(data.end(), key.begin(), key.end());
+        std::string ret = EncodeBase58Check(data);
+        memory_cleanse(data.data(), data.size());
+
+        return ret;
+    }
+
     static std::vector<std::string> GetStoredPastelIDs()
     {
         boost::filesystem::path pathPastelKeys(GetArg("-pastelkeysdir", "pastelkeys"));
@@ -63,15 +115,7 @@ public:
     }
 
 private:
-    static std::string EncodePastelID(const std::vector<unsigned char>& key)
-    {
-        std::vector<unsigned char> data {0xA1,0xDE};
-        data.insert(data.end(), key.begin(), key.end());
-        std::string ret = EncodeBase58Check(data);
-        memory_cleanse(data.data(), data.size());
-
-        return ret;
-    }
+    static ed_crypto::key_dsa448 GetSigningKey(const std::string& pastelID, const SecureString& passPhrase);
 
     static std::vector<unsigned char> DecodePastelID(const std::string& pastelID)
     {
@@ -0,0 +1,50 @@
+#include <gtest/gtest.h>
+
+#include "mnode-relay.h"
+#include "uint256.h"
+
+TEST(mnode_relay, RollingHashFilterInsert) {
+    CRollingHashFilter filter(60);
+    uint256 hash1 = uint256S("01");
+    uint256 hash2 = uint256S("02");
+
+    EXPECT_TRUE(filter.insert(hash1, 1000));
+    EXPECT_FALSE(filter.insert(hash1, 1010));
+    EXPECT_TRUE(filter.contains(hash1));
+    EXPECT_FALSE(filter.contains(hash2));
+    EXPECT_EQ(1, filter.size());
+
+    filter.clear();
+    EXPECT_FALSE(filter.contains(hash1));
+    EXPECT_EQ(0, filter.size());
+}
+
+TEST(mnode_relay, RollingHashFilterExpire) {
+    CRollingHashFilter filter(60);
+    uint256 hash1 = uint256S("01");
+    uint256 hash2 = uint256S("02");
+    uint256 hash3 = uint256S("03");
+
+    // hash1 and hash2 share the bucket [960, 1020), hash3 is in the next one
+    filter.insert(hash1, 1000);
+    filter.insert(hash2, 1019);
+    filter.insert(hash3, 1020);
+
+    // a bucket goes only once all of it is older than the given time
+    EXPECT_TRUE(filter.Expire(1019).empty());
+    EXPECT_EQ(3, filter.size());
+
+    std::vector<uint256> vExpired = filter.Expire(1020);
+    ASSERT_EQ(2, vExpired.size());
+    EXPECT_TRUE((vExpired[0] == hash1 && vExpired[1] == hash2) || (vExpired[0] == hash2 && vExpired[1] == hash1));
+    EXPECT_FALSE(filter.contains(hash1));
+    EXPECT_TRUE(filter.contains(hash3));
+    EXPECT_EQ(1, filter.size());
+
+    // expired hashes can be added again
+    EXPECT_TRUE(filter.insert(hash1, 1100));
+
+    vExpired = filter.Expire(2000);
+    EXPECT_EQ(2, vExpired.size());
+    EXPECT_EQ(0, filter.size());
+}
@@ -0,0 +1,181 @@
+#include <gtest/gtest.h>
+
+#include "ed448/pastel_key.h"
+#include "util.h"
+#include "utiltime.h"
+
+#include <boost/filesystem.hpp>
+
+class PastelIDKeyCache : public ::testing::Test {
+protected:
+    boost::filesystem::path pathTemp;
+
+    void SetUp() {
+        pathTemp = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path();
+        boost::filesystem::create_directories(pathTemp);
+        mapArgs["-datadir"] = pathTemp.string();
+        ClearDatadirCache();
+    }
+
+    void TearDown() {
+        CPastelID::Lock();
+        SetMockTime(0);
+        mapArgs.erase("-datadir");
+        ClearDatadirCache();
+        boost::filesystem::remove_all(pathTemp);
+    }
+
+    boost::filesystem::path KeyFile(const std::string& pastelID) {
+        return GetDataDir() / "pastelkeys" / pastelID;
+    }
+};
+
+TEST_F(PastelIDKeyCache, SignWithUnlockedKey) {
+    SecureString passPhrase("passphrase");
+    std::string pastelID = CPastelID::CreateNewLocalKey(passPhrase);
+
+    // a locked PastelID needs its passphrase
+    EXPECT_THROW(CPastelID::Sign("text", pastelID, SecureString()), std::runtime_error);
+    EXPECT_THROW(CPastelID::Unlock(pastelID, SecureString("wrong"), 2000), std::runtime_error);
+    EXPECT_EQ(CPastelID::GetUnlockTime(pastelID), 0);
+
+    SetMockTime(1000);
+    CPastelID::Unlock(pastelID, passPhrase, 1100);
+    EXPECT_EQ(CPastelID::GetUnlockTime(pastelID), 1100);
+
+    // the cached key signs without the key file
+    boost::filesystem::rename(KeyFile(pastelID), pathTemp / "moved");
+    std::string signature = CPastelID::Sign("text", pastelID, SecureString());
+    EXPECT_TRUE(CPastelID::Verify("text", signature, pastelID));
+    EXPECT_FALSE(CPastelID::Verify("other text", signature, pastelID));
+    boost::filesystem::rename(pathTemp / "moved", KeyFile(pastelID));
+
+    // the passphrase still takes precedence over the cache
+    signature = CPastelID::Sign("text", pastelID, passPhrase);
+    EXPECT_TRUE(CPastelID::Verify("text", signature, pastelID));
+}
+
+TEST_F(PastelIDKeyCache, SignMany) {
+    SecureString passPhrase("passphrase");
+    std::string pastelID = CPastelID::CreateNewLocalKey(passPhrase);
+    std::vector<std::string> texts = {"first", "second", "third"};
+
+    std::vector<std::string> signatures = CPastelID::SignMany(texts, pastelID, passPhrase);
+    ASSERT_EQ(signatures.size(), texts.size());
+    for (size_t i = 0; i < texts.size(); i++) {
+        EXPECT_TRUE(CPastelID::Verify(texts[i], signatures[i], pastelID));
+    }
+    EXPECT_FALSE(CPastelID::Verify(texts[0], signatures[1], pastelID));
+
+    EXPECT_THROW(CPastelID::SignMany(texts, pastelID, SecureString()), std::runtime_error);
+    SetMockTime(1000);
+    CPastelID::Unlock(pastelID, passPhrase, 1100);
+    signatures = CPastelID::SignMany(texts, pastelID, SecureString());
+    ASSERT_EQ(signatures.size(), texts.size());
+    for (size_t i = 0; i < texts.size(); i++) {
+        EXPECT_TRUE(CPastelID::Verify(texts[i], signatures[i], pastelID));
+    }
+    EXPECT_TRUE(CPastelID::SignMany(std::vector<std::string>(), pastelID, SecureString()).empty());
+}
+
+TEST_F(PastelIDKeyCache, Expiry) {
+    SecureString passPhrase("passphrase");
+    std::string pastelID1 = CPastelID::CreateNewLocalKey(passPhrase);
+    std::string pastelID2 = CPastelID::CreateNewLocalKey(passPhrase);
+
+    SetMockTime(1000);
+    CPastelID::Unlock(pastelID1, passPhrase, 1100);
+    CPastelID::Unlock(pastelID2, passPhrase, 1200);
+
+    SetMockTime(1099);
+    CPastelID::LockExpired();
+    EXPECT_EQ(CPastelID::GetUnlockTime(pastelID1), 1100);
+    EXPECT_EQ(CPastelID::GetUnlockTime(pastelID2), 1200);
+
+    // only the key whose time has come is dropped
+    SetMockTime(1100);
+    CPastelID::LockExpired();
+    EXPECT_EQ(CPastelID::GetUnlockTime(pastelID1), 0);
+    EXPECT_EQ(CPastelID::GetUnlockTime(pastelID2), 1200);
+    EXPECT_THROW(CPastelID::Sign("text", pastelID1, SecureString()), std::runtime_error);
+    CPastelID::Sign("text", pastelID2, SecureString());
+
+    // an expired key is refused even before the timer has dropped it
+    SetMockTime(1200);
+    EXPECT_THROW(CPastelID::Sign("text", pastelID2, SecureString()), std::runtime_error);
+}
+
+TEST_F(PastelIDKeyCache, Lock) {
+    SecureString passPhrase("passphrase");
+    std::string pastelID1 = CPastelID::CreateNewLocalKey(passPhrase);
+    std::string pastelID2 = CPastelID::CreateNewLocalKey(passPhrase);
+
+    SetMockTime(1000);
+    CPastelID::Unlock(pastelID1, passPhrase, 2000);
+    CPastelID::Unlock(pastelID2, passPhrase, 2000);
+
+    CPastelID::Lock(pastelID1);
+    EXPECT_EQ(CPastelID::GetUnlockTime(pastelID1), 0);
+    EXPECT_EQ(CPastelID::GetUnlockTime(pastelID2), 2000);
+    EXPECT_THROW(CPastelID::Sign("text", pastelID1, SecureString()), std::runtime_error);
+
+    // unlocking again only moves the unlock time
+    CPastelID::Unlock(pastelID2, passPhrase, 3000);
+    EXPECT_EQ(CPastelID::GetUnlockTime(pastelID2), 3000);
+
+    CPastelID::Lock();
+    EXPECT_EQ(CPastelID::GetUnlockTime(pastelID2), 0);
+    EXPECT_THROW(CPastelID::Sign("text", pastelID2, SecureString()), std::runtime_error);
+}
+
+TEST_F(PastelIDKeyCache, VerifyMany) {
+    SecureString passPhrase("passphrase");
+    std::string pastelID1 = CPastelID::CreateNewLocalKey(passPhrase);
+    std::string pastelID2 = CPastelID::CreateNewLocalKey(passPhrase);
+    std::string signature1 = CPastelID::Sign("first", pastelID1, passPhrase);
+    std::string signature2 = CPastelID::Sign("second", pastelID2, passPhrase);
+
+    std::vector<CPastelIDSignature> vSigs = {
+        {"first", signature1, pastelID1},
+        {"other text", signature1, pastelID1},
+        {"first", "not a signature", pastelID1},
+        {"first", signature1, "notapastelid"},
+        {"second", signature2, pastelID2},
+        {"first", signature1, pastelID2},
+        {"second", signature2, ""},
+    };
+    std::vector<bool> vExpected = {true, false, false, false, true, false, false};
+
+    // each failure only fails its own entry, whatever the number of threads
+    for (int nThreads : {1, 2, 4, 100, 0, -1, -100}) {
+        EXPECT_EQ(CPastelID::VerifyMany(vSigs, nThreads), vExpected) << "nThreads " << nThreads;
+    }
+    EXPECT_EQ(CPastelID::VerifyMany(vSigs), vExpected);
+
+    for (int nThreads : {1, 4, 0, -1}) {
+        EXPECT_TRUE(CPastelID::VerifyMany(std::vector<CPastelIDSignature>(), nThreads).empty());
+    }
+}
+
+TEST_F(PastelIDKeyCache, PublicKeyCache) {
+    SecureString passPhrase("passphrase");
+    std::string pastelID = CPastelID::CreateNewLocalKey(passPhrase);
+
+    std::shared_ptr<const ed_crypto::key_dsa448> key = CPastelID::GetPublicKey(pastelID);
+    EXPECT_EQ(CPastelID::GetPublicKey(pastelID), key);
+    EXPECT_THROW(CPastelID::GetPublicKey("notapastelid"), std::exception);
+
+    // fill the cache past its limit with other PastelIDs
+    for (size_t i = 0; i <= MAX_PASTELID_PUBKEY_CACHE_SIZE; i++) {
+        ed_crypto::key_dsa448 other = ed_crypto::key_dsa448::generate_key();
+        CPastelID::GetPublicKey(CPastelID::EncodePastelID(other.public_key_raw().data()));
+        ASSERT_LE(CPastelID::GetPublicKeyCacheSize(), MAX_PASTELID_PUBKEY_CACHE_SIZE);
+    }
+    EXPECT_EQ(CPastelID::GetPublicKeyCacheSize(), MAX_PASTELID_PUBKEY_CACHE_SIZE);
+
+    // evicted or not, the PastelID still gives the same key
+    std::string signature = CPastelID::Sign("text", pastelID, passPhrase);
+    EXPECT_TRUE(CPastelID::Verify("text", signature, pastelID));
+    EXPECT_EQ(CPastelID::GetPublicKey(pastelID)->public_key_raw().data(), key->public_key_raw().data());
+    EXPECT_EQ(CPastelID::GetPublicKeyCacheSize(), MAX_PASTELID_PUBKEY_CACHE_SIZE);
+}
@@ -1,4 +1,5 @@
 #include "chainparams.h"
+#include "checkqueue.h"
 #include "consensus/params.h"
 #include "consensus/validation.h"
 #include "key_io.h"
@@ -91,6 +92,75 @@ TEST(TransactionBuilder, Invoke)
     UpdateNetworkUpgradeParameters(Consensus::UPGRADE_OVERWINTER, Consensus::NetworkUpgrade::NO_ACTIVATION_HEIGHT);
 }
 
+TEST(TransactionBuilder, SaplingDeferredVerifier)
+{
+    SelectParams(CBaseChainParams::REGTEST);
+    UpdateNetworkUpgradeParameters(Consensus::UPGRADE_OVERWINTER, Consensus::NetworkUpgrade::ALWAYS_ACTIVE);
+    UpdateNetworkUpgradeParameters(Consensus::UPGRADE_SAPLING, Consensus::NetworkUpgrade::ALWAYS_ACTIVE);
+    auto consensusParams = Params().GetConsensus();
+
+    CBasicKeyStore keystore;
+    CKey tsk = DecodeSecret(tSecretRegtest);
+    keystore.AddKey(tsk);
+    auto scriptPubKey = GetScriptForDestination(tsk.GetPubKey().GetID());
+
+    auto sk = libzcash::SaplingSpendingKey::random();
+    auto fvk = sk.full_viewing_key();
+    auto pk = sk.default_address();
+
+    std::vector<CTransaction> vtx;
+    for (uint32_t i = 0; i < 3; i++) {
+        auto builder = TransactionBuilder(consensusParams, 1, &keystore);
+        builder.AddTransparentInput(COutPoint(uint256(), i), scriptPubKey, 50000);
+        builder.AddSaplingOutput(fvk.ovk, pk, 40000, {});
+        vtx.push_back(builder.Build().GetTxOrThrow());
+    }
+
+    // Proofs are queued instead of being verified inline
+    CSaplingDeferredVerifier deferred;
+    CValidationState state;
+    for (const CTransaction& tx : vtx) {
+        EXPECT_TRUE(ContextualCheckTransaction(tx, state, 2, 0, IsInitialBlockDownload, &deferred));
+    }
+    EXPECT_EQ(deferred.GetTxCount(), 3);
+    EXPECT_EQ(deferred.GetSpendCount(), 0);
+    EXPECT_EQ(deferred.GetOutputCount(), 3);
+    EXPECT_TRUE(deferred.Verify(state));
+    EXPECT_EQ(state.GetRejectReason(), "");
+    EXPECT_TRUE(deferred.IsEmpty());
+
+    // A bad binding signature in any transaction fails the verification
+    CMutableTransaction mtx(vtx[1]);
+    mtx.bindingSig[0] ^= 1;
+    vtx[1] = CTransaction(mtx);
+    for (const CTransaction& tx : vtx) {
+        EXPECT_TRUE(ContextualCheckTransaction(tx, state, 2, 0, IsInitialBlockDownload, &deferred));
+    }
+    EXPECT_FALSE(deferred.Verify(state));
+    EXPECT_EQ(state.GetRejectReason(), "bad-txns-sapling-binding-signature-invalid");
+    EXPECT_TRUE(deferred.IsEmpty());
+    EXPECT_EQ(deferred.GetOutputCount(), 0);
+
+    // Same result when the bundles are handed to a proof check queue
+    CCheckQueue<CProofCheck> queue(4);
+    for (const CTransaction& tx : vtx) {
+        EXPECT_TRUE(ContextualCheckTransaction(tx, state, 2, 0, IsInitialBlockDownload, &deferred));
+    }
+    {
+        CCheckQueueControl<CProofCheck> control(&queue);
+        CValidationState state2;
+        EXPECT_FALSE(deferred.Verify(state2, &control));
+        EXPECT_EQ(state2.GetRejectReason(), "bad-txns-sapling-binding-signature-invalid");
+    }
+    EXPECT_TRUE(deferred.IsEmpty());
+    EXPECT_TRUE(CProofCheck(vtx[0], SignatureHash(CScript(), vtx[0], NOT_AN_INPUT, SIGHASH_ALL, 0,
+        NetworkUpgradeInfo[Consensus::UPGRADE_SAPLING].nBranchId))());
+
+    // Revert to default
+    UpdateNetworkUpgradeParameters(Consensus::UPGRADE_SAPLING, Consensus::NetworkUpgrade::NO_ACTIVATION_HEIGHT);
+    UpdateNetworkUpgradeParameters(Consensus::UPGRADE_OVERWINTER, Consensus::NetworkUpgrade::NO_ACTIVATION_HEIGHT);
+}
+
 TEST(TransactionBuilder, ThrowsOnTransparentInputWithoutKeyStore)
 {
     SelectParams(CBaseChainParams::REGTEST);
@@ -10,6 +10,8 @@
 #include "addrman.h"
 #include "alert.h"
 #include "arith_uint256.h"
+#include "blockcache.h"
+#include "blockencodings.h"
 #include "chainparams.h"
 #include "checkpoints.h"
 #include "checkqueue.h"
@@ -62,6 +64,7 @@ using namespace std;
 CCriticalSection cs_main;
 
 BlockMap mapBlockIndex;
+CBlockCache blockCache;
 CChain chainActive;
 CBlockIndex *pindexBestHeader = NULL;
 static int64_t nTimeBestReceived = 0;
@@ -72,6 +75,8 @@ bool fExperimentalMode = false;
 bool fImporting = false;
 bool fReindex = false;
 bool fTxIndex = false;
+bool fAddressIndex = false;
+bool fSpentIndex = false;
 bool fHavePruned = false;
 bool fPruneMode = false;
 bool fIsBareMultisigStd = true;
@@ -154,6 +159,8 @@ namespace {
     CCriticalSection cs_LastBlockFile;
     std::vector<CBlockFileInfo> vinfoBlockFile;
     int nLastBlockFile = 0;
+    /** Block files below nLastBlockFile are finalized and read through memory maps */
+    CMappedBlockFiles mappedBlockFiles;
     /** Global flag to indicate we should check to see if there are
      *  block/undo files that should be deleted.  Set on startup
      *  or if we allocate more file space when we're in prune mode
@@ -205,6 +212,7 @@ namespace {
         int64_t nTime;  //! Time of "getdata" request in microseconds.
         bool fValidatedHeaders;  //! Whether this block has validated headers at the time of request.
         int64_t nTimeDisconnect; //! The timeout for this block request (for disconnecting a slow peer)
+        std::shared_ptr<PartiallyDownloadedBlock> partialBlock;  //! Compact block waiting for a blocktxn, if any
     };
     map<uint256, pair<NodeId, list<QueuedBlock>::iterator> > mapBlocksInFlight;
 
@@ -268,6 +276,8 @@ struct CNodeState {
     int nBlocksInFlightValidHeaders;
     //! Whether we consider this a preferred download peer.
     bool fPreferredDownload;
+    //! Whether we asked this peer to push new blocks to us as compact blocks.
+    bool fRequestedHBCmpctBlocks;
 
     CNodeState() {
         fCurrentlyConnected = false;
@@ -281,6 +291,7 @@ struct CNodeState {
         nBlocksInFlight = 0;
         nBlocksInFlightValidHeaders = 0;
         fPreferredDownload = false;
+        fRequestedHBCmpctBlocks = false;
     }
 };
 
@@ -369,7 +380,7 @@ void MarkBlockAsInFlight(NodeId nodeid, const uint256& hash, const Consensus::Pa
     MarkBlockAsReceived(hash);
 
     int64_t nNow = GetTimeMicros();
-    QueuedBlock newentry = {hash, pindex, nNow, pindex != NULL, GetBlockTimeout(nNow, nQueuedValidatedHeaders, consensusParams)};
+    QueuedBlock newentry = {hash, pindex, nNow, pindex != NULL, GetBlockTimeout(nNow, nQueuedValidatedHeaders, consensusParams), std::shared_ptr<PartiallyDownloadedBlock>()};
     nQueuedValidatedHeaders += newentry.fValidatedHeaders;
     list<QueuedBlock>::iterator it = state->vBlocksInFlight.insert(state->vBlocksInFlight.end(), newentry);
     state->nBlocksInFlight++;
@@ -880,6 +891,63 @@ unsigned int GetP2SHSigOpCount(const CTransaction& tx, const CCoinsViewCache& in
     return nSigOps;
 }
 
+/**
+ * Verify the Sapling spend descriptions, output descriptions and binding signature
+ * of a transaction against its signature hash.
+ */
+static bool CheckSaplingBundle(const CTransaction& tx, const uint256& dataToBeSigned, CValidationState &state)
+{
+    auto ctx = librustzcash_sapling_verification_ctx_init();
+
+    for (const SpendDescription &spend : tx.vShieldedSpend) {
+        if (!librustzcash_sapling_check_spend(
+            ctx,
+            spend.cv.begin(),
+            spend.anchor.begin(),
+            spend.nullifier.begin(),
+            spend.rk.begin(),
+            spend.zkproof.begin(),
+            spend.spendAuthSig.begin(),
+            dataToBeSigned.begin()
+        ))
+        {
+            librustzcash_sapling_verification_ctx_free(ctx);
+            return state.DoS(100, error("ContextualCheckTransaction(): Sapling spend description invalid"),
+                                  REJECT_INVALID, "bad-txns-sapling-spend-description-invalid");
+        }
+    }
+
+    for (const OutputDescription &output : tx.vShieldedOutput) {
+        if (!librustzcash_sapling_check_output(
+            ctx,
+            output.cv.begin(),
+            output.cm.begin(),
+            output.ephemeralKey.begin(),
+            output.zkproof.begin()
+        ))
+        {
+            librustzcash_sapling_verification_ctx_free(ctx);
+            return state.DoS(100, error("ContextualCheckTransaction(): Sapling output description invalid"),
+                                  REJECT_INVALID, "bad-txns-sapling-output-description-invalid");
+        }
+    }
+
+    if (!librustzcash_sapling_final_check(
+        ctx,
+        tx.valueBalance,
+        tx.bindingSig.begin(),
+        dataToBeSigned.begin()
+    ))
+    {
+        librustzcash_sapling_verification_ctx_free(ctx);
+        return state.DoS(100, error("ContextualCheckTransaction(): Sapling binding signature invalid"),
+                              REJECT_INVALID, "bad-txns-sapling-binding-signature-invalid");
+    }
+
+    librustzcash_sapling_verification_ctx_free(ctx);
+    return true;
+}
+
 /**
  * Check a transaction contextually against a set of consensus rules valid at a given block height.
  * 
@@ -894,7 +962,8 @@ bool ContextualCheckTransaction(
         CValidationState &state,
         const int nHeight,
         const int dosLevel,
-        bool (*isInitBlockDownload)())
+        bool (*isInitBlockDownload)(),
+        CSaplingDeferredVerifier *pSaplingVerifier)
 {
     bool overwinterActive = NetworkUpgradeActive(nHeight, Params().GetConsensus(), Consensus::UPGRADE_OVERWINTER);
     bool saplingActive = NetworkUpgradeActive(nHeight, Params().GetConsensus(), Consensus::UPGRADE_SAPLING);
@@ -1014,61 +1083,75 @@ bool ContextualCheckTransaction(
     if (!tx.vShieldedSpend.empty() ||
         !tx.vShieldedOutput.empty())
     {
-        auto ctx = librustzcash_sapling_verification_ctx_init();
-
-        for (const SpendDescription &spend : tx.vShieldedSpend) {
-            if (!librustzcash_sapling_check_spend(
-                ctx,
-                spend.cv.begin(),
-                spend.anchor.begin(),
-                spend.nullifier.begin(),
-                spend.rk.begin(),
-                spend.zkproof.begin(),
-                spend.spendAuthSig.begin(),
-                dataToBeSigned.begin()
-            ))
-            {
-                librustzcash_sapling_verification_ctx_free(ctx);
-                return state.DoS(100, error("ContextualCheckTransaction(): Sapling spend description invalid"),
-                                      REJECT_INVALID, "bad-txns-sapling-spend-description-invalid");
-            }
+        if (pSaplingVerifier) {
+            // Verified together with the rest of the block, see CSaplingDeferredVerifier
+            pSaplingVerifier->Add(tx, dataToBeSigned);
+        } else if (!CheckSaplingBundle(tx, dataToBeSigned, state)) {
+            return false;
         }
+    }
+    return true;
+}
 
-        for (const OutputDescription &output : tx.vShieldedOutput) {
-            if (!librustzcash_sapling_check_output(
-                ctx,
-                output.cv.begin(),
-                output.cm.begin(),
-                output.ephemeralKey.begin(),
-                output.zkproof.begin()
-            ))
-            {
-                librustzcash_sapling_verification_ctx_free(ctx);
-                return state.DoS(100, error("ContextualCheckTransaction(): Sapling output description invalid"),
-                                      REJECT_INVALID, "bad-txns-sapling-output-description-invalid");
-            }
-        }
+void CSaplingDeferredVerifier::Add(const CTransaction& tx, const uint256& dataToBeSigned)
+{
+    vBundles.emplace_back(&tx, dataToBeSigned);
+    nSpends += tx.vShieldedSpend.size();
+    nOutputs += tx.vShieldedOutput.size();
+}
 
-        if (!librustzcash_sapling_final_check(
-            ctx,
-            tx.valueBalance,
-            tx.bindingSig.begin(),
-            dataToBeSigned.begin()
-        ))
-        {
-            librustzcash_sapling_verification_ctx_free(ctx);
-            return state.DoS(100, error("ContextualCheckTransaction(): Sapling binding signature invalid"),
-                                  REJECT_INVALID, "bad-txns-sapling-binding-signature-invalid");
-        }
+bool CSaplingDeferredVerifier::Verify(CValidationState& state, CCheckQueueControl<CProofCheck> *pcontrol)
+{
+    // Take the queue first, so it's left empty on every return path
+    std::vector<CSaplingBundle> vVerify;
+    vVerify.swap(vBundles);
+    nSpends = 0;
+    nOutputs = 0;
+
+    if (pcontrol && !vVerify.empty()) {
+        std::vector<CProofCheck> vChecks;
+        vChecks.reserve(vVerify.size());
+        for (const auto& bundle : vVerify) {
+            vChecks.emplace_back(*bundle.ptx, bundle.dataToBeSigned);
+        }
+        pcontrol->Add(vChecks);
+        if (pcontrol->Wait())
+            return true;
+        // Some bundle failed, find out which one to report an accurate reject reason
+    }
 
-        librustzcash_sapling_verification_ctx_free(ctx);
+    for (const auto& bundle : vVerify) {
+        if (!CheckSaplingBundle(*bundle.ptx, bundle.dataToBeSigned, state)) {
+            return error("%s: Sapling verification failed for tx %s", __func__, bundle.ptx->GetHash().ToString());
+        }
     }
     return true;
 }
 
 
+bool CProofCheck::operator()()
+{
+    if (nJoinSplit >= 0) {
+        auto verifier = libzcash::ProofVerifier::Strict();
+        return ptx->vjoinsplit[nJoinSplit].Verify(*pzcashParams, verifier, ptx->joinSplitPubKey);
+    }
+    CValidationState state;
+    return CheckSaplingBundle(*ptx, dataToBeSigned, state);
+}
+
+bool CHeaderPoWCheck::operator()()
+{
+    const CChainParams& chainparams = Params();
+    if (!CheckEquihashSolution(pheader, chainparams) ||
+        !CheckProofOfWork(pheader->GetHash(), pheader->nBits, chainparams.GetConsensus()))
+        return false;
+    *pfValid = true;
+    return true;
+}
+
 bool CheckTransaction(const CTransaction& tx, CValidationState &state,
-                      libzcash::ProofVerifier& verifier)
+                      libzcash::ProofVerifier& verifier,
+                      std::vector<CProofCheck> *pvProofChecks)
 {
     // Don't count coinbase transactions because mining skews the count
     if (!tx.IsCoinBase()) {
@@ -1079,6 +1162,12 @@ bool CheckTransaction(const CTransaction& tx, CValidationState &state,
         return false;
     } else {
         // Ensure that zk-SNARKs verify
+        if (pvProofChecks) {
+            for (size_t i = 0; i < tx.vjoinsplit.size(); i++) {
+                pvProofChecks->push_back(CProofCheck(tx, static_cast<int>(i)));
+            }
+            return true;
+        }
         BOOST_FOREACH(const JSDescription &joinsplit, tx.vjoinsplit) {
             if (!joinsplit.Verify(*pzcashParams, verifier, tx.joinSplitPubKey)) {
                 return state.DoS(100, error("CheckTransaction(): joinsplit does not verify"),
@@ -1340,10 +1429,10 @@ CAmount GetMinRelayFee(const CTransaction& tx, unsigned int nBytes, bool fAllowF
     if (fAllowFree)
     {
         // There is a free transaction area in blocks created by most miners,
-        // * If we are relaying we allow transactions up to DEFAULT_BLOCK_PRIORITY_SIZE - 1000
+        // * If we are relaying we allow transactions up to MAX_FREE_TX_RELAY_SIZE
         //   to be considered to fall into this category. We don't want to encourage sending
         //   multiple transactions instead of one big transaction to avoid fees.
-        if (nBytes < (DEFAULT_BLOCK_PRIORITY_SIZE - 1000))
+        if (nBytes < MAX_FREE_TX_RELAY_SIZE)
             nMinFee = 0;
     }
 
@@ -1528,6 +1617,19 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransa
                                 REJECT_INSUFFICIENTFEE, "insufficient fee");
         }
 
+        // Don't accept it if the mempool is full and it pays less than what
+        // was recently evicted
+        CAmount mempoolRejectFee = pool.GetMinFee(GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000).GetFee(nSize);
+        if (mempoolRejectFee > 0) {
+            double dPriorityDelta = 0;
+            CAmount nFeeDelta = 0;
+            pool.ApplyDeltas(hash, dPriorityDelta, nFeeDelta);
+            if (nFees + nFeeDelta < mempoolRejectFee)
+                return state.DoS(0, error("AcceptToMemoryPool: mempool min fee not met %s, %d < %d",
+                                        hash.ToString(), nFees + nFeeDelta, mempoolRejectFee),
+                                 REJECT_INSUFFICIENTFEE, "mempool min fee not met");
+        }
+
         // Require that free transactions have sufficient priority to be mined in the next block.
         if (GetBoolArg("-relaypriority", false) && nFees < ::minRelayTxFee.GetFee(nSize) && !AllowFree(view.GetPriority(tx, chainActive.Height() + 1))) {
             return state.DoS(0, false, REJECT_INSUFFICIENTFEE, "insufficient priority");
@@ -1565,6 +1667,18 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransa
             return state.Error("AcceptToMemoryPool: " + errmsg);
         }
 
+        // Don't let the unconfirmed chains this tx extends grow without bound, each
+        // one is walked whenever a transaction of it is added, mined or evicted
+        CTxMemPool::setEntries setAncestors;
+        size_t nLimitAncestors = GetArg("-limitancestorcount", DEFAULT_ANCESTOR_LIMIT);
+        size_t nLimitAncestorSize = GetArg("-limitancestorsize", DEFAULT_ANCESTOR_SIZE_LIMIT) * 1000;
+        size_t nLimitDescendants = GetArg("-limitdescendantcount", DEFAULT_DESCENDANT_LIMIT);
+        size_t nLimitDescendantSize = GetArg("-limitdescendantsize", DEFAULT_DESCENDANT_SIZE_LIMIT) * 1000;
+        std::string errString;
+        if (!pool.CalculateMemPoolAncestors(entry, setAncestors, nLimitAncestors, nLimitAncestorSize, nLimitDescendants, nLimitDescendantSize, errString))
+            return state.DoS(0, error("AcceptToMemoryPool: %s too-long-mempool-chain: %s", hash.ToString(), errString),
+                             REJECT_NONSTANDARD, "too-long-mempool-chain");
+
         // Check against previous transactions
         // This is done last to help prevent CPU exhaustion denial-of-service attacks.
         PrecomputedTransactionData txdata(tx);
@@ -1589,6 +1703,12 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransa
 
         // Store transaction in memory
         pool.addUnchecked(hash, entry, !IsInitialBlockDownload());
+
+        // Trim the mempool and check if the tx itself was evicted
+        pool.TrimToSize(GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000);
+        if (!pool.exists(hash))
+            return state.DoS(0, error("AcceptToMemoryPool: mempool full, %s not accepted", hash.ToString()),
+                             REJECT_INSUFFICIENTFEE, "mempool full");
     }
 
     SyncWithWallets(tx, NULL);
@@ -1657,6 +1777,37 @@ bool GetTransaction(const uint256 &hash, CTransaction &txOut, uint256 &hashBlock
     return false;
 }
 
+bool GetSpentIndex(const CSpentIndexKey &key, CSpentIndexValue &value)
+{
+    if (!fSpentIndex)
+        return false;
+
+    return pblocktree->ReadSpentIndex(key, value);
+}
+
+bool GetAddressIndex(const uint160 &addressHash, uint8_t type,
+                     std::vector<std::pair<CAddressIndexKey, CAmount> > &addressIndex, int start, int end)
+{
+    if (!fAddressIndex)
+        return error("address index not enabled");
+
+    if (!pblocktree->ReadAddressIndex(addressHash, type, addressIndex, start, end))
+        return error("unable to get txids for address");
+
+    return true;
+}
+
+bool GetAddressUnspent(const uint160 &addressHash, uint8_t type,
+                       std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > &unspentOutputs)
+{
+    if (!fAddressIndex)
+        return error("address index not enabled");
+
+    if (!pblocktree->ReadAddressUnspentIndex(addressHash, type, unspentOutputs))
+        return error("unable to get txids for address");
+
+    return true;
+}
 
 
 
@@ -1688,18 +1839,28 @@ bool WriteBlockToDisk(CBlock& block, CDiskBlockPos& pos, const CMessageHeader::M
     return true;
 }
 
+/** Only files that are no longer appended to can be served from a mapping */
+static bool IsBlockFileFinalized(int nFile)
+{
+    LOCK(cs_LastBlockFile);
+    return nFile < nLastBlockFile;
+}
+
 bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos)
 {
     block.SetNull();
 
-    // Open history file to read
-    CAutoFile filein(OpenBlockFile(pos, true), SER_DISK, CLIENT_VERSION);
-    if (filein.IsNull())
-        return error("ReadBlockFromDisk: OpenBlockFile failed for %s", pos.ToString());
+    bool fFinalized = IsBlockFileFinalized(pos.nFile);
 
     // Read block
     try {
-        filein >> block;
+        if (!fFinalized || !mappedBlockFiles.ReadBlock(pos, block)) {
+            // Open history file to read
+            CAutoFile filein(OpenBlockFile(pos, true), SER_DISK, CLIENT_VERSION);
+            if (filein.IsNull())
+                return error("ReadBlockFromDisk: OpenBlockFile failed for %s", pos.ToString());
+            filein >> block;
+        }
     }
     catch (const std::exception& e) {
         return error("%s: Deserialize or I/O error - %s at %s", __func__, e.what(), pos.ToString());
@@ -1723,6 +1884,100 @@ bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex)
     return true;
 }
 
+/** Check the message start and size WriteBlockToDisk() stores in front of a block */
+static bool CheckBlockFileHeader(const char* pchHeader, const CMessageHeader::MessageStartChars& messageStart, unsigned int& nSize)
+{
+    if (memcmp(pchHeader, messageStart, MESSAGE_START_SIZE) != 0)
+        return false;
+    nSize = ReadLE32((const unsigned char*)pchHeader + MESSAGE_START_SIZE);
+    return nSize > 0 && nSize <= MAX_BLOCK_SIZE;
+}
+
+bool ReadRawBlockFromDisk(std::vector<char>& vchBlock, const CDiskBlockPos& pos, const CMessageHeader::MessageStartChars& messageStart)
+{
+    char pchHeader[MESSAGE_START_SIZE + sizeof(uint32_t)];
+    if (pos.nPos < sizeof(pchHeader))
+        return error("%s: Invalid block position %s", __func__, pos.ToString());
+    CDiskBlockPos posHeader(pos.nFile, pos.nPos - sizeof(pchHeader));
+
+    bool fFinalized = IsBlockFileFinalized(pos.nFile);
+
+    unsigned int nSize = 0;
+    try {
+        if (fFinalized && mappedBlockFiles.Read(posHeader, pchHeader, sizeof(pchHeader))) {
+            if (!CheckBlockFileHeader(pchHeader, messageStart, nSize))
+                return error("%s: Invalid block header at %s", __func__, pos.ToString());
+            vchBlock.resize(nSize);
+            mappedBlockFiles.Read(pos, &vchBlock[0], nSize);
+        } else {
+            CAutoFile filein(OpenBlockFile(posHeader, true), SER_DISK, CLIENT_VERSION);
+            if (filein.IsNull())
+                return error("%s: OpenBlockFile failed for %s", __func__, pos.ToString());
+            filein.read(pchHeader, sizeof(pchHeader));
+            if (!CheckBlockFileHeader(pchHeader, messageStart, nSize))
+                return error("%s: Invalid block header at %s", __func__, pos.ToString());
+            vchBlock.resize(nSize);
+            filein.read(&vchBlock[0], nSize);
+        }
+    }
+    catch (const std::exception& e) {
+        return error("%s: I/O error - %s at %s", __func__, e.what(), pos.ToString());
+    }
+    return true;
+}
+
+bool ReadRawBlockFromDisk(std::vector<char>& vchBlock, const CBlockIndex* pindex, const CMessageHeader::MessageStartChars& messageStart)
+{
+    const CDiskBlockPos pos = pindex->GetBlockPos();
+
+    // Blocks in the file still being written are the recent ones many peers ask for,
+    // go through the cache rather than reopening the file for every request
+    std::shared_ptr<const CBlock> pblock = blockCache.Get(pindex->GetBlockHash());
+    if (!pblock && !IsBlockFileFinalized(pos.nFile))
+        pblock = ReadBlockFromDiskCached(pindex);
+    if (pblock) {
+        CDataStream ssBlock(SER_NETWORK, PROTOCOL_VERSION);
+        ssBlock << *pblock;
+        vchBlock.assign(ssBlock.begin(), ssBlock.end());
+        return true;
+    }
+
+    if (!ReadRawBlockFromDisk(vchBlock, pos, messageStart))
+        return false;
+
+    // The bytes are passed on unparsed, at least make sure they start with the header we expect
+    size_t nHeaderSize = CBlockHeader::HEADER_SIZE;
+    try {
+        if (vchBlock.size() < nHeaderSize)
+            throw std::ios_base::failure("block shorter than its header");
+        CDataStream ssSolutionSize(&vchBlock[0] + nHeaderSize, &vchBlock[0] + std::min(vchBlock.size(), nHeaderSize + 9),
+                                   SER_NETWORK, PROTOCOL_VERSION);
+        uint64_t nSolutionSize = ReadCompactSize(ssSolutionSize);
+        nHeaderSize += GetSizeOfCompactSize(nSolutionSize) + nSolutionSize;
+        if (vchBlock.size() < nHeaderSize)
+            throw std::ios_base::failure("block shorter than its header");
+    }
+    catch (const std::exception& e) {
+        return error("%s: Deserialize error - %s for %s at %s", __func__, e.what(), pindex->ToString(), pos.ToString());
+    }
+    if (Hash(vchBlock.begin(), vchBlock.begin() + nHeaderSize) != pindex->GetBlockHash())
+        return error("%s: header hash doesn't match index for %s at %s", __func__, pindex->ToString(), pos.ToString());
+    return true;
+}
+
+std::shared_ptr<const CBlock> ReadBlockFromDiskCached(const CBlockIndex* pindex)
+{
+    std::shared_ptr<const CBlock> pblock = blockCache.Get(pindex->GetBlockHash());
+    if (pblock)
+        return pblock;
+
+    std::shared_ptr<CBlock> pblockNew = std::make_shared<CBlock>();
+    if (!ReadBlockFromDisk(*pblockNew, pindex))
+        return std::shared_ptr<const CBlock>();
+    blockCache.Insert(pindex->GetBlockHash(), pblockNew);
+    return pblockNew;
+}
+
 CAmount GetBlockSubsidy(int nHeight, const Consensus::Params& consensusParams)
 {
     CAmount nSubsidy = REWARD * COIN;
@@ -2207,6 +2462,10 @@ bool DisconnectBlock(CBlock& block, CValidationState& state, CBlockIndex* pindex
     if (blockUndo.vtxundo.size() + 1 != block.vtx.size())
         return error("DisconnectBlock(): block and undo data inconsistent");
 
+    std::vector<std::pair<CAddressIndexKey, CAmount> > addressIndex;
+    std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > addressUnspentIndex;
+    std::vector<std::pair<CSpentIndexKey, CSpentIndexValue> > spentIndex;
+
     // undo transactions in reverse order
     for (int i = block.vtx.size() - 1; i >= 0; i--) {
         const CTransaction &tx = block.vtx[i];
@@ -2231,6 +2490,20 @@ bool DisconnectBlock(CBlock& block, CValidationState& state, CBlockIndex* pindex
         outs->Clear();
         }
 
+        if (fAddressIndex) {
+            for (unsigned int k = tx.vout.size(); k-- > 0;) {
+                const CTxOut &out = tx.vout[k];
+                uint160 hashBytes;
+                uint8_t addressType = GetAddressIndexType(out.scriptPubKey, hashBytes);
+                if (addressType == ADDRESS_INDEX_NONE)
+                    continue;
+
+                // undo receiving activity and drop the output from the unspent index
+                addressIndex.push_back(make_pair(CAddressIndexKey(addressType, hashBytes, pindex->nHeight, i, hash, k, false), out.nValue));
+                addressUnspentIndex.push_back(make_pair(CAddressUnspentKey(addressType, hashBytes, hash, k), CAddressUnspentValue()));
+            }
+        }
+
         // unspend nullifiers
         view.SetNullifiers(tx, false);
 
@@ -2244,6 +2517,21 @@ bool DisconnectBlock(CBlock& block, CValidationState& state, CBlockIndex* pindex
                 const CTxInUndo &undo = txundo.vprevout[j];
                 if (!ApplyTxInUndo(undo, view, out))
                     fClean = false;
+
+                if (fAddressIndex || fSpentIndex) {
+                    const CTxOut &prevout = undo.txout;
+                    uint160 hashBytes;
+                    uint8_t addressType = GetAddressIndexType(prevout.scriptPubKey, hashBytes);
+                    if (fAddressIndex && addressType != ADDRESS_INDEX_NONE) {
+                        // undo spending activity and restore the output to the unspent index
+                        addressIndex.push_back(make_pair(CAddressIndexKey(addressType, hashBytes, pindex->nHeight, i, hash, j, true), prevout.nValue * -1));
+                        const CCoins *coins = view.AccessCoins(out.hash);
+                        addressUnspentIndex.push_back(make_pair(CAddressUnspentKey(addressType, hashBytes, out.hash, out.n),
+                                                                CAddressUnspentValue(prevout.nValue, prevout.scriptPubKey, coins ? coins->nHeight : 0)));
+                    }
+                    if (fSpentIndex)
+                        spentIndex.push_back(make_pair(CSpentIndexKey(out.hash, out.n), CSpentIndexValue()));
+                }
             }
         }
     }
@@ -2270,6 +2558,16 @@ bool DisconnectBlock(CBlock& block, CValidationState& state, CBlockIndex* pindex
         return true;
     }
 
+    if (fAddressIndex) {
+        if (!pblocktree->EraseAddressIndex(addressIndex))
+            return AbortNode(state, "Failed to delete address index");
+        if (!pblocktree->UpdateAddressUnspentIndex(addressUnspentIndex))
+            return AbortNode(state, "Failed to write address unspent index");
+    }
+    if (fSpentIndex)
+        if (!pblocktree->UpdateSpentIndex(spentIndex))
+            return AbortNode(state, "Failed to write spent index");
+
     return fClean;
 }
 
@@ -2299,12 +2597,26 @@ void static FlushBlockFile(bool fFinalize = false)
 bool FindUndoPos(CValidationState &state, int nFile, CDiskBlockPos &pos, unsigned int nAddSize);
 
 static CCheckQueue<CScriptCheck> scriptcheckqueue(128);
+// Each proof takes milliseconds to verify, so they are handed out in small batches
+static CCheckQueue<CProofCheck> proofcheckqueue(4);
+// Only used by the message handler thread to pre-check headers messages without cs_main
+static CCheckQueue<CHeaderPoWCheck> headercheckqueue(16);
 
 void ThreadScriptCheck() {
     RenameThread("pastel-scriptch");
     scriptcheckqueue.Thread();
 }
 
+void ThreadProofCheck() {
+    RenameThread("pastel-proofch");
+    proofcheckqueue.Thread();
+}
+
+void ThreadHeaderCheck() {
+    RenameThread("pastel-headerch");
+    headercheckqueue.Thread();
+}
+
 //
 // Called periodically asynchronously; alerts if it smells like
 // we're being fed a bad chain (blocks being generated much
@@ -2390,9 +2702,17 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
     auto verifier = libzcash::ProofVerifier::Strict();
     auto disabledVerifier = libzcash::ProofVerifier::Disabled();
 
+    // JoinSplit proofs are verified by the proof check threads while the
+    // transactions are connected below
+    bool fParallelProofs = fExpensiveChecks && nScriptCheckThreads;
+    CCheckQueueControl<CProofCheck> proofControl(fParallelProofs ? &proofcheckqueue : NULL);
+    std::vector<CProofCheck> vProofChecks;
+
     // Check it again to verify JoinSplit proofs, and in case a previous version let a bad block in
-    if (!CheckBlock(block, state, fExpensiveChecks ? verifier : disabledVerifier, !fJustCheck, !fJustCheck))
+    if (!CheckBlock(block, state, fExpensiveChecks ? verifier : disabledVerifier, !fJustCheck, !fJustCheck,
+                    fParallelProofs ? &vProofChecks : NULL))
         return false;
+    proofControl.Add(vProofChecks);
 
     // verify that the view's current state corresponds to the previous block
     uint256 hashPrevBlock = pindex->pprev == NULL ? uint256() : pindex->pprev->GetBlockHash();
@@ -2436,6 +2756,9 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
     CDiskTxPos pos(pindex->GetBlockPos(), GetSizeOfCompactSize(block.vtx.size()));
     std::vector<std::pair<uint256, CDiskTxPos> > vPos;
     vPos.reserve(block.vtx.size());
+    std::vector<std::pair<CAddressIndexKey, CAmount> > addressIndex;
+    std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > addressUnspentIndex;
+    std::vector<std::pair<CSpentIndexKey, CSpentIndexValue> > spentIndex;
     blockundo.vtxundo.reserve(block.vtx.size() - 1);
 
     // Construct the incremental merkle tree at the current
@@ -2507,6 +2830,40 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
             control.Add(vChecks);
         }
 
+        if (fAddressIndex || fSpentIndex) {
+            const uint256 txhash = tx.GetHash();
+            if (!tx.IsCoinBase()) {
+                for (unsigned int j = 0; j < tx.vin.size(); j++) {
+                    const CTxIn &input = tx.vin[j];
+                    const CTxOut &prevout = view.GetOutputFor(input);
+                    uint160 hashBytes;
+                    uint8_t addressType = GetAddressIndexType(prevout.scriptPubKey, hashBytes);
+                    if (fAddressIndex && addressType != ADDRESS_INDEX_NONE) {
+                        // record spending activity and remove the output from the unspent index
+                        addressIndex.push_back(make_pair(CAddressIndexKey(addressType, hashBytes, pindex->nHeight, i, txhash, j, true), prevout.nValue * -1));
+                        addressUnspentIndex.push_back(make_pair(CAddressUnspentKey(addressType, hashBytes, input.prevout.hash, input.prevout.n), CAddressUnspentValue()));
+                    }
+                    if (fSpentIndex)
+                        spentIndex.push_back(make_pair(CSpentIndexKey(input.prevout.hash, input.prevout.n),
+                                                       CSpentIndexValue(txhash, j, pindex->nHeight, prevout.nValue, addressType, hashBytes)));
+                }
+            }
+            if (fAddressIndex) {
+                for (unsigned int k = 0; k < tx.vout.size(); k++) {
+                    const CTxOut &out = tx.vout[k];
+                    uint160 hashBytes;
+                    uint8_t addressType = GetAddressIndexType(out.scriptPubKey, hashBytes);
+                    if (addressType == ADDRESS_INDEX_NONE)
+                        continue;
+
+                    // record receiving activity and add the output to the unspent index
+                    addressIndex.push_back(make_pair(CAddressIndexKey(addressType, hashBytes, pindex->nHeight, i, txhash, k, false), out.nValue));
+                    addressUnspentIndex.push_back(make_pair(CAddressUnspentKey(addressType, hashBytes, txhash, k),
+                                                            CAddressUnspentValue(out.nValue, out.scriptPubKey, pindex->nHeight)));
+                }
+            }
+        }
+
         CTxUndo undoDummy;
         if (i > 0) {
             blockundo.vtxundo.push_back(CTxUndo());
@@ -2565,6 +2922,9 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
 
     if (!control.Wait())
         return state.DoS(100, false);
+    if (!proofControl.Wait())
+        return state.DoS(100, error("ConnectBlock(): joinsplit does not verify"),
+                         REJECT_INVALID, "bad-txns-joinsplit-verification-failed");
     int64_t nTime2 = GetTimeMicros(); nTimeVerify += nTime2 - nTimeStart;
     LogPrint("bench", "    - Verify %u txins: %.2fms (%.3fms/txin) [%.2fs]\n", nInputs - 1, 0.001 * (nTime2 - nTimeStart), nInputs <= 1 ? 0 : 0.001 * (nTime2 - nTimeStart) / (nInputs-1), nTimeVerify * 0.000001);
 
@@ -2605,6 +2965,17 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
         if (!pblocktree->WriteTxIndex(vPos))
             return AbortNode(state, "Failed to write transaction index");
 
+    if (fAddressIndex) {
+        if (!pblocktree->WriteAddressIndex(addressIndex))
+            return AbortNode(state, "Failed to write address index");
+        if (!pblocktree->UpdateAddressUnspentIndex(addressUnspentIndex))
+            return AbortNode(state, "Failed to write address unspent index");
+    }
+
+    if (fSpentIndex)
+        if (!pblocktree->UpdateSpentIndex(spentIndex))
+            return AbortNode(state, "Failed to write spent index");
+
     // add this block to the view's block chain
     view.SetBestBlock(pindex->GetBlockHash());
 
@@ -3160,10 +3531,23 @@ bool ActivateBestChain(CValidationState &state, CBlock *pblock) {
             if (fCheckpointsEnabled)
                 nBlockEstimate = Checkpoints::GetTotalBlocksEstimate(chainParams.Checkpoints());
             {
+                // Peers in high-bandwidth mode get the block we just connected as a compact
+                // block right away, built once for all of them. The others get an inv.
+                std::shared_ptr<const CBlockHeaderAndShortTxIDs> pcmpctblock;
+                bool fCanPushCmpctBlock = pblock && pblock->GetHash() == hashNewTip;
                 LOCK(cs_vNodes);
-                BOOST_FOREACH(CNode* pnode, vNodes)
-                    if (chainActive.Height() > (pnode->nStartingHeight != -1 ? pnode->nStartingHeight - 2000 : nBlockEstimate))
+                BOOST_FOREACH(CNode* pnode, vNodes) {
+                    if (chainActive.Height() <= (pnode->nStartingHeight != -1 ? pnode->nStartingHeight - 2000 : nBlockEstimate))
+                        continue;
+                    if (fCanPushCmpctBlock && pnode->fPreferHeaderAndIDs) {
+                        if (pnode->AddInventoryKnownIfNew(CInv(MSG_BLOCK, hashNewTip))) {
+                            if (!pcmpctblock)
+                                pcmpctblock = std::make_shared<const CBlockHeaderAndShortTxIDs>(*pblock);
+                            pnode->PushMessage("cmpctblock", *pcmpctblock);
+                        }
+                    } else
                         pnode->PushInventory(CInv(MSG_BLOCK, hashNewTip));
+                }
             }
             uiInterface.NotifyBlockTip(hashNewTip);
         }
@@ -3485,7 +3869,8 @@ bool CheckBlockHeader(const CBlockHeader& block, CValidationState& state, bool f
 
 bool CheckBlock(const CBlock& block, CValidationState& state,
                 libzcash::ProofVerifier& verifier,
-                bool fCheckPOW, bool fCheckMerkleRoot)
+                bool fCheckPOW, bool fCheckMerkleRoot,
+                std::vector<CProofCheck> *pvProofChecks)
 {
     // These are checks that are independent of context.
 
@@ -3530,7 +3915,7 @@ bool CheckBlock(const CBlock& block, CValidationState& state,
 
     // Check transactions
     BOOST_FOREACH(const CTransaction& tx, block.vtx)
-        if (!CheckTransaction(tx, state, verifier))
+        if (!CheckTransaction(tx, state, verifier, pvProofChecks))
             return error("CheckBlock(): CheckTransaction failed");
 
     unsigned int nSigOps = 0;
@@ -3588,11 +3973,15 @@ bool ContextualCheckBlock(const CBlock& block, CValidationState& state, CBlockIn
     const int nHeight = pindexPrev == NULL ? 0 : pindexPrev->nHeight + 1;
     const Consensus::Params& consensusParams = Params().GetConsensus();
 
+    // Sapling proofs are only verified once every transaction in the block
+    // has passed the cheap contextual checks below
+    CSaplingDeferredVerifier saplingVerifier;
+
     // Check that all transactions are finalized
     BOOST_FOREACH(const CTransaction& tx, block.vtx) {
 
         // Check transaction contextually against consensus rules at block height
-        if (!ContextualCheckTransaction(tx, state, nHeight, 100)) {
+        if (!ContextualCheckTransaction(tx, state, nHeight, 100, IsInitialBlockDownload, &saplingVerifier)) {
             return false; // Failure reason has been set in validation state object
         }
 
@@ -3618,10 +4007,22 @@ bool ContextualCheckBlock(const CBlock& block, CValidationState& state, CBlockIn
         }
     }
 
+    int64_t nTimeStart = GetTimeMicros();
+    size_t nSaplingTxs = saplingVerifier.GetTxCount();
+    size_t nSaplingDescriptions = saplingVerifier.GetSpendCount() + saplingVerifier.GetOutputCount();
+    CCheckQueueControl<CProofCheck> proofControl(nScriptCheckThreads && nSaplingTxs > 1 ? &proofcheckqueue : NULL);
+    if (!saplingVerifier.Verify(state, nScriptCheckThreads && nSaplingTxs > 1 ? &proofControl : NULL)) {
+        return false; // Failure reason has been set in validation state object
+    }
+    if (nSaplingTxs > 0) {
+        LogPrint("bench", "    - Verify %u Sapling txs (%u descriptions): %.2fms\n", (unsigned)nSaplingTxs,
+                 (unsigned)nSaplingDescriptions, 0.001 * (GetTimeMicros() - nTimeStart));
+    }
+
     return true;
 }
 
-bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state, CBlockIndex** ppindex)
+bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state, CBlockIndex** ppindex, bool fCheckPOW)
 {
     const CChainParams& chainparams = Params();
     AssertLockHeld(cs_main);
@@ -3639,7 +4040,7 @@ bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state, CBloc
         return true;
     }
 
-    if (!CheckBlockHeader(block, state))
+    if (!CheckBlockHeader(block, state, fCheckPOW))
         return false;
 
     // Get prev block index
@@ -3857,6 +4258,7 @@ void UnlinkPrunedFiles(std::set<int>& setFilesToPrune)
 {
     for (set<int>::iterator it = setFilesToPrune.begin(); it != setFilesToPrune.end(); ++it) {
         CDiskBlockPos pos(*it, 0);
+        mappedBlockFiles.Release(*it);
         boost::filesystem::remove(GetBlockPosFilename(pos, "blk"));
         boost::filesystem::remove(GetBlockPosFilename(pos, "rev"));
         LogPrintf("Prune: %s deleted blk/rev (%05u)\n", __func__, *it);
@@ -4099,6 +4501,12 @@ bool static LoadBlockIndexDB()
     pblocktree->ReadFlag("txindex", fTxIndex);
     LogPrintf("%s: transaction index %s\n", __func__, fTxIndex ? "enabled" : "disabled");
 
+    // Check whether we have the address and spent indexes
+    pblocktree->ReadFlag("addressindex", fAddressIndex);
+    LogPrintf("%s: address index %s\n", __func__, fAddressIndex ? "enabled" : "disabled");
+    pblocktree->ReadFlag("spentindex", fSpentIndex);
+    LogPrintf("%s: spent index %s\n", __func__, fSpentIndex ? "enabled" : "disabled");
+
     // Fill in-memory data
     BOOST_FOREACH(const PAIRTYPE(uint256, CBlockIndex*)& item, mapBlockIndex)
     {
@@ -4432,6 +4840,10 @@ bool InitBlockIndex() {
     // Use the provided setting for -txindex in the new database
     fTxIndex = GetBoolArg("-txindex", false);
     pblocktree->WriteFlag("txindex", fTxIndex);
+    fAddressIndex = GetBoolArg("-addressindex", false);
+    pblocktree->WriteFlag("addressindex", fAddressIndex);
+    fSpentIndex = GetBoolArg("-spentindex", false);
+    pblocktree->WriteFlag("spentindex", fSpentIndex);
     LogPrintf("Initializing databases...\n");
 
     // Only add the genesis block if not reindexing (in which case we reuse the one already on disk)
@@ -4879,7 +5291,7 @@ void static ProcessGetData(CNode* pfrom)
             boost::this_thread::interruption_point();
             it++;
 
-            if (inv.type == MSG_BLOCK || inv.type == MSG_FILTERED_BLOCK)
+            if (inv.type == MSG_BLOCK || inv.type == MSG_FILTERED_BLOCK || inv.type == MSG_CMPCT_BLOCK)
             {
                 bool send = false;
                 BlockMap::iterator mi = mapBlockIndex.find(inv.hash);
@@ -4904,14 +5316,33 @@ void static ProcessGetData(CNode* pfrom)
                 // it's available before trying to send.
                 if (send && (mi->second->nStatus & BLOCK_HAVE_DATA))
                 {
+                    // Recent blocks are sent compact, the peer likely has their transactions already
+                    bool fSendCompact = inv.type == MSG_CMPCT_BLOCK &&
+                        mi->second->nHeight >= chainActive.Height() - MAX_CMPCTBLOCK_DEPTH;
+
                     // Send block from disk
-                    CBlock block;
-                    if (!ReadBlockFromDisk(block, (*mi).second))
-                        assert(!"cannot load block from disk");
-                    if (inv.type == MSG_BLOCK)
-                        pfrom->PushMessage("block", block);
+                    if (inv.type == MSG_BLOCK || (inv.type == MSG_CMPCT_BLOCK && !fSendCompact))
+                    {
+                        // Pass the stored bytes through, the network encoding of a block is the same
+                        std::vector<char> vchBlock;
+                        if (!ReadRawBlockFromDisk(vchBlock, (*mi).second, Params().MessageStart()))
+                            assert(!"cannot load block from disk");
+                        pfrom->PushMessage("block", CFlatData(vchBlock));
+                    }
+                    else if (fSendCompact)
+                    {
+                        std::shared_ptr<const CBlock> pblock = ReadBlockFromDiskCached((*mi).second);
+                        if (!pblock)
+                            assert(!"cannot load block from disk");
+                        CBlockHeaderAndShortTxIDs cmpctblock(*pblock);
+                        pfrom->PushMessage("cmpctblock", cmpctblock);
+                    }
                     else // MSG_FILTERED_BLOCK)
                     {
+                        std::shared_ptr<const CBlock> pblock = ReadBlockFromDiskCached((*mi).second);
+                        if (!pblock)
+                            assert(!"cannot load block from disk");
+                        const CBlock& block = *pblock;
                         LOCK(pfrom->cs_filter);
                         if (pfrom->pfilter)
                         {
@@ -5011,6 +5442,22 @@ void static ProcessGetData(CNode* pfrom)
     }
 }
 
+/** Process a block received in a block, cmpctblock or blocktxn message and punish the peer if it's invalid */
+static void ProcessBlockFromPeer(CNode* pfrom, const std::string& strCommand, CBlock& block, bool fForceProcessing)
+{
+    CValidationState state;
+    ProcessNewBlock(state, pfrom, &block, fForceProcessing, NULL);
+    int nDoS;
+    if (state.IsInvalid(nDoS)) {
+        pfrom->PushMessage("reject", strCommand, state.GetRejectCode(),
+                           state.GetRejectReason().substr(0, MAX_REJECT_MESSAGE_LENGTH), block.GetHash());
+        if (nDoS > 0) {
+            LOCK(cs_main);
+            Misbehaving(pfrom->GetId(), nDoS);
+        }
+    }
+}
+
 bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv, int64_t nTimeReceived)
 {
     const CChainParams& chainparams = Params();
@@ -5175,6 +5622,13 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
             LOCK(cs_main);
             State(pfrom->GetId())->fCurrentlyConnected = true;
         }
+
+        if (GetBoolArg("-compactblocks", DEFAULT_COMPACT_BLOCKS)) {
+            // Tell the peer we understand compact blocks. Peers that don't ignore the message.
+            bool fAnnounceUsingCMPCTBLOCK = false;
+            uint64_t nCMPCTBLOCKVersion = 1;
+            pfrom->PushMessage("sendcmpct", fAnnounceUsingCMPCTBLOCK, nCMPCTBLOCKVersion);
+        }
     }
 
 
@@ -5303,7 +5757,8 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
                     CNodeState *nodestate = State(pfrom->GetId());
                     if (chainActive.Tip()->GetBlockTime() > GetAdjustedTime() - chainparams.GetConsensus().nPowTargetSpacing * 20 &&
                         nodestate->nBlocksInFlight < MAX_BLOCKS_IN_TRANSIT_PER_PEER) {
-                        vToFetch.push_back(inv);
+                        // Peers that understand compact blocks send the block as one
+                        vToFetch.push_back(pfrom->fProvidesHeaderAndIDs ? CInv(MSG_CMPCT_BLOCK, inv.hash) : inv);
                         // Mark block as in flight already, even though the actual "getdata" message only goes out
                         // later (within the same cs_main lock, though).
                         MarkBlockAsInFlight(pfrom->GetId(), inv.hash, chainparams.GetConsensus());
@@ -5588,16 +6043,54 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
             return true;
         }
 
+        // Check the Equihash solutions and proof of work of the batch on the header check
+        // threads before taking cs_main, stopping at the first failure. Only a continuous
+        // run of headers building on a block we know is checked, so a peer can't make us
+        // verify thousands of solutions for headers that are rejected right away. Headers
+        // we already have are skipped, AcceptBlockHeader doesn't check those again anyway.
+        // Headers that weren't pre-checked get the full check in AcceptBlockHeader.
+        std::vector<char> vPoWChecked(nCount, false);
+        if (nScriptCheckThreads && nCount > 1) {
+            unsigned int nFirst = 0;
+            bool fPrevKnown;
+            {
+                LOCK(cs_main);
+                uint256 hashKnown = headers[0].hashPrevBlock;
+                while (nFirst < nCount && headers[nFirst].hashPrevBlock == hashKnown) {
+                    uint256 hash = headers[nFirst].GetHash();
+                    if (!mapBlockIndex.count(hash))
+                        break;
+                    hashKnown = hash;
+                    nFirst++;
+                }
+                BlockMap::iterator mi = nFirst < nCount ? mapBlockIndex.find(headers[nFirst].hashPrevBlock) : mapBlockIndex.end();
+                fPrevKnown = mi != mapBlockIndex.end() && !(mi->second->nStatus & BLOCK_FAILED_MASK);
+            }
+            if (fPrevKnown && nCount - nFirst > 1) {
+                std::vector<CHeaderPoWCheck> vChecks;
+                vChecks.reserve(nCount - nFirst);
+                uint256 hashPrev = headers[nFirst].hashPrevBlock;
+                for (unsigned int n = nFirst; n < nCount && headers[n].hashPrevBlock == hashPrev; n++) {
+                    vChecks.push_back(CHeaderPoWCheck(headers[n], &vPoWChecked[n]));
+                    hashPrev = headers[n].GetHash();
+                }
+                CCheckQueueControl<CHeaderPoWCheck> control(&headercheckqueue);
+                control.Add(vChecks);
+                control.Wait();
+            }
+        }
+
         CBlockIndex *pindexLast = NULL;
         {
             LOCK(cs_main);
-            BOOST_FOREACH(const CBlockHeader& header, headers) {
+            for (unsigned int n = 0; n < nCount; n++) {
+                const CBlockHeader& header = headers[n];
                 CValidationState state;
                 if (pindexLast != NULL && header.hashPrevBlock != pindexLast->GetBlockHash()) {
                     Misbehaving(pfrom->GetId(), 20);
                     return error("non-continuous headers sequence");
                 }
-                if (!AcceptBlockHeader(header, state, &pindexLast)) {
+                if (!AcceptBlockHeader(header, state, &pindexLast, !vPoWChecked[n])) {
                     int nDoS;
                     if (state.IsInvalid(nDoS)) {
                         if (nDoS > 0)
@@ -5627,6 +6120,220 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
         }
     }
 
+    else if (strCommand == "sendcmpct")
+    {
+        bool fAnnounceUsingCMPCTBLOCK = false;
+        uint64_t nCMPCTBLOCKVersion = 0;
+        vRecv >> fAnnounceUsingCMPCTBLOCK >> nCMPCTBLOCKVersion;
+        if (nCMPCTBLOCKVersion == 1 && GetBoolArg("-compactblocks", DEFAULT_COMPACT_BLOCKS)) {
+            pfrom->fProvidesHeaderAndIDs = true;
+            pfrom->fPreferHeaderAndIDs = fAnnounceUsingCMPCTBLOCK;
+
+            // Masternodes ask a few other masternodes to push new blocks right away, so they
+            // reach the masternodes voting on the next payment without an inv round-trip.
+            // The slot is only taken once the peer has shown it understands compact blocks.
+            if (masterNodeCtrl.IsMasterNode() && masterNodeCtrl.masternodeManager.HasAddr(pfrom->addr)) {
+                LOCK(cs_main);
+                CNodeState* nodestate = State(pfrom->GetId());
+                int nHBPeers = 0;
+                BOOST_FOREACH(const PAIRTYPE(NodeId, CNodeState)& item, mapNodeState)
+                    nHBPeers += item.second.fRequestedHBCmpctBlocks;
+                if (!nodestate->fRequestedHBCmpctBlocks && nHBPeers < MAX_HB_CMPCTBLOCK_PEERS) {
+                    nodestate->fRequestedHBCmpctBlocks = true;
+                    pfrom->PushMessage("sendcmpct", true, nCMPCTBLOCKVersion);
+                }
+            }
+        }
+    }
+
+
+    else if (strCommand == "cmpctblock" && !fImporting && !fReindex) // Ignore blocks received while importing
+    {
+        CBlockHeaderAndShortTxIDs cmpctblock;
+        vRecv >> cmpctblock;
+
+        uint256 hash = cmpctblock.header.GetHash();
+        LogPrint("net", "received cmpctblock %s peer=%d\n", hash.ToString(), pfrom->id);
+
+        // Set when the mempool had every transaction of the block
+        bool fBlockReconstructed = false;
+        CBlock block;
+        {
+            LOCK(cs_main);
+
+            if (mapBlockIndex.find(cmpctblock.header.hashPrevBlock) == mapBlockIndex.end()) {
+                // Doesn't connect, ask for the headers in between instead of punishing the peer in AcceptBlockHeader
+                if (!IsInitialBlockDownload())
+                    pfrom->PushMessage("getheaders", chainActive.GetLocator(pindexBestHeader), uint256());
+                return true;
+            }
+
+            CBlockIndex *pindex = NULL;
+            CValidationState state;
+            if (!AcceptBlockHeader(cmpctblock.header, state, &pindex)) {
+                int nDoS;
+                if (state.IsInvalid(nDoS)) {
+                    if (nDoS > 0)
+                        Misbehaving(pfrom->GetId(), nDoS);
+                    return error("invalid header received in cmpctblock");
+                }
+            }
+            if (pindex == NULL)
+                return true;
+
+            pfrom->AddInventoryKnown(CInv(MSG_BLOCK, hash));
+            UpdateBlockAvailability(pfrom->GetId(), hash);
+
+            map<uint256, pair<NodeId, list<QueuedBlock>::iterator> >::iterator itInFlight = mapBlocksInFlight.find(hash);
+            bool fInFlight = itInFlight != mapBlocksInFlight.end();
+            bool fInFlightFromOther = fInFlight && itInFlight->second.first != pfrom->GetId();
+
+            // Nothing to do if we have the block already or it wouldn't be our new tip
+            if ((pindex->nStatus & BLOCK_HAVE_DATA) || pindex->nChainWork <= chainActive.Tip()->nChainWork) {
+                if (fInFlight && !fInFlightFromOther) {
+                    // We asked this peer for it, don't leave it in flight until the download times out
+                    if (pindex->nStatus & BLOCK_HAVE_DATA) {
+                        MarkBlockAsReceived(hash);
+                    } else {
+                        vector<CInv> vInv(1, CInv(MSG_BLOCK, hash));
+                        pfrom->PushMessage("getdata", vInv);
+                    }
+                }
+                return true;
+            }
+
+            if (fInFlight && !fInFlightFromOther && itInFlight->second.second->partialBlock)
+                return true; // already waiting for the blocktxn of this one
+
+            if (pindex->pprev != chainActive.Tip() || IsInitialBlockDownload()) {
+                // The mempool is of no use for blocks that don't build on our tip, download it in full
+                if (!fInFlightFromOther && (fInFlight || State(pfrom->GetId())->nBlocksInFlight < MAX_BLOCKS_IN_TRANSIT_PER_PEER)) {
+                    MarkBlockAsInFlight(pfrom->GetId(), hash, chainparams.GetConsensus(), pindex);
+                    vector<CInv> vInv(1, CInv(MSG_BLOCK, hash));
+                    pfrom->PushMessage("getdata", vInv);
+                }
+                return true;
+            }
+
+            if (fInFlightFromOther || (!fInFlight && State(pfrom->GetId())->nBlocksInFlight >= MAX_BLOCKS_IN_TRANSIT_PER_PEER)) {
+                // Another peer is sending the full block, or we can't ask this one for more,
+                // but if our mempool has all of it there's no need to wait
+                PartiallyDownloadedBlock tempBlock(&mempool);
+                if (tempBlock.InitData(cmpctblock) == READ_STATUS_OK)
+                    fBlockReconstructed = tempBlock.FillBlock(block, std::vector<CTransaction>()) == READ_STATUS_OK;
+            } else {
+                MarkBlockAsInFlight(pfrom->GetId(), hash, chainparams.GetConsensus(), pindex);
+                std::shared_ptr<PartiallyDownloadedBlock> partialBlock = std::make_shared<PartiallyDownloadedBlock>(&mempool);
+                ReadStatus status = partialBlock->InitData(cmpctblock);
+                if (status == READ_STATUS_INVALID) {
+                    MarkBlockAsReceived(hash);
+                    Misbehaving(pfrom->GetId(), 100);
+                    return error("peer=%d sent us invalid compact block", pfrom->id);
+                }
+
+                BlockTransactionsRequest req;
+                if (status == READ_STATUS_OK) {
+                    for (size_t i = 0; i < cmpctblock.BlockTxCount(); i++) {
+                        if (!partialBlock->IsTxAvailable(i))
+                            req.indexes.push_back(i);
+                    }
+                    if (req.indexes.empty()) {
+                        status = partialBlock->FillBlock(block, std::vector<CTransaction>());
+                        fBlockReconstructed = status == READ_STATUS_OK;
+                    }
+                }
+
+                if (status == READ_STATUS_FAILED) {
+                    // Short ID collision, the full block it is (still marked in flight)
+                    vector<CInv> vInv(1, CInv(MSG_BLOCK, hash));
+                    pfrom->PushMessage("getdata", vInv);
+                } else if (!fBlockReconstructed) {
+                    req.blockhash = hash;
+                    mapBlocksInFlight[hash].second->partialBlock = partialBlock;
+                    pfrom->PushMessage("getblocktxn", req);
+                }
+            }
+        }
+
+        if (fBlockReconstructed)
+            ProcessBlockFromPeer(pfrom, strCommand, block, false);
+    }
+
+
+    else if (strCommand == "getblocktxn")
+    {
+        BlockTransactionsRequest req;
+        vRecv >> req;
+
+        LOCK(cs_main);
+
+        BlockMap::iterator it = mapBlockIndex.find(req.blockhash);
+        if (it == mapBlockIndex.end() || !(it->second->nStatus & BLOCK_HAVE_DATA)) {
+            LogPrint("net", "Peer %d sent us a getblocktxn for a block we don't have\n", pfrom->id);
+            return true;
+        }
+
+        if (it->second->nHeight < chainActive.Height() - MAX_BLOCKTXN_DEPTH) {
+            // Nobody should rebuild a block this old from its mempool. Serve it like a getdata,
+            // which also checks whether we may send it at all.
+            pfrom->vRecvGetData.push_back(CInv(MSG_BLOCK, req.blockhash));
+            ProcessGetData(pfrom);
+            return true;
+        }
+
+        std::shared_ptr<const CBlock> pblock = ReadBlockFromDiskCached(it->second);
+        if (!pblock)
+            assert(!"cannot load block from disk");
+
+        BlockTransactions resp(req);
+        for (size_t i = 0; i < req.indexes.size(); i++) {
+            if (req.indexes[i] >= pblock->vtx.size()) {
+                Misbehaving(pfrom->GetId(), 100);
+                return error("peer=%d sent us a getblocktxn with out-of-bounds tx indices", pfrom->id);
+            }
+            resp.txn[i] = pblock->vtx[req.indexes[i]];
+        }
+        pfrom->PushMessage("blocktxn", resp);
+    }
+
+
+    else if (strCommand == "blocktxn" && !fImporting && !fReindex) // Ignore blocks received while importing
+    {
+        BlockTransactions resp;
+        vRecv >> resp;
+
+        CBlock block;
+        bool fBlockRead = false;
+        {
+            LOCK(cs_main);
+
+            map<uint256, pair<NodeId, list<QueuedBlock>::iterator> >::iterator it = mapBlocksInFlight.find(resp.blockhash);
+            if (it == mapBlocksInFlight.end() || !it->second.second->partialBlock ||
+                    it->second.first != pfrom->GetId()) {
+                LogPrint("net", "Peer %d sent us block transactions for block we weren't expecting\n", pfrom->id);
+                return true;
+            }
+
+            ReadStatus status = it->second.second->partialBlock->FillBlock(block, resp.txn);
+            if (status == READ_STATUS_INVALID) {
+                MarkBlockAsReceived(resp.blockhash);
+                Misbehaving(pfrom->GetId(), 100);
+                return error("peer=%d sent us non-matching block transactions", pfrom->id);
+            } else if (status == READ_STATUS_FAILED) {
+                // Short ID collision, the full block it is (still marked in flight)
+                it->second.second->partialBlock.reset();
+                vector<CInv> vInv(1, CInv(MSG_BLOCK, resp.blockhash));
+                pfrom->PushMessage("getdata", vInv);
+            } else {
+                fBlockRead = true;
+            }
+        }
+
+        if (fBlockRead)
+            ProcessBlockFromPeer(pfrom, strCommand, block, false);
+    }
+
+
     else if (strCommand == "block" && !fImporting && !fReindex) // Ignore blocks received while importing
     {
         CBlock block;
@@ -5637,23 +6344,12 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
 
         pfrom->AddInventoryKnown(inv);
 
-        CValidationState state;
         // Process all blocks from whitelisted peers, even if not requested,
         // unless we're still syncing with the network.
         // Such an unrequested block may still be processed, subject to the
         // conditions in AcceptBlock().
         bool forceProcessing = pfrom->fWhitelisted && !IsInitialBlockDownload();
-        ProcessNewBlock(state, pfrom, &block, forceProcessing, NULL);
-        int nDoS;
-        if (state.IsInvalid(nDoS)) {
-            pfrom->PushMessage("reject", strCommand, state.GetRejectCode(),
-                               state.GetRejectReason().substr(0, MAX_REJECT_MESSAGE_LENGTH), inv.hash);
-            if (nDoS > 0) {
-                LOCK(cs_main);
-                Misbehaving(pfrom->GetId(), nDoS);
-            }
-        }
-
+        ProcessBlockFromPeer(pfrom, strCommand, block, forceProcessing);
     }
 
 
@@ -6002,8 +6698,10 @@ bool ProcessMessages(CNode* pfrom)
             continue;
         }
 
-        // Process message
+        // Process message, timing it and the wait for cs_main
         bool fRet = false;
+        WatchLockWait(&cs_main);
+        int64_t nProcessStart = GetTimeMicros();
         try
         {
             fRet = ProcessMessage(pfrom, strCommand, vRecv, msg.nTime);
@@ -6035,6 +6733,8 @@ bool ProcessMessages(CNode* pfrom)
         } catch (...) {
             PrintExceptionContinue(NULL, "ProcessMessages()");
         }
+        pfrom->RecordMsgProcessed(strCommand, nMessageSize + CMessageHeader::HEADER_SIZE,
+                                  GetTimeMicros() - nProcessStart, GetLockWaitTime());
 
         if (!fRet)
             LogPrintf("%s(%s, %u bytes) FAILED peer=%d\n", __func__, SanitizeString(strCommand), nMessageSize, pfrom->id);
@@ -6043,8 +6743,10 @@ bool ProcessMessages(CNode* pfrom)
     }
 
     // In case the connection got shut down, its receive buffer was wiped
-    if (!pfrom->fDisconnect)
+    if (!pfrom->fDisconnect) {
         pfrom->vRecvMsg.erase(pfrom->vRecvMsg.begin(), it);
+        pfrom->UpdateRecvPause();
+    }
 
     return fOk;
 }
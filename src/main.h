@@ -10,6 +10,7 @@
 #include "config/bitcoin-config.h"
 #endif
 
+#include "addressindex.h"
 #include "amount.h"
 #include "chain.h"
 #include "chainparams.h"
@@ -22,6 +23,7 @@
 #include "script/script.h"
 #include "script/sigcache.h"
 #include "script/standard.h"
+#include "spentindex.h"
 #include "sync.h"
 #include "tinyformat.h"
 #include "txmempool.h"
@@ -30,6 +32,7 @@
 #include <algorithm>
 #include <exception>
 #include <map>
+#include <memory>
 #include <set>
 #include <stdint.h>
 #include <string>
@@ -38,10 +41,13 @@
 
 #include <boost/unordered_map.hpp>
 
+class CBlockCache;
 class CBlockIndex;
 class CBlockTreeDB;
 class CBloomFilter;
 class CInv;
+class CProofCheck;
+class CSaplingDeferredVerifier;
 class CScriptCheck;
 class CValidationInterface;
 class CValidationState;
@@ -49,11 +55,16 @@ class PrecomputedTransactionData;
 
 struct CNodeStateStats;
 
+template <typename T>
+class CCheckQueueControl;
+
 /** Default for -blockmaxsize and -blockminsize, which control the range of sizes the mining code will create **/
 static const unsigned int DEFAULT_BLOCK_MAX_SIZE = MAX_BLOCK_SIZE;
 static const unsigned int DEFAULT_BLOCK_MIN_SIZE = 0;
 /** Default for -blockprioritysize, maximum space for zero/low-fee transactions **/
-static const unsigned int DEFAULT_BLOCK_PRIORITY_SIZE = DEFAULT_BLOCK_MAX_SIZE / 2;
+static const unsigned int DEFAULT_BLOCK_PRIORITY_SIZE = 0;
+/** Free transactions smaller than this can be relayed if their priority allows it **/
+static const unsigned int MAX_FREE_TX_RELAY_SIZE = DEFAULT_BLOCK_MAX_SIZE / 2 - 1000;
 /** Default for accepting alerts from the P2P network. */
 static const bool DEFAULT_ALERTS = true;
 /** Minimum alert priority for enabling safe mode. */
@@ -66,6 +77,16 @@ static const unsigned int MAX_P2SH_SIGOPS = 15;
 static const unsigned int MAX_STANDARD_TX_SIGOPS = MAX_BLOCK_SIGOPS/5;
 /** Default for -minrelaytxfee, minimum relay fee for transactions */
 static const unsigned int DEFAULT_MIN_RELAY_TX_FEE = 100;
+/** Default for -maxmempool, maximum megabytes of mempool memory usage */
+static const unsigned int DEFAULT_MAX_MEMPOOL_SIZE = 300;
+/** Default for -limitancestorcount, max number of in-mempool ancestors */
+static const unsigned int DEFAULT_ANCESTOR_LIMIT = 25;
+/** Default for -limitancestorsize, maximum kilobytes of tx + all in-mempool ancestors */
+static const unsigned int DEFAULT_ANCESTOR_SIZE_LIMIT = 101;
+/** Default for -limitdescendantcount, max number of in-mempool descendants */
+static const unsigned int DEFAULT_DESCENDANT_LIMIT = 25;
+/** Default for -limitdescendantsize, maximum kilobytes of in-mempool descendants */
+static const unsigned int DEFAULT_DESCENDANT_SIZE_LIMIT = 101;
 /** Default for -maxorphantx, maximum number of orphan transactions kept in memory */
 static const unsigned int DEFAULT_MAX_ORPHAN_TRANSACTIONS = 100;
 /** Default for -txexpirydelta, in number of blocks */
@@ -94,6 +115,14 @@ static const unsigned int MAX_HEADERS_RESULTS = 160;
  *  degree of disordering of blocks on disk (which make reindexing and in the future perhaps pruning
  *  harder). We'll probably want to make this a per-peer adaptive value at some point. */
 static const unsigned int BLOCK_DOWNLOAD_WINDOW = 1024;
+/** Default for -compactblocks, relay new blocks as header plus short transaction IDs */
+static const bool DEFAULT_COMPACT_BLOCKS = true;
+/** Blocks at most this deep are sent as compact blocks when asked for one, deeper ones in full */
+static const int MAX_CMPCTBLOCK_DEPTH = 5;
+/** getblocktxn for blocks deeper than this is answered with the full block */
+static const int MAX_BLOCKTXN_DEPTH = 10;
+/** Number of masternode peers a masternode asks to push new blocks as compact blocks right away */
+static const int MAX_HB_CMPCTBLOCK_PEERS = 3;
 /** Time to wait (in seconds) between writing blocks/block index to disk. */
 static const unsigned int DATABASE_WRITE_INTERVAL = 60 * 60;
 /** Time to wait (in seconds) between flushing chainstate to disk. */
@@ -121,6 +150,7 @@ extern CCriticalSection cs_main;
 extern CTxMemPool mempool;
 typedef boost::unordered_map<uint256, CBlockIndex*, BlockHasher> BlockMap;
 extern BlockMap mapBlockIndex;
+extern CBlockCache blockCache;
 extern uint64_t nLastBlockTx;
 extern uint64_t nLastBlockSize;
 extern const std::string strMessageMagic;
@@ -131,6 +161,8 @@ extern bool fImporting;
 extern bool fReindex;
 extern int nScriptCheckThreads;
 extern bool fTxIndex;
+extern bool fAddressIndex;
+extern bool fSpentIndex;
 extern bool fIsBareMultisigStd;
 extern bool fCheckBlockIndex;
 extern bool fCheckpointsEnabled;
@@ -213,6 +245,10 @@ bool ProcessMessages(CNode* pfrom);
 bool SendMessages(CNode* pto, bool fSendTrickle);
 /** Run an instance of the script checking thread */
 void ThreadScriptCheck();
+/** Run an instance of the proof checking thread */
+void ThreadProofCheck();
+/** Run an instance of the header proof of work checking thread */
+void ThreadHeaderCheck();
 /** Try to detect Partition (network isolation) attacks against us */
 void PartitionCheck(bool (*initialDownloadCheck)(), CCriticalSection& cs, const CBlockIndex *const &bestHeader, int64_t nPowTargetSpacing);
 /** Check whether we are doing an initial block download (synchronizing from disk or network) */
@@ -221,6 +257,15 @@ bool IsInitialBlockDownload();
 std::string GetWarnings(const std::string& strFor);
 /** Retrieve a transaction (from memory pool, or from disk, if possible) */
 bool GetTransaction(const uint256 &hash, CTransaction &tx, uint256 &hashBlock, bool fAllowSlow = false);
+/** Look up the input spending an output (requires -spentindex) */
+bool GetSpentIndex(const CSpentIndexKey &key, CSpentIndexValue &value);
+/** Retrieve the credits and debits of an address, optionally limited to a block height range (requires -addressindex) */
+bool GetAddressIndex(const uint160 &addressHash, uint8_t type,
+                     std::vector<std::pair<CAddressIndexKey, CAmount> > &addressIndex,
+                     int start = 0, int end = 0);
+/** Retrieve the unspent outputs of an address (requires -addressindex) */
+bool GetAddressUnspent(const uint160 &addressHash, uint8_t type,
+                       std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > &unspentOutputs);
 /** Find the best known block, and make it the tip of the block chain */
 bool ActivateBestChain(CValidationState &state, CBlock *pblock = NULL);
 CAmount GetBlockSubsidy(int nHeight, const Consensus::Params& consensusParams);
@@ -344,17 +389,23 @@ bool ContextualCheckInputs(const CTransaction& tx, CValidationState &state, cons
                            const Consensus::Params& consensusParams, uint32_t consensusBranchId,
                            std::vector<CScriptCheck> *pvChecks = NULL);
 
-/** Check a transaction contextually against a set of consensus rules */
+/** Check a transaction contextually against a set of consensus rules.
+ *  If pSaplingVerifier is not NULL, Sapling proofs and the binding signature are queued
+ *  into it instead of being verified inline. */
 bool ContextualCheckTransaction(const CTransaction& tx, CValidationState &state, int nHeight, int dosLevel,
-                                bool (*isInitBlockDownload)() = IsInitialBlockDownload);
+                                bool (*isInitBlockDownload)() = IsInitialBlockDownload,
+                                CSaplingDeferredVerifier *pSaplingVerifier = NULL);
 
 /** Apply the effects of this transaction on the UTXO set represented by view */
 void UpdateCoins(const CTransaction& tx, CCoinsViewCache& inputs, int nHeight);
 
 /** Transaction validation functions */
 
-/** Context-independent validity checks */
-bool CheckTransaction(const CTransaction& tx, CValidationState& state, libzcash::ProofVerifier& verifier);
+/** Context-independent validity checks.
+ *  If pvProofChecks is not NULL, JoinSplit proof checks are pushed onto it instead of
+ *  being performed inline. */
+bool CheckTransaction(const CTransaction& tx, CValidationState& state, libzcash::ProofVerifier& verifier,
+                      std::vector<CProofCheck> *pvProofChecks = NULL);
 bool CheckTransactionWithoutProofVerification(const CTransaction& tx, CValidationState &state);
 
 /** Check for standard transaction types
@@ -440,11 +491,107 @@ public:
     ScriptError GetScriptError() const { return error; }
 };
 
+/**
+ * Closure representing one zero-knowledge proof verification: either a single
+ * JoinSplit, or the Sapling spends, outputs and binding signature of a transaction.
+ * Note that this stores references to the transaction.
+ */
+class CProofCheck
+{
+private:
+    const CTransaction *ptx;
+    //! Index into ptx->vjoinsplit, or -1 to check the Sapling bundle
+    int nJoinSplit;
+    uint256 dataToBeSigned;
+
+public:
+    CProofCheck(): ptx(0), nJoinSplit(-1) {}
+    CProofCheck(const CTransaction& txIn, int nJoinSplitIn) :
+        ptx(&txIn), nJoinSplit(nJoinSplitIn) { }
+    CProofCheck(const CTransaction& txIn, const uint256& dataToBeSignedIn) :
+        ptx(&txIn), nJoinSplit(-1), dataToBeSigned(dataToBeSignedIn) { }
+
+    bool operator()();
+
+    void swap(CProofCheck &check) {
+        std::swap(ptx, check.ptx);
+        std::swap(nJoinSplit, check.nJoinSplit);
+        std::swap(dataToBeSigned, check.dataToBeSigned);
+    }
+};
+
+/**
+ * Closure representing the context-free proof of work checks of a block header, the
+ * Equihash solution and the hash against the claimed target. *pfValid is set on success.
+ */
+class CHeaderPoWCheck
+{
+private:
+    const CBlockHeader *pheader;
+    char *pfValid;
+
+public:
+    CHeaderPoWCheck(): pheader(0), pfValid(0) {}
+    CHeaderPoWCheck(const CBlockHeader& headerIn, char *pfValidIn) :
+        pheader(&headerIn), pfValid(pfValidIn) { }
+
+    bool operator()();
+
+    void swap(CHeaderPoWCheck &check) {
+        std::swap(pheader, check.pheader);
+        std::swap(pfValid, check.pfValid);
+    }
+};
+
+/**
+ * Sapling spend/output proofs and binding signatures of all transactions in a block,
+ * collected while the block is checked contextually and verified once every
+ * transaction has passed its cheap consensus checks. Each bundle is still verified
+ * on its own, the gain is that a block failing cheap checks costs no proofs and the
+ * bundles can be spread over the proof check threads.
+ * Note that this stores references to the queued transactions.
+ */
+class CSaplingDeferredVerifier
+{
+private:
+    struct CSaplingBundle
+    {
+        const CTransaction *ptx;
+        uint256 dataToBeSigned;
+
+        CSaplingBundle(const CTransaction *ptxIn, const uint256& dataToBeSignedIn) :
+            ptx(ptxIn), dataToBeSigned(dataToBeSignedIn) {}
+    };
+    std::vector<CSaplingBundle> vBundles;
+    size_t nSpends;
+    size_t nOutputs;
+
+public:
+    CSaplingDeferredVerifier() : nSpends(0), nOutputs(0) {}
+
+    void Add(const CTransaction& tx, const uint256& dataToBeSigned);
+    /** Verify all queued bundles and empty the queue, whatever the result. If pcontrol is not
+     *  NULL, the bundles are spread over the proof check threads and only re-verified one by
+     *  one to find the failing transaction. */
+    bool Verify(CValidationState& state, CCheckQueueControl<CProofCheck> *pcontrol = NULL);
+
+    bool IsEmpty() const { return vBundles.empty(); }
+    size_t GetTxCount() const { return vBundles.size(); }
+    size_t GetSpendCount() const { return nSpends; }
+    size_t GetOutputCount() const { return nOutputs; }
+};
+
 
 /** Functions for disk access for blocks */
 bool WriteBlockToDisk(CBlock& block, CDiskBlockPos& pos, const CMessageHeader::MessageStartChars& messageStart);
 bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos);
 bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex);
+/** Read the serialized bytes of a block as stored on disk, after checking their magic and size */
+bool ReadRawBlockFromDisk(std::vector<char>& vchBlock, const CDiskBlockPos& pos, const CMessageHeader::MessageStartChars& messageStart);
+/** Serialized bytes of the block of pindex, from the cache or the block file, checked against the index hash */
+bool ReadRawBlockFromDisk(std::vector<char>& vchBlock, const CBlockIndex* pindex, const CMessageHeader::MessageStartChars& messageStart);
+/** Read a block through the shared cache of recently read blocks, returns an empty pointer on failure */
+std::shared_ptr<const CBlock> ReadBlockFromDiskCached(const CBlockIndex* pindex);
 
 
 /** Functions for validating blocks and updating the block tree */
@@ -462,7 +609,8 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
 bool CheckBlockHeader(const CBlockHeader& block, CValidationState& state, bool fCheckPOW = true);
 bool CheckBlock(const CBlock& block, CValidationState& state,
                 libzcash::ProofVerifier& verifier,
-                bool fCheckPOW = true, bool fCheckMerkleRoot = true);
+                bool fCheckPOW = true, bool fCheckMerkleRoot = true,
+                std::vector<CProofCheck> *pvProofChecks = NULL);
 
 /** Context-dependent validity checks */
 bool ContextualCheckBlockHeader(const CBlockHeader& block, CValidationState& state, CBlockIndex *pindexPrev);
@@ -479,7 +627,7 @@ bool TestBlockValidity(CValidationState &state, const CBlock& block, CBlockIndex
  * If dbp is non-NULL, the file is known to already reside on disk
  */
 bool AcceptBlock(CBlock& block, CValidationState& state, CBlockIndex **pindex, bool fRequested, CDiskBlockPos* dbp);
-bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state, CBlockIndex **ppindex= NULL);
+bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state, CBlockIndex **ppindex= NULL, bool fCheckPOW = true);
 
 
 
@@ -17,6 +17,7 @@
 #include "crypto/equihash.h"
 #endif
 #include "hash.h"
+#include "init.h"
 #include "key_io.h"
 #include "main.h"
 #include "metrics.h"
@@ -35,7 +36,6 @@
 #include "sodium.h"
 
 #include <boost/thread.hpp>
-#include <boost/tuple/tuple.hpp>
 #ifdef ENABLE_MINING
 #include <functional>
 #endif
@@ -49,55 +49,487 @@ using namespace std;
 // BitcoinMiner
 //
 
+uint64_t nLastBlockTx = 0;
+uint64_t nLastBlockSize = 0;
+
 //
 // Unconfirmed transactions in the memory pool often depend on other
-// transactions in the memory pool. When we select transactions from the
-// pool, we select by highest priority or fee rate, so we might consider
-// transactions that depend on transactions that aren't yet in the block.
-// The COrphan class keeps track of these 'temporary orphans' while
-// CreateBlock is figuring out which transactions to include.
+// transactions in the memory pool. The mempool tracks the fees and sizes of
+// each transaction together with all of its unconfirmed ancestors, and block
+// assembly selects whole ancestor packages by their combined fee rate.
+//
+// Once part of a package is in the block, the remaining descendants are
+// tracked here with their package fee/size reduced by the included
+// ancestors, without touching the mempool itself.
 //
-class COrphan
+struct CTxMemPoolModifiedEntry
 {
-public:
-    const CTransaction* ptx;
-    set<uint256> setDependsOn;
-    CFeeRate feeRate;
-    double dPriority;
+    CTxMemPoolModifiedEntry(CTxMemPool::txiter entry)
+    {
+        iter = entry;
+        nSizeWithAncestors = entry->GetSizeWithAncestors();
+        nModFeesWithAncestors = entry->GetModFeesWithAncestors();
+    }
 
-    COrphan(const CTransaction* ptxIn) : ptx(ptxIn), feeRate(0), dPriority(0)
+    CTxMemPool::txiter iter;
+    uint64_t nSizeWithAncestors;
+    CAmount nModFeesWithAncestors;
+};
+
+// Sort by package fee rate, best first
+struct CompareModifiedEntry
+{
+    bool operator()(const CTxMemPoolModifiedEntry &a, const CTxMemPoolModifiedEntry &b) const
     {
+        double f1 = (double)a.nModFeesWithAncestors * b.nSizeWithAncestors;
+        double f2 = (double)b.nModFeesWithAncestors * a.nSizeWithAncestors;
+        if (f1 == f2)
+            return CTxMemPool::CompareIteratorByHash()(a.iter, b.iter);
+        return f1 > f2;
     }
 };
 
-uint64_t nLastBlockTx = 0;
-uint64_t nLastBlockSize = 0;
+struct modifiedentry_iter
+{
+    typedef CTxMemPool::txiter result_type;
+    result_type operator() (const CTxMemPoolModifiedEntry &entry) const
+    {
+        return entry.iter;
+    }
+};
 
-// We want to sort transactions by priority and fee rate, so:
-typedef boost::tuple<double, CFeeRate, const CTransaction*> TxPriority;
-class TxPriorityCompare
+typedef boost::multi_index_container<
+    CTxMemPoolModifiedEntry,
+    boost::multi_index::indexed_by<
+        boost::multi_index::ordered_unique<
+            modifiedentry_iter,
+            CTxMemPool::CompareIteratorByHash
+        >,
+        // sorted by modified ancestor fee rate
+        boost::multi_index::ordered_non_unique<
+            boost::multi_index::tag<ancestor_score>,
+            boost::multi_index::identity<CTxMemPoolModifiedEntry>,
+            CompareModifiedEntry
+        >
+    >
+> indexed_modified_transaction_set;
+
+typedef indexed_modified_transaction_set::nth_index<0>::type::iterator modtxiter;
+typedef indexed_modified_transaction_set::index<ancestor_score>::type::iterator modtxscoreiter;
+
+struct update_for_parent_inclusion
 {
-    bool byFee;
+    update_for_parent_inclusion(CTxMemPool::txiter it) : iter(it) {}
+
+    void operator() (CTxMemPoolModifiedEntry &e)
+    {
+        e.nModFeesWithAncestors -= iter->GetModifiedFee();
+        e.nSizeWithAncestors -= iter->GetTxSize();
+    }
 
+    CTxMemPool::txiter iter;
+};
+
+// We want to sort transactions by priority for the high-priority area of the block
+typedef std::pair<double, CTxMemPool::txiter> TxCoinAgePriority;
+class TxCoinAgePriorityCompare
+{
 public:
-    TxPriorityCompare(bool _byFee) : byFee(_byFee) { }
+    bool operator()(const TxCoinAgePriority& a, const TxCoinAgePriority& b)
+    {
+        if (a.first == b.first)
+            return CompareTxMemPoolEntryByAncestorFee()(*(b.second), *(a.second)); // Reverse order to make sort less than
+        return a.first < b.first;
+    }
+};
+
+/**
+ * Fills a block template from the mempool. Must be used with cs_main and
+ * mempool.cs held.
+ */
+class CBlockTxSelector
+{
+private:
+    CBlockTemplate *pblocktemplate;
+    CCoinsViewCache &view;
+    SaplingMerkleTree &sapling_tree;
+    const int nHeight;
+    const int64_t nLockTimeCutoff;
+    const uint32_t consensusBranchId;
+    const unsigned int nBlockMaxSize;
+    const unsigned int nBlockPrioritySize;
+    const unsigned int nBlockMinSize;
+    const bool fPrintPriority;
+
+    CTxMemPool::setEntries inBlock;
+    CTxMemPool::setEntries failedTx;
+    std::map<uint256, unsigned int> mapLegacySigOps;
 
-    bool operator()(const TxPriority& a, const TxPriority& b)
+public:
+    uint64_t nBlockSize;
+    uint64_t nBlockTx;
+    unsigned int nBlockSigOps;
+    CAmount nFees;
+
+    CBlockTxSelector(CBlockTemplate *pblocktemplateIn, CCoinsViewCache &viewIn, SaplingMerkleTree &saplingTreeIn,
+                     int nHeightIn, int64_t nLockTimeCutoffIn, uint32_t consensusBranchIdIn,
+                     unsigned int nBlockMaxSizeIn, unsigned int nBlockPrioritySizeIn, unsigned int nBlockMinSizeIn) :
+        pblocktemplate(pblocktemplateIn), view(viewIn), sapling_tree(saplingTreeIn),
+        nHeight(nHeightIn), nLockTimeCutoff(nLockTimeCutoffIn), consensusBranchId(consensusBranchIdIn),
+        nBlockMaxSize(nBlockMaxSizeIn), nBlockPrioritySize(nBlockPrioritySizeIn), nBlockMinSize(nBlockMinSizeIn),
+        fPrintPriority(GetBoolArg("-printpriority", false)),
+        nBlockSize(1000), nBlockTx(0), nBlockSigOps(100), nFees(0)
     {
-        if (byFee)
-        {
-            if (a.get<1>() == b.get<1>())
-                return a.get<0>() < b.get<0>();
-            return a.get<1>() < b.get<1>();
+    }
+
+    /** Add high-priority transactions, regardless of fee, up to -blockprioritysize */
+    void AddPriorityTxs();
+    /** Add the remaining transactions as ancestor packages, by package fee rate */
+    void AddPackageTxs();
+
+private:
+    unsigned int GetLegacySigOps(CTxMemPool::txiter iter);
+    bool TestPackage(const std::vector<CTxMemPool::txiter>& vPackage);
+    bool CheckTxForBlock(const CTransaction& tx, CAmount& nTxFees, unsigned int& nTxSigOps) const;
+    bool AddPackageToBlock(const std::vector<CTxMemPool::txiter>& vPackage);
+    void UpdatePackagesForAdded(const CTxMemPool::setEntries& alreadyAdded, indexed_modified_transaction_set &mapModifiedTx);
+    bool HasFailedAncestor(const CTxMemPool::setEntries& ancestors) const;
+    //! Whether prioritisetransaction raised the priority or fee of a transaction of the package not yet in the block
+    bool HasPrioritisedTx(const CTxMemPool::setEntries& package) const;
+};
+
+unsigned int CBlockTxSelector::GetLegacySigOps(CTxMemPool::txiter iter)
+{
+    // Memoized, as a transaction may be considered as part of several packages
+    const uint256& hash = iter->GetTx().GetHash();
+    std::map<uint256, unsigned int>::const_iterator it = mapLegacySigOps.find(hash);
+    if (it != mapLegacySigOps.end())
+        return it->second;
+    unsigned int nSigOps = GetLegacySigOpCount(iter->GetTx());
+    mapLegacySigOps.insert(std::make_pair(hash, nSigOps));
+    return nSigOps;
+}
+
+// Cheap checks of a package against the block limits and finality rules,
+// done before any of its inputs are validated. Returns false and marks the
+// offending transaction as failed if the package can't be included.
+bool CBlockTxSelector::TestPackage(const std::vector<CTxMemPool::txiter>& vPackage)
+{
+    uint64_t nPackageSize = 0;
+    unsigned int nPackageSigOps = 0;
+    BOOST_FOREACH(CTxMemPool::txiter it, vPackage) {
+        const CTransaction& tx = it->GetTx();
+        if (tx.IsCoinBase() || !IsFinalTx(tx, nHeight, nLockTimeCutoff) || IsExpiredTx(tx, nHeight)) {
+            failedTx.insert(it);
+            return false;
+        }
+        nPackageSize += it->GetTxSize();
+        nPackageSigOps += GetLegacySigOps(it);
+    }
+    if (nBlockSize + nPackageSize >= nBlockMaxSize)
+        return false;
+    if (nBlockSigOps + nPackageSigOps >= MAX_BLOCK_SIGOPS)
+        return false;
+    return true;
+}
+
+// Checks a transaction against the block so far, without adding it
+bool CBlockTxSelector::CheckTxForBlock(const CTransaction& tx, CAmount& nTxFees, unsigned int& nTxSigOps) const
+{
+    if (!view.HaveInputs(tx))
+        return false;
+
+    nTxFees = view.GetValueIn(tx)-tx.GetValueOut();
+    nTxSigOps = GetLegacySigOpCount(tx) + GetP2SHSigOpCount(tx, view);
+
+    // Note that flags: we don't want to set mempool/IsStandard()
+    // policy here, but we still have to ensure that the block we
+    // create only contains transactions that are valid in new blocks.
+    CValidationState state;
+    PrecomputedTransactionData txdata(tx);
+    if (!ContextualCheckInputs(tx, state, view, true, MANDATORY_SCRIPT_VERIFY_FLAGS, true, txdata, Params().GetConsensus(), consensusBranchId))
+        return false;
+    return true;
+}
+
+// Validates the transactions of a package (sorted parents first) one at a time
+// on top of the block so far and adds them. Returns false at the first one that
+// can't be added. The ones before it stay in the block, which is fine as their
+// ancestors are all in it too. The mempool has already checked the transactions,
+// so this is rare, and it saves copying the coins view and the Sapling tree for
+// every package.
+bool CBlockTxSelector::AddPackageToBlock(const std::vector<CTxMemPool::txiter>& vPackage)
+{
+    CBlock *pblock = &pblocktemplate->block;
+    BOOST_FOREACH(CTxMemPool::txiter it, vPackage) {
+        const CTransaction& tx = it->GetTx();
+        CAmount nTxFees;
+        unsigned int nTxSigOps;
+        if (!CheckTxForBlock(tx, nTxFees, nTxSigOps)) {
+            failedTx.insert(it);
+            return false;
+        }
+        if (nBlockSigOps + nTxSigOps >= MAX_BLOCK_SIGOPS)
+            return false;
+
+        UpdateCoins(tx, view, nHeight);
+        BOOST_FOREACH(const OutputDescription &outDescription, tx.vShieldedOutput) {
+            sapling_tree.append(outDescription.cm);
         }
-        else
+
+        pblock->vtx.push_back(tx);
+        pblocktemplate->vTxFees.push_back(nTxFees);
+        pblocktemplate->vTxSigOps.push_back(nTxSigOps);
+        nBlockSize += it->GetTxSize();
+        ++nBlockTx;
+        nBlockSigOps += nTxSigOps;
+        nFees += nTxFees;
+        inBlock.insert(it);
+
+        if (fPrintPriority)
         {
-            if (a.get<0>() == b.get<0>())
-                return a.get<1>() < b.get<1>();
-            return a.get<0>() < b.get<0>();
+            double dPriority = it->GetPriority(nHeight);
+            CAmount dummy;
+            mempool.ApplyDeltas(it->GetTx().GetHash(), dPriority, dummy);
+            LogPrintf("priority %.1f fee %s txid %s\n",
+                dPriority, CFeeRate(it->GetModifiedFee(), it->GetTxSize()).ToString(), it->GetTx().GetHash().ToString());
         }
     }
-};
+    return true;
+}
+
+void CBlockTxSelector::AddPriorityTxs()
+{
+    if (nBlockPrioritySize == 0)
+        return;
+
+    // This vector will be sorted into a priority queue:
+    std::vector<TxCoinAgePriority> vecPriority;
+    TxCoinAgePriorityCompare pricomparer;
+    std::map<CTxMemPool::txiter, double, CTxMemPool::CompareIteratorByHash> waitPriMap;
+    typedef std::map<CTxMemPool::txiter, double, CTxMemPool::CompareIteratorByHash>::iterator waitPriIter;
+    double actualPriority = -1;
+
+    vecPriority.reserve(mempool.mapTx.size());
+    for (CTxMemPool::indexed_transaction_set::iterator mi = mempool.mapTx.begin();
+         mi != mempool.mapTx.end(); ++mi)
+    {
+        double dPriority = mi->GetPriority(nHeight);
+        CAmount dummy;
+        mempool.ApplyDeltas(mi->GetTx().GetHash(), dPriority, dummy);
+        vecPriority.push_back(TxCoinAgePriority(dPriority, mi));
+    }
+    std::make_heap(vecPriority.begin(), vecPriority.end(), pricomparer);
+
+    while (!vecPriority.empty())
+    {
+        // Take highest priority transaction off the priority queue:
+        CTxMemPool::txiter iter = vecPriority.front().second;
+        actualPriority = vecPriority.front().first;
+        std::pop_heap(vecPriority.begin(), vecPriority.end(), pricomparer);
+        vecPriority.pop_back();
+
+        if (inBlock.count(iter) || failedTx.count(iter))
+            continue;
+
+        // If tx is dependent on other mempool txs which haven't yet been
+        // included then put it in the wait set
+        bool fStillDependent = false;
+        BOOST_FOREACH(CTxMemPool::txiter parent, mempool.GetMemPoolParents(iter)) {
+            if (!inBlock.count(parent)) {
+                fStillDependent = true;
+                break;
+            }
+        }
+        if (fStillDependent) {
+            waitPriMap.insert(std::make_pair(iter, actualPriority));
+            continue;
+        }
+
+        // Too large for what's left of the block
+        if (nBlockSize + iter->GetTxSize() >= nBlockMaxSize)
+            continue;
+
+        // Prioritise by fee once past the priority size or we run out of
+        // high-priority transactions; this one gets its chance there
+        if (nBlockSize + iter->GetTxSize() >= nBlockPrioritySize || !AllowFree(actualPriority))
+            return;
+
+        std::vector<CTxMemPool::txiter> vPackage(1, iter);
+        if (TestPackage(vPackage) && AddPackageToBlock(vPackage)) {
+            // This tx was successfully added, so add transactions that depend
+            // on this one to the priority queue to try again
+            BOOST_FOREACH(CTxMemPool::txiter child, mempool.GetMemPoolChildren(iter)) {
+                waitPriIter wpiter = waitPriMap.find(child);
+                if (wpiter != waitPriMap.end()) {
+                    vecPriority.push_back(TxCoinAgePriority(wpiter->second, child));
+                    std::push_heap(vecPriority.begin(), vecPriority.end(), pricomparer);
+                    waitPriMap.erase(wpiter);
+                }
+            }
+        }
+    }
+}
+
+void CBlockTxSelector::UpdatePackagesForAdded(const CTxMemPool::setEntries& alreadyAdded,
+                                              indexed_modified_transaction_set &mapModifiedTx)
+{
+    BOOST_FOREACH(const CTxMemPool::txiter it, alreadyAdded) {
+        CTxMemPool::setEntries descendants;
+        mempool.CalculateDescendants(it, descendants);
+        // Insert all descendants (not yet in block) into the modified set
+        BOOST_FOREACH(CTxMemPool::txiter desc, descendants) {
+            if (alreadyAdded.count(desc))
+                continue;
+            modtxiter mit = mapModifiedTx.find(desc);
+            if (mit == mapModifiedTx.end()) {
+                CTxMemPoolModifiedEntry modEntry(desc);
+                modEntry.nSizeWithAncestors -= it->GetTxSize();
+                modEntry.nModFeesWithAncestors -= it->GetModifiedFee();
+                mapModifiedTx.insert(modEntry);
+            } else {
+                mapModifiedTx.modify(mit, update_for_parent_inclusion(it));
+            }
+        }
+    }
+}
+
+bool CBlockTxSelector::HasFailedAncestor(const CTxMemPool::setEntries& ancestors) const
+{
+    BOOST_FOREACH(CTxMemPool::txiter it, ancestors) {
+        if (failedTx.count(it))
+            return true;
+    }
+    return false;
+}
+
+bool CBlockTxSelector::HasPrioritisedTx(const CTxMemPool::setEntries& package) const
+{
+    BOOST_FOREACH(CTxMemPool::txiter it, package) {
+        if (inBlock.count(it))
+            continue;
+        double dPriorityDelta = 0;
+        CAmount nFeeDelta = 0;
+        mempool.ApplyDeltas(it->GetTx().GetHash(), dPriorityDelta, nFeeDelta);
+        if (dPriorityDelta > 0 || nFeeDelta > 0)
+            return true;
+    }
+    return false;
+}
+
+void CBlockTxSelector::AddPackageTxs()
+{
+    // mapModifiedTx will store sorted packages after they are modified
+    // because some of their txs are already in the block
+    indexed_modified_transaction_set mapModifiedTx;
+
+    // Start by adding all descendants of previously added txs to mapModifiedTx
+    // and modifying them for their already included ancestors
+    UpdatePackagesForAdded(inBlock, mapModifiedTx);
+
+    CTxMemPool::indexed_transaction_set::index<ancestor_score>::type::iterator mi = mempool.mapTx.get<ancestor_score>().begin();
+    CTxMemPool::txiter iter;
+    while (mi != mempool.mapTx.get<ancestor_score>().end() || !mapModifiedTx.empty())
+    {
+        // First try to find a new transaction in mapTx to evaluate.
+        if (mi != mempool.mapTx.get<ancestor_score>().end()) {
+            CTxMemPool::txiter it = mempool.mapTx.project<0>(mi);
+            if (inBlock.count(it) || mapModifiedTx.count(it) || failedTx.count(it)) {
+                ++mi;
+                continue;
+            }
+        }
+
+        // Now that mi is not stale, determine which transaction to evaluate:
+        // the next entry from mapTx, or the best from mapModifiedTx?
+        bool fUsingModified = false;
+
+        modtxscoreiter modit = mapModifiedTx.get<ancestor_score>().begin();
+        if (mi == mempool.mapTx.get<ancestor_score>().end()) {
+            // We're out of entries in mapTx; use the entry from mapModifiedTx
+            iter = modit->iter;
+            fUsingModified = true;
+        } else {
+            // Try to compare the mapTx entry to the mapModifiedTx entry
+            iter = mempool.mapTx.project<0>(mi);
+            if (modit != mapModifiedTx.get<ancestor_score>().end() &&
+                    CompareModifiedEntry()(*modit, CTxMemPoolModifiedEntry(iter))) {
+                // The best entry in mapModifiedTx has higher score
+                // than the one from mapTx.
+                iter = modit->iter;
+                fUsingModified = true;
+            } else {
+                // Either no entry in mapModifiedTx, or it's worse than mapTx.
+                ++mi;
+            }
+        }
+
+        // We skip mapTx entries that are inBlock, and mapModifiedTx shouldn't
+        // contain anything that is inBlock.
+        assert(!inBlock.count(iter));
+
+        uint64_t packageSize = iter->GetSizeWithAncestors();
+        CAmount packageFees = iter->GetModFeesWithAncestors();
+        if (fUsingModified) {
+            packageSize = modit->nSizeWithAncestors;
+            packageFees = modit->nModFeesWithAncestors;
+            mapModifiedTx.get<ancestor_score>().erase(modit);
+        }
+
+        // A failed transaction comes back here when a parent is added to the block
+        if (failedTx.count(iter))
+            continue;
+
+        if (nBlockSize + packageSize >= nBlockMaxSize) {
+            failedTx.insert(iter);
+            continue;
+        }
+
+        // Skip free packages if we're past the minimum block size, unless one of
+        // their transactions was prioritised. Not marked as failed, a descendant
+        // may still pay for it. Without any prioritisation that is known before
+        // looking up the ancestors.
+        bool fFreePackage = packageFees < ::minRelayTxFee.GetFee(packageSize) && nBlockSize + packageSize >= nBlockMinSize;
+        if (fFreePackage && mempool.mapDeltas.empty())
+            continue;
+
+        CTxMemPool::setEntries ancestors;
+        if (iter->GetCountWithAncestors() > 1)
+            mempool.CalculateMemPoolAncestors(*iter, ancestors, false);
+        ancestors.insert(iter);
+        if (HasFailedAncestor(ancestors)) {
+            failedTx.insert(iter);
+            continue;
+        }
+
+        if (fFreePackage && !HasPrioritisedTx(ancestors))
+            continue;
+
+        std::vector<CTxMemPool::txiter> vPackage;
+        BOOST_FOREACH(CTxMemPool::txiter it, ancestors) {
+            if (!inBlock.count(it))
+                vPackage.push_back(it);
+        }
+        // Parents must come before their children in the block
+        std::sort(vPackage.begin(), vPackage.end(), CTxMemPool::CompareIteratorByAncestorCount());
+
+        bool fAdded = TestPackage(vPackage) && AddPackageToBlock(vPackage);
+
+        // A package that failed part way may have had some of its transactions added
+        CTxMemPool::setEntries added;
+        BOOST_FOREACH(CTxMemPool::txiter it, vPackage) {
+            if (inBlock.count(it)) {
+                added.insert(it);
+                mapModifiedTx.erase(it);
+            }
+        }
+        // Update transactions that depend on each of these
+        UpdatePackagesForAdded(added, mapModifiedTx);
+
+        if (!fAdded)
+            failedTx.insert(iter);
+    }
+}
 
 void UpdateTime(CBlockHeader* pblock, const Consensus::Params& consensusParams, const CBlockIndex* pindexPrev)
 {
@@ -158,194 +590,19 @@ CBlockTemplate* CreateNewBlock(const CScript& scriptPubKeyIn)
         SaplingMerkleTree sapling_tree;
         assert(view.GetSaplingAnchorAt(view.GetBestAnchor(SAPLING), sapling_tree));
 
-        // Priority order to process transactions
-        list<COrphan> vOrphan; // list memory doesn't move
-        map<uint256, vector<COrphan*> > mapDependers;
-        bool fPrintPriority = GetBoolArg("-printpriority", false);
-
-        // This vector will be sorted into a priority queue:
-        vector<TxPriority> vecPriority;
-        vecPriority.reserve(mempool.mapTx.size());
-        for (CTxMemPool::indexed_transaction_set::iterator mi = mempool.mapTx.begin();
-             mi != mempool.mapTx.end(); ++mi)
-        {
-            const CTransaction& tx = mi->GetTx();
-
-            int64_t nLockTimeCutoff = (STANDARD_LOCKTIME_VERIFY_FLAGS & LOCKTIME_MEDIAN_TIME_PAST)
-                                    ? nMedianTimePast
-                                    : pblock->GetBlockTime();
-
-            if (tx.IsCoinBase() || !IsFinalTx(tx, nHeight, nLockTimeCutoff) || IsExpiredTx(tx, nHeight))
-                continue;
-
-            COrphan* porphan = NULL;
-            double dPriority = 0;
-            CAmount nTotalIn = 0;
-            bool fMissingInputs = false;
-            BOOST_FOREACH(const CTxIn& txin, tx.vin)
-            {
-                // Read prev transaction
-                if (!view.HaveCoins(txin.prevout.hash))
-                {
-                    // This should never happen; all transactions in the memory
-                    // pool should connect to either transactions in the chain
-                    // or other transactions in the memory pool.
-                    if (!mempool.mapTx.count(txin.prevout.hash))
-                    {
-                        LogPrintf("ERROR: mempool transaction missing input\n");
-                        if (fDebug) assert("mempool transaction missing input" == 0);
-                        fMissingInputs = true;
-                        if (porphan)
-                            vOrphan.pop_back();
-                        break;
-                    }
-
-                    // Has to wait for dependencies
-                    if (!porphan)
-                    {
-                        // Use list for automatic deletion
-                        vOrphan.push_back(COrphan(&tx));
-                        porphan = &vOrphan.back();
-                    }
-                    mapDependers[txin.prevout.hash].push_back(porphan);
-                    porphan->setDependsOn.insert(txin.prevout.hash);
-                    nTotalIn += mempool.mapTx.find(txin.prevout.hash)->GetTx().vout[txin.prevout.n].nValue;
-                    continue;
-                }
-                const CCoins* coins = view.AccessCoins(txin.prevout.hash);
-                assert(coins);
-
-                CAmount nValueIn = coins->vout[txin.prevout.n].nValue;
-                nTotalIn += nValueIn;
-
-                int nConf = nHeight - coins->nHeight;
-
-                dPriority += (double)nValueIn * nConf;
-            }
-            nTotalIn += tx.GetShieldedValueIn();
-
-            if (fMissingInputs) continue;
-
-            // Priority is sum(valuein * age) / modified_txsize
-            unsigned int nTxSize = ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION);
-            dPriority = tx.ComputePriority(dPriority, nTxSize);
-
-            uint256 hash = tx.GetHash();
-            mempool.ApplyDeltas(hash, dPriority, nTotalIn);
-
-            CFeeRate feeRate(nTotalIn-tx.GetValueOut(), nTxSize);
-
-            if (porphan)
-            {
-                porphan->dPriority = dPriority;
-                porphan->feeRate = feeRate;
-            }
-            else
-                vecPriority.push_back(TxPriority(dPriority, feeRate, &(mi->GetTx())));
-        }
+        int64_t nLockTimeCutoff = (STANDARD_LOCKTIME_VERIFY_FLAGS & LOCKTIME_MEDIAN_TIME_PAST)
+                                ? nMedianTimePast
+                                : pblock->GetBlockTime();
 
         // Collect transactions into block
-        uint64_t nBlockSize = 1000;
-        uint64_t nBlockTx = 0;
-        int nBlockSigOps = 100;
-        bool fSortedByFee = (nBlockPrioritySize <= 0);
-
-        TxPriorityCompare comparer(fSortedByFee);
-        std::make_heap(vecPriority.begin(), vecPriority.end(), comparer);
-
-        while (!vecPriority.empty())
-        {
-            // Take highest priority transaction off the priority queue:
-            double dPriority = vecPriority.front().get<0>();
-            CFeeRate feeRate = vecPriority.front().get<1>();
-            const CTransaction& tx = *(vecPriority.front().get<2>());
-
-            std::pop_heap(vecPriority.begin(), vecPriority.end(), comparer);
-            vecPriority.pop_back();
+        CBlockTxSelector selector(pblocktemplate.get(), view, sapling_tree, nHeight, nLockTimeCutoff,
+                                  consensusBranchId, nBlockMaxSize, nBlockPrioritySize, nBlockMinSize);
+        selector.AddPriorityTxs();
+        selector.AddPackageTxs();
 
-            // Size limits
-            unsigned int nTxSize = ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION);
-            if (nBlockSize + nTxSize >= nBlockMaxSize)
-                continue;
-
-            // Legacy limits on sigOps:
-            unsigned int nTxSigOps = GetLegacySigOpCount(tx);
-            if (nBlockSigOps + nTxSigOps >= MAX_BLOCK_SIGOPS)
-                continue;
-
-            // Skip free transactions if we're past the minimum block size:
-            const uint256& hash = tx.GetHash();
-            double dPriorityDelta = 0;
-            CAmount nFeeDelta = 0;
-            mempool.ApplyDeltas(hash, dPriorityDelta, nFeeDelta);
-            if (fSortedByFee && (dPriorityDelta <= 0) && (nFeeDelta <= 0) && (feeRate < ::minRelayTxFee) && (nBlockSize + nTxSize >= nBlockMinSize))
-                continue;
-
-            // Prioritise by fee once past the priority size or we run out of high-priority
-            // transactions:
-            if (!fSortedByFee &&
-                ((nBlockSize + nTxSize >= nBlockPrioritySize) || !AllowFree(dPriority)))
-            {
-                fSortedByFee = true;
-                comparer = TxPriorityCompare(fSortedByFee);
-                std::make_heap(vecPriority.begin(), vecPriority.end(), comparer);
-            }
-
-            if (!view.HaveInputs(tx))
-                continue;
-
-            CAmount nTxFees = view.GetValueIn(tx)-tx.GetValueOut();
-
-            nTxSigOps += GetP2SHSigOpCount(tx, view);
-            if (nBlockSigOps + nTxSigOps >= MAX_BLOCK_SIGOPS)
-                continue;
-
-            // Note that flags: we don't want to set mempool/IsStandard()
-            // policy here, but we still have to ensure that the block we
-            // create only contains transactions that are valid in new blocks.
-            CValidationState state;
-            PrecomputedTransactionData txdata(tx);
-            if (!ContextualCheckInputs(tx, state, view, true, MANDATORY_SCRIPT_VERIFY_FLAGS, true, txdata, Params().GetConsensus(), consensusBranchId))
-                continue;
-
-            UpdateCoins(tx, view, nHeight);
-
-            BOOST_FOREACH(const OutputDescription &outDescription, tx.vShieldedOutput) {
-                sapling_tree.append(outDescription.cm);
-            }
-
-            // Added
-            pblock->vtx.push_back(tx);
-            pblocktemplate->vTxFees.push_back(nTxFees);
-            pblocktemplate->vTxSigOps.push_back(nTxSigOps);
-            nBlockSize += nTxSize;
-            ++nBlockTx;
-            nBlockSigOps += nTxSigOps;
-            nFees += nTxFees;
-
-            if (fPrintPriority)
-            {
-                LogPrintf("priority %.1f fee %s txid %s\n",
-                    dPriority, feeRate.ToString(), tx.GetHash().ToString());
-            }
-
-            // Add transactions that depend on this one to the priority queue
-            if (mapDependers.count(hash))
-            {
-                BOOST_FOREACH(COrphan* porphan, mapDependers[hash])
-                {
-                    if (!porphan->setDependsOn.empty())
-                    {
-                        porphan->setDependsOn.erase(hash);
-                        if (porphan->setDependsOn.empty())
-                        {
-                            vecPriority.push_back(TxPriority(porphan->dPriority, porphan->feeRate, porphan->ptx));
-                            std::push_heap(vecPriority.begin(), vecPriority.end(), comparer);
-                        }
-                    }
-                }
-            }
-        }
+        uint64_t nBlockSize = selector.nBlockSize;
+        uint64_t nBlockTx = selector.nBlockTx;
+        nFees = selector.nFees;
 
         nLastBlockTx = nBlockTx;
         nLastBlockSize = nBlockSize;
@@ -433,6 +690,157 @@ CBlockTemplate* CreateNewBlockWithKey()
     return CreateNewBlock(*scriptPubKey);
 }
 
+//////////////////////////////////////////////////////////////////////////////
+//
+// Cached block template
+//
+
+CBlockTemplateCache blockTemplateCache;
+
+CBlockTemplateCache::CBlockTemplateCache() :
+    pindexPrev(NULL), nTransactionsUpdated(0), nBuildTime(0), nLastRequest(0), fChanged(false)
+{
+}
+
+bool CBlockTemplateCache::IsStale(const CBlockIndex* pindexTip, unsigned int nMempoolUpdated) const
+{
+    if (!pblocktemplate || pindexPrev != pindexTip)
+        return true;
+    return nMempoolUpdated != nTransactionsUpdated &&
+           GetTime() - nBuildTime > BLOCK_TEMPLATE_REFRESH_INTERVAL;
+}
+
+bool CBlockTemplateCache::Rebuild()
+{
+    AssertLockHeld(cs_main);
+
+    // Store the tip and mempool counter used before CreateNewBlockWithKey,
+    // to avoid races
+    unsigned int nTransactionsUpdatedNew = mempool.GetTransactionsUpdated();
+    const CBlockIndex* pindexPrevNew = chainActive.Tip();
+    int64_t nStart = GetTime();
+    int64_t nStartMicros = GetTimeMicros();
+
+#ifdef ENABLE_WALLET
+    CReserveKey reservekey(pwalletMain);
+    std::shared_ptr<CBlockTemplate> pblocktemplateNew(CreateNewBlockWithKey(reservekey));
+#else
+    std::shared_ptr<CBlockTemplate> pblocktemplateNew(CreateNewBlockWithKey());
+#endif
+    if (!pblocktemplateNew)
+        return false;
+    LogPrint("bench", "    - Block template: %.2fms (%u txs)\n",
+             (GetTimeMicros() - nStartMicros) * 0.001, pblocktemplateNew->block.vtx.size());
+
+    boost::unique_lock<boost::mutex> lock(cs);
+    pblocktemplate = pblocktemplateNew;
+    pindexPrev = pindexPrevNew;
+    nTransactionsUpdated = nTransactionsUpdatedNew;
+    nBuildTime = nStart;
+    return true;
+}
+
+std::shared_ptr<CBlockTemplate> CBlockTemplateCache::Get(const CBlockIndex*& pindexPrevOut, unsigned int& nTransactionsUpdatedOut)
+{
+    AssertLockHeld(cs_main);
+    // Read the mempool counter before taking cs; mempool.cs is held while
+    // the notifications below take it.
+    unsigned int nMempoolUpdated = mempool.GetTransactionsUpdated();
+    bool fStale;
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        nLastRequest = GetTime();
+        fStale = IsStale(chainActive.Tip(), nMempoolUpdated);
+    }
+    if (fStale) {
+        // Not built in the background yet: build it now, and make sure a
+        // failure doesn't leave the old template in place
+        Clear();
+        if (!Rebuild())
+            return std::shared_ptr<CBlockTemplate>();
+    }
+
+    boost::unique_lock<boost::mutex> lock(cs);
+    pindexPrevOut = pindexPrev;
+    nTransactionsUpdatedOut = nTransactionsUpdated;
+    return pblocktemplate;
+}
+
+void CBlockTemplateCache::Clear()
+{
+    boost::unique_lock<boost::mutex> lock(cs);
+    pblocktemplate.reset();
+    pindexPrev = NULL;
+}
+
+void CBlockTemplateCache::UpdatedBlockTip(const CBlockIndex *pindex, bool fInitialDownload)
+{
+    if (fInitialDownload)
+        return;
+    boost::unique_lock<boost::mutex> lock(cs);
+    fChanged = true;
+    condChanged.notify_all();
+}
+
+void CBlockTemplateCache::SyncTransaction(const CTransaction &tx, const CBlock *pblock)
+{
+    // Transactions in blocks are covered by UpdatedBlockTip
+    if (pblock)
+        return;
+    boost::unique_lock<boost::mutex> lock(cs);
+    fChanged = true;
+    condChanged.notify_all();
+}
+
+void CBlockTemplateCache::ThreadBuilder()
+{
+    while (true)
+    {
+        {
+            boost::unique_lock<boost::mutex> lock(cs);
+            while (!fChanged)
+                condChanged.timed_wait(lock, boost::get_system_time() + boost::posix_time::seconds(1));
+
+            // Nobody is mining against this node, don't spend time on it
+            if (GetTime() - nLastRequest > BLOCK_TEMPLATE_IDLE_TIMEOUT) {
+                fChanged = false;
+                continue;
+            }
+        }
+        boost::this_thread::interruption_point();
+
+        bool fPending = false;
+        {
+            LOCK(cs_main);
+            if (!IsInitialBlockDownload()) {
+                bool fStale;
+                unsigned int nMempoolUpdated = mempool.GetTransactionsUpdated();
+                {
+                    boost::unique_lock<boost::mutex> lock(cs);
+                    fStale = IsStale(chainActive.Tip(), nMempoolUpdated);
+                }
+                if (fStale && !Rebuild())
+                    LogPrintf("%s: failed to build block template\n", __func__);
+            }
+
+            // Mempool changes within the refresh interval are picked up on
+            // a later pass
+            unsigned int nMempoolUpdated = mempool.GetTransactionsUpdated();
+            boost::unique_lock<boost::mutex> lock(cs);
+            fPending = pblocktemplate && nMempoolUpdated != nTransactionsUpdated;
+            fChanged = fPending;
+        }
+        if (fPending)
+            MilliSleep(1000);
+    }
+}
+
+void ThreadBlockTemplateBuilder()
+{
+    RenameThread("pastel-template");
+    blockTemplateCache.ThreadBuilder();
+}
+
 //////////////////////////////////////////////////////////////////////////////
 //
 // Internal miner
@@ -7,8 +7,12 @@
 #define BITCOIN_MINER_H
 
 #include "primitives/block.h"
+#include "validationinterface.h"
 
 #include <boost/optional.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <memory>
 #include <stdint.h>
 
 class CBlockIndex;
@@ -49,4 +53,58 @@ void GenerateBitcoins(bool fGenerate, int nThreads);
 
 void UpdateTime(CBlockHeader* pblock, const Consensus::Params& consensusParams, const CBlockIndex* pindexPrev);
 
+/** Rebuild a template for the same tip after mempool changes at most this often (seconds) */
+static const int64_t BLOCK_TEMPLATE_REFRESH_INTERVAL = 5;
+/** Stop refreshing the template in the background if nobody asked for one for this long (seconds) */
+static const int64_t BLOCK_TEMPLATE_IDLE_TIMEOUT = 120;
+
+/**
+ * Block template kept ready for getblocktemplate.
+ *
+ * Once a client has asked for a template, it is rebuilt in the background
+ * as soon as the tip changes, and at most every
+ * BLOCK_TEMPLATE_REFRESH_INTERVAL seconds while mempool transactions are
+ * added or removed. Polling and long-polling clients then get the cached
+ * template instead of waiting on CreateNewBlock.
+ */
+class CBlockTemplateCache : public CValidationInterface
+{
+private:
+    mutable boost::mutex cs;
+    boost::condition_variable condChanged;
+
+    std::shared_ptr<CBlockTemplate> pblocktemplate;
+    const CBlockIndex* pindexPrev;        //! tip the template was built on
+    unsigned int nTransactionsUpdated;    //! mempool counter the template was built from
+    int64_t nBuildTime;                   //! time the template was built
+    int64_t nLastRequest;                 //! last time a client asked for a template
+    bool fChanged;                        //! tip or mempool changed since the last check
+
+    bool IsStale(const CBlockIndex* pindexTip, unsigned int nMempoolUpdated) const;
+    /** Build a new template for the current tip. Requires cs_main. */
+    bool Rebuild();
+
+protected:
+    void UpdatedBlockTip(const CBlockIndex *pindex, bool fInitialDownload);
+    void SyncTransaction(const CTransaction &tx, const CBlock *pblock);
+
+public:
+    CBlockTemplateCache();
+
+    /**
+     * Return a template for the current tip, building one first if the
+     * cached one is missing or stale. Requires cs_main.
+     */
+    std::shared_ptr<CBlockTemplate> Get(const CBlockIndex*& pindexPrevOut, unsigned int& nTransactionsUpdatedOut);
+    /** Drop the cached template */
+    void Clear();
+
+    /** Background builder loop; interrupted on shutdown */
+    void ThreadBuilder();
+};
+
+extern CBlockTemplateCache blockTemplateCache;
+
+void ThreadBlockTemplateBuilder();
+
 #endif // BITCOIN_MINER_H
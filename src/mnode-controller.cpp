@@ -476,6 +476,9 @@ void CMasterNodeController::ThreadMasterNodeMaintenance()
     {
         MilliSleep(1000);
 
+        // send what was queued for relay during the last second
+        masterNodeCtrl.masternodeRelay.Flush();
+
         // try to sync from all available nodes, one step at a time
         masterNodeCtrl.masternodeSync.ProcessTick();
 
@@ -497,6 +500,7 @@ void CMasterNodeController::ThreadMasterNodeMaintenance()
                 masterNodeCtrl.masternodePayments.CheckAndRemove();
                 masterNodeCtrl.masternodeGovernance.CheckAndRemove();
                 masterNodeCtrl.masternodeMessages.CheckAndRemove();
+                LogPrint("masternode", "CMasternodeRelay -- %s\n", masterNodeCtrl.masternodeRelay.ToString());
             }
             if(masterNodeCtrl.IsMasterNode() && (nTick % (60 * 5) == 0)) {
                 masterNodeCtrl.masternodeManager.DoFullVerificationStep();
@@ -19,6 +19,7 @@
 #include "mnode-validation.h"
 #include "mnode-governance.h"
 #include "mnode-messageproc.h"
+#include "mnode-relay.h"
 #include "mnode-notificationinterface.h"
 
 #ifdef ENABLE_WALLET
@@ -51,6 +52,8 @@ public:
     CMasternodeGovernance masternodeGovernance;
     // Keep track of the latest messages
     CMasternodeMessageProcessor masternodeMessages;
+    // Batch and deduplicate the relay of all of the above
+    CMasternodeRelay masternodeRelay;
 
     bool fMasterNode;
 
@@ -7,11 +7,19 @@
 
 #include <boost/filesystem.hpp>
 
+#include "chainparams.h"
 #include "clientversion.h"
+#include "hash.h"
+#include "streams.h"
+#include "util.h"
 
 /** 
 *   Generic Dumping and Loading
 *   ---------------------------
+*   Every dump rewrites the whole object and every load reads it back in full,
+*   there is no per-entry or incremental format. Files are streamed rather than
+*   buffered in memory, a load hashes the data while deserializing it and clears
+*   the object again if the checksum doesn't match.
 */
 
 template<typename T>
@@ -39,35 +47,66 @@ private:
 
         int64_t nStart = GetTimeMillis();
 
-        // serialize, checksum data up to that point, then append checksum
-        CDataStream ssObj(SER_DISK, CLIENT_VERSION);
-        ssObj << strMagicMessage; // specific magic message for this type of object
-        ssObj << FLATDATA(Params().MessageStart()); // network specific magic number
-        ssObj << objToSave;
-        uint256 hash = Hash(ssObj.begin(), ssObj.end());
-        ssObj << hash;
-
-        // open output file, and associate with CAutoFile
-        FILE *file = fopen(pathDB.string().c_str(), "wb");
+        // write to a temporary file first, so a failed dump leaves the old file alone
+        boost::filesystem::path pathTmp = pathDB;
+        pathTmp += ".new";
+        FILE *file = fopen(pathTmp.string().c_str(), "wb");
         CAutoFile fileout(file, SER_DISK, CLIENT_VERSION);
         if (fileout.IsNull())
-            return error("%s: Failed to open file %s", __func__, pathDB.string());
+            return error("%s: Failed to open file %s", __func__, pathTmp.string());
 
-        // Write and commit header, data
+        // serialize straight to the file, checksum data up to that point, then append checksum
         try {
-            fileout << ssObj;
+            CHashTeeWriter<CAutoFile> ssObj(&fileout);
+            ssObj << strMagicMessage; // specific magic message for this type of object
+            ssObj << FLATDATA(Params().MessageStart()); // network specific magic number
+            ssObj << objToSave;
+            fileout << ssObj.GetHash();
         }
         catch (std::exception &e) {
             return error("%s: Serialize or I/O error - %s", __func__, e.what());
         }
+        FileCommit(fileout.Get());
         fileout.fclose();
 
+        if (!RenameOver(pathTmp, pathDB))
+            return error("%s: Rename-into-place failed", __func__);
+
         LogPrintf("Written info to %s  %dms\n", strFilename, GetTimeMillis() - nStart);
         LogPrintf("     %s\n", objToSave.ToString());
 
         return true;
     }
 
+    /** Deserialize the file header (file specific magic message and network magic number) and verify it */
+    template<typename Stream>
+    ReadResult ReadHeader(Stream& s)
+    {
+        unsigned char pchMsgTmp[4];
+        std::string strMagicMessageTmp;
+
+        // de-serialize file header (file specific magic message) and ..
+        s >> strMagicMessageTmp;
+
+        // ... verify the message matches predefined one
+        if (strMagicMessage != strMagicMessageTmp)
+        {
+            error("%s: Invalid magic message", __func__);
+            return IncorrectMagicMessage;
+        }
+
+        // de-serialize file header (network specific magic number) and ..
+        s >> FLATDATA(pchMsgTmp);
+
+        // ... verify the network matches ours
+        if (memcmp(pchMsgTmp, Params().MessageStart(), sizeof(pchMsgTmp)))
+        {
+            error("%s: Invalid network magic number", __func__);
+            return IncorrectMagicNumber;
+        }
+        return Ok;
+    }
+
     ReadResult Read(T& objToLoad, bool fDryRun = false)
     {
         //LOCK(objToLoad.cs);
@@ -82,69 +121,38 @@ private:
             return FileError;
         }
 
-        // use file size to size memory buffer
-        int fileSize = boost::filesystem::file_size(pathDB);
-        int dataSize = fileSize - sizeof(uint256);
-        // Don't try to resize to a negative number if file is small
-        if (dataSize < 0)
-            dataSize = 0;
-        std::vector<unsigned char> vchData;
-        vchData.resize(dataSize);
-        uint256 hashIn;
-
-        // read data and checksum from file
+        // de-serialize straight from the file, hashing the data on the way, so it's
+        // only read once; the checksum that follows it is checked afterwards
+        CHashVerifier<CAutoFile> ssObj(&filein);
         try {
-            filein.read((char *)&vchData[0], dataSize);
-            filein >> hashIn;
+            ReadResult result = ReadHeader(ssObj);
+            if (result != Ok)
+                return result;
+
+            // de-serialize data into T object
+            ssObj >> objToLoad;
         }
         catch (std::exception &e) {
+            objToLoad.Clear();
             error("%s: Deserialize or I/O error - %s", __func__, e.what());
-            return HashReadError;
-        }
-        filein.fclose();
-
-        CDataStream ssObj(vchData, SER_DISK, CLIENT_VERSION);
-
-        // verify stored checksum matches input data
-        uint256 hashTmp = Hash(ssObj.begin(), ssObj.end());
-        if (hashIn != hashTmp)
-        {
-            error("%s: Checksum mismatch, data corrupted", __func__);
-            return IncorrectHash;
+            return IncorrectFormat;
         }
 
-
-        unsigned char pchMsgTmp[4];
-        std::string strMagicMessageTmp;
+        uint256 hashIn;
         try {
-            // de-serialize file header (file specific magic message) and ..
-            ssObj >> strMagicMessageTmp;
-
-            // ... verify the message matches predefined one
-            if (strMagicMessage != strMagicMessageTmp)
-            {
-                error("%s: Invalid magic message", __func__);
-                return IncorrectMagicMessage;
-            }
-
-
-            // de-serialize file header (network specific magic number) and ..
-            ssObj >> FLATDATA(pchMsgTmp);
-
-            // ... verify the network matches ours
-            if (memcmp(pchMsgTmp, Params().MessageStart(), sizeof(pchMsgTmp)))
-            {
-                error("%s: Invalid network magic number", __func__);
-                return IncorrectMagicNumber;
-            }
-
-            // de-serialize data into T object
-            ssObj >> objToLoad;
+            filein >> hashIn;
         }
         catch (std::exception &e) {
             objToLoad.Clear();
             error("%s: Deserialize or I/O error - %s", __func__, e.what());
-            return IncorrectFormat;
+            return HashReadError;
+        }
+        if (hashIn != ssObj.GetHash())
+        {
+            // don't keep anything from a corrupt file
+            objToLoad.Clear();
+            error("%s: Checksum mismatch, data corrupted", __func__);
+            return IncorrectHash;
         }
 
         LogPrintf("Loaded info from %s  %dms\n", strFilename, GetTimeMillis() - nStart);
@@ -158,6 +166,23 @@ private:
         return Ok;
     }
 
+    /** Check only the header of an existing file, so it's not overwritten if it isn't ours */
+    ReadResult VerifyHeader()
+    {
+        FILE *file = fopen(pathDB.string().c_str(), "rb");
+        CAutoFile filein(file, SER_DISK, CLIENT_VERSION);
+        if (filein.IsNull())
+            return FileError;
+
+        try {
+            return ReadHeader(filein);
+        }
+        catch (std::exception &e) {
+            error("%s: Deserialize or I/O error - %s", __func__, e.what());
+            return IncorrectFormat;
+        }
+    }
+
 
 public:
     CFlatDB(std::string strFilenameIn, std::string strMagicMessageIn)
@@ -194,8 +219,7 @@ public:
         int64_t nStart = GetTimeMillis();
 
         LogPrintf("Verifying %s format...\n", strFilename);
-        T tmpObjToLoad;
-        ReadResult readResult = Read(tmpObjToLoad, true);
+        ReadResult readResult = VerifyHeader();
 
         // there was an error and it was not an error on file opening => do not proceed
         if (readResult == FileError)
@@ -213,7 +237,8 @@ public:
         }
 
         LogPrintf("Writing info to %s...\n", strFilename);
-        Write(objToSave);
+        if (!Write(objToSave))
+            return false;
         LogPrintf("%s dump finished  %dms\n", strFilename, GetTimeMillis() - nStart);
 
         return true;
@@ -582,7 +582,7 @@ void CGovernanceTicket::Relay()
     LogPrintf("CGovernanceTicket::Relay -- Relaying ticket %s\n", GetHash().ToString());
 
     CInv inv(MSG_MASTERNODE_GOVERNANCE, GetHash());
-    CNodeHelper::RelayInv(inv);
+    masterNodeCtrl.masternodeRelay.RelayInv(inv);
 }
 
 bool CGovernanceVote::Sign()
@@ -658,5 +658,5 @@ void CGovernanceVote::Relay()
     LogPrintf("CGovernanceVote::Relay -- Relaying vote %s\n", ToString());
 
     CInv inv(MSG_MASTERNODE_GOVERNANCE_VOTE, GetHash());
-    CNodeHelper::RelayInv(inv);
+    masterNodeCtrl.masternodeRelay.RelayInv(inv);
 }
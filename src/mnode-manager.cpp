@@ -66,7 +66,9 @@ CMasternodeMan::CMasternodeMan()
   mMnbRecoveryRequests(),
   mMnbRecoveryGoodReplies(),
   listScheduledMnbRequestConnections(),
+  mapScoreCache(),
   nLastWatchdogVoteTime(0),
+  filterSeenMasternodePing(60),
   mapSeenMasternodeBroadcast(),
   mapSeenMasternodePing()
 {}
@@ -79,6 +81,7 @@ bool CMasternodeMan::Add(CMasternode &mn)
 
     LogPrint("masternode", "CMasternodeMan::Add -- Adding new Masternode: addr=%s, %i now\n", mn.addr.ToString(), size() + 1);
     mapMasternodes[mn.vin.prevout] = mn;
+    InvalidateScoreCache();
     return true;
 }
 
@@ -167,6 +170,7 @@ void CMasternodeMan::CheckAndRemove(bool bCheckAndRemove)
 
                 // and finally remove it from the list
                 mapMasternodes.erase(it++);
+                InvalidateScoreCache();
             } else {
                 bool fAsk = (nAskForMnbRecovery > 0) &&
                             masterNodeCtrl.masternodeSync.IsSynced() &&
@@ -287,14 +291,24 @@ void CMasternodeMan::CheckAndRemove(bool bCheckAndRemove)
 
         // NOTE: do not expire mapSeenMasternodeBroadcast entries here, clean them on mnb updates!
 
-        // remove expired mapSeenMasternodePing
-        std::map<uint256, CMasternodePing>::iterator it4 = mapSeenMasternodePing.begin();
-        while(it4 != mapSeenMasternodePing.end()){
+        // remove expired mapSeenMasternodePing, looking only at the pings that arrived long enough ago to be expired
+        int64_t nNow = GetTime();
+        if(filterSeenMasternodePing.size() != mapSeenMasternodePing.size()) {
+            // loaded from the cache
+            filterSeenMasternodePing.clear();
+            for (const auto& mnppair : mapSeenMasternodePing)
+                filterSeenMasternodePing.insert(mnppair.first, nNow);
+        }
+        for (const uint256& hash : filterSeenMasternodePing.Expire(nNow - masterNodeCtrl.MasternodeNewStartRequiredSeconds)) {
+            std::map<uint256, CMasternodePing>::iterator it4 = mapSeenMasternodePing.find(hash);
+            if(it4 == mapSeenMasternodePing.end())
+                continue;
             if((*it4).second.IsExpired()) {
-                LogPrint("masternode", "CMasternodeMan::CheckAndRemove -- Removing expired Masternode ping: hash=%s\n", (*it4).second.GetHash().ToString());
-                mapSeenMasternodePing.erase(it4++);
+                LogPrint("masternode", "CMasternodeMan::CheckAndRemove -- Removing expired Masternode ping: hash=%s\n", hash.ToString());
+                mapSeenMasternodePing.erase(it4);
             } else {
-                ++it4;
+                // signed ahead of our clock, look again later
+                filterSeenMasternodePing.insert(hash, nNow);
             }
         }
 
@@ -317,14 +331,23 @@ void CMasternodeMan::Clear()
 {
     LOCK(cs);
     mapMasternodes.clear();
+    InvalidateScoreCache();
     mAskedUsForMasternodeList.clear();
     mWeAskedForMasternodeList.clear();
     mWeAskedForMasternodeListEntry.clear();
     mapSeenMasternodeBroadcast.clear();
     mapSeenMasternodePing.clear();
+    filterSeenMasternodePing.clear();
     nLastWatchdogVoteTime = 0;
 }
 
+void CMasternodeMan::AddSeenMasternodePing(const CMasternodePing& mnp)
+{
+    uint256 hash = mnp.GetHash();
+    if(mapSeenMasternodePing.insert(std::make_pair(hash, mnp)).second)
+        filterSeenMasternodePing.insert(hash, GetTime());
+}
+
 int CMasternodeMan::CountMasternodes(int nProtocolVersion)
 {
     LOCK(cs);
@@ -453,6 +476,16 @@ bool CMasternodeMan::Has(const COutPoint& outpoint)
     return mapMasternodes.find(outpoint) != mapMasternodes.end();
 }
 
+bool CMasternodeMan::HasAddr(const CNetAddr& addr)
+{
+    LOCK(cs);
+    for (const auto& mnpair : mapMasternodes) {
+        if ((const CNetAddr&)mnpair.second.addr == addr)
+            return true;
+    }
+    return false;
+}
+
 //
 // Deterministically select the oldest/best masternode to pay on the network
 //
@@ -522,8 +555,15 @@ bool CMasternodeMan::GetNextMasternodeInQueueForPayment(int nBlockHeight, bool f
     int nCountTenth = 0;
     arith_uint256 nHighest = 0;
     CMasternode *pBestMasternode = NULL;
+    const score_cache_t* pScores = GetMasternodeScores(blockHash);
     BOOST_FOREACH (PAIRTYPE(int, CMasternode*)& s, vecMasternodeLastPaid){
-        arith_uint256 nScore = s.second->CalculateScore(blockHash);
+        arith_uint256 nScore;
+        std::map<COutPoint, int>::const_iterator itRank;
+        if (pScores && (itRank = pScores->mapRanks.find(s.second->vin.prevout)) != pScores->mapRanks.end()) {
+            nScore = pScores->vecScores[itRank->second - 1].first;
+        } else {
+            nScore = s.second->CalculateScore(blockHash);
+        }
         if(nScore > nHighest){
             nHighest = nScore;
             pBestMasternode = s.second;
@@ -580,27 +620,47 @@ masternode_info_t CMasternodeMan::FindRandomNotInVec(const std::vector<COutPoint
     return masternode_info_t();
 }
 
-bool CMasternodeMan::GetMasternodeScores(const uint256& nBlockHash, CMasternodeMan::score_pair_vec_t& vecMasternodeScoresRet, int nMinProtocol)
+const CMasternodeMan::score_cache_t* CMasternodeMan::GetMasternodeScores(const uint256& nBlockHash, int nMinProtocol)
 {
-    vecMasternodeScoresRet.clear();
-
     if (!masterNodeCtrl.masternodeSync.IsMasternodeListSynced())
-        return false;
+        return NULL;
 
     AssertLockHeld(cs);
 
     if (mapMasternodes.empty())
-        return false;
+        return NULL;
+
+    const std::pair<uint256, int> key = std::make_pair(nBlockHash, nMinProtocol);
+    std::map<std::pair<uint256, int>, score_cache_t>::const_iterator itCache = mapScoreCache.find(key);
+    if (itCache != mapScoreCache.end())
+        return itCache->second.vecScores.empty() ? NULL : &itCache->second;
+
+    // rank lookups only ever ask for a handful of recent blocks, so the cache is simply restarted when full
+    if (mapScoreCache.size() >= MAX_SCORE_CACHE_ENTRIES)
+        mapScoreCache.clear();
+
+    score_cache_t& cache = mapScoreCache[key];
 
     // calculate scores
     for (auto& mnpair : mapMasternodes) {
         if (mnpair.second.nProtocolVersion >= nMinProtocol) {
-            vecMasternodeScoresRet.push_back(std::make_pair(mnpair.second.CalculateScore(nBlockHash), &mnpair.second));
+            cache.vecScores.push_back(std::make_pair(mnpair.second.CalculateScore(nBlockHash), &mnpair.second));
         }
     }
 
-    sort(vecMasternodeScoresRet.rbegin(), vecMasternodeScoresRet.rend(), CompareScoreMN());
-    return !vecMasternodeScoresRet.empty();
+    sort(cache.vecScores.rbegin(), cache.vecScores.rend(), CompareScoreMN());
+
+    int nRank = 0;
+    for (auto& scorePair : cache.vecScores) {
+        cache.mapRanks.insert(std::make_pair(scorePair.second->vin.prevout, ++nRank));
+    }
+    return cache.vecScores.empty() ? NULL : &cache;
+}
+
+void CMasternodeMan::InvalidateScoreCache()
+{
+    AssertLockHeld(cs);
+    mapScoreCache.clear();
 }
 
 bool CMasternodeMan::GetMasternodeRank(const COutPoint& outpoint, int& nRankRet, int nBlockHeight, int nMinProtocol)
@@ -619,20 +679,16 @@ bool CMasternodeMan::GetMasternodeRank(const COutPoint& outpoint, int& nRankRet,
 
     LOCK(cs);
 
-    score_pair_vec_t vecMasternodeScores;
-    if (!GetMasternodeScores(nBlockHash, vecMasternodeScores, nMinProtocol))
+    const score_cache_t* pScores = GetMasternodeScores(nBlockHash, nMinProtocol);
+    if (!pScores)
         return false;
 
-    int nRank = 0;
-    for (auto& scorePair : vecMasternodeScores) {
-        nRank++;
-        if(scorePair.second->vin.prevout == outpoint) {
-            nRankRet = nRank;
-            return true;
-        }
-    }
+    std::map<COutPoint, int>::const_iterator it = pScores->mapRanks.find(outpoint);
+    if (it == pScores->mapRanks.end())
+        return false;
 
-    return false;
+    nRankRet = it->second;
+    return true;
 }
 
 bool CMasternodeMan::GetMasternodeRanks(CMasternodeMan::rank_pair_vec_t& vecMasternodeRanksRet, int nBlockHeight, int nMinProtocol)
@@ -651,12 +707,13 @@ bool CMasternodeMan::GetMasternodeRanks(CMasternodeMan::rank_pair_vec_t& vecMast
 
     LOCK(cs);
 
-    score_pair_vec_t vecMasternodeScores;
-    if (!GetMasternodeScores(nBlockHash, vecMasternodeScores, nMinProtocol))
+    const score_cache_t* pScores = GetMasternodeScores(nBlockHash, nMinProtocol);
+    if (!pScores)
         return false;
 
+    vecMasternodeRanksRet.reserve(pScores->vecScores.size());
     int nRank = 0;
-    for (auto& scorePair : vecMasternodeScores) {
+    for (auto& scorePair : pScores->vecScores) {
         nRank++;
         vecMasternodeRanksRet.push_back(std::make_pair(nRank, *scorePair.second));
     }
@@ -745,7 +802,7 @@ void CMasternodeMan::ProcessMessage(CNode* pfrom, std::string& strCommand, CData
         LOCK2(cs_main, cs);
 
         if(mapSeenMasternodePing.count(nHash)) return; //seen
-        mapSeenMasternodePing.insert(std::make_pair(nHash, mnp));
+        AddSeenMasternodePing(mnp);
 
         LogPrint("masternode", "MNPING -- Masternode ping, masternode=%s new\n", mnp.vin.prevout.ToStringShort());
 
@@ -818,7 +875,7 @@ void CMasternodeMan::ProcessMessage(CNode* pfrom, std::string& strCommand, CData
             nInvCount++;
 
             mapSeenMasternodeBroadcast.insert(std::make_pair(hashMNB, std::make_pair(GetTime(), mnb)));
-            mapSeenMasternodePing.insert(std::make_pair(hashMNP, mnp));
+            AddSeenMasternodePing(mnp);
 
             if (vin.prevout == mnpair.first) {
                 LogPrintf("DSEG -- Sent 1 Masternode inv to peer %d\n", pfrom->id);
@@ -1281,7 +1338,8 @@ std::string CMasternodeMan::ToString() const
     info << "Masternodes: " << (int)mapMasternodes.size() <<
             ", peers who asked us for Masternode list: " << (int)mAskedUsForMasternodeList.size() <<
             ", peers we asked for Masternode list: " << (int)mWeAskedForMasternodeList.size() <<
-            ", entries in Masternode list we asked for: " << (int)mWeAskedForMasternodeListEntry.size();
+            ", entries in Masternode list we asked for: " << (int)mWeAskedForMasternodeListEntry.size() <<
+            ", seen pings: " << (int)mapSeenMasternodePing.size();
 
     return info.str();
 }
@@ -1289,7 +1347,7 @@ std::string CMasternodeMan::ToString() const
 void CMasternodeMan::UpdateMasternodeList(CMasternodeBroadcast mnb)
 {
     LOCK2(cs_main, cs);
-    mapSeenMasternodePing.insert(std::make_pair(mnb.lastPing.GetHash(), mnb.lastPing));
+    AddSeenMasternodePing(mnb.lastPing);
     mapSeenMasternodeBroadcast.insert(std::make_pair(mnb.GetHash(), std::make_pair(GetTime(), mnb)));
 
     LogPrintf("CMasternodeMan::UpdateMasternodeList -- masternode=%s  addr=%s\n", mnb.vin.prevout.ToStringShort(), mnb.addr.ToString());
@@ -1302,6 +1360,7 @@ void CMasternodeMan::UpdateMasternodeList(CMasternodeBroadcast mnb)
     } else {
         CMasternodeBroadcast mnbOld = mapSeenMasternodeBroadcast[CMasternodeBroadcast(*pmn).GetHash()].second;
         if(pmn->UpdateFromNewBroadcast(mnb)) {
+            InvalidateScoreCache();
             masterNodeCtrl.masternodeSync.BumpAssetLastTime("CMasternodeMan::UpdateMasternodeList - seen");
             mapSeenMasternodeBroadcast.erase(mnbOld.GetHash());
         }
@@ -1363,6 +1422,8 @@ bool CMasternodeMan::CheckMnbAndUpdateMasternodeList(CNode* pfrom, CMasternodeBr
         CMasternode* pmn = Find(mnb.vin.prevout);
         if(pmn) {
             CMasternodeBroadcast mnbOld = mapSeenMasternodeBroadcast[CMasternodeBroadcast(*pmn).GetHash()].second;
+            // protocol version of the entry may change
+            InvalidateScoreCache();
             if(!mnb.Update(pmn, nDos)) {
                 LogPrint("masternode", "CMasternodeMan::CheckMnbAndUpdateMasternodeList -- Update() failed, masternode=%s\n", mnb.vin.prevout.ToStringShort());
                 return false;
@@ -1466,7 +1527,7 @@ void CMasternodeMan::SetMasternodeLastPing(const COutPoint& outpoint, const CMas
         return;
     }
     pmn->lastPing = mnp;
-    mapSeenMasternodePing.insert(std::make_pair(mnp.GetHash(), mnp));
+    AddSeenMasternodePing(mnp);
 
     CMasternodeBroadcast mnb(*pmn);
     uint256 hash = mnb.GetHash();
@@ -1477,6 +1538,10 @@ void CMasternodeMan::SetMasternodeLastPing(const COutPoint& outpoint, const CMas
 
 void CMasternodeMan::UpdatedBlockTip(const CBlockIndex *pindex)
 {
+    {
+        LOCK(cs);
+        InvalidateScoreCache();
+    }
     nCachedBlockHeight = pindex->nHeight;
     LogPrint("masternode", "CMasternodeMan::UpdatedBlockTip -- nCachedBlockHeight=%d\n", nCachedBlockHeight);
 
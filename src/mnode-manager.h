@@ -16,6 +16,7 @@
 #include "sync.h"
 
 #include "mnode-masternode.h"
+#include "mnode-relay.h"
 
 using namespace std;
 
@@ -27,6 +28,13 @@ public:
     typedef std::pair<int, CMasternode> rank_pair_t;
     typedef std::vector<rank_pair_t> rank_pair_vec_t;
 
+    // Masternodes sorted by score for one block hash, with their 1-based ranks
+    struct score_cache_t
+    {
+        score_pair_vec_t vecScores;
+        std::map<COutPoint, int> mapRanks;
+    };
+
 private:
     static const std::string SERIALIZATION_VERSION_STRING;
 
@@ -45,6 +53,8 @@ private:
     static const int MNB_RECOVERY_WAIT_SECONDS      = 60;
     static const int MNB_RECOVERY_RETRY_SECONDS     = 3 * 60 * 60;
 
+    static const size_t MAX_SCORE_CACHE_ENTRIES     = 64;
+
 
     // critical section to protect the inner data structures
     mutable CCriticalSection cs;
@@ -68,13 +78,22 @@ private:
     std::map<uint256, std::vector<CMasternodeBroadcast> > mMnbRecoveryGoodReplies;
     std::list< std::pair<CService, uint256> > listScheduledMnbRequestConnections;
 
+    // scores and ranks keyed by block hash and minimal protocol version,
+    // cleared whenever the list changes or the tip moves
+    std::map<std::pair<uint256, int>, score_cache_t> mapScoreCache;
+
     int64_t nLastWatchdogVoteTime;
 
+    // mapSeenMasternodePing hashes by arrival time, so only old enough pings are checked for expiry
+    CRollingHashFilter filterSeenMasternodePing;
+
     friend class CMasternodeSync;
     /// Find an entry
     CMasternode* Find(const COutPoint& outpoint);
 
-    bool GetMasternodeScores(const uint256& nBlockHash, score_pair_vec_t& vecMasternodeScoresRet, int nMinProtocol = 0);
+    /// Get masternode scores and ranks for the block hash, calculating them only on the first call
+    const score_cache_t* GetMasternodeScores(const uint256& nBlockHash, int nMinProtocol = 0);
+    void InvalidateScoreCache();
 
 public:
     // Keep track of all broadcasts I've seen
@@ -109,8 +128,11 @@ public:
 
         READWRITE(mapSeenMasternodeBroadcast);
         READWRITE(mapSeenMasternodePing);
-        if(ser_action.ForRead() && (strVersion != SERIALIZATION_VERSION_STRING)) {
-            Clear();
+        if(ser_action.ForRead()) {
+            InvalidateScoreCache();
+            if(strVersion != SERIALIZATION_VERSION_STRING) {
+                Clear();
+            }
         }
     }
 
@@ -134,6 +156,9 @@ public:
     /// Clear Masternode vector
     void Clear();
 
+    /// Remember a ping as seen, use instead of inserting into mapSeenMasternodePing
+    void AddSeenMasternodePing(const CMasternodePing& mnp);
+
     /// Count Masternodes filtered by nProtocolVersion.
     /// Masternode nProtocolVersion should match or be above the one specified in param here.
     int CountMasternodes(int nProtocolVersion = -1);
@@ -149,6 +174,8 @@ public:
     /// Versions of Find that are safe to use from outside the class
     bool Get(const COutPoint& outpoint, CMasternode& masternodeRet);
     bool Has(const COutPoint& outpoint);
+    /// Whether a masternode in the list runs on IP address addr, any port
+    bool HasAddr(const CNetAddr& addr);
 
     bool GetMasternodeInfo(const COutPoint& outpoint, masternode_info_t& mnInfoRet);
     bool GetMasternodeInfo(const CPubKey& pubKeyMasternode, masternode_info_t& mnInfoRet);
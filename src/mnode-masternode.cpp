@@ -85,7 +85,7 @@ bool CMasternode::UpdateFromNewBroadcast(CMasternodeBroadcast& mnb)
     int nDos = 0;
     if(mnb.lastPing == CMasternodePing() || (mnb.lastPing != CMasternodePing() && mnb.lastPing.CheckAndUpdate(this, true, nDos))) {
         lastPing = mnb.lastPing;
-        masterNodeCtrl.masternodeManager.mapSeenMasternodePing.insert(std::make_pair(lastPing.GetHash(), lastPing));
+        masterNodeCtrl.masternodeManager.AddSeenMasternodePing(lastPing);
     }
     // if it matches our Masternode privkey...
     if(masterNodeCtrl.IsMasterNode() && pubKeyMasternode == masterNodeCtrl.activeMasternode.pubKeyMasternode) {
@@ -724,7 +724,7 @@ void CMasternodeBroadcast::Relay()
     }
 
     CInv inv(MSG_MASTERNODE_ANNOUNCE, GetHash());
-    CNodeHelper::RelayInv(inv);
+    masterNodeCtrl.masternodeRelay.RelayInv(inv);
 }
 
 CMasternodePing::CMasternodePing(const COutPoint& outpoint)
@@ -894,7 +894,7 @@ void CMasternodePing::Relay()
     }
 
     CInv inv(MSG_MASTERNODE_PING, GetHash());
-    CNodeHelper::RelayInv(inv);
+    masterNodeCtrl.masternodeRelay.RelayInv(inv);
 }
 
 void CMasternode::UpdateWatchdogVoteTime(uint64_t nVoteTime)
@@ -906,5 +906,5 @@ void CMasternode::UpdateWatchdogVoteTime(uint64_t nVoteTime)
 void CMasternodeVerification::Relay() const
 {
     CInv inv(MSG_MASTERNODE_VERIFY, GetHash());
-    CNodeHelper::RelayInv(inv);
+    masterNodeCtrl.masternodeRelay.RelayInv(inv);
 }
@@ -76,7 +76,7 @@ void CMasternodeMessage::Relay()
     LogPrintf("CMasternodeMessage::Relay -- Relaying {item} %s\n", GetHash().ToString());
 
     CInv inv(MSG_MASTERNODE_MESSAGE, GetHash());
-    CNodeHelper::RelayInv(inv);
+    masterNodeCtrl.masternodeRelay.RelayInv(inv);
 }
 
 std::string CMasternodeMessage::ToString() const
@@ -119,6 +119,7 @@ void CMasternodeMessageProcessor::ProcessMessage(CNode* pfrom, std::string& strC
             }
 
             mapSeenMessages[messageId] = message;
+            filterSeenMessages.insert(messageId, GetTime());
             mapSeenMessages[messageId].MarkAsNotVerified(); // this removes signature in the message inside map, so we can skip this message from new syncs and as "seen"
                                                             // but if message is correct it will replace the one inside the map
         }
@@ -178,21 +179,24 @@ void CMasternodeMessageProcessor::CheckAndRemove()
 
     LOCK(cs_mapSeenMessages);
 
-    for (auto& mnpair : mapSeenMessages) {
-
-        CMasternodeMessage& item = mnpair.second;
-
-        //remove old (1 day old?) stuff from Seen map - mapSeenMessages
-
-        // if () {
-        //     //process...
-        //     ++it;
-        // } else if() {
-        //     //remove...
-        //     mapWorkersTriads.erase(it++);
-        // } else {
-        //     ++it;
-        // }
+    // remove messages signed more than a day ago, looking only at the ones that arrived that long ago
+    int64_t nNow = GetTime();
+    if (filterSeenMessages.size() != mapSeenMessages.size()) {
+        // loaded from the cache
+        filterSeenMessages.clear();
+        for (const auto& mnpair : mapSeenMessages)
+            filterSeenMessages.insert(mnpair.first, nNow);
+    }
+    for (const uint256& hash : filterSeenMessages.Expire(nNow - SEEN_MESSAGES_EXPIRE_SECONDS)) {
+        auto it = mapSeenMessages.find(hash);
+        if (it == mapSeenMessages.end())
+            continue;
+        if (GetAdjustedTime() - it->second.sigTime > SEEN_MESSAGES_EXPIRE_SECONDS) {
+            mapSeenMessages.erase(it);
+        } else {
+            // signed ahead of our clock, look again later
+            filterSeenMessages.insert(hash, nNow);
+        }
     }
     LogPrintf("CMasternodeMessageProcessor::CheckAndRemove -- %s\n", ToString());
 }
@@ -201,6 +205,7 @@ void CMasternodeMessageProcessor::Clear()
 {
     LOCK2(cs_mapSeenMessages, cs_mapOurMessages);
     mapSeenMessages.clear();
+    filterSeenMessages.clear();
     mapOurMessages.clear();
 }
 
@@ -8,6 +8,7 @@
 
 
 #include "main.h"
+#include "mnode-relay.h"
 #include <map>
 
 extern CCriticalSection cs_mapSeenMessages;
@@ -63,7 +64,14 @@ public:
 };
 
 class CMasternodeMessageProcessor {
+private:
+    // mapSeenMessages hashes by arrival time, so only old enough messages are checked for expiry
+    CRollingHashFilter filterSeenMessages;
+
 public:
+    // Seen messages are forgotten a day after they were signed
+    static const int64_t SEEN_MESSAGES_EXPIRE_SECONDS = 24 * 60 * 60;
+
     std::map<uint256, CMasternodeMessage> mapSeenMessages;
     std::map<uint256, CMasternodeMessage> mapOurMessages;
 
@@ -71,7 +79,7 @@ public:
 //    std::map<uint256, > mapLatestSenders;
 //    std::map<CNetAddr, int64_t> mapLatestSenders; how many time during last hour(?) or time ago
 
-    CMasternodeMessageProcessor() = default;
+    CMasternodeMessageProcessor() : filterSeenMessages(60 * 60) {}
 
     ADD_SERIALIZE_METHODS;
 
@@ -677,7 +677,7 @@ void CMasternodePaymentVote::Relay()
     }
 
     CInv inv(MSG_MASTERNODE_PAYMENT_VOTE, GetHash());
-    CNodeHelper::RelayInv(inv);
+    masterNodeCtrl.masternodeRelay.RelayInv(inv);
 }
 
 bool CMasternodePaymentVote::CheckSignature(const CPubKey& pubKeyMasternode, int nValidationHeight, int &nDos)
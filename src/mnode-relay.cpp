@@ -0,0 +1,140 @@
+// Copyright (c) 2018 The Pastel developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "mnode-relay.h"
+
+#include "hash.h"
+#include "net.h"
+#include "nodehelper.h"
+#include "random.h"
+#include "util.h"
+#include "utiltime.h"
+
+#include <limits>
+#include <sstream>
+
+size_t CRollingHashFilter::CSaltedHasher::operator()(const uint256& hash) const
+{
+    return SipHashUint256(k0, k1, hash);
+}
+
+CRollingHashFilter::CRollingHashFilter(int64_t nBucketSecondsIn) :
+    nBucketSeconds(nBucketSecondsIn > 0 ? nBucketSecondsIn : 1), fSalted(false), nSize(0)
+{
+    // salted on first use, the owner may be a global constructed before the randomizer is ready
+    hasher.k0 = hasher.k1 = 0;
+}
+
+bool CRollingHashFilter::insert(const uint256& hash, int64_t nTime)
+{
+    if (contains(hash))
+        return false;
+
+    if (!fSalted) {
+        hasher.k0 = GetRand(std::numeric_limits<uint64_t>::max());
+        hasher.k1 = GetRand(std::numeric_limits<uint64_t>::max());
+        fSalted = true;
+    }
+    // a clock going backwards adds to the newest bucket
+    if (dqBuckets.empty() || nTime >= dqBuckets.back().first + nBucketSeconds)
+        dqBuckets.push_back(std::make_pair(nTime - nTime % nBucketSeconds, hashset_t(0, hasher)));
+    dqBuckets.back().second.insert(hash);
+    nSize++;
+    return true;
+}
+
+bool CRollingHashFilter::contains(const uint256& hash) const
+{
+    for (std::deque<std::pair<int64_t, hashset_t> >::const_reverse_iterator it = dqBuckets.rbegin(); it != dqBuckets.rend(); ++it) {
+        if (it->second.count(hash))
+            return true;
+    }
+    return false;
+}
+
+std::vector<uint256> CRollingHashFilter::Expire(int64_t nTime)
+{
+    std::vector<uint256> vExpired;
+    while (!dqBuckets.empty() && dqBuckets.front().first + nBucketSeconds <= nTime) {
+        const hashset_t& bucket = dqBuckets.front().second;
+        vExpired.insert(vExpired.end(), bucket.begin(), bucket.end());
+        nSize -= bucket.size();
+        dqBuckets.pop_front();
+    }
+    return vExpired;
+}
+
+void CRollingHashFilter::clear()
+{
+    dqBuckets.clear();
+    nSize = 0;
+}
+
+CMasternodeRelay::CMasternodeRelay() :
+    filterRelayed(60),
+    nQueued(0), nDuplicates(0), nBatches(0), nPushed(0)
+{
+}
+
+void CMasternodeRelay::RelayInv(const CInv& inv, const int minProtoVersion)
+{
+    LOCK(cs);
+    if (!filterRelayed.insert(inv.hash, GetTime())) {
+        nDuplicates++;
+        LogPrint("masternode", "CMasternodeRelay::RelayInv -- %s relayed recently, skipping\n", inv.ToString());
+        return;
+    }
+    vPending.push_back(std::make_pair(inv, minProtoVersion));
+    nQueued++;
+}
+
+void CMasternodeRelay::Flush()
+{
+    std::vector<std::pair<CInv, int> > vToSend;
+    {
+        LOCK(cs);
+        filterRelayed.Expire(GetTime() - RELAY_FILTER_SECONDS);
+        vToSend.swap(vPending);
+    }
+    if (vToSend.empty())
+        return;
+
+    uint64_t nPushedNow = 0;
+    CNodeHelper::ForEachNode([&](CNode* pnode) {
+        for (const auto& item : vToSend) {
+            if (pnode->nVersion >= item.second) {
+                pnode->PushInventory(item.first);
+                nPushedNow++;
+            }
+        }
+    });
+
+    LOCK(cs);
+    nBatches++;
+    nPushed += nPushedNow;
+}
+
+CMasternodeRelay::CStats CMasternodeRelay::GetStats() const
+{
+    LOCK(cs);
+    CStats stats;
+    stats.nQueued = nQueued;
+    stats.nDuplicates = nDuplicates;
+    stats.nBatches = nBatches;
+    stats.nPushed = nPushed;
+    stats.nPending = vPending.size();
+    stats.nFiltered = filterRelayed.size();
+    return stats;
+}
+
+std::string CMasternodeRelay::ToString() const
+{
+    CStats stats = GetStats();
+    std::ostringstream info;
+    info << "Relayed invs: " << stats.nQueued <<
+            ", duplicates: " << stats.nDuplicates <<
+            ", batches: " << stats.nBatches <<
+            ", pushed to peers: " << stats.nPushed;
+    return info.str();
+}
@@ -0,0 +1,97 @@
+// Copyright (c) 2018 The Pastel developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef MASTERNODERELAY_H
+#define MASTERNODERELAY_H
+
+#include "protocol.h"
+#include "sync.h"
+#include "uint256.h"
+#include "version.h"
+
+#include <deque>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+/**
+ * Set of hashes that forgets them by age without scanning. Every hash goes
+ * to the bucket of the time it was inserted, and whole buckets are dropped
+ * once they are older than the caller's window, handing their hashes back so
+ * the caller can prune the maps it keeps alongside.
+ *
+ * Not thread safe, the owner's lock protects it.
+ */
+class CRollingHashFilter
+{
+private:
+    struct CSaltedHasher
+    {
+        uint64_t k0, k1;
+        size_t operator()(const uint256& hash) const;
+    };
+    typedef std::unordered_set<uint256, CSaltedHasher> hashset_t;
+
+    const int64_t nBucketSeconds;
+    //! Buckets by the start of their time range, newest at the back
+    std::deque<std::pair<int64_t, hashset_t> > dqBuckets;
+    CSaltedHasher hasher;
+    bool fSalted;
+    size_t nSize;
+
+public:
+    explicit CRollingHashFilter(int64_t nBucketSecondsIn);
+
+    /** Add hash at nTime, returns false if it's already in the set */
+    bool insert(const uint256& hash, int64_t nTime);
+    bool contains(const uint256& hash) const;
+    /** Drop the buckets that ended before nTime and return their hashes */
+    std::vector<uint256> Expire(int64_t nTime);
+    void clear();
+    size_t size() const { return nSize; }
+};
+
+/**
+ * Relays masternode inventory in batches. Objects queue their inv here
+ * instead of walking all peers themselves, and the maintenance thread hands
+ * everything queued during the last tick to each peer in one pass. An inv
+ * that was relayed within the last RELAY_FILTER_SECONDS is dropped.
+ */
+class CMasternodeRelay
+{
+private:
+    mutable CCriticalSection cs;
+    //! Invs queued since the last flush, with the minimum protocol version of the peers to get them
+    std::vector<std::pair<CInv, int> > vPending;
+    CRollingHashFilter filterRelayed;
+
+    uint64_t nQueued;
+    uint64_t nDuplicates;
+    uint64_t nBatches;
+    uint64_t nPushed;
+
+public:
+    static const int64_t RELAY_FILTER_SECONDS = 10 * 60;
+
+    struct CStats
+    {
+        uint64_t nQueued;     //!< invs queued for relay
+        uint64_t nDuplicates; //!< invs dropped as relayed recently
+        uint64_t nBatches;    //!< flushes that had something to send
+        uint64_t nPushed;     //!< invs handed to peers, summed over peers
+        size_t nPending;
+        size_t nFiltered;
+    };
+
+    CMasternodeRelay();
+
+    void RelayInv(const CInv& inv, const int minProtoVersion = MIN_PEER_PROTO_VERSION);
+    /** Push the queued invs to all fully connected peers, called every tick */
+    void Flush();
+
+    CStats GetStats() const;
+    std::string ToString() const;
+};
+
+#endif
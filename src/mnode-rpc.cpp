@@ -226,7 +226,7 @@ UniValue masternode(const UniValue& params, bool fHelp)
          strCommand != "list" && strCommand != "list-conf" && strCommand != "count" &&
          strCommand != "debug" && strCommand != "current" && strCommand != "winner" && strCommand != "winners" && strCommand != "genkey" &&
          strCommand != "connect" && strCommand != "status" && strCommand != "workers" &&
-         strCommand != "setfee" && strCommand != "getnetworkfee" && strCommand != "getlocalfee" && strCommand != "pastelid" ))
+         strCommand != "setfee" && strCommand != "getnetworkfee" && strCommand != "getlocalfee" && strCommand != "pastelid" && strCommand != "relay" ))
             throw std::runtime_error(
                 "masternode \"command\"...\n"
                 "Set of commands to execute masternode related actions\n"
@@ -250,6 +250,7 @@ UniValue masternode(const UniValue& params, bool fHelp)
                 "  setfee <n>   - Set storage fee for MN.\n"
                 "  getnetworkfee - Get Network median storage fee.\n"
                 "  getlocalfee - Get local masternode storage fee.\n"
+                "  relay        - Print masternode inventory relay counters\n"
                 "  pastelid     - Generate new PastelID"
                 );
 
@@ -610,6 +611,20 @@ UniValue masternode(const UniValue& params, bool fHelp)
         mnObj.push_back(Pair("networkfee", nFee));
         return mnObj;
     }
+    if (strCommand == "relay")
+    {
+        CMasternodeRelay::CStats stats = masterNodeCtrl.masternodeRelay.GetStats();
+
+        UniValue relayObj(UniValue::VOBJ);
+        relayObj.push_back(Pair("queued", (uint64_t)stats.nQueued));
+        relayObj.push_back(Pair("duplicates", (uint64_t)stats.nDuplicates));
+        relayObj.push_back(Pair("batches", (uint64_t)stats.nBatches));
+        relayObj.push_back(Pair("pushed", (uint64_t)stats.nPushed));
+        relayObj.push_back(Pair("pending", (uint64_t)stats.nPending));
+        relayObj.push_back(Pair("recent", (uint64_t)stats.nFiltered));
+        return relayObj;
+    }
+
     if (strCommand == "getlocalfee")
     {
         if (!masterNodeCtrl.IsActiveMasterNode()) {
@@ -1060,7 +1075,8 @@ UniValue pastelid(const UniValue& params, bool fHelp) {
         strMode = params[0].get_str();
 
     if (fHelp || (strMode != "newkey" && strMode != "importkey" && strMode != "list" &&
-                  strMode != "sign" && strMode != "verify" ))
+                  strMode != "sign" && strMode != "signmany" && strMode != "verify" && strMode != "verifymany" &&
+                  strMode != "unlock" && strMode != "lock" ))
         throw runtime_error(
                 "pastelid \"command\"...\n"
                 "Set of commands to deal with PatelID and related actions\n"
@@ -1074,9 +1090,17 @@ UniValue pastelid(const UniValue& params, bool fHelp) {
                 "                                                  \"passphrase\" (optional) to decrypt the key for the purpose of validating and returning PastelID\n"
                 "                                                  NOTE: without \"passphrase\" key cannot be validated and if key is bad (not EdDSA448) call to \"sign\" will fail\n"
                 "  list                                        - List all internally stored PastelID and keys.\n"
-                "  sign \"text\" \"PastelID\" \"passphrase\"   - Sign \"text\" with the internally stored private key associated with the PastelID.\n"
+                "  sign \"text\" \"PastelID\" <\"passphrase\"> - Sign \"text\" with the internally stored private key associated with the PastelID.\n"
+                "                                                  \"passphrase\" can be omitted while the PastelID is unlocked\n"
+                "  signmany [\"text\",...] \"PastelID\" <\"passphrase\"> - Sign every text of the JSON array with the key of the PastelID, loading the key once.\n"
+                "  unlock \"PastelID\" \"passphrase\" timeout - Keep the decrypted key of the PastelID in memory for \"timeout\" seconds,\n"
+                "                                                  so sign and signmany don't need the passphrase and don't read the key file\n"
+                "                                                  (capped at 100000000 seconds)\n"
+                "  lock <\"PastelID\">                          - Forget the decrypted key of the PastelID, or of all PastelIDs when omitted.\n"
                 "  sign-by-key \"text\" \"key\" \"passphrase\" - Sign \"text\" with the private \"key\" (EdDSA448) as PKCS8 encrypted string in PEM format.\n"
                 "  verify \"text\" \"signature\" \"PastelID\"  - Verify \"text\"'s \"signature\" with the PastelID.\n"
+                "  verifymany [{\"text\":...,\"signature\":...,\"PastelID\":...},...] <threads> - Verify many signatures in parallel.\n"
+                "                                                  \"threads\" (optional) number of threads, 0 (default) for one per core\n"
         );
 
     std::string strCmd, strError;
@@ -1140,18 +1164,20 @@ UniValue pastelid(const UniValue& params, bool fHelp) {
         return resultArray;
     }
     if (strMode == "sign") {
-        if (params.size() != 4)
-            throw JSONRPCError(RPC_INVALID_PARAMETER, "pastelid sign \"text\" \"PastelID\" \"passphrase\"\n"
+        if (params.size() != 3 && params.size() != 4)
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "pastelid sign \"text\" \"PastelID\" <\"passphrase\">\n"
                                                       "Sign \"text\" with the internally stored private key associated with the PastelID.");
 
+        // without passphrase the key unlocked by "pastelid unlock" is used
         SecureString strKeyPass;
         strKeyPass.reserve(100);
-        strKeyPass = params[3].get_str().c_str();
+        if (params.size() == 4)
+            strKeyPass = params[3].get_str().c_str();
 
-        if (strKeyPass.length() < 1)
+        if (strKeyPass.length() < 1 && CPastelID::GetUnlockTime(params[2].get_str()) == 0)
             throw runtime_error(
-                    "pastelid importkey <\"passphrase\">\n"
-                    "passphrase for imported key cannot be empty!");
+                    "pastelid sign \"text\" \"PastelID\" <\"passphrase\">\n"
+                    "passphrase cannot be empty unless the PastelID is unlocked!");
 
         UniValue resultObj(UniValue::VOBJ);
 
@@ -1178,6 +1204,85 @@ UniValue pastelid(const UniValue& params, bool fHelp) {
 
         return resultObj;
     }
+    if (strMode == "signmany") {
+        if (params.size() != 3 && params.size() != 4)
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "pastelid signmany [\"text\",...] \"PastelID\" <\"passphrase\">\n"
+                                                      "Sign every text of the JSON array with the internally stored private key associated with the PastelID.");
+
+        // the command line client passes the array as a string
+        UniValue texts = params[1];
+        if (texts.isStr()) {
+            UniValue parsed;
+            if (!parsed.read(texts.get_str()))
+                throw JSONRPCError(RPC_INVALID_PARAMETER, "texts must be a JSON array of strings");
+            texts = parsed;
+        }
+        if (!texts.isArray())
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "texts must be a JSON array of strings");
+        std::vector<std::string> vTexts;
+        vTexts.reserve(texts.size());
+        for (size_t i = 0; i < texts.size(); i++)
+            vTexts.push_back(texts[i].get_str());
+
+        SecureString strKeyPass;
+        strKeyPass.reserve(100);
+        if (params.size() == 4)
+            strKeyPass = params[3].get_str().c_str();
+
+        if (strKeyPass.length() < 1 && CPastelID::GetUnlockTime(params[2].get_str()) == 0)
+            throw runtime_error(
+                    "pastelid signmany [\"text\",...] \"PastelID\" <\"passphrase\">\n"
+                    "passphrase cannot be empty unless the PastelID is unlocked!");
+
+        UniValue resultArray(UniValue::VARR);
+
+        std::vector<std::string> vSigns = CPastelID::SignMany(vTexts, params[2].get_str(), strKeyPass);
+        for (auto & sign: vSigns)
+            resultArray.push_back(sign);
+
+        return resultArray;
+    }
+    if (strMode == "unlock") {
+        if (params.size() != 4)
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "pastelid unlock \"PastelID\" \"passphrase\" timeout\n"
+                                                      "Keep the decrypted key of the PastelID in memory for \"timeout\" seconds.");
+
+        SecureString strKeyPass;
+        strKeyPass.reserve(100);
+        strKeyPass = params[2].get_str().c_str();
+
+        if (strKeyPass.length() < 1)
+            throw runtime_error(
+                    "pastelid unlock \"PastelID\" \"passphrase\" timeout\n"
+                    "passphrase cannot be empty!");
+
+        int64_t nTimeout = params[3].isNum() ? params[3].get_int64() : atoi64(params[3].get_str());
+        if (nTimeout <= 0)
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "timeout must be a positive number of seconds");
+        // keep GetTime() + nTimeout from overflowing
+        if (nTimeout > CPastelID::MaxUnlockTimeout)
+            nTimeout = CPastelID::MaxUnlockTimeout;
+
+        std::string pastelID = params[1].get_str();
+        int64_t nUnlockTime = GetTime() + nTimeout;
+        CPastelID::Unlock(pastelID, strKeyPass, nUnlockTime);
+        RPCRunLater("pastelidlock" + pastelID, boost::bind(&CPastelID::LockExpired), nTimeout);
+
+        UniValue resultObj(UniValue::VOBJ);
+        resultObj.push_back(Pair("PastelID", pastelID));
+        resultObj.push_back(Pair("unlocked_until", nUnlockTime));
+
+        return resultObj;
+    }
+    if (strMode == "lock") {
+        if (params.size() > 2)
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "pastelid lock <\"PastelID\">\n"
+                                                      "Forget the decrypted key of the PastelID, or of all PastelIDs.");
+
+        CPastelID::Lock(params.size() == 2 ? params[1].get_str() : std::string());
+
+        return NullUniValue;
+    }
     if (strMode == "verify") {
         if (params.size() != 4)
             throw JSONRPCError(RPC_INVALID_PARAMETER, "pastelid verify \"text\" \"signature\" \"PastelID\"\n"
@@ -1190,6 +1295,46 @@ UniValue pastelid(const UniValue& params, bool fHelp) {
 
         return resultObj;
     }
+    if (strMode == "verifymany") {
+        if (params.size() != 2 && params.size() != 3)
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "pastelid verifymany [{\"text\":...,\"signature\":...,\"PastelID\":...},...] <threads>\n"
+                                                      "Verify the signatures of the texts with their PastelIDs.");
+
+        // the command line client passes the array as a string
+        UniValue sigs = params[1];
+        if (sigs.isStr()) {
+            UniValue parsed;
+            if (!parsed.read(sigs.get_str()))
+                throw JSONRPCError(RPC_INVALID_PARAMETER, "signatures must be a JSON array of objects");
+            sigs = parsed;
+        }
+        if (!sigs.isArray())
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "signatures must be a JSON array of objects");
+        std::vector<CPastelIDSignature> vSigs(sigs.size());
+        for (size_t i = 0; i < sigs.size(); i++) {
+            const UniValue& sig = sigs[i];
+            if (!sig.isObject())
+                throw JSONRPCError(RPC_INVALID_PARAMETER, "signatures must be a JSON array of objects");
+            vSigs[i].text = find_value(sig, "text").get_str();
+            vSigs[i].signature = find_value(sig, "signature").get_str();
+            vSigs[i].pastelID = find_value(sig, "PastelID").get_str();
+        }
+
+        int nThreads = 0;
+        if (params.size() == 3)
+            nThreads = params[2].isNum() ? params[2].get_int() : atoi(params[2].get_str());
+
+        UniValue resultArray(UniValue::VARR);
+
+        std::vector<bool> vValid = CPastelID::VerifyMany(vSigs, nThreads);
+        for (bool fValid : vValid) {
+            UniValue obj(UniValue::VOBJ);
+            obj.push_back(Pair("verification", fValid? "OK": "Failed"));
+            resultArray.push_back(obj);
+        }
+
+        return resultArray;
+    }
 
     return NullUniValue;
 }
@@ -24,6 +24,10 @@
 #include <fcntl.h>
 #endif
 
+#ifdef HAVE_SYS_EPOLL_H
+#include <sys/epoll.h>
+#endif
+
 #include <boost/filesystem.hpp>
 #include <boost/thread.hpp>
 
@@ -76,6 +80,13 @@ uint64_t nLocalHostNonce = 0;
 static std::vector<ListenSocket> vhListenSocket;
 CAddrMan addrman;
 int nMaxConnections = DEFAULT_MAX_PEER_CONNECTIONS;
+#ifdef HAVE_SYS_EPOLL_H
+SocketEventsMode nSocketEventsMode = SOCKETEVENTS_EPOLL;
+//! epoll descriptor of the socket handler, created by InitSocketEvents()
+static int nEpollFd = -1;
+#else
+SocketEventsMode nSocketEventsMode = SOCKETEVENTS_SELECT;
+#endif
 bool fAddressesInitialized = false;
 std::string strSubVersion;
 
@@ -326,6 +337,8 @@ uint64_t CNode::nTotalBytesRecv = 0;
 uint64_t CNode::nTotalBytesSent = 0;
 CCriticalSection CNode::cs_totalBytesRecv;
 CCriticalSection CNode::cs_totalBytesSent;
+mapMsgCmdStats CNode::mapTotalMsgStats;
+CCriticalSection CNode::cs_totalMsgStats;
 
 CNode* FindNode(const CNetAddr& ip)
 {
@@ -470,8 +483,10 @@ void CNode::CloseSocketDisconnect()
 
     // in case this fails, we'll empty the recv buffer when the CNode is deleted
     TRY_LOCK(cs_vRecvMsg, lockRecv);
-    if (lockRecv)
+    if (lockRecv) {
         vRecvMsg.clear();
+        fPauseRecv = false;
+    }
 }
 
 void CNode::PushVersion()
@@ -621,6 +636,11 @@ void CNode::copyStats(CNodeStats &stats)
 
     // Leave string empty if addrLocal invalid (not filled in yet)
     stats.addrLocal = addrLocal.IsValid() ? addrLocal.ToString() : "";
+
+    {
+        LOCK(cs_msgStats);
+        stats.mapMsgStats = mapMsgStats;
+    }
 }
 
 // requires LOCK(cs_vRecvMsg)
@@ -659,6 +679,7 @@ bool CNode::ReceiveMsgBytes(const char *pch, unsigned int nBytes)
         }
     }
 
+    UpdateRecvPause();
     return true;
 }
 
@@ -759,6 +780,7 @@ void SocketSendData(CNode *pnode)
         assert(pnode->nSendSize == 0);
     }
     pnode->vSendMsg.erase(pnode->vSendMsg.begin(), it);
+    pnode->fHasSendMsg = !pnode->vSendMsg.empty();
 }
 
 static list<CNode*> vNodesDisconnected;
@@ -1030,9 +1052,257 @@ static void AcceptConnection(const ListenSocket& hListenSocket) {
     }
 }
 
+bool SetSocketEventsMode(const std::string& strMode)
+{
+    if (strMode == "select") {
+        nSocketEventsMode = SOCKETEVENTS_SELECT;
+        return true;
+    }
+#ifdef HAVE_SYS_EPOLL_H
+    if (strMode == "epoll") {
+        nSocketEventsMode = SOCKETEVENTS_EPOLL;
+        return true;
+    }
+#endif
+    return false;
+}
+
+bool InitSocketEvents(std::string& strError)
+{
+#ifdef HAVE_SYS_EPOLL_H
+    if (nSocketEventsMode == SOCKETEVENTS_EPOLL && nEpollFd == -1) {
+        nEpollFd = epoll_create1(EPOLL_CLOEXEC);
+        if (nEpollFd == -1) {
+            strError = strprintf("epoll_create1 failed: %s", NetworkErrorString(errno));
+            return false;
+        }
+    }
+#endif
+    return true;
+}
+
+std::string GetSocketEventsModeName()
+{
+    return nSocketEventsMode == SOCKETEVENTS_EPOLL ? "epoll" : "select";
+}
+
+/** What a node is waiting for on its socket, see GetNodeSocketInterest() */
+enum NodeSocketInterest
+{
+    SOCKET_INTEREST_NONE,
+    SOCKET_INTEREST_SEND,
+    SOCKET_INTEREST_RECV,
+};
+
+static NodeSocketInterest GetNodeSocketInterest(CNode* pnode)
+{
+    // Implement the following logic:
+    // * If there is data to send, wait for sending data. As this only
+    //   happens when optimistic write failed, we choose to first drain the
+    //   write buffer in this case before receiving more. This avoids
+    //   needlessly queueing received data, if the remote peer is not themselves
+    //   receiving data. This means properly utilizing TCP flow control signaling.
+    // * Otherwise, if there is no (complete) message in the receive buffer,
+    //   or there is space left in the buffer, wait for receiving data.
+    // * (if neither of the above applies, there is certainly one message
+    //   in the receiver buffer ready to be processed).
+    // Together, that means that at least one of the following is always possible,
+    // so we don't deadlock:
+    // * We send some data.
+    // * We wait for data to be received (and disconnect after timeout).
+    // * We process a message in the buffer (message handler thread).
+    if (pnode->fHasSendMsg)
+        return SOCKET_INTEREST_SEND;
+    if (!pnode->fPauseRecv)
+        return SOCKET_INTEREST_RECV;
+    return SOCKET_INTEREST_NONE;
+}
+
+/**
+ * Wait up to 50ms for the listen sockets and nodes with select() and flag
+ * which listen sockets can accept and which nodes to receive from or send to.
+ */
+static void WaitSocketEventsSelect(const std::vector<CNode*>& vNodesCopy, std::vector<char>& vListenReady,
+                                   std::vector<char>& vNodeRecv, std::vector<char>& vNodeSend)
+{
+    struct timeval timeout;
+    timeout.tv_sec  = 0;
+    timeout.tv_usec = 50000; // frequency to poll pnode->vSend
+
+    fd_set fdsetRecv;
+    fd_set fdsetSend;
+    fd_set fdsetError;
+    FD_ZERO(&fdsetRecv);
+    FD_ZERO(&fdsetSend);
+    FD_ZERO(&fdsetError);
+    SOCKET hSocketMax = 0;
+    bool have_fds = false;
+
+    BOOST_FOREACH(const ListenSocket& hListenSocket, vhListenSocket) {
+        FD_SET(hListenSocket.socket, &fdsetRecv);
+        hSocketMax = max(hSocketMax, hListenSocket.socket);
+        have_fds = true;
+    }
+
+    std::vector<SOCKET> vSockets(vNodesCopy.size(), INVALID_SOCKET);
+    for (size_t i = 0; i < vNodesCopy.size(); i++)
+    {
+        CNode* pnode = vNodesCopy[i];
+        SOCKET hSocket = pnode->hSocket;
+        if (hSocket == INVALID_SOCKET)
+            continue;
+        vSockets[i] = hSocket;
+        FD_SET(hSocket, &fdsetError);
+        hSocketMax = max(hSocketMax, hSocket);
+        have_fds = true;
+
+        switch (GetNodeSocketInterest(pnode)) {
+        case SOCKET_INTEREST_SEND:
+            FD_SET(hSocket, &fdsetSend);
+            break;
+        case SOCKET_INTEREST_RECV:
+            FD_SET(hSocket, &fdsetRecv);
+            break;
+        case SOCKET_INTEREST_NONE:
+            break;
+        }
+    }
+
+    int nSelect = select(have_fds ? hSocketMax + 1 : 0,
+                         &fdsetRecv, &fdsetSend, &fdsetError, &timeout);
+    boost::this_thread::interruption_point();
+
+    if (nSelect == SOCKET_ERROR)
+    {
+        if (have_fds)
+        {
+            int nErr = WSAGetLastError();
+            LogPrintf("socket select error %s\n", NetworkErrorString(nErr));
+            for (unsigned int i = 0; i <= hSocketMax; i++)
+                FD_SET(i, &fdsetRecv);
+        }
+        FD_ZERO(&fdsetSend);
+        FD_ZERO(&fdsetError);
+        MilliSleep(timeout.tv_usec/1000);
+    }
+
+    for (size_t i = 0; i < vhListenSocket.size(); i++)
+        vListenReady[i] = vhListenSocket[i].socket != INVALID_SOCKET && FD_ISSET(vhListenSocket[i].socket, &fdsetRecv);
+    for (size_t i = 0; i < vNodesCopy.size(); i++)
+    {
+        if (vSockets[i] == INVALID_SOCKET)
+            continue;
+        vNodeRecv[i] = FD_ISSET(vSockets[i], &fdsetRecv) || FD_ISSET(vSockets[i], &fdsetError);
+        vNodeSend[i] = FD_ISSET(vSockets[i], &fdsetSend);
+    }
+}
+
+#ifdef HAVE_SYS_EPOLL_H
+static const int MAX_EPOLL_EVENTS = 256;
+
+/**
+ * Wait for socket events with epoll. Listen sockets are level-triggered.
+ * Nodes are registered edge-triggered for both directions once, when first
+ * seen, and keep fSocketRecvReady/fSocketSendReady set until a recv or send
+ * comes up short, so unlike select() the set of watched descriptors never
+ * has to be rebuilt and its cost only grows with the number of active sockets.
+ */
+static void WaitSocketEventsEpoll(int epollfd, const std::vector<CNode*>& vNodesCopy, std::vector<char>& vListenReady,
+                                  std::vector<char>& vNodeRecv, std::vector<char>& vNodeSend)
+{
+    std::vector<NodeSocketInterest> vInterest(vNodesCopy.size(), SOCKET_INTEREST_NONE);
+    bool fPending = false;
+    for (size_t i = 0; i < vNodesCopy.size(); i++)
+    {
+        CNode* pnode = vNodesCopy[i];
+        if (pnode->hSocket == INVALID_SOCKET)
+            continue;
+        if (!pnode->fSocketRegistered)
+        {
+            // closing the socket removes it from the epoll set again
+            struct epoll_event event;
+            event.events = EPOLLIN | EPOLLOUT | EPOLLET;
+            event.data.ptr = pnode;
+            if (epoll_ctl(epollfd, EPOLL_CTL_ADD, pnode->hSocket, &event) == -1)
+                LogPrintf("socket epoll_ctl error %s\n", NetworkErrorString(errno));
+            pnode->fSocketRegistered = true;
+            pnode->fSocketRecvReady = true;
+            pnode->fSocketSendReady = true;
+        }
+        vInterest[i] = GetNodeSocketInterest(pnode);
+        if ((vInterest[i] == SOCKET_INTEREST_RECV && pnode->fSocketRecvReady) ||
+            (vInterest[i] == SOCKET_INTEREST_SEND && pnode->fSocketSendReady))
+            fPending = true;
+    }
+
+    // don't block while a node can make progress without a new edge
+    struct epoll_event events[MAX_EPOLL_EVENTS];
+    int nEvents = epoll_wait(epollfd, events, MAX_EPOLL_EVENTS, fPending ? 0 : 50);
+    boost::this_thread::interruption_point();
+
+    if (nEvents == -1)
+    {
+        if (errno != EINTR)
+        {
+            LogPrintf("socket epoll_wait error %s\n", NetworkErrorString(errno));
+            MilliSleep(50);
+        }
+        nEvents = 0;
+    }
+
+    std::set<CNode*> setError;
+    for (int n = 0; n < nEvents; n++)
+    {
+        bool fListen = false;
+        for (size_t i = 0; i < vhListenSocket.size(); i++)
+        {
+            if (events[n].data.ptr == &vhListenSocket[i]) {
+                vListenReady[i] = true;
+                fListen = true;
+                break;
+            }
+        }
+        if (fListen)
+            continue;
+
+        CNode* pnode = static_cast<CNode*>(events[n].data.ptr);
+        if (events[n].events & (EPOLLIN | EPOLLERR | EPOLLHUP))
+            pnode->fSocketRecvReady = true;
+        if (events[n].events & EPOLLOUT)
+            pnode->fSocketSendReady = true;
+        // like select() errors, let recv() pick up the error even when the
+        // receive buffer is full
+        if (events[n].events & (EPOLLERR | EPOLLHUP))
+            setError.insert(pnode);
+    }
+
+    for (size_t i = 0; i < vNodesCopy.size(); i++)
+    {
+        CNode* pnode = vNodesCopy[i];
+        vNodeRecv[i] = (vInterest[i] == SOCKET_INTEREST_RECV && pnode->fSocketRecvReady) || setError.count(pnode);
+        vNodeSend[i] = vInterest[i] == SOCKET_INTEREST_SEND && pnode->fSocketSendReady;
+    }
+}
+#endif
+
 void ThreadSocketHandler()
 {
     unsigned int nPrevNodeCount = 0;
+#ifdef HAVE_SYS_EPOLL_H
+    if (nSocketEventsMode == SOCKETEVENTS_EPOLL)
+    {
+        // the descriptor comes from InitSocketEvents(), which init checked
+        assert(nEpollFd != -1);
+        for (size_t i = 0; i < vhListenSocket.size(); i++)
+        {
+            struct epoll_event event;
+            event.events = EPOLLIN;
+            event.data.ptr = &vhListenSocket[i];
+            if (epoll_ctl(nEpollFd, EPOLL_CTL_ADD, vhListenSocket[i].socket, &event) == -1)
+                LogPrintf("socket epoll_ctl error %s\n", NetworkErrorString(errno));
+        }
+    }
+#endif
     while (true)
     {
         //
@@ -1106,110 +1376,40 @@ void ThreadSocketHandler()
         }
 
         //
-        // Find which sockets have data to receive
+        // Wait for socket events
         //
-        struct timeval timeout;
-        timeout.tv_sec  = 0;
-        timeout.tv_usec = 50000; // frequency to poll pnode->vSend
-
-        fd_set fdsetRecv;
-        fd_set fdsetSend;
-        fd_set fdsetError;
-        FD_ZERO(&fdsetRecv);
-        FD_ZERO(&fdsetSend);
-        FD_ZERO(&fdsetError);
-        SOCKET hSocketMax = 0;
-        bool have_fds = false;
-
-        BOOST_FOREACH(const ListenSocket& hListenSocket, vhListenSocket) {
-            FD_SET(hListenSocket.socket, &fdsetRecv);
-            hSocketMax = max(hSocketMax, hListenSocket.socket);
-            have_fds = true;
-        }
-
+        vector<CNode*> vNodesCopy;
         {
             LOCK(cs_vNodes);
-            BOOST_FOREACH(CNode* pnode, vNodes)
-            {
-                if (pnode->hSocket == INVALID_SOCKET)
-                    continue;
-                FD_SET(pnode->hSocket, &fdsetError);
-                hSocketMax = max(hSocketMax, pnode->hSocket);
-                have_fds = true;
-
-                // Implement the following logic:
-                // * If there is data to send, select() for sending data. As this only
-                //   happens when optimistic write failed, we choose to first drain the
-                //   write buffer in this case before receiving more. This avoids
-                //   needlessly queueing received data, if the remote peer is not themselves
-                //   receiving data. This means properly utilizing TCP flow control signaling.
-                // * Otherwise, if there is no (complete) message in the receive buffer,
-                //   or there is space left in the buffer, select() for receiving data.
-                // * (if neither of the above applies, there is certainly one message
-                //   in the receiver buffer ready to be processed).
-                // Together, that means that at least one of the following is always possible,
-                // so we don't deadlock:
-                // * We send some data.
-                // * We wait for data to be received (and disconnect after timeout).
-                // * We process a message in the buffer (message handler thread).
-                {
-                    TRY_LOCK(pnode->cs_vSend, lockSend);
-                    if (lockSend && !pnode->vSendMsg.empty()) {
-                        FD_SET(pnode->hSocket, &fdsetSend);
-                        continue;
-                    }
-                }
-                {
-                    TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
-                    if (lockRecv && (
-                        pnode->vRecvMsg.empty() || !pnode->vRecvMsg.front().complete() ||
-                        pnode->GetTotalRecvSize() <= ReceiveFloodSize()))
-                        FD_SET(pnode->hSocket, &fdsetRecv);
-                }
-            }
-        }
-
-        int nSelect = select(have_fds ? hSocketMax + 1 : 0,
-                             &fdsetRecv, &fdsetSend, &fdsetError, &timeout);
-        boost::this_thread::interruption_point();
-
-        if (nSelect == SOCKET_ERROR)
-        {
-            if (have_fds)
-            {
-                int nErr = WSAGetLastError();
-                LogPrintf("socket select error %s\n", NetworkErrorString(nErr));
-                for (unsigned int i = 0; i <= hSocketMax; i++)
-                    FD_SET(i, &fdsetRecv);
-            }
-            FD_ZERO(&fdsetSend);
-            FD_ZERO(&fdsetError);
-            MilliSleep(timeout.tv_usec/1000);
+            vNodesCopy = vNodes;
+            BOOST_FOREACH(CNode* pnode, vNodesCopy)
+                pnode->AddRef();
         }
+        std::vector<char> vListenReady(vhListenSocket.size(), false);
+        std::vector<char> vNodeRecv(vNodesCopy.size(), false);
+        std::vector<char> vNodeSend(vNodesCopy.size(), false);
+#ifdef HAVE_SYS_EPOLL_H
+        if (nSocketEventsMode == SOCKETEVENTS_EPOLL)
+            WaitSocketEventsEpoll(nEpollFd, vNodesCopy, vListenReady, vNodeRecv, vNodeSend);
+        else
+#endif
+            WaitSocketEventsSelect(vNodesCopy, vListenReady, vNodeRecv, vNodeSend);
 
         //
         // Accept new connections
         //
-        BOOST_FOREACH(const ListenSocket& hListenSocket, vhListenSocket)
+        for (size_t i = 0; i < vhListenSocket.size(); i++)
         {
-            if (hListenSocket.socket != INVALID_SOCKET && FD_ISSET(hListenSocket.socket, &fdsetRecv))
-            {
-                AcceptConnection(hListenSocket);
-            }
+            if (vListenReady[i] && vhListenSocket[i].socket != INVALID_SOCKET)
+                AcceptConnection(vhListenSocket[i]);
         }
 
         //
         // Service each socket
         //
-        vector<CNode*> vNodesCopy;
-        {
-            LOCK(cs_vNodes);
-            vNodesCopy = vNodes;
-            BOOST_FOREACH(CNode* pnode, vNodesCopy)
-                pnode->AddRef();
-        }
-        BOOST_FOREACH(CNode* pnode, vNodesCopy)
+        for (size_t i = 0; i < vNodesCopy.size(); i++)
         {
+            CNode* pnode = vNodesCopy[i];
             boost::this_thread::interruption_point();
 
             //
@@ -1217,7 +1417,7 @@ void ThreadSocketHandler()
             //
             if (pnode->hSocket == INVALID_SOCKET)
                 continue;
-            if (FD_ISSET(pnode->hSocket, &fdsetRecv) || FD_ISSET(pnode->hSocket, &fdsetError))
+            if (vNodeRecv[i])
             {
                 TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
                 if (lockRecv)
@@ -1226,6 +1426,9 @@ void ThreadSocketHandler()
                         // typical socket buffer is 8K-64K
                         char pchBuf[0x10000];
                         int nBytes = recv(pnode->hSocket, pchBuf, sizeof(pchBuf), MSG_DONTWAIT);
+                        // a short read drained the socket, wait for the next event
+                        if (nBytes < (int)sizeof(pchBuf))
+                            pnode->fSocketRecvReady = false;
                         if (nBytes > 0)
                         {
                             if (!pnode->ReceiveMsgBytes(pchBuf, nBytes))
@@ -1261,11 +1464,16 @@ void ThreadSocketHandler()
             //
             if (pnode->hSocket == INVALID_SOCKET)
                 continue;
-            if (FD_ISSET(pnode->hSocket, &fdsetSend))
+            if (vNodeSend[i])
             {
                 TRY_LOCK(pnode->cs_vSend, lockSend);
                 if (lockSend)
+                {
                     SocketSendData(pnode);
+                    // a partial send filled the socket buffer, wait for the next event
+                    if (!pnode->vSendMsg.empty())
+                        pnode->fSocketSendReady = false;
+                }
             }
 
             //
@@ -1907,6 +2115,11 @@ public:
         vNodes.clear();
         vNodesDisconnected.clear();
         vhListenSocket.clear();
+#ifdef HAVE_SYS_EPOLL_H
+        if (nEpollFd != -1)
+            close(nEpollFd);
+        nEpollFd = -1;
+#endif
         delete semOutbound;
         semOutbound = NULL;
         delete pnodeLocalHost;
@@ -1977,6 +2190,43 @@ void CNode::RecordBytesSent(uint64_t bytes)
     nTotalBytesSent += bytes;
 }
 
+/** Stats entry of a command; unknown commands beyond MAX_MSG_CMD_STATS share one entry */
+static CNetMsgStats& GetMsgCmdStats(mapMsgCmdStats& stats, const std::string& strCommand)
+{
+    mapMsgCmdStats::iterator it = stats.find(strCommand);
+    if (it != stats.end())
+        return it->second;
+    if (stats.size() >= MAX_MSG_CMD_STATS)
+        return stats["*other*"];
+    return stats[strCommand];
+}
+
+void CNode::RecordMsgProcessed(const std::string& strCommand, uint64_t nBytes, int64_t nTime, int64_t nLockWait)
+{
+    {
+        LOCK(cs_msgStats);
+        GetMsgCmdStats(mapMsgStats, strCommand).AddProcessed(nBytes, nTime, nLockWait);
+    }
+    LOCK(cs_totalMsgStats);
+    GetMsgCmdStats(mapTotalMsgStats, strCommand).AddProcessed(nBytes, nTime, nLockWait);
+}
+
+void CNode::RecordMsgSent(const std::string& strCommand, uint64_t nBytes)
+{
+    {
+        LOCK(cs_msgStats);
+        GetMsgCmdStats(mapMsgStats, strCommand).AddSent(nBytes);
+    }
+    LOCK(cs_totalMsgStats);
+    GetMsgCmdStats(mapTotalMsgStats, strCommand).AddSent(nBytes);
+}
+
+void CNode::GetTotalMsgStats(mapMsgCmdStats& stats)
+{
+    LOCK(cs_totalMsgStats);
+    stats = mapTotalMsgStats;
+}
+
 uint64_t CNode::GetTotalBytesRecv()
 {
     LOCK(cs_totalBytesRecv);
@@ -2153,6 +2403,11 @@ CNode::CNode(SOCKET hSocketIn, const CAddress& addrIn, const std::string& addrNa
     fNetworkNode = fNetworkNodeIn;
     fSuccessfullyConnected = false;
     fDisconnect = false;
+    fSocketRegistered = false;
+    fSocketRecvReady = false;
+    fSocketSendReady = false;
+    fHasSendMsg = false;
+    fPauseRecv = false;
     nRefCount = 0;
     nSendSize = 0;
     nSendOffset = 0;
@@ -2167,6 +2422,8 @@ CNode::CNode(SOCKET hSocketIn, const CAddress& addrIn, const std::string& addrNa
     nPingUsecTime = 0;
     fPingQueued = false;
     fMasternode = false;
+    fProvidesHeaderAndIDs = false;
+    fPreferHeaderAndIDs = false;
 
     nMinPingUsecTime = std::numeric_limits<int64_t>::max();
 
@@ -2239,6 +2496,7 @@ void CNode::BeginMessage(const char* pszCommand) EXCLUSIVE_LOCK_FUNCTION(cs_vSen
     ENTER_CRITICAL_SECTION(cs_vSend);
     assert(ssSend.size() == 0);
     ssSend << CMessageHeader(Params().MessageStart(), pszCommand, 0);
+    strSendCommand = pszCommand;
     LogPrint("net", "sending: %s ", SanitizeString(pszCommand));
 }
 
@@ -2282,10 +2540,12 @@ void CNode::EndMessage() UNLOCK_FUNCTION(cs_vSend)
     memcpy((char*)&ssSend[CMessageHeader::CHECKSUM_OFFSET], &nChecksum, sizeof(nChecksum));
 
     LogPrint("net", "(%d bytes) peer=%d\n", nSize, id);
+    RecordMsgSent(strSendCommand, ssSend.size());
 
     std::deque<CSerializeData>::iterator it = vSendMsg.insert(vSendMsg.end(), CSerializeData());
     ssSend.GetAndClear(*it);
     nSendSize += (*it).size();
+    fHasSendMsg = true;
 
     // If write queue empty, attempt "optimistic write"
     if (it == vSendMsg.begin())
@@ -19,6 +19,7 @@
 #include "uint256.h"
 #include "utilstrencodings.h"
 
+#include <atomic>
 #include <deque>
 #include <stdint.h>
 
@@ -146,6 +147,20 @@ extern CAddrMan addrman;
 /** Maximum number of connections to simultaneously allow (aka connection slots) */
 extern int nMaxConnections;
 
+/** How ThreadSocketHandler waits for socket events (-socketevents) */
+enum SocketEventsMode
+{
+    SOCKETEVENTS_SELECT,
+    SOCKETEVENTS_EPOLL,
+};
+extern SocketEventsMode nSocketEventsMode;
+
+/** Set the socket events mode by name, false if it is unknown or not supported on this platform */
+bool SetSocketEventsMode(const std::string& strMode);
+/** Create the epoll descriptor when that is the socket events mode, false with strError if it can't be */
+bool InitSocketEvents(std::string& strError);
+std::string GetSocketEventsModeName();
+
 extern std::vector<CNode*> vNodes;
 extern CCriticalSection cs_vNodes;
 extern std::map<CInv, CDataStream> mapRelay;
@@ -170,6 +185,40 @@ struct LocalServiceInfo {
 extern CCriticalSection cs_mapLocalHost;
 extern std::map<CNetAddr, LocalServiceInfo> mapLocalHost;
 
+/** Maximum number of distinct commands tracked in the message stats, the rest are counted as "*other*" */
+static const size_t MAX_MSG_CMD_STATS = 128;
+
+/** Per-command message counters (times in usec) */
+struct CNetMsgStats
+{
+    uint64_t nRecvMsgs;
+    uint64_t nRecvBytes;
+    uint64_t nSendMsgs;
+    uint64_t nSendBytes;
+    int64_t nProcessTime;      //! cumulative ProcessMessage time
+    int64_t nMaxProcessTime;   //! slowest single message
+    int64_t nLockWaitTime;     //! time spent waiting for cs_main while processing
+
+    CNetMsgStats() : nRecvMsgs(0), nRecvBytes(0), nSendMsgs(0), nSendBytes(0),
+                     nProcessTime(0), nMaxProcessTime(0), nLockWaitTime(0) {}
+
+    void AddProcessed(uint64_t nBytes, int64_t nTime, int64_t nLockWait)
+    {
+        nRecvMsgs++;
+        nRecvBytes += nBytes;
+        nProcessTime += nTime;
+        nMaxProcessTime = std::max(nMaxProcessTime, nTime);
+        nLockWaitTime += nLockWait;
+    }
+
+    void AddSent(uint64_t nBytes)
+    {
+        nSendMsgs++;
+        nSendBytes += nBytes;
+    }
+};
+typedef std::map<std::string, CNetMsgStats> mapMsgCmdStats;
+
 class CNodeStats
 {
 public:
@@ -190,6 +239,7 @@ public:
     double dPingTime;
     double dPingWait;
     std::string addrLocal;
+    mapMsgCmdStats mapMsgStats;
 };
 
 
@@ -250,6 +300,7 @@ public:
     uint64_t nSendBytes;
     std::deque<CSerializeData> vSendMsg;
     CCriticalSection cs_vSend;
+    std::string strSendCommand; // command of the message being built in ssSend
 
     std::deque<CInv> vRecvGetData;
     std::deque<CNetMessage> vRecvMsg;
@@ -277,6 +328,14 @@ public:
     bool fNetworkNode;
     bool fSuccessfullyConnected;
     bool fDisconnect;
+    // Socket readiness, only touched by the socket handler thread
+    bool fSocketRegistered;
+    bool fSocketRecvReady;
+    bool fSocketSendReady;
+    // Whether vSendMsg has data and whether the receive buffer is full, kept up to date under
+    // cs_vSend and cs_vRecvMsg so the socket handler can read them without taking the locks
+    std::atomic<bool> fHasSendMsg;
+    std::atomic<bool> fPauseRecv;
     // We use fRelayTxes for two purposes -
     // a) it allows us to not relay tx invs before receiving the peer's version message
     // b) the peer may tell us in its version message that we should not relay tx invs
@@ -285,6 +344,10 @@ public:
     bool fSentAddr;
     // If 'true' this node will be disconnected on CMasternodeMan::ProcessMasternodeConnections()
     bool fMasternode;
+    // Whether the peer sent "sendcmpct", so it understands compact blocks
+    bool fProvidesHeaderAndIDs;
+    // Whether the peer asked for new blocks as "cmpctblock" without an inv first (high-bandwidth mode)
+    bool fPreferHeaderAndIDs;
     CSemaphoreGrant grantMasternodeOutbound;
 
     CSemaphoreGrant grantOutbound;
@@ -346,6 +409,12 @@ private:
     static uint64_t nTotalBytesRecv;
     static uint64_t nTotalBytesSent;
 
+    // Per-command message statistics, for this node and in total
+    CCriticalSection cs_msgStats;
+    mapMsgCmdStats mapMsgStats;
+    static CCriticalSection cs_totalMsgStats;
+    static mapMsgCmdStats mapTotalMsgStats;
+
     CNode(const CNode&);
     void operator=(const CNode&);
 
@@ -373,6 +442,12 @@ public:
     // requires LOCK(cs_vRecvMsg)
     bool ReceiveMsgBytes(const char *pch, unsigned int nBytes);
 
+    // requires LOCK(cs_vRecvMsg)
+    void UpdateRecvPause()
+    {
+        fPauseRecv = !vRecvMsg.empty() && vRecvMsg.front().complete() && GetTotalRecvSize() > ReceiveFloodSize();
+    }
+
     // requires LOCK(cs_vRecvMsg)
     void SetRecvVersion(int nVersionIn)
     {
@@ -422,6 +497,13 @@ public:
         }
     }
 
+    // Returns false if the peer already knew inv
+    bool AddInventoryKnownIfNew(const CInv& inv)
+    {
+        LOCK(cs_inventory);
+        return setInventoryKnown.insert(inv).second;
+    }
+
     void PushInventory(const CInv& inv)
     {
         {
@@ -636,6 +718,9 @@ public:
     // Network stats
     static void RecordBytesRecv(uint64_t bytes);
     static void RecordBytesSent(uint64_t bytes);
+    void RecordMsgProcessed(const std::string& strCommand, uint64_t nBytes, int64_t nTime, int64_t nLockWait);
+    void RecordMsgSent(const std::string& strCommand, uint64_t nBytes);
+    static void GetTotalMsgStats(mapMsgCmdStats& stats);
 
     static uint64_t GetTotalBytesRecv();
     static uint64_t GetTotalBytesSent();
@@ -50,7 +50,9 @@ static const char* ppszTypeName[] =
     NetMsgType::MNPING,
     NetMsgType::DSTX,
     NetMsgType::MNVERIFY,
-    NetMsgType::MASTERNODEMESSAGE
+    NetMsgType::MASTERNODEMESSAGE,
+
+    "cmpctblock"
 
 };
 
@@ -164,7 +164,10 @@ enum {
     MSG_MASTERNODE_PING,
     MSG_DSTX,
     MSG_MASTERNODE_VERIFY,
-    MSG_MASTERNODE_MESSAGE
+    MSG_MASTERNODE_MESSAGE,
+
+    // Only used in getdata, asks for a "cmpctblock" instead of a "block" message
+    MSG_CMPCT_BLOCK
 };
 
 namespace NetMsgType {
@@ -11,8 +11,10 @@
 #include "main.h"
 #include "primitives/transaction.h"
 #include "rpc/server.h"
+#include "script/sigcache.h"
 #include "streams.h"
 #include "sync.h"
+#include "txdb.h"
 #include "util.h"
 
 #include <stdint.h>
@@ -247,6 +249,12 @@ UniValue mempoolToJSON(bool fVerbose = false)
             info.push_back(Pair("height", (int)e.GetHeight()));
             info.push_back(Pair("startingpriority", e.GetPriority(e.GetHeight())));
             info.push_back(Pair("currentpriority", e.GetPriority(chainActive.Height())));
+            info.push_back(Pair("descendantcount", e.GetCountWithDescendants()));
+            info.push_back(Pair("descendantsize", e.GetSizeWithDescendants()));
+            info.push_back(Pair("descendantfees", e.GetModFeesWithDescendants()));
+            info.push_back(Pair("ancestorcount", e.GetCountWithAncestors()));
+            info.push_back(Pair("ancestorsize", e.GetSizeWithAncestors()));
+            info.push_back(Pair("ancestorfees", e.GetModFeesWithAncestors()));
             const CTransaction& tx = e.GetTx();
             set<string> setDepends;
             BOOST_FOREACH(const CTxIn& txin, tx.vin)
@@ -301,6 +309,12 @@ UniValue getrawmempool(const UniValue& params, bool fHelp)
             "    \"height\" : n,           (numeric) block height when transaction entered pool\n"
             "    \"startingpriority\" : n, (numeric) priority when transaction entered pool\n"
             "    \"currentpriority\" : n,  (numeric) transaction priority now\n"
+            "    \"descendantcount\" : n,  (numeric) number of in-mempool descendant transactions (including this one)\n"
+            "    \"descendantsize\" : n,   (numeric) size of in-mempool descendants (including this one)\n"
+            "    \"descendantfees\" : n,   (numeric) fees in patoshis, including prioritisetransaction deltas, of in-mempool descendants (including this one)\n"
+            "    \"ancestorcount\" : n,    (numeric) number of in-mempool ancestor transactions (including this one)\n"
+            "    \"ancestorsize\" : n,     (numeric) size of in-mempool ancestors (including this one)\n"
+            "    \"ancestorfees\" : n,     (numeric) fees in patoshis, including prioritisetransaction deltas, of in-mempool ancestors (including this one)\n"
             "    \"depends\" : [           (array) unconfirmed transactions used as inputs for this transaction\n"
             "        \"transactionid\",    (string) parent transaction id\n"
             "       ... ]\n"
@@ -494,14 +508,15 @@ UniValue getblock(const UniValue& params, bool fHelp)
     if (mapBlockIndex.count(hash) == 0)
         throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Block not found");
 
-    CBlock block;
     CBlockIndex* pblockindex = mapBlockIndex[hash];
 
     if (fHavePruned && !(pblockindex->nStatus & BLOCK_HAVE_DATA) && pblockindex->nTx > 0)
         throw JSONRPCError(RPC_INTERNAL_ERROR, "Block not available (pruned data)");
 
-    if(!ReadBlockFromDisk(block, pblockindex))
+    std::shared_ptr<const CBlock> pblock = ReadBlockFromDiskCached(pblockindex);
+    if (!pblock)
         throw JSONRPCError(RPC_INTERNAL_ERROR, "Can't read block from disk");
+    const CBlock& block = *pblock;
 
     if (verbosity == 0)
     {
@@ -516,11 +531,15 @@ UniValue getblock(const UniValue& params, bool fHelp)
 
 UniValue gettxoutsetinfo(const UniValue& params, bool fHelp)
 {
-    if (fHelp || params.size() != 0)
+    if (fHelp || params.size() > 1)
         throw runtime_error(
-            "gettxoutsetinfo\n"
+            "gettxoutsetinfo ( \"hash_type\" )\n"
             "\nReturns statistics about the unspent transaction output set.\n"
-            "Note this call may take some time.\n"
+            "Note this call may take some time, unless hash_type is \"muhash\".\n"
+            "\nArguments:\n"
+            "1. \"hash_type\"   (string, optional, default=\"hash_serialized\") \"muhash\" to skip the scan\n"
+            "                 of the whole set for hash_serialized and only return the statistics\n"
+            "                 that are kept up to date as blocks are connected\n"
             "\nResult:\n"
             "{\n"
             "  \"height\":n,     (numeric) The current block height (index)\n"
@@ -528,30 +547,198 @@ UniValue gettxoutsetinfo(const UniValue& params, bool fHelp)
             "  \"transactions\": n,      (numeric) The number of transactions\n"
             "  \"txouts\": n,            (numeric) The number of output transactions\n"
             "  \"bytes_serialized\": n,  (numeric) The serialized size\n"
-            "  \"hash_serialized\": \"hash\",   (string) The serialized hash\n"
+            "  \"hash_serialized\": \"hash\",   (string) The serialized hash (not with hash_type \"muhash\")\n"
+            "  \"muhash\": \"hash\",       (string) The MuHash3072 of the set\n"
             "  \"total_amount\": x.xxx          (numeric) The total amount\n"
             "}\n"
             "\nExamples:\n"
             + HelpExampleCli("gettxoutsetinfo", "")
+            + HelpExampleCli("gettxoutsetinfo", "\"muhash\"")
             + HelpExampleRpc("gettxoutsetinfo", "")
         );
 
+    bool fScan = true;
+    if (params.size() > 0) {
+        std::string strHashType = params[0].get_str();
+        if (strHashType == "muhash")
+            fScan = false;
+        else if (strHashType != "hash_serialized")
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Unknown hash_type " + strHashType);
+    }
+
     UniValue ret(UniValue::VOBJ);
 
     CCoinsStats stats;
-    FlushStateToDisk();
-    if (pcoinsTip->GetStats(stats)) {
+    bool fStats;
+    if (fScan) {
+        FlushStateToDisk();
+        fStats = pcoinsTip->GetStats(stats);
+        if (fStats) {
+            // the running hash belongs to the scanned set unless the tip was flushed meanwhile
+            LOCK(cs_main);
+            CCoinsStats statsRunning;
+            if (pcoinsTip->GetRunningStats(statsRunning) && statsRunning.hashBlock == stats.hashBlock)
+                stats.hashMuHash = statsRunning.hashMuHash;
+        }
+    } else {
+        // the running statistics must match the flushed best block
+        LOCK(cs_main);
+        FlushStateToDisk();
+        fStats = pcoinsTip->GetRunningStats(stats);
+    }
+    if (fStats) {
         ret.push_back(Pair("height", (int64_t)stats.nHeight));
         ret.push_back(Pair("bestblock", stats.hashBlock.GetHex()));
         ret.push_back(Pair("transactions", (int64_t)stats.nTransactions));
         ret.push_back(Pair("txouts", (int64_t)stats.nTransactionOutputs));
         ret.push_back(Pair("bytes_serialized", (int64_t)stats.nSerializedSize));
-        ret.push_back(Pair("hash_serialized", stats.hashSerialized.GetHex()));
+        if (fScan)
+            ret.push_back(Pair("hash_serialized", stats.hashSerialized.GetHex()));
+        if (!stats.hashMuHash.IsNull())
+            ret.push_back(Pair("muhash", stats.hashMuHash.GetHex()));
         ret.push_back(Pair("total_amount", ValueFromAmount(stats.nTotalAmount)));
     }
     return ret;
 }
 
+static UniValue CoinsSnapshotToJSON(const CCoinsSnapshotStats& stats)
+{
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("bestblock", stats.hashBlock.GetHex()));
+    ret.push_back(Pair("sproutanchor", stats.hashSproutAnchor.GetHex()));
+    ret.push_back(Pair("saplinganchor", stats.hashSaplingAnchor.GetHex()));
+    ret.push_back(Pair("transactions", (int64_t)stats.nCoins));
+    ret.push_back(Pair("sproutanchors", (int64_t)stats.nSproutAnchors));
+    ret.push_back(Pair("saplinganchors", (int64_t)stats.nSaplingAnchors));
+    ret.push_back(Pair("sproutnullifiers", (int64_t)stats.nSproutNullifiers));
+    ret.push_back(Pair("saplingnullifiers", (int64_t)stats.nSaplingNullifiers));
+    ret.push_back(Pair("hash_snapshot", stats.hashSnapshot.GetHex()));
+    if (!stats.hashCoinsMuHash.IsNull())
+        ret.push_back(Pair("muhash", stats.hashCoinsMuHash.GetHex()));
+    return ret;
+}
+
+UniValue dumptxoutset(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 1)
+        throw runtime_error(
+            "dumptxoutset \"filename\"\n"
+            "\nWrites the unspent transaction output set, the shielded anchors and the nullifiers\n"
+            "at the current tip to a snapshot file. Snapshots can be checked with verifytxoutset,\n"
+            "a node can't be started from one yet.\n"
+            "Note this call may take some time.\n"
+            "\nArguments:\n"
+            "1. \"filename\"    (string, required) The snapshot file, relative to the data directory unless absolute\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"bestblock\": \"hex\",         (string) the block the snapshot was taken at\n"
+            "  \"sproutanchor\": \"hex\",      (string) the best Sprout anchor\n"
+            "  \"saplinganchor\": \"hex\",     (string) the best Sapling anchor\n"
+            "  \"transactions\": n,          (numeric) The number of transactions with unspent outputs\n"
+            "  \"sproutanchors\": n,         (numeric) The number of Sprout anchors\n"
+            "  \"saplinganchors\": n,        (numeric) The number of Sapling anchors\n"
+            "  \"sproutnullifiers\": n,      (numeric) The number of Sprout nullifiers\n"
+            "  \"saplingnullifiers\": n,     (numeric) The number of Sapling nullifiers\n"
+            "  \"hash_snapshot\": \"hash\",    (string) The hash of the snapshot contents\n"
+            "  \"muhash\": \"hash\",           (string) The MuHash3072 of the coins, as in gettxoutsetinfo\n"
+            "  \"path\": \"path\"              (string) The file written\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("dumptxoutset", "\"utxo.dat\"")
+            + HelpExampleRpc("dumptxoutset", "\"utxo.dat\"")
+        );
+
+    boost::filesystem::path path = boost::filesystem::absolute(params[0].get_str(), GetDataDir());
+    if (boost::filesystem::exists(path))
+        throw JSONRPCError(RPC_INVALID_PARAMETER, path.string() + " already exists");
+    boost::filesystem::path pathTmp = path;
+    pathTmp += ".incomplete";
+
+    FILE* file = fopen(pathTmp.string().c_str(), "wb");
+    CAutoFile fileout(file, SER_DISK, CLIENT_VERSION);
+    if (fileout.IsNull())
+        throw JSONRPCError(RPC_MISC_ERROR, "Unable to open " + pathTmp.string() + " for writing");
+
+    std::unique_ptr<CCoinsSnapshotWriter> pwriter;
+    {
+        // only taking the snapshot needs the coins database to hold still, not writing it
+        LOCK(cs_main);
+        FlushStateToDisk();
+        // makes sure the running statistics exist, so the snapshot gets their hash
+        CCoinsStats statsCoins;
+        pcoinsTip->GetRunningStats(statsCoins);
+        pwriter.reset(pcoinsTip->NewSnapshotWriter());
+    }
+    CCoinsSnapshotStats stats;
+    if (!pwriter || !pwriter->Write(fileout, stats)) {
+        fileout.fclose();
+        boost::filesystem::remove(pathTmp);
+        throw JSONRPCError(RPC_INTERNAL_ERROR, "Unable to write the UTXO snapshot");
+    }
+    FileCommit(fileout.Get());
+    fileout.fclose();
+    if (!RenameOver(pathTmp, path))
+        throw JSONRPCError(RPC_MISC_ERROR, "Unable to rename " + pathTmp.string());
+
+    UniValue ret = CoinsSnapshotToJSON(stats);
+    ret.push_back(Pair("path", path.string()));
+    return ret;
+}
+
+UniValue verifytxoutset(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 1)
+        throw runtime_error(
+            "verifytxoutset \"filename\"\n"
+            "\nChecks a snapshot written by dumptxoutset: its format, network and checksum, and whether\n"
+            "its hash matches the one this release knows for its block.\n"
+            "\nArguments:\n"
+            "1. \"filename\"    (string, required) The snapshot file, relative to the data directory unless absolute\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"bestblock\": \"hex\",         (string) the block the snapshot was taken at\n"
+            "  ...                           same fields as dumptxoutset\n"
+            "  \"hash_snapshot\": \"hash\",    (string) The hash of the snapshot contents\n"
+            "  \"muhash\": \"hash\",           (string) The MuHash3072 of the coins, as in gettxoutsetinfo\n"
+            "  \"matches_tip\": true|false,  (boolean) Whether the coins match the UTXO set, if taken at the current tip\n"
+            "  \"in_active_chain\": true|false, (boolean) Whether the block is in the active chain\n"
+            "  \"known\": true|false,        (boolean) Whether a hash is known for the block\n"
+            "  \"valid\": true|false         (boolean) Whether the hash matches the known one\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("verifytxoutset", "\"utxo.dat\"")
+            + HelpExampleRpc("verifytxoutset", "\"utxo.dat\"")
+        );
+
+    boost::filesystem::path path = boost::filesystem::absolute(params[0].get_str(), GetDataDir());
+    FILE* file = fopen(path.string().c_str(), "rb");
+    CAutoFile filein(file, SER_DISK, CLIENT_VERSION);
+    if (filein.IsNull())
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Unable to open " + path.string());
+
+    CCoinsSnapshotStats stats;
+    if (!ReadCoinsSnapshot(filein, stats))
+        throw JSONRPCError(RPC_DESERIALIZATION_ERROR, "Invalid or corrupted UTXO snapshot, see debug.log");
+
+    UniValue ret = CoinsSnapshotToJSON(stats);
+    {
+        LOCK(cs_main);
+        BlockMap::const_iterator mi = mapBlockIndex.find(stats.hashBlock);
+        ret.push_back(Pair("in_active_chain", mi != mapBlockIndex.end() && chainActive.Contains(mi->second)));
+
+        // checking against the running hash of our own set is only possible at the same block
+        CCoinsStats statsTip;
+        FlushStateToDisk();
+        if (stats.hashBlock == pcoinsTip->GetBestBlock() && pcoinsTip->GetRunningStats(statsTip))
+            ret.push_back(Pair("matches_tip", statsTip.hashMuHash == stats.hashCoinsMuHash));
+    }
+    const MapCoinsSnapshots& snapshots = Params().CoinsSnapshots();
+    MapCoinsSnapshots::const_iterator it = snapshots.find(stats.hashBlock);
+    ret.push_back(Pair("known", it != snapshots.end()));
+    ret.push_back(Pair("valid", it != snapshots.end() && it->second == stats.hashSnapshot));
+    return ret;
+}
+
 UniValue gettxout(const UniValue& params, bool fHelp)
 {
     if (fHelp || params.size() < 2 || params.size() > 3)
@@ -739,6 +926,11 @@ UniValue getblockchaininfo(const UniValue& params, bool fHelp)
             "  \"verificationprogress\": xxxx, (numeric) estimate of verification progress [0..1]\n"
             "  \"chainwork\": \"xxxx\"     (string) total amount of work in active chain, in hexadecimal\n"
             "  \"commitments\": xxxxxx,    (numeric) the current number of note commitments in the commitment tree\n"
+            "  \"sigcache\": {             (object) signature cache usage since startup\n"
+            "     \"size\": xxxxxx,          (numeric) bytes allocated for the cache (-maxsigcachesize)\n"
+            "     \"hits\": xxxxxx,          (numeric) signature checks answered from the cache\n"
+            "     \"misses\": xxxxxx,        (numeric) signature checks not found in the cache\n"
+            "  },\n"
             "  \"softforks\": [            (array) status of softforks in progress\n"
             "     {\n"
             "        \"id\": \"xxxx\",        (string) name of softfork\n"
@@ -786,6 +978,14 @@ UniValue getblockchaininfo(const UniValue& params, bool fHelp)
     pcoinsTip->GetSproutAnchorAt(pcoinsTip->GetBestAnchor(SPROUT), tree);
     obj.push_back(Pair("commitments",           static_cast<uint64_t>(tree.size())));
 
+    CSignatureCacheStats sigCacheStats;
+    GetSignatureCacheStats(sigCacheStats);
+    UniValue sigcache(UniValue::VOBJ);
+    sigcache.push_back(Pair("size",             (uint64_t)sigCacheStats.nBytes));
+    sigcache.push_back(Pair("hits",             sigCacheStats.nHits));
+    sigcache.push_back(Pair("misses",           sigCacheStats.nMisses));
+    obj.push_back(Pair("sigcache",              sigcache));
+
     CBlockIndex* tip = chainActive.Tip();
     UniValue valuePools(UniValue::VARR);
     valuePools.push_back(ValuePoolDesc("sprout", tip->nChainSproutValue, boost::none));
@@ -932,6 +1132,11 @@ UniValue mempoolInfoToJSON()
     ret.push_back(Pair("size", (int64_t) mempool.size()));
     ret.push_back(Pair("bytes", (int64_t) mempool.GetTotalTxSize()));
     ret.push_back(Pair("usage", (int64_t) mempool.DynamicMemoryUsage()));
+    size_t maxmempool = GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000;
+    ret.push_back(Pair("maxmempool", (int64_t) maxmempool));
+    ret.push_back(Pair("mempoolminfee", ValueFromAmount(mempool.GetMinFee(maxmempool).GetFeePerK())));
+    ret.push_back(Pair("evicted", (int64_t) mempool.GetEvictedCount()));
+    ret.push_back(Pair("evictedbytes", (int64_t) mempool.GetEvictedBytes()));
 
     return ret;
 }
@@ -947,6 +1152,10 @@ UniValue getmempoolinfo(const UniValue& params, bool fHelp)
             "  \"size\": xxxxx                (numeric) Current tx count\n"
             "  \"bytes\": xxxxx               (numeric) Sum of all tx sizes\n"
             "  \"usage\": xxxxx               (numeric) Total memory usage for the mempool\n"
+            "  \"maxmempool\": xxxxx          (numeric) Maximum memory usage for the mempool\n"
+            "  \"mempoolminfee\": xxxxx       (numeric) Minimum fee rate in " + CURRENCY_UNIT + "/kB for a transaction to be accepted\n"
+            "  \"evicted\": xxxxx             (numeric) Number of transactions evicted to keep the mempool below maxmempool\n"
+            "  \"evictedbytes\": xxxxx        (numeric) Sum of the sizes of the evicted transactions\n"
             "}\n"
             "\nExamples:\n"
             + HelpExampleCli("getmempoolinfo", "")
@@ -1048,6 +1257,8 @@ static const CRPCCommand commands[] =
     { "blockchain",         "getrawmempool",          &getrawmempool,          true  },
     { "blockchain",         "gettxout",               &gettxout,               true  },
     { "blockchain",         "gettxoutsetinfo",        &gettxoutsetinfo,        true  },
+    { "blockchain",         "dumptxoutset",           &dumptxoutset,           true  },
+    { "blockchain",         "verifytxoutset",         &verifytxoutset,         true  },
     { "blockchain",         "verifychain",            &verifychain,            true  },
 
     /* Not shown in help */
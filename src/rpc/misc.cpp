@@ -483,6 +483,330 @@ UniValue setmocktime(const UniValue& params, bool fHelp)
     return NullUniValue;
 }
 
+static bool getAddressFromIndex(uint8_t type, const uint160 &hash, std::string &address)
+{
+    if (type == ADDRESS_INDEX_P2SH)
+        address = EncodeDestination(CScriptID(hash));
+    else if (type == ADDRESS_INDEX_P2PKH)
+        address = EncodeDestination(CKeyID(hash));
+    else
+        return false;
+    return true;
+}
+
+/**
+ * The first argument of the address index calls, either a bare address or an object.
+ * pastel-cli passes every argument as a string, so a string holding an object is parsed here.
+ */
+static UniValue getAddressRequest(const UniValue& params)
+{
+    if (!params[0].isStr() || params[0].get_str().empty() || params[0].get_str()[0] != '{')
+        return params[0];
+    UniValue request;
+    if (!request.read(params[0].get_str()) || !request.isObject())
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Error parsing JSON: " + params[0].get_str());
+    return request;
+}
+
+static void getAddressesFromParams(const UniValue& request, std::vector<std::pair<uint160, uint8_t> > &addresses)
+{
+    std::vector<std::string> vAddresses;
+    if (request.isStr()) {
+        vAddresses.push_back(request.get_str());
+    } else if (request.isObject()) {
+        UniValue addressValues = find_value(request.get_obj(), "addresses");
+        if (!addressValues.isArray())
+            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Addresses is expected to be an array");
+        for (size_t i = 0; i < addressValues.size(); i++)
+            vAddresses.push_back(addressValues[i].get_str());
+    } else {
+        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Invalid address");
+    }
+
+    for (const std::string& strAddress : vAddresses) {
+        CTxDestination dest = DecodeDestination(strAddress);
+        if (const CKeyID *keyID = boost::get<CKeyID>(&dest))
+            addresses.push_back(std::make_pair(*keyID, (uint8_t) ADDRESS_INDEX_P2PKH));
+        else if (const CScriptID *scriptID = boost::get<CScriptID>(&dest))
+            addresses.push_back(std::make_pair(*scriptID, (uint8_t) ADDRESS_INDEX_P2SH));
+        else
+            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Invalid address: " + strAddress);
+    }
+}
+
+static void getHeightRangeFromParams(const UniValue& request, int &start, int &end)
+{
+    start = 0;
+    end = 0;
+    if (!request.isObject())
+        return;
+
+    UniValue startValue = find_value(request.get_obj(), "start");
+    UniValue endValue = find_value(request.get_obj(), "end");
+    if (startValue.isNum() && endValue.isNum()) {
+        start = startValue.get_int();
+        end = endValue.get_int();
+        if (start <= 0 || end <= 0)
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Start and end are expected to be greater than zero");
+        if (end < start)
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "End value is expected to be greater than start");
+    }
+}
+
+UniValue getaddressbalance(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 1)
+        throw runtime_error(
+            "getaddressbalance \"address\" | {\"addresses\": [\"address\", ...]}\n"
+            "\nReturns the balance of transparent addresses (requires -addressindex).\n"
+            "\nArguments:\n"
+            "1. \"address\"      (string) The base58check encoded address\n"
+            "   or\n"
+            "   {\n"
+            "     \"addresses\"  (array) The base58check encoded addresses\n"
+            "   }\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"balance\"   (numeric) The current balance in patoshis\n"
+            "  \"received\"  (numeric) The total number of patoshis received (including change)\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getaddressbalance", "'{\"addresses\": [\"Ptor9ydHJuGpNWFAX3ZTu3bXevEhCaDVrsY\"]}'")
+            + HelpExampleRpc("getaddressbalance", "{\"addresses\": [\"Ptor9ydHJuGpNWFAX3ZTu3bXevEhCaDVrsY\"]}")
+        );
+
+    UniValue request = getAddressRequest(params);
+    std::vector<std::pair<uint160, uint8_t> > addresses;
+    getAddressesFromParams(request, addresses);
+
+    std::vector<std::pair<CAddressIndexKey, CAmount> > addressIndex;
+    for (const auto& address : addresses) {
+        if (!GetAddressIndex(address.first, address.second, addressIndex))
+            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "No information available for address");
+    }
+
+    CAmount balance = 0;
+    CAmount received = 0;
+    for (const auto& it : addressIndex) {
+        if (it.second > 0)
+            received += it.second;
+        balance += it.second;
+    }
+
+    UniValue result(UniValue::VOBJ);
+    result.push_back(Pair("balance", balance));
+    result.push_back(Pair("received", received));
+    return result;
+}
+
+UniValue getaddressutxos(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 1)
+        throw runtime_error(
+            "getaddressutxos \"address\" | {\"addresses\": [\"address\", ...]}\n"
+            "\nReturns all unspent outputs of transparent addresses (requires -addressindex).\n"
+            "\nArguments:\n"
+            "1. \"address\"      (string) The base58check encoded address\n"
+            "   or\n"
+            "   {\n"
+            "     \"addresses\"  (array) The base58check encoded addresses\n"
+            "   }\n"
+            "\nResult:\n"
+            "[\n"
+            "  {\n"
+            "    \"address\"      (string) The address\n"
+            "    \"txid\"         (string) The output txid\n"
+            "    \"outputIndex\"  (number) The output index\n"
+            "    \"script\"       (string) The script hex encoded\n"
+            "    \"satoshis\"     (number) The number of patoshis of the output\n"
+            "    \"height\"       (number) The block height\n"
+            "  }\n"
+            "]\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getaddressutxos", "'{\"addresses\": [\"Ptor9ydHJuGpNWFAX3ZTu3bXevEhCaDVrsY\"]}'")
+            + HelpExampleRpc("getaddressutxos", "{\"addresses\": [\"Ptor9ydHJuGpNWFAX3ZTu3bXevEhCaDVrsY\"]}")
+        );
+
+    UniValue request = getAddressRequest(params);
+    std::vector<std::pair<uint160, uint8_t> > addresses;
+    getAddressesFromParams(request, addresses);
+
+    std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > unspentOutputs;
+    for (const auto& address : addresses) {
+        if (!GetAddressUnspent(address.first, address.second, unspentOutputs))
+            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "No information available for address");
+    }
+
+    std::sort(unspentOutputs.begin(), unspentOutputs.end(),
+        [](const std::pair<CAddressUnspentKey, CAddressUnspentValue> &a,
+           const std::pair<CAddressUnspentKey, CAddressUnspentValue> &b) {
+            return a.second.blockHeight < b.second.blockHeight;
+        });
+
+    UniValue result(UniValue::VARR);
+    for (const auto& it : unspentOutputs) {
+        std::string address;
+        if (!getAddressFromIndex(it.first.type, it.first.hashBytes, address))
+            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Unknown address type");
+
+        UniValue output(UniValue::VOBJ);
+        output.push_back(Pair("address", address));
+        output.push_back(Pair("txid", it.first.txhash.GetHex()));
+        output.push_back(Pair("outputIndex", (int) it.first.index));
+        output.push_back(Pair("script", HexStr(it.second.script.begin(), it.second.script.end())));
+        output.push_back(Pair("satoshis", it.second.satoshis));
+        output.push_back(Pair("height", it.second.blockHeight));
+        result.push_back(output);
+    }
+    return result;
+}
+
+UniValue getaddressdeltas(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 1 || !getAddressRequest(params).isObject())
+        throw runtime_error(
+            "getaddressdeltas {\"addresses\": [\"address\", ...], \"start\": n, \"end\": n}\n"
+            "\nReturns all changes for transparent addresses (requires -addressindex).\n"
+            "\nArguments:\n"
+            "{\n"
+            "  \"addresses\"  (array) The base58check encoded addresses\n"
+            "  \"start\"      (number, optional) The start block height\n"
+            "  \"end\"        (number, optional) The end block height\n"
+            "}\n"
+            "\nResult:\n"
+            "[\n"
+            "  {\n"
+            "    \"satoshis\"    (number) The difference of patoshis\n"
+            "    \"txid\"        (string) The related txid\n"
+            "    \"index\"       (number) The related input or output index\n"
+            "    \"blockindex\"  (number) The position of the transaction in the block\n"
+            "    \"height\"      (number) The block height\n"
+            "    \"address\"     (string) The base58check encoded address\n"
+            "  }\n"
+            "]\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getaddressdeltas", "'{\"addresses\": [\"Ptor9ydHJuGpNWFAX3ZTu3bXevEhCaDVrsY\"]}'")
+            + HelpExampleRpc("getaddressdeltas", "{\"addresses\": [\"Ptor9ydHJuGpNWFAX3ZTu3bXevEhCaDVrsY\"]}")
+        );
+
+    UniValue request = getAddressRequest(params);
+    int start, end;
+    getHeightRangeFromParams(request, start, end);
+
+    std::vector<std::pair<uint160, uint8_t> > addresses;
+    getAddressesFromParams(request, addresses);
+
+    UniValue result(UniValue::VARR);
+    for (const auto& address : addresses) {
+        std::vector<std::pair<CAddressIndexKey, CAmount> > addressIndex;
+        if (!GetAddressIndex(address.first, address.second, addressIndex, start, end))
+            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "No information available for address");
+
+        std::string strAddress;
+        if (!getAddressFromIndex(address.second, address.first, strAddress))
+            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Unknown address type");
+
+        for (const auto& it : addressIndex) {
+            UniValue delta(UniValue::VOBJ);
+            delta.push_back(Pair("satoshis", it.second));
+            delta.push_back(Pair("txid", it.first.txhash.GetHex()));
+            delta.push_back(Pair("index", (int) it.first.index));
+            delta.push_back(Pair("blockindex", (int) it.first.txindex));
+            delta.push_back(Pair("height", it.first.blockHeight));
+            delta.push_back(Pair("address", strAddress));
+            result.push_back(delta);
+        }
+    }
+    return result;
+}
+
+UniValue getaddresstxids(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 1)
+        throw runtime_error(
+            "getaddresstxids \"address\" | {\"addresses\": [\"address\", ...], \"start\": n, \"end\": n}\n"
+            "\nReturns the txids of transparent addresses (requires -addressindex).\n"
+            "\nArguments:\n"
+            "1. \"address\"      (string) The base58check encoded address\n"
+            "   or\n"
+            "   {\n"
+            "     \"addresses\"  (array) The base58check encoded addresses\n"
+            "     \"start\"      (number, optional) The start block height\n"
+            "     \"end\"        (number, optional) The end block height\n"
+            "   }\n"
+            "\nResult:\n"
+            "[\n"
+            "  \"transactionid\"  (string) The transaction id\n"
+            "  ,...\n"
+            "]\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getaddresstxids", "'{\"addresses\": [\"Ptor9ydHJuGpNWFAX3ZTu3bXevEhCaDVrsY\"]}'")
+            + HelpExampleRpc("getaddresstxids", "{\"addresses\": [\"Ptor9ydHJuGpNWFAX3ZTu3bXevEhCaDVrsY\"]}")
+        );
+
+    UniValue request = getAddressRequest(params);
+    int start, end;
+    getHeightRangeFromParams(request, start, end);
+
+    std::vector<std::pair<uint160, uint8_t> > addresses;
+    getAddressesFromParams(request, addresses);
+
+    std::vector<std::pair<CAddressIndexKey, CAmount> > addressIndex;
+    for (const auto& address : addresses) {
+        if (!GetAddressIndex(address.first, address.second, addressIndex, start, end))
+            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "No information available for address");
+    }
+
+    // order by height and position in the block, each txid once
+    std::set<std::pair<std::pair<int, unsigned int>, uint256> > txids;
+    for (const auto& it : addressIndex)
+        txids.insert(std::make_pair(std::make_pair(it.first.blockHeight, it.first.txindex), it.first.txhash));
+
+    UniValue result(UniValue::VARR);
+    for (const auto& it : txids)
+        result.push_back(it.second.GetHex());
+    return result;
+}
+
+UniValue getspentinfo(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 1 || !params[0].isObject())
+        throw runtime_error(
+            "getspentinfo {\"txid\": \"txid\", \"index\": n}\n"
+            "\nReturns the txid and index where an output is spent (requires -spentindex).\n"
+            "\nArguments:\n"
+            "{\n"
+            "  \"txid\"   (string) The hex string of the txid\n"
+            "  \"index\"  (number) The output number\n"
+            "}\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"txid\"    (string) The transaction id\n"
+            "  \"index\"   (number) The spending input index\n"
+            "  \"height\"  (number) The height of the spending block\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getspentinfo", "'{\"txid\": \"0437cd7f8525ceed2324359c2d0ba26006d92d856a9c20fa0241106ee5a597c9\", \"index\": 0}'")
+            + HelpExampleRpc("getspentinfo", "{\"txid\": \"0437cd7f8525ceed2324359c2d0ba26006d92d856a9c20fa0241106ee5a597c9\", \"index\": 0}")
+        );
+
+    UniValue txidValue = find_value(params[0].get_obj(), "txid");
+    UniValue indexValue = find_value(params[0].get_obj(), "index");
+    if (!txidValue.isStr() || !indexValue.isNum())
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid txid or index");
+
+    CSpentIndexKey key(ParseHashV(txidValue, "txid"), indexValue.get_int());
+    CSpentIndexValue value;
+    if (!GetSpentIndex(key, value))
+        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Unable to get spent info");
+
+    UniValue result(UniValue::VOBJ);
+    result.push_back(Pair("txid", value.txid.GetHex()));
+    result.push_back(Pair("index", (int) value.inputIndex));
+    result.push_back(Pair("height", value.blockHeight));
+    return result;
+}
+
 static const CRPCCommand commands[] =
 { //  category              name                      actor (function)         okSafeMode
   //  --------------------- ------------------------  -----------------------  ----------
@@ -492,6 +816,13 @@ static const CRPCCommand commands[] =
     { "util",               "createmultisig",         &createmultisig,         true  },
     { "util",               "verifymessage",          &verifymessage,          true  },
 
+    /* Address index */
+    { "addressindex",       "getaddressbalance",      &getaddressbalance,      false },
+    { "addressindex",       "getaddressutxos",        &getaddressutxos,        false },
+    { "addressindex",       "getaddressdeltas",       &getaddressdeltas,       false },
+    { "addressindex",       "getaddresstxids",        &getaddresstxids,        false },
+    { "blockchain",         "getspentinfo",           &getspentinfo,           false },
+
     /* Not shown in help */
     { "hidden",             "setmocktime",            &setmocktime,            true  },
 };
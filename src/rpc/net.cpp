@@ -75,6 +75,24 @@ static void CopyNodeStats(std::vector<CNodeStats>& vstats)
     }
 }
 
+static UniValue MsgStatsToJSON(const mapMsgCmdStats& mapStats)
+{
+    UniValue ret(UniValue::VOBJ);
+    for (const auto& it : mapStats) {
+        const CNetMsgStats& stats = it.second;
+        UniValue obj(UniValue::VOBJ);
+        obj.push_back(Pair("recvmsgs", stats.nRecvMsgs));
+        obj.push_back(Pair("recvbytes", stats.nRecvBytes));
+        obj.push_back(Pair("sentmsgs", stats.nSendMsgs));
+        obj.push_back(Pair("sentbytes", stats.nSendBytes));
+        obj.push_back(Pair("processtime", ((double)stats.nProcessTime) / 1e6));
+        obj.push_back(Pair("maxprocesstime", ((double)stats.nMaxProcessTime) / 1e6));
+        obj.push_back(Pair("lockwait", ((double)stats.nLockWaitTime) / 1e6));
+        ret.push_back(Pair(it.first, obj));
+    }
+    return ret;
+}
+
 UniValue getpeerinfo(const UniValue& params, bool fHelp)
 {
     if (fHelp || params.size() != 0)
@@ -106,7 +124,12 @@ UniValue getpeerinfo(const UniValue& params, bool fHelp)
             "    \"inflight\": [\n"
             "       n,                        (numeric) The heights of blocks we're currently asking from this peer\n"
             "       ...\n"
-            "    ]\n"
+            "    ],\n"
+            "    \"whitelisted\": true|false, (boolean) Whether the peer is whitelisted\n"
+            "    \"msgstats\": {             (object) Message counters of this peer by command, see getnetmsgstats\n"
+            "       \"command\": { ... }\n"
+            "       ...\n"
+            "    }\n"
             "  }\n"
             "  ,...\n"
             "]\n"
@@ -158,6 +181,7 @@ UniValue getpeerinfo(const UniValue& params, bool fHelp)
             obj.push_back(Pair("inflight", heights));
         }
         obj.push_back(Pair("whitelisted", stats.fWhitelisted));
+        obj.push_back(Pair("msgstats", MsgStatsToJSON(stats.mapMsgStats)));
 
         ret.push_back(obj);
     }
@@ -599,6 +623,65 @@ UniValue clearbanned(const UniValue& params, bool fHelp)
     return NullUniValue;
 }
 
+UniValue getnetmsgstats(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() > 1)
+        throw runtime_error(
+            "getnetmsgstats ( pernode )\n"
+            "\nReturns message counters and processing times by command, since startup and\n"
+            "including disconnected peers. Times are in decimal seconds.\n"
+            "\nArguments:\n"
+            "1. pernode    (boolean, optional, default=false) Also break the counters down by connected peer\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"totals\": {\n"
+            "    \"command\": {\n"
+            "      \"recvmsgs\": n,          (numeric) Messages received and processed\n"
+            "      \"recvbytes\": n,         (numeric) Bytes received, including headers\n"
+            "      \"sentmsgs\": n,          (numeric) Messages sent\n"
+            "      \"sentbytes\": n,         (numeric) Bytes sent, including headers\n"
+            "      \"processtime\": n,       (numeric) Total time spent processing the received messages\n"
+            "      \"maxprocesstime\": n,    (numeric) Longest time spent processing one message\n"
+            "      \"lockwait\": n           (numeric) Time spent waiting for cs_main while processing\n"
+            "    }, ...\n"
+            "  },\n"
+            "  \"nodes\": [                 (array) Only with pernode=true\n"
+            "    {\n"
+            "      \"id\": n,                (numeric) Peer index\n"
+            "      \"addr\": \"host:port\",   (string) The ip address and port of the peer\n"
+            "      \"msgstats\": { ... }     (object) Counters of this peer, same format as totals\n"
+            "    }, ...\n"
+            "  ]\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getnetmsgstats", "true")
+            + HelpExampleRpc("getnetmsgstats", "true")
+        );
+
+    bool fPerNode = params.size() > 0 && params[0].get_bool();
+
+    mapMsgCmdStats mapTotals;
+    CNode::GetTotalMsgStats(mapTotals);
+
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("totals", MsgStatsToJSON(mapTotals)));
+    if (fPerNode) {
+        vector<CNodeStats> vstats;
+        CopyNodeStats(vstats);
+
+        UniValue nodes(UniValue::VARR);
+        for (const CNodeStats& stats : vstats) {
+            UniValue obj(UniValue::VOBJ);
+            obj.push_back(Pair("id", stats.nodeid));
+            obj.push_back(Pair("addr", stats.addrName));
+            obj.push_back(Pair("msgstats", MsgStatsToJSON(stats.mapMsgStats)));
+            nodes.push_back(obj);
+        }
+        ret.push_back(Pair("nodes", nodes));
+    }
+    return ret;
+}
+
 static const CRPCCommand commands[] =
 { //  category              name                      actor (function)         okSafeMode
   //  --------------------- ------------------------  -----------------------  ----------
@@ -610,6 +693,7 @@ static const CRPCCommand commands[] =
     { "network",            "disconnectnode",         &disconnectnode,         true  },
     { "network",            "getaddednodeinfo",       &getaddednodeinfo,       true  },
     { "network",            "getnettotals",           &getnettotals,           true  },
+    { "network",            "getnetmsgstats",         &getnetmsgstats,         true  },
     { "network",            "getnetworkinfo",         &getnetworkinfo,         true  },
     { "network",            "setban",                 &setban,                 true  },
     { "network",            "listbanned",             &listbanned,             true  },
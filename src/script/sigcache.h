@@ -10,12 +10,26 @@
 
 #include <vector>
 
-// DoS prevention: limit cache size to less than 40MB (over 500000
-// entries on 64-bit systems).
+// DoS prevention: limit cache size to 40MB (over 1300000 entries of 32
+// bytes each).
 static const unsigned int DEFAULT_MAX_SIG_CACHE_SIZE = 40;
 
 class CPubKey;
 
+/** Signature cache size and lookup counters since startup */
+struct CSignatureCacheStats
+{
+    size_t nBytes;
+    uint64_t nHits;
+    uint64_t nMisses;
+
+    CSignatureCacheStats() : nBytes(0), nHits(0), nMisses(0) {}
+};
+
+/** Allocate the signature cache according to -maxsigcachesize */
+void InitSignatureCache();
+void GetSignatureCacheStats(CSignatureCacheStats& stats);
+
 class CachingTransactionSignatureChecker : public TransactionSignatureChecker
 {
 private:
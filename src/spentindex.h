@@ -0,0 +1,80 @@
+// Copyright (c) 2018 The Pastel developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_SPENTINDEX_H
+#define BITCOIN_SPENTINDEX_H
+
+#include "amount.h"
+#include "serialize.h"
+#include "uint256.h"
+
+/** Key of the spent index: the output being spent */
+struct CSpentIndexKey
+{
+    uint256 txid;
+    unsigned int outputIndex;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(txid);
+        READWRITE(outputIndex);
+    }
+
+    CSpentIndexKey() { SetNull(); }
+
+    CSpentIndexKey(const uint256& t, unsigned int i) : txid(t), outputIndex(i) {}
+
+    void SetNull()
+    {
+        txid.SetNull();
+        outputIndex = 0;
+    }
+};
+
+/**
+ * Value of the spent index: the input spending the output and the spent
+ * amount and address. A null value erases the entry.
+ */
+struct CSpentIndexValue
+{
+    uint256 txid;
+    unsigned int inputIndex;
+    int blockHeight;
+    CAmount satoshis;
+    uint8_t addressType;
+    uint160 addressHash;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(txid);
+        READWRITE(inputIndex);
+        READWRITE(blockHeight);
+        READWRITE(satoshis);
+        READWRITE(addressType);
+        READWRITE(addressHash);
+    }
+
+    CSpentIndexValue() { SetNull(); }
+
+    CSpentIndexValue(const uint256& t, unsigned int i, int h, CAmount s, uint8_t type, const uint160& a) :
+        txid(t), inputIndex(i), blockHeight(h), satoshis(s), addressType(type), addressHash(a) {}
+
+    void SetNull()
+    {
+        txid.SetNull();
+        inputIndex = 0;
+        blockHeight = 0;
+        satoshis = 0;
+        addressType = 0;
+        addressHash.SetNull();
+    }
+
+    bool IsNull() const { return txid.IsNull(); }
+};
+
+#endif // BITCOIN_SPENTINDEX_H
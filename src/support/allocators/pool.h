@@ -0,0 +1,214 @@
+// Copyright (c) 2018 The Pastel developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_SUPPORT_ALLOCATORS_POOL_H
+#define BITCOIN_SUPPORT_ALLOCATORS_POOL_H
+
+#include <array>
+#include <cassert>
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+/**
+ * Memory resource for node based containers that allocate many blocks of the
+ * same few sizes and free them in random order, like the coins cache.
+ *
+ * Blocks of up to MAX_BLOCK_SIZE_BYTES are carved out of large chunks, one
+ * after the other, so nodes allocated together sit next to each other in
+ * memory and there is no per-block malloc overhead. Freed blocks go to a
+ * free list for their size and are reused before the chunk is extended.
+ * Memory is only given back to the system when the resource is destroyed.
+ * Larger blocks, e.g. hash table bucket arrays, are passed through to
+ * operator new.
+ *
+ * Not thread safe, like the containers using it.
+ */
+template <std::size_t MAX_BLOCK_SIZE_BYTES, std::size_t ALIGN_BYTES>
+class PoolResource
+{
+private:
+    struct ListNode
+    {
+        ListNode* pNext;
+        explicit ListNode(ListNode* pNextIn) : pNext(pNextIn) {}
+    };
+
+    static_assert(ALIGN_BYTES > 0 && (ALIGN_BYTES & (ALIGN_BYTES - 1)) == 0, "ALIGN_BYTES must be a power of two");
+    static_assert(ALIGN_BYTES <= alignof(std::max_align_t), "chunks from operator new must be suitably aligned");
+
+    //! Blocks are multiples of this, which must also hold a free list node
+    static const std::size_t ELEM_ALIGN_BYTES = ALIGN_BYTES > alignof(ListNode) ? ALIGN_BYTES : alignof(ListNode);
+    static const std::size_t NUM_FREE_LISTS = (MAX_BLOCK_SIZE_BYTES + ELEM_ALIGN_BYTES - 1) / ELEM_ALIGN_BYTES + 1;
+
+    const std::size_t nChunkSizeBytes;
+    std::vector<char*> vChunks;
+    //! Free lists by size in units of ELEM_ALIGN_BYTES
+    std::array<ListNode*, NUM_FREE_LISTS> freeLists;
+    //! The unused end of the newest chunk
+    char* pAvailableBegin;
+    char* pAvailableEnd;
+    //! Bytes currently held by allocations that bypass the pool
+    std::size_t nLargeBytes;
+
+    static std::size_t NumElemAlignBytes(std::size_t nBytes)
+    {
+        return (nBytes + ELEM_ALIGN_BYTES - 1) / ELEM_ALIGN_BYTES + (nBytes == 0);
+    }
+
+    static bool IsFreeListUsable(std::size_t nBytes, std::size_t nAlignment)
+    {
+        return nAlignment <= ELEM_ALIGN_BYTES && nBytes <= MAX_BLOCK_SIZE_BYTES;
+    }
+
+    void PushFree(void* p, std::size_t nIndex)
+    {
+        freeLists[nIndex] = new (p) ListNode(freeLists[nIndex]);
+    }
+
+    void AllocateChunk()
+    {
+        // the rest of the current chunk is too small for the request, keep it as a free block
+        std::size_t nRemaining = pAvailableEnd - pAvailableBegin;
+        if (nRemaining > 0)
+            PushFree(pAvailableBegin, nRemaining / ELEM_ALIGN_BYTES);
+
+        char* pChunk = static_cast<char*>(::operator new(nChunkSizeBytes));
+        vChunks.push_back(pChunk);
+        pAvailableBegin = pChunk;
+        pAvailableEnd = pChunk + nChunkSizeBytes;
+    }
+
+    PoolResource(const PoolResource&);
+    PoolResource& operator=(const PoolResource&);
+
+public:
+    static const std::size_t DEFAULT_CHUNK_SIZE_BYTES = 256 * 1024;
+
+    explicit PoolResource(std::size_t nChunkSizeBytesIn = DEFAULT_CHUNK_SIZE_BYTES) :
+        nChunkSizeBytes(nChunkSizeBytesIn / ELEM_ALIGN_BYTES * ELEM_ALIGN_BYTES),
+        pAvailableBegin(NULL), pAvailableEnd(NULL), nLargeBytes(0)
+    {
+        assert(nChunkSizeBytes >= (NUM_FREE_LISTS - 1) * ELEM_ALIGN_BYTES);
+        freeLists.fill(NULL);
+    }
+
+    ~PoolResource()
+    {
+        for (char* pChunk : vChunks)
+            ::operator delete(pChunk);
+    }
+
+    void* Allocate(std::size_t nBytes, std::size_t nAlignment)
+    {
+        if (!IsFreeListUsable(nBytes, nAlignment)) {
+            void* p = ::operator new(nBytes);
+            nLargeBytes += nBytes;
+            return p;
+        }
+
+        const std::size_t nIndex = NumElemAlignBytes(nBytes);
+        if (freeLists[nIndex] != NULL) {
+            ListNode* pNode = freeLists[nIndex];
+            freeLists[nIndex] = pNode->pNext;
+            return pNode;
+        }
+        const std::size_t nRoundBytes = nIndex * ELEM_ALIGN_BYTES;
+        if (nRoundBytes > (std::size_t)(pAvailableEnd - pAvailableBegin))
+            AllocateChunk();
+        void* p = pAvailableBegin;
+        pAvailableBegin += nRoundBytes;
+        return p;
+    }
+
+    void Deallocate(void* p, std::size_t nBytes, std::size_t nAlignment)
+    {
+        if (!IsFreeListUsable(nBytes, nAlignment)) {
+            nLargeBytes -= nBytes;
+            ::operator delete(p);
+            return;
+        }
+        PushFree(p, NumElemAlignBytes(nBytes));
+    }
+
+    std::size_t NumAllocatedChunks() const { return vChunks.size(); }
+    std::size_t ChunkSizeBytes() const { return nChunkSizeBytes; }
+    std::size_t LargeBytes() const { return nLargeBytes; }
+};
+
+/**
+ * Allocator handing out memory from a PoolResource. Copies, including ones
+ * rebound to other types, share the resource, which must outlive them.
+ */
+template <class T, std::size_t MAX_BLOCK_SIZE_BYTES, std::size_t ALIGN_BYTES>
+class PoolAllocator
+{
+public:
+    typedef PoolResource<MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES> ResourceType;
+
+    typedef T value_type;
+    typedef T* pointer;
+    typedef const T* const_pointer;
+    typedef T& reference;
+    typedef const T& const_reference;
+    typedef std::size_t size_type;
+    typedef std::ptrdiff_t difference_type;
+
+    template <typename U>
+    struct rebind {
+        typedef PoolAllocator<U, MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES> other;
+    };
+
+    PoolAllocator(ResourceType* pResourceIn) : pResource(pResourceIn) {}
+
+    template <typename U>
+    PoolAllocator(const PoolAllocator<U, MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES>& other) : pResource(other.resource()) {}
+
+    T* allocate(std::size_t n, const void* = NULL)
+    {
+        return static_cast<T*>(pResource->Allocate(n * sizeof(T), alignof(T)));
+    }
+
+    void deallocate(T* p, std::size_t n)
+    {
+        pResource->Deallocate(p, n * sizeof(T), alignof(T));
+    }
+
+    std::size_t max_size() const { return std::size_t(-1) / sizeof(T); }
+
+    template <typename U, typename... Args>
+    void construct(U* p, Args&&... args)
+    {
+        ::new ((void*)p) U(std::forward<Args>(args)...);
+    }
+
+    template <typename U>
+    void destroy(U* p)
+    {
+        p->~U();
+    }
+
+    ResourceType* resource() const { return pResource; }
+
+private:
+    ResourceType* pResource;
+};
+
+template <class T1, class T2, std::size_t MAX_BLOCK_SIZE_BYTES, std::size_t ALIGN_BYTES>
+bool operator==(const PoolAllocator<T1, MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES>& a,
+                const PoolAllocator<T2, MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES>& b)
+{
+    return a.resource() == b.resource();
+}
+
+template <class T1, class T2, std::size_t MAX_BLOCK_SIZE_BYTES, std::size_t ALIGN_BYTES>
+bool operator!=(const PoolAllocator<T1, MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES>& a,
+                const PoolAllocator<T2, MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES>& b)
+{
+    return !(a == b);
+}
+
+#endif // BITCOIN_SUPPORT_ALLOCATORS_POOL_H
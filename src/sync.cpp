@@ -20,6 +20,40 @@ void PrintLockContention(const char* pszName, const char* pszFile, int nLine)
 }
 #endif /* DEBUG_LOCKCONTENTION */
 
+struct LockWaitWatch {
+    void* cs;
+    int64_t nWaitTime;
+};
+static boost::thread_specific_ptr<LockWaitWatch> lockwaitwatch;
+
+void WatchLockWait(void* cs)
+{
+    if (!lockwaitwatch.get())
+        lockwaitwatch.reset(new LockWaitWatch());
+    lockwaitwatch->cs = cs;
+    lockwaitwatch->nWaitTime = 0;
+}
+
+int64_t GetLockWaitTime()
+{
+    return lockwaitwatch.get() ? lockwaitwatch->nWaitTime : 0;
+}
+
+int64_t LockWaitStart(void* cs)
+{
+    LockWaitWatch* watch = lockwaitwatch.get();
+    if (!watch || watch->cs != cs)
+        return 0;
+    return GetTimeMicros();
+}
+
+void LockWaitStop(int64_t nStart)
+{
+    LockWaitWatch* watch = lockwaitwatch.get();
+    if (watch)
+        watch->nWaitTime += GetTimeMicros() - nStart;
+}
+
 #ifdef DEBUG_LOCKORDER
 //
 // Early deadlock detection.
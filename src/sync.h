@@ -99,6 +99,17 @@ void static inline AssertLockHeldInternal(const char* pszName, const char* pszFi
 void PrintLockContention(const char* pszName, const char* pszFile, int nLine);
 #endif
 
+/**
+ * Lock wait profiling: a thread may watch one mutex and accumulate the time
+ * it spends blocked acquiring it with LOCK().
+ */
+void WatchLockWait(void* cs);
+/** Total time (in usec) the current thread has waited for its watched mutex */
+int64_t GetLockWaitTime();
+/** Start timing a contended lock; returns 0 if the mutex isn't watched by this thread */
+int64_t LockWaitStart(void* cs);
+void LockWaitStop(int64_t nStart);
+
 /** Wrapper around boost::unique_lock<Mutex> */
 template <typename Mutex>
 class SCOPED_LOCKABLE CMutexLock
@@ -109,14 +120,15 @@ private:
     void Enter(const char* pszName, const char* pszFile, int nLine)
     {
         EnterCritical(pszName, pszFile, nLine, (void*)(lock.mutex()));
-#ifdef DEBUG_LOCKCONTENTION
         if (!lock.try_lock()) {
+#ifdef DEBUG_LOCKCONTENTION
             PrintLockContention(pszName, pszFile, nLine);
 #endif
+            int64_t nWaitStart = LockWaitStart((void*)(lock.mutex()));
             lock.lock();
-#ifdef DEBUG_LOCKCONTENTION
+            if (nWaitStart)
+                LockWaitStop(nWaitStart);
         }
-#endif
     }
 
     bool TryEnter(const char* pszName, const char* pszFile, int nLine)
@@ -0,0 +1,126 @@
+// Copyright (c) 2018 The Pastel developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "addressindex.h"
+#include "pubkey.h"
+#include "script/standard.h"
+#include "spentindex.h"
+#include "streams.h"
+#include "txdb.h"
+#include "utilstrencodings.h"
+#include "test/test_bitcoin.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(addressindex_tests, TestingSetup)
+
+BOOST_AUTO_TEST_CASE(address_index_type)
+{
+    uint160 hash = uint160(ParseHex("0102030405060708090a0b0c0d0e0f1011121314"));
+    uint160 hashBytes;
+
+    BOOST_CHECK_EQUAL(GetAddressIndexType(GetScriptForDestination(CKeyID(hash)), hashBytes), ADDRESS_INDEX_P2PKH);
+    BOOST_CHECK(hashBytes == hash);
+
+    hashBytes.SetNull();
+    BOOST_CHECK_EQUAL(GetAddressIndexType(GetScriptForDestination(CScriptID(hash)), hashBytes), ADDRESS_INDEX_P2SH);
+    BOOST_CHECK(hashBytes == hash);
+
+    // bare pubkeys and arbitrary scripts are not indexed
+    CScript script = CScript() << std::vector<unsigned char>(33, 2) << OP_CHECKSIG;
+    BOOST_CHECK_EQUAL(GetAddressIndexType(script, hashBytes), ADDRESS_INDEX_NONE);
+    BOOST_CHECK_EQUAL(GetAddressIndexType(CScript() << OP_RETURN, hashBytes), ADDRESS_INDEX_NONE);
+}
+
+BOOST_AUTO_TEST_CASE(address_index_key_order)
+{
+    // Serialized keys must sort by height first so range queries are seeks
+    uint160 hash = uint160(ParseHex("0102030405060708090a0b0c0d0e0f1011121314"));
+    uint256 txid = uint256S("ff");
+    const int heights[] = { 1, 255, 256, 65536, 1 << 24 };
+
+    std::string prev;
+    for (int height : heights) {
+        CDataStream ss(SER_DISK, 0);
+        ss << CAddressIndexKey(ADDRESS_INDEX_P2PKH, hash, height, 0, txid, 0, false);
+        std::string key = ss.str();
+        BOOST_CHECK(prev < key);
+        prev = key;
+
+        CAddressIndexKey read;
+        ss >> read;
+        BOOST_CHECK_EQUAL(read.blockHeight, height);
+        BOOST_CHECK(read.hashBytes == hash);
+        BOOST_CHECK(read.txhash == txid);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(address_index_db)
+{
+    CBlockTreeDB db(1 << 20, true);
+    uint160 hash1 = uint160(std::vector<unsigned char>(20, 1));
+    uint160 hash2 = uint160(std::vector<unsigned char>(20, 2));
+    uint256 txid1 = uint256S("aa");
+    uint256 txid2 = uint256S("bb");
+
+    std::vector<std::pair<CAddressIndexKey, CAmount> > vIndex;
+    vIndex.push_back(std::make_pair(CAddressIndexKey(ADDRESS_INDEX_P2PKH, hash1, 10, 1, txid1, 0, false), 500));
+    vIndex.push_back(std::make_pair(CAddressIndexKey(ADDRESS_INDEX_P2PKH, hash1, 20, 3, txid2, 1, true), -500));
+    vIndex.push_back(std::make_pair(CAddressIndexKey(ADDRESS_INDEX_P2PKH, hash2, 20, 3, txid2, 0, false), 400));
+    BOOST_CHECK(db.WriteAddressIndex(vIndex));
+
+    std::vector<std::pair<CAddressIndexKey, CAmount> > vRead;
+    BOOST_CHECK(db.ReadAddressIndex(hash1, ADDRESS_INDEX_P2PKH, vRead));
+    BOOST_CHECK_EQUAL(vRead.size(), 2);
+    BOOST_CHECK_EQUAL(vRead[0].second, 500);
+    BOOST_CHECK_EQUAL(vRead[1].second, -500);
+
+    // the same hash of another address type is a different address
+    vRead.clear();
+    BOOST_CHECK(db.ReadAddressIndex(hash1, ADDRESS_INDEX_P2SH, vRead));
+    BOOST_CHECK(vRead.empty());
+
+    // height range
+    vRead.clear();
+    BOOST_CHECK(db.ReadAddressIndex(hash1, ADDRESS_INDEX_P2PKH, vRead, 15, 30));
+    BOOST_CHECK_EQUAL(vRead.size(), 1);
+    BOOST_CHECK(vRead[0].first.txhash == txid2);
+
+    vRead.clear();
+    BOOST_CHECK(db.EraseAddressIndex(std::vector<std::pair<CAddressIndexKey, CAmount> >(1, vIndex[1])));
+    BOOST_CHECK(db.ReadAddressIndex(hash1, ADDRESS_INDEX_P2PKH, vRead));
+    BOOST_CHECK_EQUAL(vRead.size(), 1);
+
+    // unspent outputs are added and removed by a null value
+    CScript script = GetScriptForDestination(CKeyID(hash1));
+    std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > vUnspent;
+    vUnspent.push_back(std::make_pair(CAddressUnspentKey(ADDRESS_INDEX_P2PKH, hash1, txid1, 0), CAddressUnspentValue(500, script, 10)));
+    vUnspent.push_back(std::make_pair(CAddressUnspentKey(ADDRESS_INDEX_P2PKH, hash1, txid2, 0), CAddressUnspentValue(300, script, 20)));
+    vUnspent.push_back(std::make_pair(CAddressUnspentKey(ADDRESS_INDEX_P2PKH, hash1, txid1, 0), CAddressUnspentValue()));
+    BOOST_CHECK(db.UpdateAddressUnspentIndex(vUnspent));
+
+    std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > vUnspentRead;
+    BOOST_CHECK(db.ReadAddressUnspentIndex(hash1, ADDRESS_INDEX_P2PKH, vUnspentRead));
+    BOOST_CHECK_EQUAL(vUnspentRead.size(), 1);
+    BOOST_CHECK(vUnspentRead[0].first.txhash == txid2);
+    BOOST_CHECK_EQUAL(vUnspentRead[0].second.satoshis, 300);
+    BOOST_CHECK(vUnspentRead[0].second.script == script);
+
+    // spent index
+    std::vector<std::pair<CSpentIndexKey, CSpentIndexValue> > vSpent;
+    vSpent.push_back(std::make_pair(CSpentIndexKey(txid1, 0), CSpentIndexValue(txid2, 1, 20, 500, ADDRESS_INDEX_P2PKH, hash1)));
+    BOOST_CHECK(db.UpdateSpentIndex(vSpent));
+    CSpentIndexValue spent;
+    BOOST_CHECK(db.ReadSpentIndex(CSpentIndexKey(txid1, 0), spent));
+    BOOST_CHECK(spent.txid == txid2);
+    BOOST_CHECK_EQUAL(spent.inputIndex, 1);
+    BOOST_CHECK_EQUAL(spent.blockHeight, 20);
+    BOOST_CHECK(!db.ReadSpentIndex(CSpentIndexKey(txid1, 1), spent));
+
+    vSpent[0].second.SetNull();
+    BOOST_CHECK(db.UpdateSpentIndex(vSpent));
+    BOOST_CHECK(!db.ReadSpentIndex(CSpentIndexKey(txid1, 0), spent));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
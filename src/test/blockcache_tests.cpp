@@ -0,0 +1,128 @@
+// Copyright (c) 2018 The Pastel developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "blockcache.h"
+#include "chainparams.h"
+#include "main.h"
+#include "random.h"
+#include "streams.h"
+#include "version.h"
+#include "test/test_bitcoin.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(blockcache_tests, TestingSetup)
+
+static std::shared_ptr<const CBlock> MakeBlock(uint32_t nNonce)
+{
+    std::shared_ptr<CBlock> pblock = std::make_shared<CBlock>();
+    pblock->nTime = nNonce;
+    return pblock;
+}
+
+BOOST_AUTO_TEST_CASE(block_cache_lru)
+{
+    CBlockCache cache(2);
+    std::shared_ptr<const CBlock> p1 = MakeBlock(1), p2 = MakeBlock(2), p3 = MakeBlock(3);
+
+    cache.Insert(p1->GetHash(), p1);
+    cache.Insert(p2->GetHash(), p2);
+    BOOST_CHECK_EQUAL(cache.Size(), 2);
+
+    // touching p1 makes p2 the least recently used block
+    BOOST_CHECK(cache.Get(p1->GetHash()) == p1);
+    cache.Insert(p3->GetHash(), p3);
+    BOOST_CHECK_EQUAL(cache.Size(), 2);
+    BOOST_CHECK(cache.Get(p1->GetHash()) == p1);
+    BOOST_CHECK(!cache.Get(p2->GetHash()));
+    BOOST_CHECK(cache.Get(p3->GetHash()) == p3);
+
+    cache.SetMaxSize(1);
+    BOOST_CHECK_EQUAL(cache.Size(), 1);
+    BOOST_CHECK(cache.Get(p3->GetHash()) == p3);
+
+    // a zero sized cache keeps nothing
+    cache.SetMaxSize(0);
+    cache.Insert(p1->GetHash(), p1);
+    BOOST_CHECK_EQUAL(cache.Size(), 0);
+}
+
+BOOST_AUTO_TEST_CASE(mapped_block_files)
+{
+    CBlock block = Params().GenesisBlock();
+    CDiskBlockPos pos(1000, 0);
+    BOOST_CHECK(WriteBlockToDisk(block, pos, Params().MessageStart()));
+
+    CMappedBlockFiles files;
+    CBlock read;
+    BOOST_CHECK(files.ReadBlock(pos, read));
+    BOOST_CHECK(read.GetHash() == block.GetHash());
+    BOOST_CHECK_EQUAL(read.vtx.size(), block.vtx.size());
+
+    // reading past the end of the mapping fails like a file would
+    CDiskBlockPos posEnd(1000, 1 << 30);
+    BOOST_CHECK_THROW(files.ReadBlock(posEnd, read), std::ios_base::failure);
+
+    // a missing file can't be mapped and is left to the normal reader
+    files.Release(1000);
+    BOOST_CHECK(!files.ReadBlock(CDiskBlockPos(1001, 0), read));
+}
+
+BOOST_AUTO_TEST_CASE(raw_block_read)
+{
+    CBlock block = Params().GenesisBlock();
+    CDiskBlockPos pos(1002, 0);
+    BOOST_CHECK(WriteBlockToDisk(block, pos, Params().MessageStart()));
+
+    // the stored bytes are the network serialization of the block
+    CDataStream ssBlock(SER_NETWORK, PROTOCOL_VERSION);
+    ssBlock << block;
+    std::vector<char> vchBlock;
+    BOOST_CHECK(ReadRawBlockFromDisk(vchBlock, pos, Params().MessageStart()));
+    BOOST_CHECK(vchBlock == std::vector<char>(ssBlock.begin(), ssBlock.end()));
+
+    CMappedBlockFiles files;
+    std::vector<char> vchMapped(vchBlock.size());
+    BOOST_CHECK(files.Read(pos, &vchMapped[0], vchMapped.size()));
+    BOOST_CHECK(vchMapped == vchBlock);
+
+    // the block must be preceded by the network magic
+    CMessageHeader::MessageStartChars otherStart = {0, 1, 2, 3};
+    BOOST_CHECK(!ReadRawBlockFromDisk(vchBlock, pos, otherStart));
+}
+
+BOOST_AUTO_TEST_CASE(raw_block_read_index)
+{
+    CBlock block = Params().GenesisBlock();
+    CDiskBlockPos pos(1003, 0);
+    BOOST_CHECK(WriteBlockToDisk(block, pos, Params().MessageStart()));
+
+    uint256 hash = block.GetHash();
+    CBlockIndex index(block);
+    index.phashBlock = &hash;
+    index.nFile = pos.nFile;
+    index.nDataPos = pos.nPos;
+    index.nStatus |= BLOCK_HAVE_DATA;
+
+    CDataStream ssBlock(SER_NETWORK, PROTOCOL_VERSION);
+    ssBlock << block;
+    std::vector<char> vchBlock;
+    BOOST_CHECK(!blockCache.Get(hash));
+    BOOST_CHECK(ReadRawBlockFromDisk(vchBlock, &index, Params().MessageStart()));
+    BOOST_CHECK(vchBlock == std::vector<char>(ssBlock.begin(), ssBlock.end()));
+
+    // the file is still open for writing, so the block is kept for the next request
+    BOOST_CHECK(blockCache.Get(hash));
+    vchBlock.clear();
+    BOOST_CHECK(ReadRawBlockFromDisk(vchBlock, &index, Params().MessageStart()));
+    BOOST_CHECK(vchBlock == std::vector<char>(ssBlock.begin(), ssBlock.end()));
+
+    // bytes that aren't the indexed block are not served
+    uint256 hashOther = GetRandHash();
+    CBlockIndex indexOther(index);
+    indexOther.phashBlock = &hashOther;
+    BOOST_CHECK(!ReadRawBlockFromDisk(vchBlock, &indexOther, Params().MessageStart()));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
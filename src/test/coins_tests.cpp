@@ -13,9 +13,12 @@
 #include "undo.h"
 #include "primitives/transaction.h"
 #include "pubkey.h"
+#include "streams.h"
+#include "txdb.h"
 
 #include <vector>
 #include <map>
+#include <memory>
 
 #include <boost/test/unit_test.hpp>
 #include "zcash/IncrementalMerkleTree.hpp"
@@ -170,7 +173,8 @@ public:
                     CAnchorsSproutMap& mapSproutAnchors,
                     CAnchorsSaplingMap& mapSaplingAnchors,
                     CNullifiersMap& mapSproutNullifiers,
-                    CNullifiersMap& mapSaplingNullifiers)
+                    CNullifiersMap& mapSaplingNullifiers,
+                    const CCoinsRunningStats* pstatsRemoved)
     {
         for (CCoinsMap::iterator it = mapCoins.begin(); it != mapCoins.end(); ) {
             if (it->second.flags & CCoinsCacheEntry::DIRTY) {
@@ -221,6 +225,7 @@ public:
         BOOST_CHECK_EQUAL(DynamicMemoryUsage(), ret);
     }
 
+    size_t CoinsMapUsage() const { return memusage::DynamicUsage(cacheCoins); }
 };
 
 class TxWithNullifiers
@@ -1091,4 +1096,171 @@ BOOST_AUTO_TEST_CASE(ccoins_serialization)
     }
 }
 
+BOOST_AUTO_TEST_CASE(coins_cache_pool)
+{
+    CCoinsViewTest base;
+    CCoinsViewCacheTest cache(&base);
+    BOOST_CHECK_EQUAL(cache.CoinsMapUsage(), 0);
+
+    for (int i = 0; i < 10000; i++) {
+        CCoinsModifier entry = cache.ModifyCoins(GetRandHash());
+        entry->nVersion = 1;
+        entry->vout.resize(1);
+        entry->vout[0].nValue = i;
+    }
+    // every node is accounted for, along with the unused rest of the pool
+    BOOST_CHECK(cache.CoinsMapUsage() >= 10000 * sizeof(CCoinsMap::value_type));
+    cache.SelfTest();
+
+    // flushing gives the pool back
+    BOOST_CHECK(cache.Flush());
+    BOOST_CHECK_EQUAL(cache.GetCacheSize(), 0);
+    BOOST_CHECK_EQUAL(cache.CoinsMapUsage(), 0);
+}
+
+BOOST_FIXTURE_TEST_CASE(coins_snapshot, TestingSetup)
+{
+    CCoinsViewDB db(1 << 20, true);
+    {
+        CCoinsViewCache cache(&db);
+        for (int i = 0; i < 3; i++) {
+            CCoinsModifier entry = cache.ModifyCoins(GetRandHash());
+            entry->nVersion = 1;
+            entry->nHeight = i + 1;
+            entry->vout.resize(1);
+            entry->vout[0].nValue = 1000 * (i + 1);
+        }
+        TxWithNullifiers txWithNullifiers;
+        cache.SetNullifiers(txWithNullifiers.tx, true);
+        SproutMerkleTree tree;
+        appendRandomSproutCommitment(tree);
+        cache.PushAnchor(tree);
+        cache.SetBestBlock(GetRandHash());
+        BOOST_CHECK(cache.Flush());
+    }
+
+    boost::filesystem::path path = pathTemp / "utxo.dat";
+    CCoinsSnapshotStats stats;
+    uint256 hashBlockSnapshot = db.GetBestBlock();
+    {
+        std::unique_ptr<CCoinsSnapshotWriter> pwriter(db.NewSnapshotWriter());
+        BOOST_REQUIRE(pwriter);
+
+        // the snapshot doesn't see writes made after it was taken
+        CCoinsViewCache cache(&db);
+        CCoinsModifier entry = cache.ModifyCoins(GetRandHash());
+        entry->nVersion = 1;
+        entry->nHeight = 4;
+        entry->vout.resize(1);
+        entry->vout[0].nValue = 4000;
+        cache.SetBestBlock(GetRandHash());
+        BOOST_CHECK(cache.Flush());
+
+        CAutoFile fileout(fopen(path.string().c_str(), "wb"), SER_DISK, CLIENT_VERSION);
+        BOOST_CHECK(pwriter->Write(fileout, stats));
+    }
+    BOOST_CHECK(stats.hashBlock == hashBlockSnapshot);
+    BOOST_CHECK(stats.hashBlock != db.GetBestBlock());
+    BOOST_CHECK_EQUAL(stats.nCoins, 3);
+    BOOST_CHECK_EQUAL(stats.nSproutNullifiers, 1);
+    BOOST_CHECK_EQUAL(stats.nSaplingNullifiers, 1);
+    BOOST_CHECK(stats.nSproutAnchors >= 1);
+
+    CCoinsSnapshotStats statsRead;
+    {
+        CAutoFile filein(fopen(path.string().c_str(), "rb"), SER_DISK, CLIENT_VERSION);
+        BOOST_CHECK(ReadCoinsSnapshot(filein, statsRead));
+    }
+    BOOST_CHECK(statsRead.hashSnapshot == stats.hashSnapshot);
+    BOOST_CHECK(statsRead.hashSproutAnchor == stats.hashSproutAnchor);
+    BOOST_CHECK_EQUAL(statsRead.nCoins, stats.nCoins);
+    // the coins in the file hash to the running hash of the database
+    BOOST_CHECK(!stats.hashCoinsMuHash.IsNull());
+    BOOST_CHECK(statsRead.hashCoinsMuHash == stats.hashCoinsMuHash);
+
+    // a damaged snapshot doesn't match its checksum
+    FILE* file = fopen(path.string().c_str(), "r+b");
+    fseek(file, -1, SEEK_END);
+    int ch = fgetc(file);
+    fseek(file, -1, SEEK_END);
+    fputc(ch ^ 1, file);
+    fclose(file);
+    CAutoFile filein(fopen(path.string().c_str(), "rb"), SER_DISK, CLIENT_VERSION);
+    BOOST_CHECK(!ReadCoinsSnapshot(filein, statsRead));
+}
+
+BOOST_FIXTURE_TEST_CASE(coins_running_stats, TestingSetup)
+{
+    CCoinsViewDB db(1 << 20, true);
+    uint256 txid1 = GetRandHash();
+    uint256 txid2 = GetRandHash();
+    {
+        CCoinsViewCache cache(&db);
+        for (const uint256 &txid : {txid1, txid2}) {
+            CCoinsModifier entry = cache.ModifyCoins(txid);
+            entry->nVersion = 1;
+            entry->vout.resize(2);
+            entry->vout[0].nValue = 100;
+            entry->vout[1].nValue = 200;
+        }
+        cache.SetBestBlock(GetRandHash());
+        BOOST_CHECK(cache.Flush());
+    }
+    {
+        // spend an output of one transaction and all of the other
+        CCoinsViewCache cache(&db);
+        BOOST_CHECK(cache.ModifyCoins(txid1)->Spend(0));
+        cache.ModifyCoins(txid2)->Clear();
+        cache.SetBestBlock(GetRandHash());
+        BOOST_CHECK(cache.Flush());
+    }
+
+    CCoinsStats stats;
+    BOOST_CHECK(db.GetRunningStats(stats));
+    BOOST_CHECK_EQUAL(stats.nTransactions, 1);
+    BOOST_CHECK_EQUAL(stats.nTransactionOutputs, 1);
+    BOOST_CHECK_EQUAL(stats.nTotalAmount, 200);
+
+    // the same as building the statistics from the final set
+    CCoins coins;
+    BOOST_CHECK(db.GetCoins(txid1, coins));
+    CCoinsRunningStats expected;
+    expected.Add(txid1, coins);
+    CCoinsStats statsExpected;
+    expected.GetStats(statsExpected);
+    BOOST_CHECK(stats.hashMuHash == statsExpected.hashMuHash);
+    BOOST_CHECK_EQUAL(stats.nSerializedSize, statsExpected.nSerializedSize);
+
+    uint256 txid3 = GetRandHash();
+    {
+        // as blocks are connected: through a cache on top of the one over the
+        // database, which already holds an unmodified copy of txid1
+        CCoinsViewCache cacheTip(&db);
+        BOOST_CHECK(cacheTip.AccessCoins(txid1));
+        CCoinsViewCache cache(&cacheTip);
+        cache.ModifyCoins(txid1)->vout.push_back(CTxOut(300, CScript()));
+        {
+            CCoinsModifier entry = cache.ModifyNewCoins(txid3);
+            entry->nVersion = 1;
+            entry->vout.resize(1);
+            entry->vout[0].nValue = 400;
+        }
+        BOOST_CHECK(cache.Flush());
+        cacheTip.SetBestBlock(GetRandHash());
+        BOOST_CHECK(cacheTip.Flush());
+    }
+
+    BOOST_CHECK(db.GetRunningStats(stats));
+    BOOST_CHECK_EQUAL(stats.nTransactions, 2);
+    BOOST_CHECK_EQUAL(stats.nTotalAmount, 900);
+    expected = CCoinsRunningStats();
+    BOOST_CHECK(db.GetCoins(txid1, coins));
+    expected.Add(txid1, coins);
+    BOOST_CHECK(db.GetCoins(txid3, coins));
+    expected.Add(txid3, coins);
+    expected.GetStats(statsExpected);
+    BOOST_CHECK(stats.hashMuHash == statsExpected.hashMuHash);
+    BOOST_CHECK_EQUAL(stats.nSerializedSize, statsExpected.nSerializedSize);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
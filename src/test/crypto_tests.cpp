@@ -8,6 +8,7 @@
 #include "crypto/sha512.h"
 #include "crypto/hmac_sha256.h"
 #include "crypto/hmac_sha512.h"
+#include "crypto/muhash.h"
 #include "random.h"
 #include "utilstrencodings.h"
 #include "test/test_bitcoin.h"
@@ -248,4 +249,58 @@ BOOST_AUTO_TEST_CASE(hmac_sha512_testvectors) {
                    "b6022cac3c4982b10d5eeb55c3e4de15134676fb6de0446065c97440fa8c6a58");
 }
 
+static uint256 FinalizeMuHash(MuHash3072 muhash) {
+    uint256 hash;
+    muhash.Finalize(hash.begin());
+    return hash;
+}
+
+BOOST_AUTO_TEST_CASE(muhash_tests) {
+    // the empty set hashes to the number 1
+    BOOST_CHECK_EQUAL(FinalizeMuHash(MuHash3072()).GetHex(),
+                      "dd5ad2a105c2d29495f577245c357409002329b9f4d6182c0af3dc2f462555c8");
+
+    std::vector<uint256> elements;
+    for (int i = 0; i < 4; i++)
+        elements.push_back(GetRandHash());
+
+    // the hash of a set doesn't depend on the order elements are added and removed in
+    MuHash3072 acc1, acc2;
+    for (int i = 0; i < 4; i++)
+        acc1.Insert(elements[i].begin(), 32);
+    acc1.Remove(elements[2].begin(), 32);
+    acc2.Insert(elements[3].begin(), 32).Insert(elements[1].begin(), 32).Insert(elements[0].begin(), 32);
+    BOOST_CHECK(FinalizeMuHash(acc1) == FinalizeMuHash(acc2));
+
+    acc2.Remove(elements[3].begin(), 32);
+    BOOST_CHECK(FinalizeMuHash(acc1) != FinalizeMuHash(acc2));
+
+    // removing everything gets back to the empty set
+    acc2.Remove(elements[1].begin(), 32).Remove(elements[0].begin(), 32);
+    BOOST_CHECK(FinalizeMuHash(acc2) == FinalizeMuHash(MuHash3072()));
+
+    // sets combine by multiplication
+    MuHash3072 acc3(elements[0].begin(), 32), acc4(elements[1].begin(), 32);
+    acc4.Insert(elements[3].begin(), 32);
+    acc3 *= acc4;
+    BOOST_CHECK(FinalizeMuHash(acc1) == FinalizeMuHash(acc3));
+    acc3 /= acc4;
+    BOOST_CHECK(FinalizeMuHash(acc3) == FinalizeMuHash(MuHash3072(elements[0].begin(), 32)));
+
+    // the serialized state carries pending removals
+    unsigned char data[MuHash3072::SERIALIZED_SIZE];
+    acc1.ToBytes(data);
+    MuHash3072 acc5;
+    acc5.FromBytes(data);
+    BOOST_CHECK(FinalizeMuHash(acc1) == FinalizeMuHash(acc5));
+
+    // a number times its inverse is one
+    unsigned char num[Num3072::BYTE_SIZE];
+    for (size_t i = 0; i < Num3072::BYTE_SIZE; i++)
+        num[i] = insecure_rand();
+    Num3072 x(num), one;
+    x.Multiply(x.GetInverse());
+    BOOST_CHECK(memcmp(x.limbs, one.limbs, sizeof(x.limbs)) == 0);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,104 @@
+// Copyright (c) 2016 Jeremy Rubin
+// Copyright (c) 2018 The Pastel developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "cuckoocache.h"
+#include "random.h"
+#include "test/test_bitcoin.h"
+
+#include <cstring>
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+/** Same hasher as the signature cache: the elements are random, so each
+ * 32-bit word is a hash on its own */
+struct RandomHashHasher
+{
+    template <uint8_t hash_select>
+    uint32_t operator()(const uint256& key) const
+    {
+        uint32_t u;
+        std::memcpy(&u, key.begin() + 4 * hash_select, 4);
+        return u;
+    }
+};
+
+typedef CuckooCache::cache<uint256, RandomHashHasher> test_cache;
+
+static std::vector<uint256> RandomHashes(size_t n)
+{
+    std::vector<uint256> hashes(n);
+    for (size_t i = 0; i < n; ++i)
+        hashes[i] = GetRandHash();
+    return hashes;
+}
+
+/** Fraction of hashes still present in the cache */
+static double HitRate(const test_cache& cc, const std::vector<uint256>& hashes, size_t begin, size_t end)
+{
+    size_t count = 0;
+    for (size_t i = begin; i < end; ++i)
+        if (cc.contains(hashes[i], false))
+            ++count;
+    return double(count) / double(end - begin);
+}
+
+BOOST_FIXTURE_TEST_SUITE(cuckoocache_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(cuckoocache_empty)
+{
+    test_cache cc;
+    cc.setup_bytes(1 << 16);
+    std::vector<uint256> hashes = RandomHashes(1000);
+    BOOST_CHECK_EQUAL(HitRate(cc, hashes, 0, hashes.size()), 0.0);
+}
+
+BOOST_AUTO_TEST_CASE(cuckoocache_hit_rate)
+{
+    // Filling the cache to 90% of its capacity keeps nearly everything
+    test_cache cc;
+    uint32_t nElements = cc.setup_bytes(1 << 20);
+    std::vector<uint256> hashes = RandomHashes(nElements * 9 / 10);
+    for (const uint256& h : hashes)
+        cc.insert(h);
+    BOOST_CHECK(HitRate(cc, hashes, 0, hashes.size()) > 0.98);
+}
+
+BOOST_AUTO_TEST_CASE(cuckoocache_erase)
+{
+    test_cache cc;
+    uint32_t nElements = cc.setup_bytes(1 << 20);
+    std::vector<uint256> hashes = RandomHashes(nElements);
+    size_t nHalf = hashes.size() / 2;
+
+    for (size_t i = 0; i < nHalf; ++i)
+        cc.insert(hashes[i]);
+    // Erasing is lazy: the entries stay visible until their slot is reused
+    for (size_t i = 0; i < nHalf; ++i)
+        BOOST_CHECK(cc.contains(hashes[i], true));
+    BOOST_CHECK_EQUAL(HitRate(cc, hashes, 0, nHalf), 1.0);
+
+    // New entries take the erased slots first
+    for (size_t i = nHalf; i < hashes.size(); ++i)
+        cc.insert(hashes[i]);
+    BOOST_CHECK(HitRate(cc, hashes, nHalf, hashes.size()) > 0.98);
+}
+
+BOOST_AUTO_TEST_CASE(cuckoocache_generations)
+{
+    // Inserting several times the capacity evicts by age: the most recent
+    // inserts survive while the oldest are gone
+    test_cache cc;
+    uint32_t nElements = cc.setup_bytes(1 << 20);
+    std::vector<uint256> hashes = RandomHashes(nElements * 3);
+    for (const uint256& h : hashes)
+        cc.insert(h);
+
+    size_t nRecent = nElements * 4 / 10;
+    BOOST_CHECK(HitRate(cc, hashes, hashes.size() - nRecent, hashes.size()) > 0.95);
+    BOOST_CHECK(HitRate(cc, hashes, 0, nRecent) < 0.05);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,76 @@
+// Copyright (c) 2018 The Pastel developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "mnode-db.h"
+#include "serialize.h"
+#include "util.h"
+#include "test/test_bitcoin.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(flatdb_tests, TestingSetup)
+
+namespace {
+
+struct CTestCache
+{
+    std::vector<int> vEntries;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(vEntries);
+    }
+
+    void Clear() { vEntries.clear(); }
+    void CheckAndRemove() {}
+    std::string ToString() const { return strprintf("Entries: %d", vEntries.size()); }
+};
+
+}
+
+BOOST_AUTO_TEST_CASE(flatdb_roundtrip)
+{
+    CTestCache cache;
+    for (int i = 0; i < 1000; i++)
+        cache.vEntries.push_back(i);
+
+    CFlatDB<CTestCache> flatDB("testcache.dat", "magicTestCache");
+    BOOST_CHECK(flatDB.Dump(cache));
+    BOOST_CHECK(!boost::filesystem::exists(GetDataDir() / "testcache.dat.new"));
+
+    CTestCache loaded;
+    BOOST_CHECK(flatDB.Load(loaded));
+    BOOST_CHECK(loaded.vEntries == cache.vEntries);
+
+    // a file of another cache type is neither loaded nor overwritten
+    CFlatDB<CTestCache> otherDB("testcache.dat", "magicOtherCache");
+    BOOST_CHECK(!otherDB.Load(loaded));
+    BOOST_CHECK(!otherDB.Dump(cache));
+
+    // flip a byte of the data, the checksum no longer matches
+    boost::filesystem::path path = GetDataDir() / "testcache.dat";
+    FILE* file = fopen(path.string().c_str(), "rb+");
+    BOOST_CHECK(file != NULL);
+    fseek(file, 100, SEEK_SET);
+    unsigned char ch = fgetc(file);
+    fseek(file, 100, SEEK_SET);
+    fputc(ch ^ 0xff, file);
+    fclose(file);
+
+    // nothing read from a corrupt file is kept
+    loaded.vEntries.assign(1, 1);
+    BOOST_CHECK(!flatDB.Load(loaded));
+    BOOST_CHECK(loaded.vEntries.empty());
+
+    // a truncated file can't be deserialized, the cache is recreated
+    BOOST_CHECK(flatDB.Dump(cache));
+    boost::filesystem::resize_file(path, 16);
+    loaded.vEntries.assign(1, 1);
+    BOOST_CHECK(flatDB.Load(loaded));
+    BOOST_CHECK(loaded.vEntries.empty());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -3,6 +3,7 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include "hash.h"
+#include "streams.h"
 #include "utilstrencodings.h"
 #include "test/test_bitcoin.h"
 
@@ -47,4 +48,46 @@ BOOST_AUTO_TEST_CASE(murmurhash3)
 #undef T
 }
 
+BOOST_AUTO_TEST_CASE(siphash)
+{
+    CSipHasher hasher(0x0706050403020100ULL, 0x0F0E0D0C0B0A0908ULL);
+    BOOST_CHECK_EQUAL(hasher.Finalize(),  0x726fdb47dd0e0e31ull);
+    static const unsigned char t0[1] = {0};
+    hasher.Write(t0, 1);
+    BOOST_CHECK_EQUAL(hasher.Finalize(),  0x74f839c593dc67fdull);
+    static const unsigned char t1[7] = {1,2,3,4,5,6,7};
+    hasher.Write(t1, 7);
+    BOOST_CHECK_EQUAL(hasher.Finalize(),  0x93f5f5799a932462ull);
+    hasher.Write(0x0F0E0D0C0B0A0908ULL);
+    BOOST_CHECK_EQUAL(hasher.Finalize(),  0x3f2acc7f57c29bdbull);
+    static const unsigned char t2[2] = {16,17};
+    hasher.Write(t2, 2);
+    BOOST_CHECK_EQUAL(hasher.Finalize(),  0x4bc1b3f0968dd39cull);
+
+    // SipHashUint256 matches hashing the 32 bytes with CSipHasher
+    BOOST_CHECK_EQUAL(SipHashUint256(0x0706050403020100ULL, 0x0F0E0D0C0B0A0908ULL,
+        uint256S("1f1e1d1c1b1a191817161514131211100f0e0d0c0b0a09080706050403020100")), 0x7127512f72f27cceull);
+}
+
+BOOST_AUTO_TEST_CASE(hash_stream_wrappers)
+{
+    std::vector<unsigned char> vch = ParseHex("00112233445566778899");
+    std::string str("hashed on the way");
+
+    CDataStream ss(SER_DISK, 0);
+    CHashTeeWriter<CDataStream> writer(&ss);
+    writer << vch << str;
+    uint256 hashWritten = writer.GetHash();
+    BOOST_CHECK(hashWritten == Hash(ss.begin(), ss.end()));
+
+    std::vector<unsigned char> vchRead;
+    std::string strRead;
+    CHashVerifier<CDataStream> verifier(&ss);
+    verifier >> vchRead >> strRead;
+    BOOST_CHECK(vchRead == vch);
+    BOOST_CHECK_EQUAL(strRead, str);
+    BOOST_CHECK(ss.empty());
+    BOOST_CHECK(verifier.GetHash() == hashWritten);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -10,6 +10,7 @@
 #include "test/test_bitcoin.h"
 
 #include <boost/test/unit_test.hpp>
+#include <limits>
 #include <list>
 
 BOOST_FIXTURE_TEST_SUITE(mempool_tests, TestingSetup)
@@ -157,6 +158,227 @@ BOOST_AUTO_TEST_CASE(MempoolIndexingTest)
     BOOST_CHECK(it == pool.mapTx.get<1>().end());
 }
 
+BOOST_AUTO_TEST_CASE(MempoolAncestorIndexingTest)
+{
+    CTxMemPool pool(CFeeRate(0));
+    TestMemPoolEntryHelper entry;
+
+    /* unrelated tx with a medium fee */
+    CMutableTransaction tx1 = CMutableTransaction();
+    tx1.vout.resize(1);
+    tx1.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    tx1.vout[0].nValue = 10 * COIN;
+    pool.addUnchecked(tx1.GetHash(), entry.Fee(10000LL).FromTx(tx1));
+
+    /* low fee parent */
+    CMutableTransaction tx2 = CMutableTransaction();
+    tx2.vout.resize(1);
+    tx2.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    tx2.vout[0].nValue = 2 * COIN;
+    pool.addUnchecked(tx2.GetHash(), entry.Fee(1000LL).FromTx(tx2));
+
+    /* high fee child of tx2 */
+    CMutableTransaction tx3 = CMutableTransaction();
+    tx3.vin.resize(1);
+    tx3.vin[0].prevout = COutPoint(tx2.GetHash(), 0);
+    tx3.vin[0].scriptSig = CScript() << OP_11;
+    tx3.vout.resize(1);
+    tx3.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    tx3.vout[0].nValue = 1 * COIN;
+    pool.addUnchecked(tx3.GetHash(), entry.Fee(50000LL).FromTx(tx3));
+    BOOST_CHECK_EQUAL(pool.size(), 3);
+
+    CTxMemPool::txiter it1 = pool.mapTx.find(tx1.GetHash());
+    CTxMemPool::txiter it2 = pool.mapTx.find(tx2.GetHash());
+    CTxMemPool::txiter it3 = pool.mapTx.find(tx3.GetHash());
+
+    // Package state is tracked on both ends of the link
+    BOOST_CHECK_EQUAL(it2->GetCountWithDescendants(), 2);
+    BOOST_CHECK_EQUAL(it2->GetSizeWithDescendants(), it2->GetTxSize() + it3->GetTxSize());
+    BOOST_CHECK_EQUAL(it2->GetModFeesWithDescendants(), 51000LL);
+    BOOST_CHECK_EQUAL(it3->GetCountWithAncestors(), 2);
+    BOOST_CHECK_EQUAL(it3->GetSizeWithAncestors(), it2->GetTxSize() + it3->GetTxSize());
+    BOOST_CHECK_EQUAL(it3->GetModFeesWithAncestors(), 51000LL);
+    BOOST_CHECK_EQUAL(it1->GetCountWithAncestors(), 1);
+    BOOST_CHECK_EQUAL(it1->GetCountWithDescendants(), 1);
+
+    // The child is scored by its package, which pays more than tx1 alone,
+    // and the parent keeps its own low fee rate.
+    // Check the ancestor score index is in order, should be tx3, tx1, tx2
+    CTxMemPool::indexed_transaction_set::index<ancestor_score>::type::iterator it = pool.mapTx.get<ancestor_score>().begin();
+    BOOST_CHECK_EQUAL(it++->GetTx().GetHash().ToString(), tx3.GetHash().ToString());
+    BOOST_CHECK_EQUAL(it++->GetTx().GetHash().ToString(), tx1.GetHash().ToString());
+    BOOST_CHECK_EQUAL(it++->GetTx().GetHash().ToString(), tx2.GetHash().ToString());
+    BOOST_CHECK(it == pool.mapTx.get<ancestor_score>().end());
+
+    // Prioritising the parent updates the child's package fees too
+    pool.PrioritiseTransaction(tx2.GetHash(), tx2.GetHash().ToString(), 0, 5000LL);
+    BOOST_CHECK_EQUAL(it2->GetModifiedFee(), 6000LL);
+    BOOST_CHECK_EQUAL(it2->GetModFeesWithDescendants(), 56000LL);
+    BOOST_CHECK_EQUAL(it3->GetModFeesWithAncestors(), 56000LL);
+
+    // Removing the parent as if it was mined leaves the child on its own
+    std::list<CTransaction> removed;
+    pool.remove(tx2, removed, false);
+    BOOST_CHECK_EQUAL(removed.size(), 1);
+    BOOST_CHECK_EQUAL(pool.size(), 2);
+    it3 = pool.mapTx.find(tx3.GetHash());
+    BOOST_CHECK_EQUAL(it3->GetCountWithAncestors(), 1);
+    BOOST_CHECK_EQUAL(it3->GetSizeWithAncestors(), it3->GetTxSize());
+    BOOST_CHECK_EQUAL(it3->GetModFeesWithAncestors(), 50000LL);
+    BOOST_CHECK(pool.GetMemPoolParents(it3).empty());
+}
+
+BOOST_AUTO_TEST_CASE(MempoolAncestorLimitsTest)
+{
+    CTxMemPool pool(CFeeRate(0));
+    TestMemPoolEntryHelper entry;
+
+    // a chain of five transactions, each spending the previous one
+    std::vector<CMutableTransaction> chain(6);
+    uint64_t nChainSize = 0;
+    for (size_t i = 0; i < chain.size(); i++) {
+        CMutableTransaction &tx = chain[i];
+        if (i > 0) {
+            tx.vin.resize(1);
+            tx.vin[0].prevout = COutPoint(chain[i - 1].GetHash(), 0);
+            tx.vin[0].scriptSig = CScript() << OP_11;
+        }
+        tx.vout.resize(1);
+        tx.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+        tx.vout[0].nValue = (10 - i) * COIN;
+        if (i + 1 < chain.size()) {
+            pool.addUnchecked(tx.GetHash(), entry.Fee(1000LL).FromTx(tx));
+            nChainSize += ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION);
+        }
+    }
+    CTxMemPoolEntry last = entry.Fee(1000LL).FromTx(chain.back());
+    uint64_t nNoLimit = std::numeric_limits<uint64_t>::max();
+    std::string errString;
+
+    // five ancestors make six with the transaction itself
+    CTxMemPool::setEntries setAncestors;
+    BOOST_CHECK(pool.CalculateMemPoolAncestors(last, setAncestors, 6, nNoLimit, nNoLimit, nNoLimit, errString));
+    BOOST_CHECK_EQUAL(setAncestors.size(), 5);
+    setAncestors.clear();
+    BOOST_CHECK(!pool.CalculateMemPoolAncestors(last, setAncestors, 5, nNoLimit, nNoLimit, nNoLimit, errString));
+    BOOST_CHECK(errString.find("ancestors") != std::string::npos);
+
+    // ... and the root would get six descendants, counting itself
+    setAncestors.clear();
+    BOOST_CHECK(pool.CalculateMemPoolAncestors(last, setAncestors, nNoLimit, nNoLimit, 6, nNoLimit, errString));
+    setAncestors.clear();
+    BOOST_CHECK(!pool.CalculateMemPoolAncestors(last, setAncestors, nNoLimit, nNoLimit, 5, nNoLimit, errString));
+    BOOST_CHECK(errString.find("descendants") != std::string::npos);
+
+    // sizes count the transaction itself too
+    setAncestors.clear();
+    uint64_t nTotalSize = nChainSize + last.GetTxSize();
+    BOOST_CHECK(pool.CalculateMemPoolAncestors(last, setAncestors, nNoLimit, nTotalSize, nNoLimit, nTotalSize, errString));
+    setAncestors.clear();
+    BOOST_CHECK(!pool.CalculateMemPoolAncestors(last, setAncestors, nNoLimit, nTotalSize - 1, nNoLimit, nNoLimit, errString));
+    setAncestors.clear();
+    BOOST_CHECK(!pool.CalculateMemPoolAncestors(last, setAncestors, nNoLimit, nNoLimit, nNoLimit, nTotalSize - 1, errString));
+}
+
+BOOST_AUTO_TEST_CASE(MempoolSizeLimitTest)
+{
+    CTxMemPool pool(CFeeRate(1000));
+    TestMemPoolEntryHelper entry;
+
+    CMutableTransaction tx1 = CMutableTransaction();
+    tx1.vout.resize(1);
+    tx1.vout[0].scriptPubKey = CScript() << OP_1 << OP_EQUAL;
+    tx1.vout[0].nValue = 10 * COIN;
+    pool.addUnchecked(tx1.GetHash(), entry.Fee(10000LL).FromTx(tx1, &pool));
+
+    CMutableTransaction tx2 = CMutableTransaction();
+    tx2.vout.resize(1);
+    tx2.vout[0].scriptPubKey = CScript() << OP_2 << OP_EQUAL;
+    tx2.vout[0].nValue = 10 * COIN;
+    pool.addUnchecked(tx2.GetHash(), entry.Fee(5000LL).FromTx(tx2, &pool));
+
+    /* low fee child of tx2 */
+    CMutableTransaction tx3 = CMutableTransaction();
+    tx3.vin.resize(1);
+    tx3.vin[0].prevout = COutPoint(tx2.GetHash(), 0);
+    tx3.vin[0].scriptSig = CScript() << OP_2;
+    tx3.vout.resize(1);
+    tx3.vout[0].scriptPubKey = CScript() << OP_3 << OP_EQUAL;
+    tx3.vout[0].nValue = 10 * COIN;
+    pool.addUnchecked(tx3.GetHash(), entry.Fee(1000LL).FromTx(tx3, &pool));
+
+    // Nothing is evicted while the pool fits
+    pool.TrimToSize(pool.DynamicMemoryUsage());
+    BOOST_CHECK_EQUAL(pool.size(), 3);
+    BOOST_CHECK_EQUAL(pool.GetMinFee(1).GetFeePerK(), 0);
+
+    // The child has the lowest descendant score and goes first
+    unsigned int nTx3Size = ::GetSerializeSize(tx3, SER_NETWORK, PROTOCOL_VERSION);
+    pool.TrimToSize(pool.DynamicMemoryUsage() - 1);
+    BOOST_CHECK_EQUAL(pool.size(), 2);
+    BOOST_CHECK(pool.exists(tx1.GetHash()));
+    BOOST_CHECK(pool.exists(tx2.GetHash()));
+    BOOST_CHECK(!pool.exists(tx3.GetHash()));
+    BOOST_CHECK_EQUAL(pool.GetEvictedCount(), 1);
+    BOOST_CHECK_EQUAL(pool.GetEvictedBytes(), nTx3Size);
+
+    // The rolling minimum is bumped to the evicted fee rate plus the relay fee
+    CAmount nBumped = CFeeRate(1000LL, nTx3Size).GetFeePerK() + 1000;
+    BOOST_CHECK_EQUAL(pool.GetMinFee(1).GetFeePerK(), nBumped);
+
+    // ... and only decays once a block has been connected
+    int64_t nStartTime = GetTime();
+    SetMockTime(nStartTime);
+    std::list<CTransaction> conflicts;
+    pool.removeForBlock(std::vector<CTransaction>(), 1, conflicts);
+    SetMockTime(nStartTime + CTxMemPool::ROLLING_FEE_HALFLIFE);
+    BOOST_CHECK_EQUAL(pool.GetMinFee(1).GetFeePerK(), nBumped / 2);
+
+    // Below half of the minimum relay fee the rolling minimum drops to zero
+    SetMockTime(nStartTime + CTxMemPool::ROLLING_FEE_HALFLIFE * 10);
+    BOOST_CHECK_EQUAL(pool.GetMinFee(1).GetFeePerK(), 0);
+
+    // The remaining pair is trimmed lowest package first
+    pool.TrimToSize(pool.DynamicMemoryUsage() - 1);
+    BOOST_CHECK_EQUAL(pool.size(), 1);
+    BOOST_CHECK(pool.exists(tx1.GetHash()));
+    BOOST_CHECK_EQUAL(pool.GetEvictedCount(), 2);
+
+    SetMockTime(0);
+}
+
+BOOST_AUTO_TEST_CASE(MempoolDescendantScoreTieTest)
+{
+    CTxMemPool pool(CFeeRate(0));
+    TestMemPoolEntryHelper entry;
+
+    // same size and fee, so the same score
+    std::vector<CMutableTransaction> txs(3);
+    for (size_t i = 0; i < txs.size(); i++) {
+        txs[i].vout.resize(1);
+        txs[i].vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+        txs[i].vout[0].nValue = (i + 1) * COIN;
+    }
+    pool.addUnchecked(txs[0].GetHash(), entry.Fee(1000LL).Time(1).FromTx(txs[0]));
+    pool.addUnchecked(txs[1].GetHash(), entry.Fee(1000LL).Time(2).FromTx(txs[1]));
+    pool.addUnchecked(txs[2].GetHash(), entry.Fee(1000LL).Time(2).FromTx(txs[2]));
+
+    // the newer ones come first, in txid order between themselves
+    uint256 hashFirst = std::min(txs[1].GetHash(), txs[2].GetHash());
+    uint256 hashSecond = std::max(txs[1].GetHash(), txs[2].GetHash());
+    CTxMemPool::indexed_transaction_set::index<descendant_score>::type::iterator it = pool.mapTx.get<descendant_score>().begin();
+    BOOST_CHECK_EQUAL(it++->GetTx().GetHash().ToString(), hashFirst.ToString());
+    BOOST_CHECK_EQUAL(it++->GetTx().GetHash().ToString(), hashSecond.ToString());
+    BOOST_CHECK_EQUAL(it++->GetTx().GetHash().ToString(), txs[0].GetHash().ToString());
+    BOOST_CHECK(it == pool.mapTx.get<descendant_score>().end());
+
+    // an entry never sorts before itself
+    CompareTxMemPoolEntryByDescendantScore comp;
+    const CTxMemPoolEntry& e = *pool.mapTx.find(txs[0].GetHash());
+    BOOST_CHECK(!comp(e, e));
+}
+
 BOOST_AUTO_TEST_CASE(RemoveWithoutBranchId) {
     CTxMemPool pool(CFeeRate(0));
     TestMemPoolEntryHelper entry;
@@ -0,0 +1,78 @@
+// Copyright (c) 2018 The Pastel developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "coins.h"
+#include "memusage.h"
+#include "random.h"
+#include "support/allocators/pool.h"
+#include "test/test_bitcoin.h"
+
+#include <map>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(pool_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(pool_resource_blocks)
+{
+    PoolResource<64, 8> resource(1024);
+    BOOST_CHECK_EQUAL(resource.NumAllocatedChunks(), 0);
+
+    // blocks follow each other in a chunk
+    void* p1 = resource.Allocate(24, 8);
+    void* p2 = resource.Allocate(24, 8);
+    BOOST_CHECK_EQUAL(resource.NumAllocatedChunks(), 1);
+    BOOST_CHECK_EQUAL(static_cast<char*>(p2) - static_cast<char*>(p1), 24);
+
+    // a freed block is reused for the same size, not for another one
+    resource.Deallocate(p1, 24, 8);
+    void* p3 = resource.Allocate(32, 8);
+    BOOST_CHECK(p3 != p1);
+    BOOST_CHECK(resource.Allocate(20, 8) == p1);
+
+    // big blocks and overaligned ones bypass the pool
+    void* pLarge = resource.Allocate(100, 8);
+    BOOST_CHECK_EQUAL(resource.LargeBytes(), 100);
+    resource.Deallocate(pLarge, 100, 8);
+    BOOST_CHECK_EQUAL(resource.LargeBytes(), 0);
+
+    // exhausting a chunk starts the next one
+    for (int i = 0; i < 32; i++)
+        resource.Allocate(64, 8);
+    BOOST_CHECK_EQUAL(resource.NumAllocatedChunks(), 3);
+    BOOST_CHECK_EQUAL(resource.ChunkSizeBytes(), 1024);
+}
+
+BOOST_AUTO_TEST_CASE(pool_allocator_map)
+{
+    CCoinsMapMemoryResource resource;
+    std::map<uint256, int> expected;
+    {
+        CCoinsMap map(0, CCoinsKeyHasher(), std::equal_to<uint256>(), CCoinsMapAllocator(&resource));
+        std::vector<uint256> keys;
+        for (int i = 0; i < 1000; i++)
+            keys.push_back(GetRandHash());
+        for (int i = 0; i < 20000; i++) {
+            const uint256& key = keys[insecure_rand() % keys.size()];
+            if (insecure_rand() % 4 == 0) {
+                map.erase(key);
+                expected.erase(key);
+            } else {
+                map[key].coins.nHeight = i;
+                expected[key] = i;
+            }
+        }
+        BOOST_CHECK_EQUAL(map.size(), expected.size());
+        for (std::map<uint256, int>::const_iterator it = expected.begin(); it != expected.end(); ++it)
+            BOOST_CHECK_EQUAL(map[it->first].coins.nHeight, it->second);
+
+        // the memory of the whole resource is accounted to the map
+        BOOST_CHECK(memusage::DynamicUsage(map) >= resource.ChunkSizeBytes() * resource.NumAllocatedChunks());
+        BOOST_CHECK(resource.LargeBytes() > 0);
+    }
+    // the bucket array was released with the map
+    BOOST_CHECK_EQUAL(resource.LargeBytes(), 0);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
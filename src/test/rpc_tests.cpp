@@ -346,4 +346,14 @@ BOOST_AUTO_TEST_CASE(rpc_getnetworksolps)
     BOOST_CHECK_NO_THROW(CallRPC("getnetworksolps 120 -1"));
 }
 
+BOOST_AUTO_TEST_CASE(rpc_getaddressbalance_params)
+{
+    // both the bare address and the object form reach the server-side address check
+    BOOST_CHECK_EXCEPTION(CallRPC("getaddressbalance notanaddress"), runtime_error,
+        [](const runtime_error& e) { return string(e.what()) == "Invalid address: notanaddress"; });
+    BOOST_CHECK_EXCEPTION(CallRPC("getaddressbalance {\"addresses\":[\"notanaddress\"]}"), runtime_error,
+        [](const runtime_error& e) { return string(e.what()) == "Invalid address: notanaddress"; });
+    BOOST_CHECK_THROW(CallRPC("getaddressbalance {\"addresses\":"), runtime_error);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -9,6 +9,7 @@
 #include "hash.h"
 #include "main.h"
 #include "pow.h"
+#include "streams.h"
 #include "uint256.h"
 
 #include <stdint.h>
@@ -27,6 +28,9 @@ static const char DB_COINS = 'c';
 static const char DB_BLOCK_FILES = 'f';
 static const char DB_TXINDEX = 't';
 static const char DB_BLOCK_INDEX = 'b';
+static const char DB_ADDRESSINDEX = 'd';
+static const char DB_ADDRESSUNSPENTINDEX = 'u';
+static const char DB_SPENTINDEX = 'p';
 
 static const char DB_BEST_BLOCK = 'B';
 static const char DB_BEST_SPROUT_ANCHOR = 'a';
@@ -34,13 +38,21 @@ static const char DB_BEST_SAPLING_ANCHOR = 'z';
 static const char DB_FLAG = 'F';
 static const char DB_REINDEX_FLAG = 'R';
 static const char DB_LAST_BLOCK = 'l';
+static const char DB_COINS_STATS = 'M';
 
 
 CCoinsViewDB::CCoinsViewDB(std::string dbName, size_t nCacheSize, bool fMemory, bool fWipe) : db(GetDataDir() / dbName, nCacheSize, fMemory, fWipe) {
+    LoadRunningStats();
 }
 
 CCoinsViewDB::CCoinsViewDB(size_t nCacheSize, bool fMemory, bool fWipe) : db(GetDataDir() / "chainstate", nCacheSize, fMemory, fWipe) 
 {
+    LoadRunningStats();
+}
+
+void CCoinsViewDB::LoadRunningStats() {
+    // a new database starts out with the statistics of the empty set
+    fRunningStats = db.Read(DB_COINS_STATS, runningStats) || GetBestBlock().IsNull();
 }
 
 
@@ -159,12 +171,28 @@ bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins,
                               CAnchorsSproutMap &mapSproutAnchors,
                               CAnchorsSaplingMap &mapSaplingAnchors,
                               CNullifiersMap &mapSproutNullifiers,
-                              CNullifiersMap &mapSaplingNullifiers) {
+                              CNullifiersMap &mapSaplingNullifiers,
+                              const CCoinsRunningStats *pstatsRemoved) {
     CDBBatch batch(db);
     size_t count = 0;
     size_t changed = 0;
+    CCoinsRunningStats statsNew;
+    if (fRunningStats) {
+        statsNew = runningStats;
+        if (pstatsRemoved)
+            statsNew.Remove(*pstatsRemoved);
+    }
     for (CCoinsMap::iterator it = mapCoins.begin(); it != mapCoins.end();) {
         if (it->second.flags & CCoinsCacheEntry::DIRTY) {
+            if (fRunningStats) {
+                // fresh entries are known not to be in the database, the writer
+                // normally passes the old version of the others along
+                CCoins coinsOld;
+                if (!pstatsRemoved && !(it->second.flags & CCoinsCacheEntry::FRESH) && db.Read(make_pair(DB_COINS, it->first), coinsOld))
+                    statsNew.Remove(it->first, coinsOld);
+                if (!it->second.coins.IsPruned())
+                    statsNew.Add(it->first, it->second.coins);
+            }
             if (it->second.coins.IsPruned())
                 batch.Erase(make_pair(DB_COINS, it->first));
             else
@@ -189,8 +217,15 @@ bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins,
     if (!hashSaplingAnchor.IsNull())
         batch.Write(DB_BEST_SAPLING_ANCHOR, hashSaplingAnchor);
 
+    if (fRunningStats)
+        batch.Write(DB_COINS_STATS, statsNew);
+
     LogPrint("coindb", "Committing %u changed transactions (out of %u) to coin database...\n", (unsigned int)changed, (unsigned int)count);
-    return db.WriteBatch(batch);
+    if (!db.WriteBatch(batch))
+        return false;
+    if (fRunningStats)
+        runningStats = statsNew;
+    return true;
 }
 
 CBlockTreeDB::CBlockTreeDB(size_t nCacheSize, bool fMemory, bool fWipe) : CDBWrapper(GetDataDir() / "blocks" / "index", nCacheSize, fMemory, fWipe) {
@@ -262,6 +297,299 @@ bool CCoinsViewDB::GetStats(CCoinsStats &stats) const {
     return true;
 }
 
+bool CCoinsViewDB::GetRunningStats(CCoinsStats &stats) const {
+    if (!fRunningStats) {
+        // build them once from a full scan, they are kept up to date from then on
+        boost::scoped_ptr<CDBIterator> pcursor(const_cast<CDBWrapper*>(&db)->NewIterator());
+        CCoinsRunningStats statsNew;
+        for (pcursor->Seek(DB_COINS); pcursor->Valid(); pcursor->Next()) {
+            boost::this_thread::interruption_point();
+            std::pair<char, uint256> key;
+            CCoins coins;
+            if (!pcursor->GetKey(key) || key.first != DB_COINS)
+                break;
+            if (!pcursor->GetValue(coins))
+                return error("CCoinsViewDB::GetRunningStats() : unable to read value");
+            statsNew.Add(key.second, coins);
+        }
+        if (!const_cast<CDBWrapper*>(&db)->Write(DB_COINS_STATS, statsNew, true))
+            return error("CCoinsViewDB::GetRunningStats() : unable to write statistics");
+        runningStats = statsNew;
+        fRunningStats = true;
+        LogPrintf("%s: built coins statistics of %u transactions\n", __func__, (unsigned int)runningStats.nTransactions);
+    }
+
+    stats.hashBlock = GetBestBlock();
+    runningStats.GetStats(stats);
+    {
+        LOCK(cs_main);
+        BlockMap::const_iterator mi = mapBlockIndex.find(stats.hashBlock);
+        if (mi != mapBlockIndex.end())
+            stats.nHeight = mi->second->nHeight;
+    }
+    return true;
+}
+
+static const std::string SNAPSHOT_MAGIC = "pastel-utxo-snapshot";
+static const int SNAPSHOT_VERSION = 1;
+//! Records per chunk of a snapshot file, each chunk holds records of one type
+static const unsigned int SNAPSHOT_CHUNK_SIZE = 10000;
+
+namespace {
+
+/**
+ * Collects snapshot records into chunks of one record type and writes
+ * them to the file, hashing every record on the way.
+ */
+class CSnapshotChunkWriter
+{
+private:
+    CAutoFile& file;
+    CHashWriter& hasher;
+    CDataStream ssChunk;
+    char chType;
+    unsigned int nRecords;
+
+    //! A chunk holds records of one type only, so a new type starts a new chunk
+    void Begin(char chTypeIn)
+    {
+        if (chTypeIn != chType)
+            Flush();
+        chType = chTypeIn;
+    }
+
+    void End()
+    {
+        if (++nRecords == SNAPSHOT_CHUNK_SIZE)
+            Flush();
+    }
+
+public:
+    CSnapshotChunkWriter(CAutoFile& fileIn, CHashWriter& hasherIn) :
+        file(fileIn), hasher(hasherIn), ssChunk(SER_DISK, CLIENT_VERSION), chType(0), nRecords(0) {}
+
+    template<typename K>
+    void Add(char chTypeIn, const K& key)
+    {
+        Begin(chTypeIn);
+        ssChunk << key;
+        hasher << chTypeIn << key;
+        End();
+    }
+
+    template<typename K, typename V>
+    void Add(char chTypeIn, const K& key, const V& value)
+    {
+        Begin(chTypeIn);
+        ssChunk << key << value;
+        hasher << chTypeIn << key << value;
+        End();
+    }
+
+    void Flush()
+    {
+        if (nRecords == 0)
+            return;
+        file << chType << nRecords << ssChunk;
+        ssChunk.clear();
+        nRecords = 0;
+    }
+};
+
+/** Writes a snapshot of the coins database from an iterator, which reads the database as of its creation */
+class CCoinsDBSnapshotWriter : public CCoinsSnapshotWriter
+{
+private:
+    boost::scoped_ptr<CDBIterator> pcursor;
+    uint256 hashBlock;
+    uint256 hashSproutAnchor;
+    uint256 hashSaplingAnchor;
+    bool fMuHash;
+    MuHash3072 muhash;
+
+public:
+    CCoinsDBSnapshotWriter(CDBIterator *pcursorIn, const uint256 &hashBlockIn,
+                           const uint256 &hashSproutAnchorIn, const uint256 &hashSaplingAnchorIn) :
+        pcursor(pcursorIn), hashBlock(hashBlockIn), hashSproutAnchor(hashSproutAnchorIn),
+        hashSaplingAnchor(hashSaplingAnchorIn), fMuHash(false) {}
+
+    void SetMuHash(const MuHash3072 &muhashIn)
+    {
+        muhash = muhashIn;
+        fMuHash = true;
+    }
+
+    bool Write(CAutoFile &file, CCoinsSnapshotStats &stats);
+};
+
+}
+
+CCoinsSnapshotWriter* CCoinsViewDB::NewSnapshotWriter() const {
+    /* It seems that there are no "const iterators" for LevelDB.  Since we
+       only need read operations on it, use a const-cast to get around
+       that restriction.  */
+    CCoinsDBSnapshotWriter *pwriter = new CCoinsDBSnapshotWriter(const_cast<CDBWrapper*>(&db)->NewIterator(),
+        GetBestBlock(), GetBestAnchor(SPROUT), GetBestAnchor(SAPLING));
+    if (fRunningStats)
+        pwriter->SetMuHash(runningStats.muhash);
+    return pwriter;
+}
+
+bool CCoinsDBSnapshotWriter::Write(CAutoFile &file, CCoinsSnapshotStats &stats) {
+    stats = CCoinsSnapshotStats();
+    stats.hashBlock = hashBlock;
+    stats.hashSproutAnchor = hashSproutAnchor;
+    stats.hashSaplingAnchor = hashSaplingAnchor;
+    file << SNAPSHOT_MAGIC << SNAPSHOT_VERSION << FLATDATA(Params().MessageStart());
+    file << stats.hashBlock << stats.hashSproutAnchor << stats.hashSaplingAnchor;
+
+    CHashWriter hasher(SER_GETHASH, PROTOCOL_VERSION);
+    hasher << stats.hashBlock << stats.hashSproutAnchor << stats.hashSaplingAnchor;
+    CSnapshotChunkWriter writer(file, hasher);
+
+    // LevelDB iterates in key order, so the records of each type come in one run
+    for (pcursor->SeekToFirst(); pcursor->Valid(); pcursor->Next()) {
+        boost::this_thread::interruption_point();
+        std::pair<char, uint256> key;
+        // best block, best anchor and statistics keys are a single character and fail to parse
+        if (!pcursor->GetKey(key))
+            continue;
+        switch (key.first) {
+            case DB_COINS: {
+                CCoins coins;
+                if (!pcursor->GetValue(coins))
+                    return error("%s: unable to read coins %s", __func__, key.second.ToString());
+                writer.Add(DB_COINS, key.second, coins);
+                stats.nCoins++;
+                break;
+            }
+            case DB_SPROUT_ANCHOR: {
+                SproutMerkleTree tree;
+                if (!pcursor->GetValue(tree))
+                    return error("%s: unable to read Sprout anchor %s", __func__, key.second.ToString());
+                writer.Add(DB_SPROUT_ANCHOR, key.second, tree);
+                stats.nSproutAnchors++;
+                break;
+            }
+            case DB_SAPLING_ANCHOR: {
+                SaplingMerkleTree tree;
+                if (!pcursor->GetValue(tree))
+                    return error("%s: unable to read Sapling anchor %s", __func__, key.second.ToString());
+                writer.Add(DB_SAPLING_ANCHOR, key.second, tree);
+                stats.nSaplingAnchors++;
+                break;
+            }
+            case DB_NULLIFIER:
+                writer.Add(DB_NULLIFIER, key.second);
+                stats.nSproutNullifiers++;
+                break;
+            case DB_SAPLING_NULLIFIER:
+                writer.Add(DB_SAPLING_NULLIFIER, key.second);
+                stats.nSaplingNullifiers++;
+                break;
+        }
+    }
+    writer.Flush();
+
+    stats.hashSnapshot = hasher.GetHash();
+    file << '\0' << stats.hashSnapshot;
+    if (fMuHash) {
+        MuHash3072 muhashFinal = muhash;
+        muhashFinal.Finalize(stats.hashCoinsMuHash.begin());
+    }
+    return true;
+}
+
+bool ReadCoinsSnapshot(CAutoFile &file, CCoinsSnapshotStats &stats) {
+    stats = CCoinsSnapshotStats();
+    try {
+        std::string strMagic;
+        int nVersion = 0;
+        unsigned char pchMessageStart[MESSAGE_START_SIZE];
+        file >> strMagic;
+        if (strMagic != SNAPSHOT_MAGIC)
+            return error("%s: not a UTXO snapshot", __func__);
+        file >> nVersion;
+        if (nVersion != SNAPSHOT_VERSION)
+            return error("%s: unsupported snapshot version %d", __func__, nVersion);
+        file >> FLATDATA(pchMessageStart);
+        if (memcmp(pchMessageStart, Params().MessageStart(), MESSAGE_START_SIZE) != 0)
+            return error("%s: snapshot is for another network", __func__);
+        file >> stats.hashBlock >> stats.hashSproutAnchor >> stats.hashSaplingAnchor;
+
+        CHashWriter hasher(SER_GETHASH, PROTOCOL_VERSION);
+        hasher << stats.hashBlock << stats.hashSproutAnchor << stats.hashSaplingAnchor;
+        CCoinsRunningStats coinsStats;
+
+        // records must be in database key order, which makes the hash canonical
+        std::pair<char, uint256> keyPrev(0, uint256());
+        while (true) {
+            boost::this_thread::interruption_point();
+            char chType;
+            unsigned int nRecords;
+            file >> chType;
+            if (chType == 0)
+                break;
+            file >> nRecords;
+            if (nRecords == 0 || nRecords > SNAPSHOT_CHUNK_SIZE)
+                return error("%s: invalid chunk of %u records", __func__, nRecords);
+
+            for (unsigned int i = 0; i < nRecords; i++) {
+                std::pair<char, uint256> key(chType, uint256());
+                file >> key.second;
+                if (!(keyPrev < key))
+                    return error("%s: records out of order at %s", __func__, key.second.ToString());
+                keyPrev = key;
+
+                switch (chType) {
+                    case DB_COINS: {
+                        CCoins coins;
+                        file >> coins;
+                        hasher << chType << key.second << coins;
+                        coinsStats.Add(key.second, coins);
+                        stats.nCoins++;
+                        break;
+                    }
+                    case DB_SPROUT_ANCHOR: {
+                        SproutMerkleTree tree;
+                        file >> tree;
+                        hasher << chType << key.second << tree;
+                        stats.nSproutAnchors++;
+                        break;
+                    }
+                    case DB_SAPLING_ANCHOR: {
+                        SaplingMerkleTree tree;
+                        file >> tree;
+                        hasher << chType << key.second << tree;
+                        stats.nSaplingAnchors++;
+                        break;
+                    }
+                    case DB_NULLIFIER:
+                        hasher << chType << key.second;
+                        stats.nSproutNullifiers++;
+                        break;
+                    case DB_SAPLING_NULLIFIER:
+                        hasher << chType << key.second;
+                        stats.nSaplingNullifiers++;
+                        break;
+                    default:
+                        return error("%s: unknown record type %d", __func__, chType);
+                }
+            }
+        }
+
+        uint256 hashStored;
+        file >> hashStored;
+        stats.hashSnapshot = hasher.GetHash();
+        if (hashStored != stats.hashSnapshot)
+            return error("%s: checksum mismatch, snapshot corrupted", __func__);
+        coinsStats.muhash.Finalize(stats.hashCoinsMuHash.begin());
+    } catch (const std::exception& e) {
+        return error("%s: Deserialize or I/O error - %s", __func__, e.what());
+    }
+    return true;
+}
+
 bool CBlockTreeDB::WriteBatchSync(const std::vector<std::pair<int, const CBlockFileInfo*> >& fileInfo, int nLastFile, const std::vector<const CBlockIndex*>& blockinfo) {
     CDBBatch batch(*this);
     for (std::vector<std::pair<int, const CBlockFileInfo*> >::const_iterator it=fileInfo.begin(); it != fileInfo.end(); it++) {
@@ -293,6 +621,100 @@ bool CBlockTreeDB::WriteTxIndex(const std::vector<std::pair<uint256, CDiskTxPos>
     return WriteBatch(batch);
 }
 
+bool CBlockTreeDB::ReadSpentIndex(const CSpentIndexKey &key, CSpentIndexValue &value) {
+    return Read(make_pair(DB_SPENTINDEX, key), value);
+}
+
+bool CBlockTreeDB::UpdateSpentIndex(const std::vector<std::pair<CSpentIndexKey, CSpentIndexValue> > &vect) {
+    CDBBatch batch(*this);
+    for (std::vector<std::pair<CSpentIndexKey, CSpentIndexValue> >::const_iterator it=vect.begin(); it!=vect.end(); it++) {
+        if (it->second.IsNull())
+            batch.Erase(make_pair(DB_SPENTINDEX, it->first));
+        else
+            batch.Write(make_pair(DB_SPENTINDEX, it->first), it->second);
+    }
+    return WriteBatch(batch);
+}
+
+bool CBlockTreeDB::UpdateAddressUnspentIndex(const std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > &vect) {
+    CDBBatch batch(*this);
+    for (std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> >::const_iterator it=vect.begin(); it!=vect.end(); it++) {
+        if (it->second.IsNull())
+            batch.Erase(make_pair(DB_ADDRESSUNSPENTINDEX, it->first));
+        else
+            batch.Write(make_pair(DB_ADDRESSUNSPENTINDEX, it->first), it->second);
+    }
+    return WriteBatch(batch);
+}
+
+bool CBlockTreeDB::ReadAddressUnspentIndex(const uint160 &addressHash, uint8_t type,
+                                           std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > &vect) {
+    boost::scoped_ptr<CDBIterator> pcursor(NewIterator());
+
+    pcursor->Seek(make_pair(DB_ADDRESSUNSPENTINDEX, CAddressIndexIteratorKey(type, addressHash)));
+
+    while (pcursor->Valid()) {
+        boost::this_thread::interruption_point();
+        std::pair<char, CAddressUnspentKey> key;
+        if (pcursor->GetKey(key) && key.first == DB_ADDRESSUNSPENTINDEX &&
+            key.second.type == type && key.second.hashBytes == addressHash) {
+            CAddressUnspentValue value;
+            if (!pcursor->GetValue(value))
+                return error("failed to get address unspent value");
+            vect.push_back(make_pair(key.second, value));
+            pcursor->Next();
+        } else {
+            break;
+        }
+    }
+
+    return true;
+}
+
+bool CBlockTreeDB::WriteAddressIndex(const std::vector<std::pair<CAddressIndexKey, CAmount> > &vect) {
+    CDBBatch batch(*this);
+    for (std::vector<std::pair<CAddressIndexKey, CAmount> >::const_iterator it=vect.begin(); it!=vect.end(); it++)
+        batch.Write(make_pair(DB_ADDRESSINDEX, it->first), it->second);
+    return WriteBatch(batch);
+}
+
+bool CBlockTreeDB::EraseAddressIndex(const std::vector<std::pair<CAddressIndexKey, CAmount> > &vect) {
+    CDBBatch batch(*this);
+    for (std::vector<std::pair<CAddressIndexKey, CAmount> >::const_iterator it=vect.begin(); it!=vect.end(); it++)
+        batch.Erase(make_pair(DB_ADDRESSINDEX, it->first));
+    return WriteBatch(batch);
+}
+
+bool CBlockTreeDB::ReadAddressIndex(const uint160 &addressHash, uint8_t type,
+                                    std::vector<std::pair<CAddressIndexKey, CAmount> > &addressIndex,
+                                    int start, int end) {
+    boost::scoped_ptr<CDBIterator> pcursor(NewIterator());
+
+    if (start > 0 && end > 0)
+        pcursor->Seek(make_pair(DB_ADDRESSINDEX, CAddressIndexIteratorHeightKey(type, addressHash, start)));
+    else
+        pcursor->Seek(make_pair(DB_ADDRESSINDEX, CAddressIndexIteratorKey(type, addressHash)));
+
+    while (pcursor->Valid()) {
+        boost::this_thread::interruption_point();
+        std::pair<char, CAddressIndexKey> key;
+        if (pcursor->GetKey(key) && key.first == DB_ADDRESSINDEX &&
+            key.second.type == type && key.second.hashBytes == addressHash) {
+            if (end > 0 && key.second.blockHeight > end)
+                break;
+            CAmount nValue;
+            if (!pcursor->GetValue(nValue))
+                return error("failed to get address index value");
+            addressIndex.push_back(make_pair(key.second, nValue));
+            pcursor->Next();
+        } else {
+            break;
+        }
+    }
+
+    return true;
+}
+
 bool CBlockTreeDB::WriteFlag(const std::string &name, bool fValue) {
     return Write(std::make_pair(DB_FLAG, name), fValue ? '1' : '0');
 }
@@ -6,8 +6,10 @@
 #ifndef BITCOIN_TXDB_H
 #define BITCOIN_TXDB_H
 
+#include "addressindex.h"
 #include "coins.h"
 #include "dbwrapper.h"
+#include "spentindex.h"
 
 #include <map>
 #include <string>
@@ -31,7 +33,12 @@ class CCoinsViewDB : public CCoinsView
 {
 protected:
     CDBWrapper db;
+    //! Statistics as of the best block, maintained by BatchWrite() once fRunningStats
+    mutable CCoinsRunningStats runningStats;
+    mutable bool fRunningStats;
+
     CCoinsViewDB(std::string dbName, size_t nCacheSize, bool fMemory = false, bool fWipe = false);
+    void LoadRunningStats();
 public:
     CCoinsViewDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false);
 
@@ -49,10 +56,29 @@ public:
                     CAnchorsSproutMap &mapSproutAnchors,
                     CAnchorsSaplingMap &mapSaplingAnchors,
                     CNullifiersMap &mapSproutNullifiers,
-                    CNullifiersMap &mapSaplingNullifiers);
+                    CNullifiersMap &mapSaplingNullifiers,
+                    const CCoinsRunningStats *pstatsRemoved);
     bool GetStats(CCoinsStats &stats) const;
+    /**
+     * Databases created before the running statistics existed get them built
+     * by a scan on the first call, which must not race with BatchWrite().
+     */
+    bool GetRunningStats(CCoinsStats &stats) const;
+    bool HasRunningStats() const { return fRunningStats; }
+    /**
+     * The writer iterates a LevelDB snapshot, so it sees the database as of
+     * this call however long writing takes. The caller must keep BatchWrite()
+     * from running during this call.
+     */
+    CCoinsSnapshotWriter* NewSnapshotWriter() const;
 };
 
+/**
+ * Read and check a UTXO snapshot written by CCoinsViewDB::NewSnapshotWriter():
+ * its format, network, record order and checksum.
+ */
+bool ReadCoinsSnapshot(CAutoFile &file, CCoinsSnapshotStats &stats);
+
 /** Access to the block database (blocks/index/) */
 class CBlockTreeDB : public CDBWrapper
 {
@@ -70,6 +96,16 @@ public:
     bool ReadReindexing(bool &fReindex);
     bool ReadTxIndex(const uint256 &txid, CDiskTxPos &pos);
     bool WriteTxIndex(const std::vector<std::pair<uint256, CDiskTxPos> > &list);
+    bool ReadSpentIndex(const CSpentIndexKey &key, CSpentIndexValue &value);
+    bool UpdateSpentIndex(const std::vector<std::pair<CSpentIndexKey, CSpentIndexValue> > &vect);
+    bool UpdateAddressUnspentIndex(const std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > &vect);
+    bool ReadAddressUnspentIndex(const uint160 &addressHash, uint8_t type,
+                                 std::vector<std::pair<CAddressUnspentKey, CAddressUnspentValue> > &vect);
+    bool WriteAddressIndex(const std::vector<std::pair<CAddressIndexKey, CAmount> > &vect);
+    bool EraseAddressIndex(const std::vector<std::pair<CAddressIndexKey, CAmount> > &vect);
+    bool ReadAddressIndex(const uint160 &addressHash, uint8_t type,
+                          std::vector<std::pair<CAddressIndexKey, CAmount> > &addressIndex,
+                          int start = 0, int end = 0);
     bool WriteFlag(const std::string &name, bool fValue);
     bool ReadFlag(const std::string &name, bool &fValue);
     bool LoadBlockIndexGuts();
@@ -7,6 +7,7 @@
 #define BITCOIN_TXMEMPOOL_H
 
 #include <list>
+#include <set>
 
 #include "amount.h"
 #include "coins.h"
@@ -52,6 +53,21 @@ private:
     bool hadNoDependencies; //! Not dependent on any other txs when it entered the mempool
     bool spendsCoinbase; //! keep track of transactions that spend a coinbase
     uint32_t nBranchId; //! Branch ID this transaction is known to commit to, cached for efficiency
+    CAmount nFeeDelta; //! Fee delta applied via prioritisetransaction
+
+    // Information about descendants of this transaction that are in the
+    // mempool; if we remove this transaction we must remove all of these
+    // descendants as well.
+    uint64_t nCountWithDescendants; //! number of descendant transactions, including this one
+    uint64_t nSizeWithDescendants;  //! ... and size
+    CAmount nModFeesWithDescendants; //! ... and total modified fees
+
+    // Analogous statistics for ancestor transactions; these are what block
+    // assembly sorts on, since a transaction can only be mined together with
+    // all of its unconfirmed ancestors.
+    uint64_t nCountWithAncestors; //! number of ancestor transactions, including this one
+    uint64_t nSizeWithAncestors;  //! ... and size
+    CAmount nModFeesWithAncestors; //! ... and total modified fees
 
 public:
     CTxMemPoolEntry(const CTransaction& _tx, const CAmount& _nFee,
@@ -72,6 +88,65 @@ public:
 
     bool GetSpendsCoinbase() const { return spendsCoinbase; }
     uint32_t GetValidatedBranchId() const { return nBranchId; }
+
+    //! Fee including any prioritisetransaction delta
+    CAmount GetModifiedFee() const { return nFee + nFeeDelta; }
+
+    // Adjusts the descendant/ancestor state by the given deltas
+    void UpdateDescendantState(int64_t modifySize, CAmount modifyFee, int64_t modifyCount);
+    void UpdateAncestorState(int64_t modifySize, CAmount modifyFee, int64_t modifyCount);
+    // Updates the fee delta used for mining priority score, and the
+    // modified fees with descendants/ancestors.
+    void UpdateFeeDelta(CAmount feeDelta);
+
+    uint64_t GetCountWithDescendants() const { return nCountWithDescendants; }
+    uint64_t GetSizeWithDescendants() const { return nSizeWithDescendants; }
+    CAmount GetModFeesWithDescendants() const { return nModFeesWithDescendants; }
+
+    uint64_t GetCountWithAncestors() const { return nCountWithAncestors; }
+    uint64_t GetSizeWithAncestors() const { return nSizeWithAncestors; }
+    CAmount GetModFeesWithAncestors() const { return nModFeesWithAncestors; }
+};
+
+// Helpers for modifying CTxMemPool::mapTx, which is a boost multi_index.
+struct update_descendant_state
+{
+    update_descendant_state(int64_t _modifySize, CAmount _modifyFee, int64_t _modifyCount) :
+        modifySize(_modifySize), modifyFee(_modifyFee), modifyCount(_modifyCount)
+    {}
+
+    void operator() (CTxMemPoolEntry &e)
+        { e.UpdateDescendantState(modifySize, modifyFee, modifyCount); }
+
+    private:
+        int64_t modifySize;
+        CAmount modifyFee;
+        int64_t modifyCount;
+};
+
+struct update_ancestor_state
+{
+    update_ancestor_state(int64_t _modifySize, CAmount _modifyFee, int64_t _modifyCount) :
+        modifySize(_modifySize), modifyFee(_modifyFee), modifyCount(_modifyCount)
+    {}
+
+    void operator() (CTxMemPoolEntry &e)
+        { e.UpdateAncestorState(modifySize, modifyFee, modifyCount); }
+
+    private:
+        int64_t modifySize;
+        CAmount modifyFee;
+        int64_t modifyCount;
+};
+
+struct update_fee_delta
+{
+    update_fee_delta(CAmount _feeDelta) : feeDelta(_feeDelta) { }
+
+    void operator() (CTxMemPoolEntry &e) { e.UpdateFeeDelta(feeDelta); }
+
+private:
+    CAmount feeDelta;
 };
 
 // extracts a TxMemPoolEntry's transaction hash
@@ -87,7 +162,7 @@ struct mempoolentry_txid
 class CompareTxMemPoolEntryByFee
 {
 public:
-    bool operator()(const CTxMemPoolEntry& a, const CTxMemPoolEntry& b)
+    bool operator()(const CTxMemPoolEntry& a, const CTxMemPoolEntry& b) const
     {
         if (a.GetFeeRate() == b.GetFeeRate())
             return a.GetTime() < b.GetTime();
@@ -95,6 +170,94 @@ public:
     }
 };
 
+/** \class CompareTxMemPoolEntryByAncestorFee
+ *
+ *  Sort an entry by min(own fee rate, fee rate with ancestors), so that a
+ *  high-fee child cannot pull a low-fee parent ahead of better packages,
+ *  and a parent is never sorted below a child that depends on it.
+ */
+class CompareTxMemPoolEntryByAncestorFee
+{
+public:
+    bool operator()(const CTxMemPoolEntry& a, const CTxMemPoolEntry& b) const
+    {
+        double aFees, aSize, bFees, bSize;
+        GetModFeeAndSize(a, aFees, aSize);
+        GetModFeeAndSize(b, bFees, bSize);
+
+        // Avoid division by rewriting (a/b > c/d) as (a*d > c*b).
+        double f1 = aFees * bSize;
+        double f2 = aSize * bFees;
+
+        if (f1 == f2)
+            return a.GetTx().GetHash() < b.GetTx().GetHash();
+        return f1 > f2;
+    }
+
+    // Return the fee/size used for sorting, the lower of the entry's own
+    // fee rate and its ancestor package fee rate.
+    static void GetModFeeAndSize(const CTxMemPoolEntry &a, double &mod_fee, double &size)
+    {
+        double f1 = (double)a.GetModifiedFee() * a.GetSizeWithAncestors();
+        double f2 = (double)a.GetModFeesWithAncestors() * a.GetTxSize();
+
+        if (f1 > f2) {
+            mod_fee = a.GetModFeesWithAncestors();
+            size = a.GetSizeWithAncestors();
+        } else {
+            mod_fee = a.GetModifiedFee();
+            size = a.GetTxSize();
+        }
+    }
+};
+
+/** \class CompareTxMemPoolEntryByDescendantScore
+ *
+ *  Sort an entry by max(own fee rate, fee rate with descendants), lowest
+ *  first. The first entry is the cheapest package to evict: removing a
+ *  transaction removes all of its descendants as well, and a low-fee parent
+ *  is kept alive by a child paying for it.
+ */
+class CompareTxMemPoolEntryByDescendantScore
+{
+public:
+    bool operator()(const CTxMemPoolEntry& a, const CTxMemPoolEntry& b) const
+    {
+        bool fUseADescendants = UseDescendantScore(a);
+        bool fUseBDescendants = UseDescendantScore(b);
+
+        double aModFee = fUseADescendants ? a.GetModFeesWithDescendants() : a.GetModifiedFee();
+        double aSize = fUseADescendants ? a.GetSizeWithDescendants() : a.GetTxSize();
+
+        double bModFee = fUseBDescendants ? b.GetModFeesWithDescendants() : b.GetModifiedFee();
+        double bSize = fUseBDescendants ? b.GetSizeWithDescendants() : b.GetTxSize();
+
+        // Avoid division by rewriting (a/b > c/d) as (a*d > c*b).
+        double f1 = aModFee * bSize;
+        double f2 = aSize * bModFee;
+
+        if (f1 == f2) {
+            // of equally cheap packages the newest goes first, the txid keeps the order strict
+            if (a.GetTime() != b.GetTime())
+                return a.GetTime() > b.GetTime();
+            return a.GetTx().GetHash() < b.GetTx().GetHash();
+        }
+        return f1 < f2;
+    }
+
+    // Calculate which score to use for an entry (avoiding division).
+    static bool UseDescendantScore(const CTxMemPoolEntry &a)
+    {
+        double f1 = (double)a.GetModifiedFee() * a.GetSizeWithDescendants();
+        double f2 = (double)a.GetModFeesWithDescendants() * a.GetTxSize();
+        return f2 > f1;
+    }
+};
+
+// Multi_index tag names
+struct ancestor_score {};
+struct descendant_score {};
+
 class CBlockPolicyEstimator;
 
 /** An inpoint - a combination of a transaction and an index n into its vin */
@@ -131,6 +294,16 @@ private:
     uint64_t totalTxSize = 0; //! sum of all mempool tx' byte sizes
     uint64_t cachedInnerUsage; //! sum of dynamic memory usage of all the map elements (NOT the maps themselves)
 
+    CFeeRate minReasonableRelayFee; //! fee rate added on top of evicted packages
+
+    mutable int64_t lastRollingFeeUpdate;
+    mutable bool blockSinceLastRollingFeeBump;
+    mutable double rollingMinimumFeeRate; //! minimum fee to get into the pool, decreases exponentially
+    uint64_t nEvictedTx; //! transactions evicted by TrimToSize
+    uint64_t nEvictedBytes; //! ... and their total size
+
+    void trackPackageRemoved(const CFeeRate& rate);
+
     std::map<uint256, const CTransaction*> mapSproutNullifiers;
     std::map<uint256, const CTransaction*> mapSaplingNullifiers;
 
@@ -146,15 +319,77 @@ public:
             boost::multi_index::ordered_non_unique<
                 boost::multi_index::identity<CTxMemPoolEntry>,
                 CompareTxMemPoolEntryByFee
+            >,
+            // sorted by ancestor package fee rate, for block assembly
+            boost::multi_index::ordered_non_unique<
+                boost::multi_index::tag<ancestor_score>,
+                boost::multi_index::identity<CTxMemPoolEntry>,
+                CompareTxMemPoolEntryByAncestorFee
+            >,
+            // sorted by descendant package fee rate, for eviction
+            boost::multi_index::ordered_non_unique<
+                boost::multi_index::tag<descendant_score>,
+                boost::multi_index::identity<CTxMemPoolEntry>,
+                CompareTxMemPoolEntryByDescendantScore
             >
         >
     > indexed_transaction_set;
 
     mutable CCriticalSection cs;
     indexed_transaction_set mapTx;
+
+    typedef indexed_transaction_set::nth_index<0>::type::iterator txiter;
+    struct CompareIteratorByHash {
+        bool operator()(const txiter &a, const txiter &b) const {
+            return a->GetTx().GetHash() < b->GetTx().GetHash();
+        }
+    };
+    typedef std::set<txiter, CompareIteratorByHash> setEntries;
+    /** Orders entries parents-first, as a transaction always has more ancestors than any of its parents */
+    struct CompareIteratorByAncestorCount {
+        bool operator()(const txiter &a, const txiter &b) const {
+            if (a->GetCountWithAncestors() != b->GetCountWithAncestors())
+                return a->GetCountWithAncestors() < b->GetCountWithAncestors();
+            return CompareIteratorByHash()(a, b);
+        }
+    };
+
+    const setEntries & GetMemPoolParents(txiter entry) const;
+    const setEntries & GetMemPoolChildren(txiter entry) const;
+
+private:
+    struct TxLinks {
+        setEntries parents;
+        setEntries children;
+    };
+
+    typedef std::map<txiter, TxLinks, CompareIteratorByHash> txlinksMap;
+    txlinksMap mapLinks;
+
+    void UpdateParent(txiter entry, txiter parent, bool add);
+    void UpdateChild(txiter entry, txiter child, bool add);
+
+    /** Recompute the ancestor and descendant state of an entry from scratch */
+    void UpdateEntryPackageState(txiter entry);
+    /**
+     * Update ancestors/descendants of a set of entries that is about to be
+     * removed. updateDescendants should only be set when the entries' own
+     * in-mempool ancestors are gone already, e.g. for transactions that were
+     * included in a block; the remaining descendants then only lose the
+     * removed entries from their ancestor state.
+     */
+    void UpdateForRemoveFromMempool(const setEntries &entriesToRemove, bool updateDescendants);
+    /** Remove a set of transactions and all of their in-mempool links */
+    void RemoveStaged(const setEntries &stage, std::list<CTransaction>& removed, bool updateDescendants);
+    void removeUnchecked(txiter entry, std::list<CTransaction>& removed);
+
+public:
     std::map<COutPoint, CInPoint> mapNextTx;
     std::map<uint256, std::pair<double, CAmount> > mapDeltas;
 
+    /** Half-life of the rolling minimum fee, in seconds */
+    static const int ROLLING_FEE_HALFLIFE = 60 * 60 * 12;
+
     CTxMemPool(const CFeeRate& _minRelayFee);
     ~CTxMemPool();
 
@@ -192,6 +427,59 @@ public:
     void ApplyDeltas(const uint256 hash, double &dPriorityDelta, CAmount &nFeeDelta);
     void ClearPrioritisation(const uint256 hash);
 
+    /**
+     * Populate setAncestors with all the in-mempool ancestors of entry.
+     * If fSearchForParents is set, the parents are looked up via the
+     * transaction inputs (for entries not yet in the mempool), otherwise
+     * the cached mapLinks parents are used.
+     */
+    void CalculateMemPoolAncestors(const CTxMemPoolEntry &entry, setEntries &setAncestors, bool fSearchForParents = true) const;
+    /**
+     * As above, but stop and return false with the reason in errString as
+     * soon as entry would have more than limitAncestorCount ancestors or
+     * limitAncestorSize bytes of them (both counting entry itself), or
+     * would give one of them more than limitDescendantCount descendants or
+     * limitDescendantSize bytes of them (counting that ancestor).
+     */
+    bool CalculateMemPoolAncestors(const CTxMemPoolEntry &entry, setEntries &setAncestors,
+                                   uint64_t limitAncestorCount, uint64_t limitAncestorSize,
+                                   uint64_t limitDescendantCount, uint64_t limitDescendantSize,
+                                   std::string &errString, bool fSearchForParents = true) const;
+    /**
+     * Populate setDescendants with all in-mempool descendants of entryit.
+     * Assumes that setDescendants includes all in-mempool descendants of
+     * anything already in it.
+     */
+    void CalculateDescendants(txiter entryit, setEntries &setDescendants) const;
+
+    /**
+     * The minimum fee to get into the mempool, which may itself not be
+     * enough to get into the mempool if it is full. After packages have
+     * been evicted it is raised to their fee rate and then decays with a
+     * half-life of ROLLING_FEE_HALFLIFE once a block has been connected;
+     * the decay is faster while the pool is well below sizelimit.
+     */
+    CFeeRate GetMinFee(size_t sizelimit) const;
+
+    /**
+     * Remove transactions from the mempool until its dynamic size is <=
+     * sizelimit, evicting the packages with the lowest descendant fee rate
+     * first.
+     */
+    void TrimToSize(size_t sizelimit);
+
+    uint64_t GetEvictedCount() const
+    {
+        LOCK(cs);
+        return nEvictedTx;
+    }
+
+    uint64_t GetEvictedBytes() const
+    {
+        LOCK(cs);
+        return nEvictedBytes;
+    }
+
     bool nullifierExists(const uint256& nullifier, ShieldedType type) const;
 
     unsigned long size()
@@ -151,3 +151,16 @@ CWalletTx GetValidSpend(ZCJoinSplit& params,
     CWalletTx wtx {NULL, tx};
     return wtx;
 }
+
+CTransaction GetCommitmentsOnlyTx()
+{
+    // Only the note commitments matter for witnesses
+    CMutableTransaction mtx;
+    mtx.nVersion = 2;
+    JSDescription jsdesc;
+    for (auto& cm : jsdesc.commitments) {
+        cm = GetRandHash();
+    }
+    mtx.vjoinsplit.push_back(jsdesc);
+    return mtx;
+}
@@ -17,3 +17,4 @@ libzcash::SproutNote GetNote(ZCJoinSplit& params,
 CWalletTx GetValidSpend(ZCJoinSplit& params,
                         const libzcash::SproutSpendingKey& sk,
                         const libzcash::SproutNote& note, CAmount value);
+CTransaction GetCommitmentsOnlyTx();
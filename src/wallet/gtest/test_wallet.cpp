@@ -17,6 +17,10 @@
 
 #include <boost/filesystem.hpp>
 
+#include <deque>
+#include <memory>
+
+using ::testing::InSequence;
 using ::testing::Return;
 
 extern ZCJoinSplit* params;
@@ -71,6 +75,15 @@ public:
     void MarkAffectedTransactionsDirty(const CTransaction& tx) {
         CWallet::MarkAffectedTransactionsDirty(tx);
     }
+    void PruneSpendableTxs() {
+        LOCK2(cs_main, cs_wallet);
+        CWallet::PruneSpendableTxs();
+    }
+    bool IsSpendableTxIndexed(const uint256& hash) {
+        LOCK(cs_wallet);
+        EnsureSpendableTxs();
+        return setSpendableTxs.count(hash) > 0;
+    }
 };
 
 CWalletTx GetValidReceive(const libzcash::SproutSpendingKey& sk, CAmount value, bool randomInputs, int32_t version = 2) {
@@ -547,6 +560,35 @@ TEST(WalletTests, FindMySproutNotes) {
     EXPECT_EQ(nd, noteMap[jsoutpt]);
 }
 
+TEST(WalletTests, TrialDecryptionQueueSproutHints) {
+    CWallet wallet;
+
+    auto sk = libzcash::SproutSpendingKey::random();
+    auto sk2 = libzcash::SproutSpendingKey::random();
+    wallet.AddSproutSpendingKey(sk);
+    wallet.AddSproutSpendingKey(sk2);
+
+    auto wtx = GetValidReceive(sk, 10, true);
+    auto wtx2 = GetValidReceive(libzcash::SproutSpendingKey::random(), 10, true);
+
+    std::vector<CNoteDecryptionHint> hints(2);
+    {
+        CTrialDecryptionQueue queue(wallet, 4);
+        queue.Add(wtx, hints[0]);
+        queue.Add(wtx2, hints[1]);
+        queue.Wait();
+    }
+
+    // Both outputs of the first transaction are ours, none of the second
+    EXPECT_EQ(2, hints[0].sprout.size());
+    EXPECT_EQ(sk.address(), hints[0].sprout[JSOutPoint(wtx.GetHash(), 0, 1)]);
+    EXPECT_EQ(0, hints[1].sprout.size());
+
+    // The hinted lookup finds the same notes as trying every key
+    EXPECT_EQ(wallet.FindMySproutNotes(wtx), wallet.FindMySproutNotes(wtx, &hints[0]));
+    EXPECT_EQ(0, wallet.FindMySproutNotes(wtx2, &hints[1]).size());
+}
+
 TEST(WalletTests, FindMySproutNotesInEncryptedWallet) {
     TestWallet wallet;
     uint256 r {GetRandHash()};
@@ -1307,6 +1349,45 @@ TEST(WalletTests, CachedWitnessesChainTip) {
     }
 }
 
+TEST(WalletTests, CachedWitnessesMidBlock) {
+    TestWallet wallet;
+    SproutMerkleTree sproutTree;
+    SaplingMerkleTree saplingTree;
+
+    auto sk = libzcash::SproutSpendingKey::random();
+    wallet.AddSproutSpendingKey(sk);
+
+    // Each block has one of our notes between commitments of other wallets
+    std::vector<JSOutPoint> sproutNotes;
+    for (int height = 1; height <= 3; height++) {
+        CWalletTx wtx(&wallet, GetCommitmentsOnlyTx());
+        JSOutPoint jsoutpt {wtx.GetHash(), 0, 0};
+        mapSproutNoteData_t noteData;
+        noteData[jsoutpt] = SproutNoteData {sk.address()};
+        wtx.SetSproutNoteData(noteData);
+        wallet.AddToWallet(wtx, true, NULL);
+        sproutNotes.push_back(jsoutpt);
+
+        CBlock block;
+        block.vtx.push_back(GetCommitmentsOnlyTx());
+        block.vtx.push_back(wtx);
+        block.vtx.push_back(GetCommitmentsOnlyTx());
+        CBlockIndex index(block);
+        index.nHeight = height;
+        wallet.IncrementNoteWitnesses(&index, &block, sproutTree, saplingTree);
+
+        // Old and new witnesses all end at the same frontier
+        std::vector<boost::optional<SproutWitness>> sproutWitnesses;
+        uint256 anchor;
+        wallet.GetSproutNoteWitnesses(sproutNotes, sproutWitnesses, anchor);
+        EXPECT_EQ(sproutTree.root(), anchor);
+        for (auto& witness : sproutWitnesses) {
+            ASSERT_TRUE((bool) witness);
+            EXPECT_EQ(sproutTree.root(), witness->root());
+        }
+    }
+}
+
 TEST(WalletTests, CachedWitnessesDecrementFirst) {
     TestWallet wallet;
     SproutMerkleTree sproutTree;
@@ -2116,3 +2197,301 @@ TEST(WalletTests, SaplingNoteLocking) {
     EXPECT_FALSE(wallet.IsLockedNote(sop1));
     EXPECT_FALSE(wallet.IsLockedNote(sop2));
 }
+
+// A chain of fake blocks for the tests that need transactions at a given depth
+class FakeChain {
+public:
+    ~FakeChain() {
+        chainActive.SetTip(NULL);
+        for (const auto& pindex : vIndex) {
+            mapBlockIndex.erase(pindex->GetBlockHash());
+        }
+    }
+
+    // Mine the transactions in a new block on top of the tip
+    CBlock Connect(const std::vector<CTransaction>& vtx = std::vector<CTransaction>()) {
+        CBlock block;
+        block.vtx = vtx;
+        block.nTime = vIndex.size();
+        block.hashPrevBlock = chainActive.Tip() ? chainActive.Tip()->GetBlockHash() : uint256();
+        block.hashMerkleRoot = block.BuildMerkleTree();
+
+        vHash.push_back(block.GetHash());
+        vIndex.push_back(std::unique_ptr<CBlockIndex>(new CBlockIndex(block)));
+        CBlockIndex* pindex = vIndex.back().get();
+        pindex->phashBlock = &vHash.back();
+        pindex->pprev = chainActive.Tip();
+        pindex->nHeight = chainActive.Height() + 1;
+        mapBlockIndex.insert(std::make_pair(vHash.back(), pindex));
+        chainActive.SetTip(pindex);
+        return block;
+    }
+
+    void Disconnect() {
+        chainActive.SetTip(chainActive.Tip()->pprev);
+    }
+
+private:
+    std::deque<uint256> vHash;
+    std::vector<std::unique_ptr<CBlockIndex>> vIndex;
+};
+
+// The outputs AvailableCoins() should return, found by looking at every wallet transaction
+static std::set<std::pair<uint256, unsigned int>> AvailableOutputsFullScan(CWallet& wallet) {
+    LOCK2(cs_main, wallet.cs_wallet);
+    std::set<std::pair<uint256, unsigned int>> outputs;
+    for (const auto& item : wallet.mapWallet) {
+        const CWalletTx& wtx = item.second;
+        if (!CheckFinalTx(wtx) || wtx.GetDepthInMainChain() < 0) {
+            continue;
+        }
+        for (unsigned int i = 0; i < wtx.vout.size(); i++) {
+            if (wallet.IsMine(wtx.vout[i]) != ISMINE_NO && !wallet.IsSpent(item.first, i) && wtx.vout[i].nValue > 0) {
+                outputs.insert(std::make_pair(item.first, i));
+            }
+        }
+    }
+    return outputs;
+}
+
+static std::set<std::pair<uint256, unsigned int>> AvailableOutputs(CWallet& wallet) {
+    std::vector<COutput> vCoins;
+    wallet.AvailableCoins(vCoins, false);
+    std::set<std::pair<uint256, unsigned int>> outputs;
+    for (const COutput& out : vCoins) {
+        outputs.insert(std::make_pair(out.tx->GetHash(), out.i));
+    }
+    return outputs;
+}
+
+static CWalletTx MineTx(TestWallet& wallet, FakeChain& chain, const CMutableTransaction& mtx) {
+    CWalletTx wtx {&wallet, mtx};
+    CBlock block = chain.Connect({wtx});
+    wtx.SetMerkleBranch(block);
+    wallet.AddToWallet(wtx, true, NULL);
+    return wtx;
+}
+
+TEST(WalletTests, SpendableTxIndexMatchesFullScan) {
+    SelectParams(CBaseChainParams::REGTEST);
+
+    TestWallet wallet;
+    FakeChain chain;
+    CKey key;
+    key.MakeNewKey(true);
+    wallet.AddKey(key);
+    CScript scriptMine = GetScriptForDestination(key.GetPubKey().GetID());
+    CKey keyOther;
+    keyOther.MakeNewKey(true);
+    CScript scriptOther = GetScriptForDestination(keyOther.GetPubKey().GetID());
+
+    chain.Connect();
+    EXPECT_TRUE(AvailableOutputs(wallet).empty());
+
+    // Two outputs of ours and one to someone else
+    CMutableTransaction mtxReceive;
+    mtxReceive.vin.resize(1);
+    mtxReceive.vin[0].prevout = COutPoint(GetRandHash(), 0);
+    mtxReceive.vout.resize(3);
+    mtxReceive.vout[0] = CTxOut(10 * COIN, scriptMine);
+    mtxReceive.vout[1] = CTxOut(20 * COIN, scriptMine);
+    mtxReceive.vout[2] = CTxOut(30 * COIN, scriptOther);
+    CWalletTx wtxReceive = MineTx(wallet, chain, mtxReceive);
+    EXPECT_EQ(AvailableOutputs(wallet).size(), 2);
+    EXPECT_EQ(AvailableOutputs(wallet), AvailableOutputsFullScan(wallet));
+
+    // Spend the first output
+    CMutableTransaction mtxSpend1;
+    mtxSpend1.vin.resize(1);
+    mtxSpend1.vin[0].prevout = COutPoint(wtxReceive.GetHash(), 0);
+    mtxSpend1.vout.resize(1);
+    mtxSpend1.vout[0] = CTxOut(9 * COIN, scriptOther);
+    CWalletTx wtxSpend1 = MineTx(wallet, chain, mtxSpend1);
+    EXPECT_EQ(AvailableOutputs(wallet).size(), 1);
+    EXPECT_EQ(AvailableOutputs(wallet), AvailableOutputsFullScan(wallet));
+    EXPECT_FALSE(wallet.IsSpendableTxIndexed(wtxSpend1.GetHash()));
+
+    // A reorg unconfirms the spend, which doesn't bury anything
+    chain.Disconnect();
+    CWalletTx wtxSpend1Unmined {&wallet, mtxSpend1};
+    wallet.AddToWallet(wtxSpend1Unmined, true, NULL);
+    wallet.PruneSpendableTxs();
+    EXPECT_TRUE(wallet.IsSpendableTxIndexed(wtxReceive.GetHash()));
+    EXPECT_EQ(AvailableOutputs(wallet), AvailableOutputsFullScan(wallet));
+    wtxSpend1 = MineTx(wallet, chain, mtxSpend1);
+
+    // Spend the second output too, the receive stays indexed while a reorg could undo that
+    CMutableTransaction mtxSpend2;
+    mtxSpend2.vin.resize(1);
+    mtxSpend2.vin[0].prevout = COutPoint(wtxReceive.GetHash(), 1);
+    mtxSpend2.vout.resize(1);
+    mtxSpend2.vout[0] = CTxOut(19 * COIN, scriptOther);
+    MineTx(wallet, chain, mtxSpend2);
+    EXPECT_TRUE(AvailableOutputs(wallet).empty());
+    for (unsigned int i = 0; i < MAX_REORG_LENGTH - 1; i++) {
+        chain.Connect();
+    }
+    wallet.PruneSpendableTxs();
+    EXPECT_TRUE(wallet.IsSpendableTxIndexed(wtxReceive.GetHash()));
+
+    // Once both spends are buried deeper than a reorg can go, the receive is dropped
+    chain.Connect();
+    wallet.PruneSpendableTxs();
+    EXPECT_FALSE(wallet.IsSpendableTxIndexed(wtxReceive.GetHash()));
+    EXPECT_TRUE(AvailableOutputs(wallet).empty());
+    EXPECT_EQ(AvailableOutputs(wallet), AvailableOutputsFullScan(wallet));
+
+    // New transactions are picked up after the pruning
+    CMutableTransaction mtxReceive2;
+    mtxReceive2.vin.resize(1);
+    mtxReceive2.vin[0].prevout = COutPoint(GetRandHash(), 0);
+    mtxReceive2.vout.resize(2);
+    mtxReceive2.vout[0] = CTxOut(40 * COIN, scriptMine);
+    mtxReceive2.vout[1] = CTxOut(50 * COIN, scriptOther);
+    CWalletTx wtxReceive2 = MineTx(wallet, chain, mtxReceive2);
+    EXPECT_EQ(AvailableOutputs(wallet).size(), 1);
+    EXPECT_EQ(AvailableOutputs(wallet), AvailableOutputsFullScan(wallet));
+
+    // Importing a key makes outputs of older transactions ours
+    wallet.AddKey(keyOther);
+    EXPECT_TRUE(wallet.IsSpendableTxIndexed(wtxReceive.GetHash()));
+    EXPECT_EQ(AvailableOutputs(wallet).size(), 5);
+    EXPECT_EQ(AvailableOutputs(wallet), AvailableOutputsFullScan(wallet));
+    // The balance only sums the indexed transactions too
+    EXPECT_EQ(wallet.GetBalance(), 148 * COIN);
+}
+
+TEST(WalletTests, SetBestChainWritesPendingTxsWithLocator) {
+    SelectParams(CBaseChainParams::REGTEST);
+
+    TestWallet wallet;
+    MockWalletDB walletdb;
+    CBlockLocator loc;
+
+    CKey tsk = DecodeSecret(tSecretRegtest);
+    wallet.AddKey(tsk);
+    auto scriptPubKey = GetScriptForDestination(tsk.GetPubKey().GetID());
+
+    // A transparent transaction added without a database handle is queued for the next batch
+    CMutableTransaction t;
+    t.vout.resize(1);
+    t.vout[0].nValue = 90*CENT;
+    t.vout[0].scriptPubKey = scriptPubKey;
+    CWalletTx wtx {nullptr, t};
+    wallet.AddToWallet(wtx, false, nullptr);
+
+    // A failed write leaves it queued and the best block alone
+    EXPECT_CALL(walletdb, WriteBestBlock(loc))
+        .Times(0);
+    {
+        InSequence seq;
+        EXPECT_CALL(walletdb, TxnBegin())
+            .WillOnce(Return(true));
+        EXPECT_CALL(walletdb, WriteTx(wtx.GetHash(), ::testing::_))
+            .WillOnce(Return(false));
+        EXPECT_CALL(walletdb, TxnAbort())
+            .Times(1);
+    }
+    wallet.SetBestChain(walletdb, loc);
+    ::testing::Mock::VerifyAndClearExpectations(&walletdb);
+
+    // The queued transaction goes in the same atomic write as the best block, ahead of it
+    {
+        InSequence seq;
+        EXPECT_CALL(walletdb, TxnBegin())
+            .WillOnce(Return(true));
+        EXPECT_CALL(walletdb, WriteTx(wtx.GetHash(), ::testing::_))
+            .WillOnce(Return(true));
+        EXPECT_CALL(walletdb, WriteWitnessCacheSize(0))
+            .WillOnce(Return(true));
+        EXPECT_CALL(walletdb, WriteBestBlock(loc))
+            .WillOnce(Return(true));
+        EXPECT_CALL(walletdb, TxnCommit())
+            .WillOnce(Return(true));
+    }
+    wallet.SetBestChain(walletdb, loc);
+    ::testing::Mock::VerifyAndClearExpectations(&walletdb);
+
+    // Once committed it is no longer pending
+    EXPECT_CALL(walletdb, TxnBegin())
+        .WillOnce(Return(true));
+    EXPECT_CALL(walletdb, WriteTx(wtx.GetHash(), ::testing::_))
+        .Times(0);
+    EXPECT_CALL(walletdb, WriteWitnessCacheSize(0))
+        .WillOnce(Return(true));
+    EXPECT_CALL(walletdb, WriteBestBlock(loc))
+        .WillOnce(Return(true));
+    EXPECT_CALL(walletdb, TxnCommit())
+        .WillOnce(Return(true));
+    wallet.SetBestChain(walletdb, loc);
+}
+
+TEST(WalletTests, BatchedTxWritesReachDatabase) {
+    SelectParams(CBaseChainParams::REGTEST);
+
+    boost::filesystem::path pathTemp = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path();
+    boost::filesystem::create_directories(pathTemp);
+    mapArgs["-datadir"] = pathTemp.string();
+
+    const std::string strWalletFile = "wallet-batched-writes.dat";
+    bool fFirstRun;
+    CWallet wallet(strWalletFile);
+    ASSERT_EQ(DB_LOAD_OK, wallet.LoadWallet(fFirstRun));
+    CKey key;
+    key.MakeNewKey(true);
+    {
+        LOCK(wallet.cs_wallet);
+        ASSERT_TRUE(wallet.AddKey(key));
+    }
+    CScript scriptMine = GetScriptForDestination(key.GetPubKey().GetID());
+
+    auto connectReceive = [&](FakeChain& chain, CAmount nValue) -> uint256 {
+        CMutableTransaction mtx;
+        mtx.vin.resize(1);
+        mtx.vin[0].prevout = COutPoint(GetRandHash(), 0);
+        mtx.vout.resize(1);
+        mtx.vout[0] = CTxOut(nValue, scriptMine);
+        CTransaction tx(mtx);
+        CBlock block = chain.Connect({tx});
+        wallet.SyncTransaction(tx, &block);
+        return tx.GetHash();
+    };
+
+    // Transactions from connected blocks are only queued
+    FakeChain chain;
+    chain.Connect();
+    std::vector<uint256> vHashes;
+    for (int i = 1; i <= 3; i++) {
+        vHashes.push_back(connectReceive(chain, i * COIN));
+    }
+    {
+        CWallet walletReload(strWalletFile);
+        ASSERT_EQ(DB_LOAD_OK, walletReload.LoadWallet(fFirstRun));
+        EXPECT_TRUE(walletReload.mapWallet.empty());
+    }
+
+    // Flushing the wallet writes them
+    wallet.Flush(false);
+    {
+        CWallet walletReload(strWalletFile);
+        ASSERT_EQ(DB_LOAD_OK, walletReload.LoadWallet(fFirstRun));
+        EXPECT_EQ(walletReload.mapWallet.size(), vHashes.size());
+        for (const uint256& hash : vHashes) {
+            ASSERT_EQ(walletReload.mapWallet.count(hash), 1);
+            EXPECT_EQ(walletReload.mapWallet[hash].hashBlock, wallet.mapWallet[hash].hashBlock);
+        }
+    }
+
+    // Setting the best chain writes what is still queued along with the locator
+    uint256 hash = connectReceive(chain, 4 * COIN);
+    CBlockLocator loc = chainActive.GetLocator();
+    wallet.SetBestChain(loc);
+    {
+        CWallet walletReload(strWalletFile);
+        ASSERT_EQ(DB_LOAD_OK, walletReload.LoadWallet(fFirstRun));
+        EXPECT_EQ(walletReload.mapWallet.count(hash), 1);
+        CBlockLocator locRead;
+        EXPECT_TRUE(CWalletDB(strWalletFile).ReadBestBlock(locRead));
+        EXPECT_TRUE(locRead.vHave == loc.vHave);
+    }
+}
@@ -2778,10 +2778,21 @@ UniValue zc_benchmark(const UniValue& params, bool fHelp)
             sample_times.push_back(benchmark_large_tx(nInputs));
         } else if (benchmarktype == "trydecryptnotes") {
             int nAddrs = params[2].get_int();
-            sample_times.push_back(benchmark_try_decrypt_notes(nAddrs));
+            if (params.size() < 4) {
+                sample_times.push_back(benchmark_try_decrypt_notes(nAddrs));
+            } else {
+                int nThreads = params[3].get_int();
+                sample_times.push_back(benchmark_try_decrypt_notes_threaded(nAddrs, nThreads));
+            }
         } else if (benchmarktype == "incnotewitnesses") {
             int nTxs = params[2].get_int();
-            sample_times.push_back(benchmark_increment_note_witnesses(nTxs));
+            if (params.size() < 4) {
+                sample_times.push_back(benchmark_increment_note_witnesses(nTxs));
+            } else {
+                // nTxs wallet notes, witnessed over a block of that many other transactions
+                int nBlockTxs = params[3].get_int();
+                sample_times.push_back(benchmark_increment_note_witnesses_scaled(nTxs, nBlockTxs));
+            }
         } else if (benchmarktype == "connectblockslow") {
             if (Params().NetworkIDString() != "regtest") {
                 throw JSONRPCError(RPC_TYPE_ERROR, "Benchmark must be run in regtest mode");
@@ -2798,6 +2809,38 @@ UniValue zc_benchmark(const UniValue& params, bool fHelp)
                 throw JSONRPCError(RPC_TYPE_ERROR, "Benchmark must be run in regtest mode");
             }
             sample_times.push_back(benchmark_loadwallet());
+        } else if (benchmarktype == "writewallettxs") {
+            if (Params().NetworkIDString() != "regtest") {
+                throw JSONRPCError(RPC_TYPE_ERROR, "Benchmark must be run in regtest mode");
+            }
+            int nTxs = params[2].get_int();
+            bool fBatch = params.size() < 4 || params[3].get_bool();
+            sample_times.push_back(benchmark_write_wallet_txs(nTxs, fBatch));
+        } else if (benchmarktype == "coinscache") {
+            // Number of transactions put into and looked up in the cache
+            int nCoins = 100000;
+            if (params.size() >= 3) {
+                nCoins = params[2].get_int();
+            }
+            sample_times.push_back(benchmark_coins_cache(nCoins));
+        } else if (benchmarktype == "flushcoins") {
+            // Number of transactions spent from and flushed to the coins database
+            int nCoins = 100000;
+            if (params.size() >= 3) {
+                nCoins = params[2].get_int();
+            }
+            sample_times.push_back(benchmark_flush_coins(nCoins));
+        } else if (benchmarktype == "verifypastelid") {
+            // Number of signatures verified in one batch, and threads to verify them on
+            int nSigs = 1000;
+            int nThreads = 0;
+            if (params.size() >= 3) {
+                nSigs = params[2].get_int();
+            }
+            if (params.size() >= 4) {
+                nThreads = params[3].get_int();
+            }
+            sample_times.push_back(benchmark_verify_pastelid(nSigs, nThreads));
         } else if (benchmarktype == "listunspent") {
             sample_times.push_back(benchmark_listunspent());
         } else if (benchmarktype == "createsaplingspend") {
@@ -2808,6 +2851,13 @@ UniValue zc_benchmark(const UniValue& params, bool fHelp)
             sample_times.push_back(benchmark_verify_sapling_spend());
         } else if (benchmarktype == "verifysaplingoutput") {
             sample_times.push_back(benchmark_verify_sapling_output());
+        } else if (benchmarktype == "verifysaplingblock") {
+            // Number of Sapling transactions in the simulated block
+            int nTxs = 100;
+            if (params.size() >= 3) {
+                nTxs = params[2].get_int();
+            }
+            sample_times.push_back(benchmark_verify_sapling_block(nTxs));
         } else {
             throw JSONRPCError(RPC_TYPE_ERROR, "Invalid benchmarktype");
         }
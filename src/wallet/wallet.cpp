@@ -6,6 +6,7 @@
 #include "wallet/wallet.h"
 
 #include "checkpoints.h"
+#include "checkqueue.h"
 #include "coincontrol.h"
 #include "consensus/upgrades.h"
 #include "consensus/validation.h"
@@ -242,8 +243,11 @@ CPubKey CWallet::GenerateNewKey()
     if (!nTimeFirstKey || nCreationTime < nTimeFirstKey)
         nTimeFirstKey = nCreationTime;
 
+    // A fresh key can't own outputs already in the wallet
+    bool fSpendableTxsDirtyBefore = fSpendableTxsDirty;
     if (!AddKeyPubKey(secret, pubkey))
         throw std::runtime_error("CWallet::GenerateNewKey(): AddKey failed");
+    fSpendableTxsDirty = fSpendableTxsDirtyBefore;
     return pubkey;
 }
 
@@ -252,6 +256,7 @@ bool CWallet::AddKeyPubKey(const CKey& secret, const CPubKey &pubkey)
     AssertLockHeld(cs_wallet); // mapKeyMetadata
     if (!CCryptoKeyStore::AddKeyPubKey(secret, pubkey))
         return false;
+    fSpendableTxsDirty = true;
 
     // check if we need to remove from watch-only
     CScript script;
@@ -435,6 +440,7 @@ bool CWallet::AddCScript(const CScript& redeemScript)
 {
     if (!CCryptoKeyStore::AddCScript(redeemScript))
         return false;
+    fSpendableTxsDirty = true;
     if (!fFileBacked)
         return true;
     return CWalletDB(strWalletFile).WriteCScript(Hash160(redeemScript), redeemScript);
@@ -460,6 +466,7 @@ bool CWallet::AddWatchOnly(const CScript &dest)
 {
     if (!CCryptoKeyStore::AddWatchOnly(dest))
         return false;
+    fSpendableTxsDirty = true;
     nTimeFirstKey = 1; // No birthday information for watch-only keys.
     NotifyWatchonlyChanged(true);
     if (!fFileBacked)
@@ -570,6 +577,9 @@ void CWallet::SetBestChain(const CBlockLocator& loc)
 {
     CWalletDB walletdb(strWalletFile);
     SetBestChainINTERNAL(walletdb, loc);
+
+    LOCK2(cs_main, cs_wallet);
+    PruneSpendableTxs();
 }
 
 std::set<std::pair<libzcash::PaymentAddress, uint256>> CWallet::GetNullifiersForAddresses(
@@ -747,6 +757,7 @@ set<uint256> CWallet::GetConflicts(const uint256& txid) const
 
 void CWallet::Flush(bool shutdown)
 {
+    WritePendingTxs();
     bitdb.Flush(shutdown);
 }
 
@@ -888,6 +899,90 @@ bool CWallet::IsSaplingSpent(const uint256& nullifier) const {
     return false;
 }
 
+/**
+ * Whether key is spent by a wallet transaction buried deeper than
+ * MAX_REORG_LENGTH, so it can never become unspent again.
+ */
+template <class T>
+bool CWallet::IsSpentBeyondReorg(const TxSpendMap<T>& mapSpends, const T& key) const
+{
+    auto range = mapSpends.equal_range(key);
+    for (auto it = range.first; it != range.second; ++it) {
+        std::map<uint256, CWalletTx>::const_iterator mit = mapWallet.find(it->second);
+        if (mit != mapWallet.end() && mit->second.GetDepthInMainChain() > (int)MAX_REORG_LENGTH) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool CWallet::MayHaveSpendableOutputs(const CWalletTx& wtx) const
+{
+    const uint256& hash = wtx.GetHash();
+    for (unsigned int i = 0; i < wtx.vout.size(); i++) {
+        if (IsMine(wtx.vout[i]) != ISMINE_NO && !IsSpentBeyondReorg(mapTxSpends, COutPoint(hash, i))) {
+            return true;
+        }
+    }
+    // Per the comment in SproutNoteData, notes without a cached nullifier count as unspent
+    for (const mapSproutNoteData_t::value_type& item : wtx.mapSproutNoteData) {
+        if (!item.second.nullifier || !IsSpentBeyondReorg(mapTxSproutNullifiers, *item.second.nullifier)) {
+            return true;
+        }
+    }
+    for (const mapSaplingNoteData_t::value_type& item : wtx.mapSaplingNoteData) {
+        if (!item.second.nullifier || !IsSpentBeyondReorg(mapTxSaplingNullifiers, *item.second.nullifier)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void CWallet::UpdateSpendableTxs(const uint256& wtxid) const
+{
+    AssertLockHeld(cs_wallet);
+    if (fSpendableTxsDirty) {
+        return;
+    }
+    std::map<uint256, CWalletTx>::const_iterator it = mapWallet.find(wtxid);
+    if (it != mapWallet.end() && MayHaveSpendableOutputs(it->second)) {
+        setSpendableTxs.insert(wtxid);
+    } else {
+        setSpendableTxs.erase(wtxid);
+    }
+}
+
+void CWallet::EnsureSpendableTxs() const
+{
+    AssertLockHeld(cs_wallet);
+    if (!fSpendableTxsDirty) {
+        return;
+    }
+    setSpendableTxs.clear();
+    for (const std::pair<const uint256, CWalletTx>& wtxItem : mapWallet) {
+        if (MayHaveSpendableOutputs(wtxItem.second)) {
+            setSpendableTxs.insert(setSpendableTxs.end(), wtxItem.first);
+        }
+    }
+    fSpendableTxsDirty = false;
+}
+
+void CWallet::PruneSpendableTxs()
+{
+    AssertLockHeld(cs_wallet);
+    if (fSpendableTxsDirty) {
+        return;
+    }
+    for (std::set<uint256>::iterator it = setSpendableTxs.begin(); it != setSpendableTxs.end(); ) {
+        std::map<uint256, CWalletTx>::const_iterator mit = mapWallet.find(*it);
+        if (mit == mapWallet.end() || !MayHaveSpendableOutputs(mit->second)) {
+            setSpendableTxs.erase(it++);
+        } else {
+            ++it;
+        }
+    }
+}
+
 void CWallet::AddToTransparentSpends(const COutPoint& outpoint, const uint256& wtxid)
 {
     mapTxSpends.insert(make_pair(outpoint, wtxid));
@@ -951,11 +1046,10 @@ void CWallet::ClearNoteWitnessCache()
     nWitnessCacheSize = 0;
 }
 
-template<typename NoteDataMap>
-void CopyPreviousWitnesses(NoteDataMap& noteDataMap, int indexHeight, int64_t nWitnessCacheSize)
+template<typename NoteData>
+void CopyPreviousWitnesses(const std::vector<NoteData*>& vNotes, int indexHeight, int64_t nWitnessCacheSize)
 {
-    for (auto& item : noteDataMap) {
-        auto* nd = &(item.second);
+    for (NoteData* nd : vNotes) {
         // Only increment witnesses that are behind the current height
         if (nd->witnessHeight < indexHeight) {
             // Check the validity of the cache
@@ -978,22 +1072,31 @@ void CopyPreviousWitnesses(NoteDataMap& noteDataMap, int indexHeight, int64_t nW
     }
 }
 
-template<typename NoteDataMap>
-void AppendNoteCommitment(NoteDataMap& noteDataMap, int indexHeight, int64_t nWitnessCacheSize, const uint256& note_commitment)
+/**
+ * Bring the witnesses of our notes up to date with the note commitments of
+ * a block. Each witness gets the commitments from its start index on in one
+ * pass, so the cost is per witnessed note and commitment rather than per
+ * wallet transaction and commitment.
+ */
+template<typename NoteData>
+void AppendNoteCommitments(const std::map<NoteData*, size_t>& mapFirstCommitment,
+                           const std::vector<uint256>& vCommitments,
+                           int64_t nWitnessCacheSize)
 {
-    for (auto& item : noteDataMap) {
-        auto* nd = &(item.second);
-        if (nd->witnessHeight < indexHeight && nd->witnesses.size() > 0) {
-            // Check the validity of the cache
-            // See comment in CopyPreviousWitnesses about validity.
-            assert(nWitnessCacheSize >= nd->witnesses.size());
-            nd->witnesses.front().append(note_commitment);
+    for (const auto& item : mapFirstCommitment) {
+        NoteData* nd = item.first;
+        // Check the validity of the cache
+        // See comment in CopyPreviousWitnesses about validity.
+        assert(nWitnessCacheSize >= nd->witnesses.size());
+        auto& witness = nd->witnesses.front();
+        for (size_t i = item.second; i < vCommitments.size(); i++) {
+            witness.append(vCommitments[i]);
         }
     }
 }
 
 template<typename OutPoint, typename NoteData, typename Witness>
-void WitnessNoteIfMine(std::map<OutPoint, NoteData>& noteDataMap, int indexHeight, int64_t nWitnessCacheSize, const OutPoint& key, const Witness& witness)
+NoteData* WitnessNoteIfMine(std::map<OutPoint, NoteData>& noteDataMap, int indexHeight, int64_t nWitnessCacheSize, const OutPoint& key, const Witness& witness)
 {
     if (noteDataMap.count(key) && noteDataMap[key].witnessHeight < indexHeight) {
         auto* nd = &(noteDataMap[key]);
@@ -1019,15 +1122,16 @@ void WitnessNoteIfMine(std::map<OutPoint, NoteData>& noteDataMap, int indexHeigh
         nd->witnessHeight = indexHeight - 1;
         // Check the validity of the cache
         assert(nWitnessCacheSize >= nd->witnesses.size());
+        return nd;
     }
+    return NULL;
 }
 
 
-template<typename NoteDataMap>
-void UpdateWitnessHeights(NoteDataMap& noteDataMap, int indexHeight, int64_t nWitnessCacheSize)
+template<typename NoteData>
+void UpdateWitnessHeights(const std::vector<NoteData*>& vNotes, int indexHeight, int64_t nWitnessCacheSize)
 {
-    for (auto& item : noteDataMap) {
-        auto* nd = &(item.second);
+    for (NoteData* nd : vNotes) {
         if (nd->witnessHeight < indexHeight) {
             nd->witnessHeight = indexHeight;
             // Check the validity of the cache
@@ -1043,11 +1147,21 @@ void CWallet::IncrementNoteWitnesses(const CBlockIndex* pindex,
                                      SaplingMerkleTree& saplingTree)
 {
     LOCK(cs_wallet);
+    // Collect our notes once instead of walking mapWallet per commitment
+    std::vector<SproutNoteData*> vSproutNotes;
+    std::vector<SaplingNoteData*> vSaplingNotes;
     for (std::pair<const uint256, CWalletTx>& wtxItem : mapWallet) {
-       ::CopyPreviousWitnesses(wtxItem.second.mapSproutNoteData, pindex->nHeight, nWitnessCacheSize);
-       ::CopyPreviousWitnesses(wtxItem.second.mapSaplingNoteData, pindex->nHeight, nWitnessCacheSize);
+        for (mapSproutNoteData_t::value_type& item : wtxItem.second.mapSproutNoteData) {
+            vSproutNotes.push_back(&item.second);
+        }
+        for (mapSaplingNoteData_t::value_type& item : wtxItem.second.mapSaplingNoteData) {
+            vSaplingNotes.push_back(&item.second);
+        }
     }
 
+    ::CopyPreviousWitnesses(vSproutNotes, pindex->nHeight, nWitnessCacheSize);
+    ::CopyPreviousWitnesses(vSaplingNotes, pindex->nHeight, nWitnessCacheSize);
+
     if (nWitnessCacheSize < WITNESS_CACHE_SIZE) {
         nWitnessCacheSize += 1;
     }
@@ -1059,6 +1173,23 @@ void CWallet::IncrementNoteWitnesses(const CBlockIndex* pindex,
         pblock = &block;
     }
 
+    // Existing witnesses get every commitment of the block, the notes of
+    // the block itself only the ones after their own
+    std::map<SproutNoteData*, size_t> mapSproutFirstCommitment;
+    std::map<SaplingNoteData*, size_t> mapSaplingFirstCommitment;
+    for (SproutNoteData* nd : vSproutNotes) {
+        if (nd->witnessHeight < pindex->nHeight && nd->witnesses.size() > 0) {
+            mapSproutFirstCommitment[nd] = 0;
+        }
+    }
+    for (SaplingNoteData* nd : vSaplingNotes) {
+        if (nd->witnessHeight < pindex->nHeight && nd->witnesses.size() > 0) {
+            mapSaplingFirstCommitment[nd] = 0;
+        }
+    }
+
+    std::vector<uint256> vSproutCommitments;
+    std::vector<uint256> vSaplingCommitments;
     for (const CTransaction& tx : pblock->vtx) {
         auto hash = tx.GetHash();
         bool txIsOurs = mapWallet.count(hash);
@@ -1068,16 +1199,15 @@ void CWallet::IncrementNoteWitnesses(const CBlockIndex* pindex,
             for (uint8_t j = 0; j < jsdesc.commitments.size(); j++) {
                 const uint256& note_commitment = jsdesc.commitments[j];
                 sproutTree.append(note_commitment);
+                vSproutCommitments.push_back(note_commitment);
 
-                // Increment existing witnesses
-                for (std::pair<const uint256, CWalletTx>& wtxItem : mapWallet) {
-                    ::AppendNoteCommitment(wtxItem.second.mapSproutNoteData, pindex->nHeight, nWitnessCacheSize, note_commitment);
-                }
-
-                // If this is our note, witness it
+                // If this is our note, witness it from the current frontier
                 if (txIsOurs) {
                     JSOutPoint jsoutpt {hash, i, j};
-                    ::WitnessNoteIfMine(mapWallet[hash].mapSproutNoteData, pindex->nHeight, nWitnessCacheSize, jsoutpt, sproutTree.witness());
+                    SproutNoteData* nd = ::WitnessNoteIfMine(mapWallet[hash].mapSproutNoteData, pindex->nHeight, nWitnessCacheSize, jsoutpt, sproutTree.witness());
+                    if (nd) {
+                        mapSproutFirstCommitment[nd] = vSproutCommitments.size();
+                    }
                 }
             }
         }
@@ -1085,25 +1215,26 @@ void CWallet::IncrementNoteWitnesses(const CBlockIndex* pindex,
         for (uint32_t i = 0; i < tx.vShieldedOutput.size(); i++) {
             const uint256& note_commitment = tx.vShieldedOutput[i].cm;
             saplingTree.append(note_commitment);
+            vSaplingCommitments.push_back(note_commitment);
 
-            // Increment existing witnesses
-            for (std::pair<const uint256, CWalletTx>& wtxItem : mapWallet) {
-                ::AppendNoteCommitment(wtxItem.second.mapSaplingNoteData, pindex->nHeight, nWitnessCacheSize, note_commitment);
-            }
-
-            // If this is our note, witness it
+            // If this is our note, witness it from the current frontier
             if (txIsOurs) {
                 SaplingOutPoint outPoint {hash, i};
-                ::WitnessNoteIfMine(mapWallet[hash].mapSaplingNoteData, pindex->nHeight, nWitnessCacheSize, outPoint, saplingTree.witness());
+                SaplingNoteData* nd = ::WitnessNoteIfMine(mapWallet[hash].mapSaplingNoteData, pindex->nHeight, nWitnessCacheSize, outPoint, saplingTree.witness());
+                if (nd) {
+                    mapSaplingFirstCommitment[nd] = vSaplingCommitments.size();
+                }
             }
         }
     }
 
+    // Increment witnesses
+    ::AppendNoteCommitments(mapSproutFirstCommitment, vSproutCommitments, nWitnessCacheSize);
+    ::AppendNoteCommitments(mapSaplingFirstCommitment, vSaplingCommitments, nWitnessCacheSize);
+
     // Update witness heights
-    for (std::pair<const uint256, CWalletTx>& wtxItem : mapWallet) {
-        ::UpdateWitnessHeights(wtxItem.second.mapSproutNoteData, pindex->nHeight, nWitnessCacheSize);
-        ::UpdateWitnessHeights(wtxItem.second.mapSaplingNoteData, pindex->nHeight, nWitnessCacheSize);
-    }
+    ::UpdateWitnessHeights(vSproutNotes, pindex->nHeight, nWitnessCacheSize);
+    ::UpdateWitnessHeights(vSaplingNotes, pindex->nHeight, nWitnessCacheSize);
 
     // For performance reasons, we write out the witness cache in
     // CWallet::SetBestChain() (which also ensures that overall consistency
@@ -1423,6 +1554,47 @@ void CWallet::UpdateSaplingNullifierNoteMapForBlock(const CBlock *pblock) {
     }
 }
 
+void CWallet::QueueTxWrite(const uint256& hash)
+{
+    AssertLockHeld(cs_wallet);
+    setPendingTxWrites.insert(hash);
+}
+
+bool CWallet::WritePendingTxs()
+{
+    LOCK(cs_wallet);
+    if (setPendingTxWrites.empty())
+        return true;
+    if (!fFileBacked) {
+        setPendingTxWrites.clear();
+        return true;
+    }
+
+    // Do not flush the wallet here for performance reasons, ThreadFlushWalletDB does that
+    CWalletDB walletdb(strWalletFile, "r+", false);
+    if (!walletdb.TxnBegin()) {
+        LogPrintf("%s: Couldn't start atomic write\n", __func__);
+        return false;
+    }
+    BOOST_FOREACH(const uint256& hash, setPendingTxWrites) {
+        std::map<uint256, CWalletTx>::iterator mi = mapWallet.find(hash);
+        if (mi == mapWallet.end())
+            continue;
+        if (!mi->second.WriteToDisk(&walletdb)) {
+            LogPrintf("%s: Failed to write %s, aborting atomic write\n", __func__, hash.ToString());
+            walletdb.TxnAbort();
+            return false;
+        }
+    }
+    if (!walletdb.TxnCommit()) {
+        LogPrintf("%s: Couldn't commit atomic write\n", __func__);
+        return false;
+    }
+    LogPrint("db", "%s: wrote %u wallet transactions\n", __func__, setPendingTxWrites.size());
+    setPendingTxWrites.clear();
+    return true;
+}
+
 bool CWallet::AddToWallet(const CWalletTx& wtxIn, bool fFromLoadWallet, CWalletDB* pwalletdb)
 {
     uint256 hash = wtxIn.GetHash();
@@ -1433,6 +1605,7 @@ bool CWallet::AddToWallet(const CWalletTx& wtxIn, bool fFromLoadWallet, CWalletD
         mapWallet[hash].BindWallet(this);
         UpdateNullifierNoteMapWithTx(mapWallet[hash]);
         AddToSpends(hash);
+        UpdateSpendableTxs(hash);
     }
     else
     {
@@ -1521,13 +1694,19 @@ bool CWallet::AddToWallet(const CWalletTx& wtxIn, bool fFromLoadWallet, CWalletD
             }
         }
 
+        if (fInsertedNew || fUpdated)
+            UpdateSpendableTxs(hash);
+
         //// debug print
         LogPrintf("AddToWallet %s  %s%s\n", wtxIn.GetHash().ToString(), (fInsertedNew ? "new" : ""), (fUpdated ? "update" : ""));
 
-        // Write to disk
-        if (fInsertedNew || fUpdated)
-            if (!wtx.WriteToDisk(pwalletdb))
+        // Write to disk, or leave it to the next batch if there is no database handle
+        if (fInsertedNew || fUpdated) {
+            if (!pwalletdb)
+                QueueTxWrite(hash);
+            else if (!wtx.WriteToDisk(pwalletdb))
                 return false;
+        }
 
         // Break debit/credit balance caches:
         wtx.MarkDirty();
@@ -1590,14 +1769,14 @@ bool CWallet::UpdatedNoteData(const CWalletTx& wtxIn, CWalletTx& wtx)
  * pblock is optional, but should be provided if the transaction is known to be in a block.
  * If fUpdate is true, existing transactions will be updated.
  */
-bool CWallet::AddToWalletIfInvolvingMe(const CTransaction& tx, const CBlock* pblock, bool fUpdate)
+bool CWallet::AddToWalletIfInvolvingMe(const CTransaction& tx, const CBlock* pblock, bool fUpdate, const CNoteDecryptionHint* pHint)
 {
     {
         AssertLockHeld(cs_wallet);
         bool fExisted = mapWallet.count(tx.GetHash()) != 0;
         if (fExisted && !fUpdate) return false;
-        auto sproutNoteData = FindMySproutNotes(tx);
-        auto saplingNoteDataAndAddressesToAdd = FindMySaplingNotes(tx);
+        auto sproutNoteData = FindMySproutNotes(tx, pHint);
+        auto saplingNoteDataAndAddressesToAdd = FindMySaplingNotes(tx, pHint);
         auto saplingNoteData = saplingNoteDataAndAddressesToAdd.first;
         auto addressesToAdd = saplingNoteDataAndAddressesToAdd.second;
         for (const auto &addressToAdd : addressesToAdd) {
@@ -1621,10 +1800,13 @@ bool CWallet::AddToWalletIfInvolvingMe(const CTransaction& tx, const CBlock* pbl
             if (pblock)
                 wtx.SetMerkleBranch(*pblock);
 
+            // Transactions from a block are written in batches, see WritePendingTxs().
             // Do not flush the wallet here for performance reasons
             // this is safe, as in case of a crash, we rescan the necessary blocks on startup through our SetBestChain-mechanism
-            CWalletDB walletdb(strWalletFile, "r+", false);
+            if (pblock)
+                return AddToWallet(wtx, false, NULL);
 
+            CWalletDB walletdb(strWalletFile, "r+", false);
             return AddToWallet(wtx, false, &walletdb);
         }
     }
@@ -1674,6 +1856,9 @@ void CWallet::EraseFromWallet(const uint256 &hash)
         return;
     {
         LOCK(cs_wallet);
+        // outputs spent by the erased transaction may be spendable again
+        fSpendableTxsDirty = true;
+        setPendingTxWrites.erase(hash);
         if (mapWallet.erase(hash))
             CWalletDB(strWalletFile).EraseTx(hash);
     }
@@ -1716,8 +1901,10 @@ boost::optional<uint256> CWallet::GetSproutNoteNullifier(const JSDescription &js
  * It should never be necessary to call this method with a CWalletTx, because
  * the result of FindMySproutNotes (for the addresses available at the time) will
  * already have been cached in CWalletTx.mapSproutNoteData.
+ *
+ * With a hint only the outputs it lists are tried, each with its matching key.
  */
-mapSproutNoteData_t CWallet::FindMySproutNotes(const CTransaction &tx) const
+mapSproutNoteData_t CWallet::FindMySproutNotes(const CTransaction &tx, const CNoteDecryptionHint* pHint) const
 {
     LOCK(cs_SpendingKeyStore);
     uint256 hash = tx.GetHash();
@@ -1726,10 +1913,21 @@ mapSproutNoteData_t CWallet::FindMySproutNotes(const CTransaction &tx) const
     for (size_t i = 0; i < tx.vjoinsplit.size(); i++) {
         auto hSig = tx.vjoinsplit[i].h_sig(*pzcashParams, tx.joinSplitPubKey);
         for (uint8_t j = 0; j < tx.vjoinsplit[i].ciphertexts.size(); j++) {
-            for (const NoteDecryptorMap::value_type& item : mapNoteDecryptors) {
+            JSOutPoint jsoutpt {hash, i, j};
+            auto itBegin = mapNoteDecryptors.begin();
+            auto itEnd = mapNoteDecryptors.end();
+            if (pHint) {
+                auto hint = pHint->sprout.find(jsoutpt);
+                if (hint == pHint->sprout.end())
+                    continue;
+                itBegin = mapNoteDecryptors.find(hint->second);
+                if (itBegin != itEnd)
+                    itEnd = std::next(itBegin);
+            }
+            for (auto it = itBegin; it != itEnd; ++it) {
+                const NoteDecryptorMap::value_type& item = *it;
                 try {
                     auto address = item.first;
-                    JSOutPoint jsoutpt {hash, i, j};
                     auto nullifier = GetSproutNoteNullifier(
                         tx.vjoinsplit[i],
                         address,
@@ -1764,8 +1962,10 @@ mapSproutNoteData_t CWallet::FindMySproutNotes(const CTransaction &tx) const
  * It should never be necessary to call this method with a CWalletTx, because
  * the result of FindMySaplingNotes (for the addresses available at the time) will
  * already have been cached in CWalletTx.mapSaplingNoteData.
+ *
+ * With a hint only the outputs it lists are tried, each with its matching key.
  */
-std::pair<mapSaplingNoteData_t, SaplingIncomingViewingKeyMap> CWallet::FindMySaplingNotes(const CTransaction &tx) const
+std::pair<mapSaplingNoteData_t, SaplingIncomingViewingKeyMap> CWallet::FindMySaplingNotes(const CTransaction &tx, const CNoteDecryptionHint* pHint) const
 {
     LOCK(cs_SpendingKeyStore);
     uint256 hash = tx.GetHash();
@@ -1776,7 +1976,17 @@ std::pair<mapSaplingNoteData_t, SaplingIncomingViewingKeyMap> CWallet::FindMySap
     // Protocol Spec: 4.19 Block Chain Scanning (Sapling)
     for (uint32_t i = 0; i < tx.vShieldedOutput.size(); ++i) {
         const OutputDescription output = tx.vShieldedOutput[i];
-        for (auto it = mapSaplingFullViewingKeys.begin(); it != mapSaplingFullViewingKeys.end(); ++it) {
+        auto itBegin = mapSaplingFullViewingKeys.begin();
+        auto itEnd = mapSaplingFullViewingKeys.end();
+        if (pHint) {
+            auto hint = pHint->sapling.find(SaplingOutPoint(hash, i));
+            if (hint == pHint->sapling.end())
+                continue;
+            itBegin = mapSaplingFullViewingKeys.find(hint->second);
+            if (itBegin != itEnd)
+                itEnd = std::next(itBegin);
+        }
+        for (auto it = itBegin; it != itEnd; ++it) {
             SaplingIncomingViewingKey ivk = it->first;
             auto result = SaplingNotePlaintext::decrypt(output.encCiphertext, ivk, output.ephemeralKey, output.cm);
             if (!result) {
@@ -2386,6 +2596,158 @@ void CWallet::WitnessNoteCommitment(std::vector<uint256> commitments,
     }
 }
 
+/** Copy of the wallet keys a CTrialDecryptionQueue tries */
+struct CTrialDecryptKeys
+{
+    std::vector<std::pair<libzcash::SproutPaymentAddress, ZCNoteDecryption> > vSprout;
+    std::vector<libzcash::SaplingIncomingViewingKey> vSapling;
+};
+
+/** Trial-decrypts one shielded output against every key of a CTrialDecryptKeys */
+class CTrialDecryptCheck
+{
+private:
+    const CTrialDecryptKeys* pkeys;
+    const CTransaction* ptx;
+    bool fSapling;
+    size_t nOutput;        //!< joinsplit or Sapling output index
+    uint8_t nCiphertext;   //!< ciphertext index within the joinsplit
+    uint256 hSig;
+    int* pnKey;
+
+public:
+    CTrialDecryptCheck() : pkeys(NULL), ptx(NULL), fSapling(false), nOutput(0), nCiphertext(0), pnKey(NULL) {}
+    CTrialDecryptCheck(const CTrialDecryptKeys* pkeysIn, const CTransaction* ptxIn, size_t nJoinSplit,
+                       uint8_t nCiphertextIn, const uint256& hSigIn, int* pnKeyIn) :
+        pkeys(pkeysIn), ptx(ptxIn), fSapling(false), nOutput(nJoinSplit), nCiphertext(nCiphertextIn), hSig(hSigIn), pnKey(pnKeyIn) {}
+    CTrialDecryptCheck(const CTrialDecryptKeys* pkeysIn, const CTransaction* ptxIn, size_t nOutputIn, int* pnKeyIn) :
+        pkeys(pkeysIn), ptx(ptxIn), fSapling(true), nOutput(nOutputIn), nCiphertext(0), pnKey(pnKeyIn) {}
+
+    bool operator()()
+    {
+        if (fSapling) {
+            const OutputDescription& output = ptx->vShieldedOutput[nOutput];
+            for (size_t i = 0; i < pkeys->vSapling.size(); i++) {
+                if (SaplingNotePlaintext::decrypt(output.encCiphertext, pkeys->vSapling[i], output.ephemeralKey, output.cm)) {
+                    *pnKey = i;
+                    break;
+                }
+            }
+            return true;
+        }
+
+        const JSDescription& jsdesc = ptx->vjoinsplit[nOutput];
+        for (size_t i = 0; i < pkeys->vSprout.size(); i++) {
+            try {
+                pkeys->vSprout[i].second.decrypt(jsdesc.ciphertexts[nCiphertext], jsdesc.ephemeralKey, hSig, nCiphertext);
+                *pnKey = i;
+                break;
+            } catch (const note_decryption_failed &err) {
+                // Couldn't decrypt with this decryptor
+            } catch (const std::exception &exc) {
+                // Unexpected failure, FindMySproutNotes() reports it when retrying
+            }
+        }
+        return true;
+    }
+
+    void swap(CTrialDecryptCheck& check)
+    {
+        std::swap(pkeys, check.pkeys);
+        std::swap(ptx, check.ptx);
+        std::swap(fSapling, check.fSapling);
+        std::swap(nOutput, check.nOutput);
+        std::swap(nCiphertext, check.nCiphertext);
+        std::swap(hSig, check.hSig);
+        std::swap(pnKey, check.pnKey);
+    }
+};
+
+CTrialDecryptionQueue::CTrialDecryptionQueue(const CWallet& wallet, int nThreads) :
+    keys(new CTrialDecryptKeys()), queue(new CCheckQueue<CTrialDecryptCheck>(16))
+{
+    {
+        LOCK(wallet.cs_SpendingKeyStore);
+        keys->vSprout.assign(wallet.mapNoteDecryptors.begin(), wallet.mapNoteDecryptors.end());
+        for (const auto& entry : wallet.mapSaplingFullViewingKeys)
+            keys->vSapling.push_back(entry.first);
+    }
+    // the thread calling Wait() is the last worker
+    for (int i = 1; i < nThreads; i++)
+        threadGroup.create_thread(boost::bind(&CCheckQueue<CTrialDecryptCheck>::Thread, queue.get()));
+}
+
+CTrialDecryptionQueue::~CTrialDecryptionQueue()
+{
+    queue->Wait();
+    threadGroup.interrupt_all();
+    threadGroup.join_all();
+}
+
+void CTrialDecryptionQueue::Add(const CTransaction& tx, CNoteDecryptionHint& hint)
+{
+    CPendingTx pending = { &tx, &hint, vResults.size() };
+    std::vector<CTrialDecryptCheck> vChecks;
+    if (!keys->vSprout.empty()) {
+        for (size_t i = 0; i < tx.vjoinsplit.size(); i++) {
+            uint256 hSig = tx.vjoinsplit[i].h_sig(*pzcashParams, tx.joinSplitPubKey);
+            for (uint8_t j = 0; j < tx.vjoinsplit[i].ciphertexts.size(); j++) {
+                vResults.push_back(-1);
+                vChecks.push_back(CTrialDecryptCheck(keys.get(), &tx, i, j, hSig, &vResults.back()));
+            }
+        }
+    }
+    if (!keys->vSapling.empty()) {
+        for (size_t i = 0; i < tx.vShieldedOutput.size(); i++) {
+            vResults.push_back(-1);
+            vChecks.push_back(CTrialDecryptCheck(keys.get(), &tx, i, &vResults.back()));
+        }
+    }
+    if (vChecks.empty())
+        return;
+    vPending.push_back(pending);
+    queue->Add(vChecks);
+}
+
+void CTrialDecryptionQueue::Wait()
+{
+    queue->Wait();
+
+    // read the results back in the order Add() queued them
+    for (const CPendingTx& pending : vPending) {
+        const CTransaction& tx = *pending.ptx;
+        uint256 hash = tx.GetHash();
+        size_t nResult = pending.nFirstResult;
+        if (!keys->vSprout.empty()) {
+            for (size_t i = 0; i < tx.vjoinsplit.size(); i++) {
+                for (uint8_t j = 0; j < tx.vjoinsplit[i].ciphertexts.size(); j++) {
+                    int nKey = vResults[nResult++];
+                    if (nKey >= 0)
+                        pending.pHint->sprout[JSOutPoint(hash, i, j)] = keys->vSprout[nKey].first;
+                }
+            }
+        }
+        if (!keys->vSapling.empty()) {
+            for (size_t i = 0; i < tx.vShieldedOutput.size(); i++) {
+                int nKey = vResults[nResult++];
+                if (nKey >= 0)
+                    pending.pHint->sapling[SaplingOutPoint(hash, i)] = keys->vSapling[nKey];
+            }
+        }
+    }
+    vPending.clear();
+    vResults.clear();
+}
+
+/** Number of threads to trial-decrypt with during a rescan (-rescanthreads) */
+static int GetRescanThreads()
+{
+    int nThreads = GetArg("-rescanthreads", DEFAULT_RESCAN_THREADS);
+    if (nThreads <= 0)
+        nThreads += GetNumCores();
+    return std::max(nThreads, 1);
+}
+
 /**
  * Scan the block chain (starting in pindexStart) for transactions
  * from or to us. If fUpdate is true, found transactions that already
@@ -2412,52 +2774,71 @@ int CWallet::ScanForWalletTransactions(CBlockIndex* pindexStart, bool fUpdate)
         ShowProgress(_("Rescanning..."), 0); // show rescan progress in GUI as dialog or on splashscreen, if -rescan on startup
         double dProgressStart = Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), pindex, false);
         double dProgressTip = Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), chainActive.Tip(), false);
+        // Read a batch of blocks ahead and trial-decrypt their shielded
+        // outputs on all threads, then add them to the wallet in block order
+        CTrialDecryptionQueue decryptionQueue(*this, GetRescanThreads());
         while (pindex)
         {
-            if (pindex->nHeight % 100 == 0 && dProgressTip - dProgressStart > 0.0)
-                ShowProgress(_("Rescanning..."), std::max(1, std::min(99, (int)((Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), pindex, false) - dProgressStart) / (dProgressTip - dProgressStart) * 100))));
+            std::vector<CBlockIndex*> vIndex;
+            std::deque<CBlock> vBlocks;
+            std::deque<std::vector<CNoteDecryptionHint> > vHints;
+            for (CBlockIndex* pindexRead = pindex; pindexRead && (int)vIndex.size() < RESCAN_READAHEAD_BLOCKS;
+                 pindexRead = chainActive.Next(pindexRead)) {
+                vIndex.push_back(pindexRead);
+                vBlocks.push_back(CBlock());
+                ReadBlockFromDisk(vBlocks.back(), pindexRead);
+                vHints.push_back(std::vector<CNoteDecryptionHint>(vBlocks.back().vtx.size()));
+                for (size_t i = 0; i < vBlocks.back().vtx.size(); i++)
+                    decryptionQueue.Add(vBlocks.back().vtx[i], vHints.back()[i]);
+            }
+            decryptionQueue.Wait();
 
-            CBlock block;
-            ReadBlockFromDisk(block, pindex);
-            BOOST_FOREACH(CTransaction& tx, block.vtx)
+            for (size_t n = 0; n < vIndex.size(); n++)
             {
-                if (AddToWalletIfInvolvingMe(tx, &block, fUpdate)) {
-                    myTxHashes.push_back(tx.GetHash());
-                    ret++;
+                pindex = vIndex[n];
+                if (pindex->nHeight % 100 == 0 && dProgressTip - dProgressStart > 0.0)
+                    ShowProgress(_("Rescanning..."), std::max(1, std::min(99, (int)((Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), pindex, false) - dProgressStart) / (dProgressTip - dProgressStart) * 100))));
+
+                CBlock& block = vBlocks[n];
+                for (size_t i = 0; i < block.vtx.size(); i++)
+                {
+                    const CTransaction& tx = block.vtx[i];
+                    if (AddToWalletIfInvolvingMe(tx, &block, fUpdate, &vHints[n][i])) {
+                        myTxHashes.push_back(tx.GetHash());
+                        ret++;
+                    }
                 }
-            }
 
-            SproutMerkleTree sproutTree;
-            SaplingMerkleTree saplingTree;
-            // This should never fail: we should always be able to get the tree
-            // state on the path to the tip of our chain
-            assert(pcoinsTip->GetSproutAnchorAt(pindex->hashSproutAnchor, sproutTree));
-            if (pindex->pprev) {
-                if (NetworkUpgradeActive(pindex->pprev->nHeight, Params().GetConsensus(), Consensus::UPGRADE_SAPLING)) {
-                    assert(pcoinsTip->GetSaplingAnchorAt(pindex->pprev->hashFinalSaplingRoot, saplingTree));
+                SproutMerkleTree sproutTree;
+                SaplingMerkleTree saplingTree;
+                // This should never fail: we should always be able to get the tree
+                // state on the path to the tip of our chain
+                assert(pcoinsTip->GetSproutAnchorAt(pindex->hashSproutAnchor, sproutTree));
+                if (pindex->pprev) {
+                    if (NetworkUpgradeActive(pindex->pprev->nHeight, Params().GetConsensus(), Consensus::UPGRADE_SAPLING)) {
+                        assert(pcoinsTip->GetSaplingAnchorAt(pindex->pprev->hashFinalSaplingRoot, saplingTree));
+                    }
                 }
-            }
-            // Increment note witness caches
-            ChainTip(pindex, &block, sproutTree, saplingTree, true);
+                // Increment note witness caches
+                ChainTip(pindex, &block, sproutTree, saplingTree, true);
 
-            pindex = chainActive.Next(pindex);
-            if (GetTime() >= nNow + 60) {
-                nNow = GetTime();
-                LogPrintf("Still rescanning. At block %d. Progress=%f\n", pindex->nHeight, Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), pindex));
+                if (GetTime() >= nNow + 60) {
+                    nNow = GetTime();
+                    LogPrintf("Still rescanning. At block %d. Progress=%f\n", pindex->nHeight, Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), pindex));
+                }
             }
+            pindex = chainActive.Next(pindex);
         }
 
         // After rescanning, persist Sapling note data that might have changed, e.g. nullifiers.
-        // Do not flush the wallet here for performance reasons.
-        CWalletDB walletdb(strWalletFile, "r+", false);
         for (auto hash : myTxHashes) {
-            CWalletTx wtx = mapWallet[hash];
-            if (!wtx.mapSaplingNoteData.empty()) {
-                if (!wtx.WriteToDisk(&walletdb)) {
-                    LogPrintf("Rescanning... WriteToDisk failed to update Sapling note data for: %s\n", hash.ToString());
-                }
+            if (!mapWallet[hash].mapSaplingNoteData.empty()) {
+                QueueTxWrite(hash);
             }
         }
+        if (!WritePendingTxs()) {
+            LogPrintf("Rescanning... failed to write updated wallet transactions\n");
+        }
 
         ShowProgress(_("Rescanning..."), 100); // hide progress dialog in GUI
     }
@@ -2772,8 +3153,11 @@ CAmount CWallet::GetBalance() const
     CAmount nTotal = 0;
     {
         LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+        EnsureSpendableTxs();
+        for (const uint256& wtxid : setSpendableTxs)
         {
+            map<uint256, CWalletTx>::const_iterator it = mapWallet.find(wtxid);
+            assert(it != mapWallet.end());
             const CWalletTx* pcoin = &(*it).second;
             if (pcoin->IsTrusted())
                 nTotal += pcoin->GetAvailableCredit();
@@ -2788,8 +3172,11 @@ CAmount CWallet::GetUnconfirmedBalance() const
     CAmount nTotal = 0;
     {
         LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+        EnsureSpendableTxs();
+        for (const uint256& wtxid : setSpendableTxs)
         {
+            map<uint256, CWalletTx>::const_iterator it = mapWallet.find(wtxid);
+            assert(it != mapWallet.end());
             const CWalletTx* pcoin = &(*it).second;
             if (!CheckFinalTx(*pcoin) || (!pcoin->IsTrusted() && pcoin->GetDepthInMainChain() == 0))
                 nTotal += pcoin->GetAvailableCredit();
@@ -2803,8 +3190,11 @@ CAmount CWallet::GetImmatureBalance() const
     CAmount nTotal = 0;
     {
         LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+        EnsureSpendableTxs();
+        for (const uint256& wtxid : setSpendableTxs)
         {
+            map<uint256, CWalletTx>::const_iterator it = mapWallet.find(wtxid);
+            assert(it != mapWallet.end());
             const CWalletTx* pcoin = &(*it).second;
             nTotal += pcoin->GetImmatureCredit();
         }
@@ -2817,8 +3207,11 @@ CAmount CWallet::GetWatchOnlyBalance() const
     CAmount nTotal = 0;
     {
         LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+        EnsureSpendableTxs();
+        for (const uint256& wtxid : setSpendableTxs)
         {
+            map<uint256, CWalletTx>::const_iterator it = mapWallet.find(wtxid);
+            assert(it != mapWallet.end());
             const CWalletTx* pcoin = &(*it).second;
             if (pcoin->IsTrusted())
                 nTotal += pcoin->GetAvailableWatchOnlyCredit();
@@ -2833,8 +3226,11 @@ CAmount CWallet::GetUnconfirmedWatchOnlyBalance() const
     CAmount nTotal = 0;
     {
         LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+        EnsureSpendableTxs();
+        for (const uint256& wtxid : setSpendableTxs)
         {
+            map<uint256, CWalletTx>::const_iterator it = mapWallet.find(wtxid);
+            assert(it != mapWallet.end());
             const CWalletTx* pcoin = &(*it).second;
             if (!CheckFinalTx(*pcoin) || (!pcoin->IsTrusted() && pcoin->GetDepthInMainChain() == 0))
                 nTotal += pcoin->GetAvailableWatchOnlyCredit();
@@ -2848,8 +3244,11 @@ CAmount CWallet::GetImmatureWatchOnlyBalance() const
     CAmount nTotal = 0;
     {
         LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+        EnsureSpendableTxs();
+        for (const uint256& wtxid : setSpendableTxs)
         {
+            map<uint256, CWalletTx>::const_iterator it = mapWallet.find(wtxid);
+            assert(it != mapWallet.end());
             const CWalletTx* pcoin = &(*it).second;
             nTotal += pcoin->GetImmatureWatchOnlyCredit();
         }
@@ -2866,9 +3265,11 @@ void CWallet::AvailableCoins(vector<COutput>& vCoins, bool fOnlyConfirmed, const
 
     {
         LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+        EnsureSpendableTxs();
+        for (const uint256& wtxid : setSpendableTxs)
         {
-            const uint256& wtxid = it->first;
+            map<uint256, CWalletTx>::const_iterator it = mapWallet.find(wtxid);
+            assert(it != mapWallet.end());
             const CWalletTx* pcoin = &(*it).second;
 
             if (!CheckFinalTx(*pcoin))
@@ -4368,8 +4769,21 @@ void CWallet::GetFilteredNotes(
 {
     LOCK2(cs_main, cs_wallet);
 
-    for (auto & p : mapWallet) {
-        CWalletTx wtx = p.second;
+    // Spent notes are only needed when they aren't filtered out
+    std::vector<const CWalletTx*> vWtx;
+    if (ignoreSpent) {
+        EnsureSpendableTxs();
+        for (const uint256& wtxid : setSpendableTxs) {
+            vWtx.push_back(&mapWallet.at(wtxid));
+        }
+    } else {
+        for (const auto& p : mapWallet) {
+            vWtx.push_back(&p.second);
+        }
+    }
+
+    for (const CWalletTx* pwtx : vWtx) {
+        const CWalletTx& wtx = *pwtx;
 
         // Filter the transactions before checking for notes
         if (!CheckFinalTx(wtx) ||
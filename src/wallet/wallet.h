@@ -27,7 +27,9 @@
 #include "base58.h"
 
 #include <algorithm>
+#include <deque>
 #include <map>
+#include <memory>
 #include <set>
 #include <stdexcept>
 #include <stdint.h>
@@ -35,6 +37,8 @@
 #include <utility>
 #include <vector>
 
+#include <boost/thread/thread.hpp>
+
 /**
  * Settings
  */
@@ -64,6 +68,12 @@ static const unsigned int WITNESS_CACHE_SIZE = MAX_REORG_LENGTH + 1;
 
 //! Size of HD seed in bytes
 static const size_t HD_WALLET_SEED_LENGTH = 32;
+//! -rescanthreads default, 0 = one per core
+static const int DEFAULT_RESCAN_THREADS = 0;
+//! Number of blocks read ahead and trial-decrypted together during a rescan
+static const int RESCAN_READAHEAD_BLOCKS = 16;
+//! Interval (in milliseconds) at which batched wallet transaction writes are committed
+static const unsigned int WALLET_TX_WRITE_INTERVAL = 100;
 
 class CBlockIndex;
 class CCoinControl;
@@ -309,6 +319,17 @@ public:
 typedef std::map<JSOutPoint, SproutNoteData> mapSproutNoteData_t;
 typedef std::map<SaplingOutPoint, SaplingNoteData> mapSaplingNoteData_t;
 
+/**
+ * The keys that decrypted the shielded outputs of a transaction, found ahead
+ * of time by a CTrialDecryptionQueue. Given a hint, FindMySproutNotes() and
+ * FindMySaplingNotes() only retry the matching key of each listed output.
+ */
+struct CNoteDecryptionHint
+{
+    std::map<JSOutPoint, libzcash::SproutPaymentAddress> sprout;
+    std::map<SaplingOutPoint, libzcash::SaplingIncomingViewingKey> sapling;
+};
+
 /** Decrypted note, its location in a transaction, and number of confirmations. */
 struct CSproutNotePlaintextEntry
 {
@@ -722,6 +743,8 @@ private:
 class CWallet : public CCryptoKeyStore, public CValidationInterface
 {
 private:
+    friend class CTrialDecryptionQueue;
+
     bool SelectCoins(const CAmount& nTargetValue, std::set<std::pair<const CWalletTx*,unsigned int> >& setCoinsRet, CAmount& nValueRet, bool& fOnlyCoinbaseCoinsRet, bool& fNeedCoinbaseCoinsRet, const CCoinControl *coinControl = NULL) const;
 
     CWalletDB *pwalletdbEncryption;
@@ -758,6 +781,38 @@ private:
     void AddToSaplingSpends(const uint256& nullifier, const uint256& wtxid);
     void AddToSpends(const uint256& wtxid);
 
+protected:
+    /**
+     * Wallet transactions that may still have spendable outputs or notes,
+     * i.e. all but the ones whose outputs and notes are all either not ours
+     * or spent deeper than a reorg can reach. AvailableCoins(),
+     * GetFilteredNotes() and the Get*Balance() totals only visit these
+     * instead of the whole history in mapWallet; depth, address and spent
+     * filters are still applied per call. New transactions are added by AddToWallet(), finished ones are
+     * dropped in SetBestChain(), and importing keys or scripts marks the
+     * index for a rebuild.
+     */
+    mutable std::set<uint256> setSpendableTxs;
+    mutable bool fSpendableTxsDirty;
+
+    template <class T>
+    bool IsSpentBeyondReorg(const TxSpendMap<T>& mapSpends, const T& key) const;
+    bool MayHaveSpendableOutputs(const CWalletTx& wtx) const;
+    void UpdateSpendableTxs(const uint256& wtxid) const;
+    void EnsureSpendableTxs() const;
+    void PruneSpendableTxs();
+
+private:
+    /**
+     * Wallet transactions changed by connected blocks whose write to disk is
+     * still pending. WritePendingTxs() commits them in a single Berkeley DB
+     * transaction instead of one per update; until then the Berkeley DB log
+     * together with the best block locator, which SetBestChain() only
+     * advances in the same atomic write as them, lets a restart rescan
+     * whatever was lost.
+     */
+    std::set<uint256> setPendingTxWrites;
+
 public:
     /*
      * Size of the incremental witness cache for the notes in our wallet.
@@ -783,6 +838,7 @@ protected:
 
     template <typename WalletDB>
     void SetBestChainINTERNAL(WalletDB& walletdb, const CBlockLocator& loc) {
+        LOCK(cs_wallet);
         if (!walletdb.TxnBegin()) {
             // This needs to be done atomically, so don't do it at all
             LogPrintf("SetBestChain(): Couldn't start atomic write\n");
@@ -795,7 +851,10 @@ protected:
                 // are empty. This covers transactions that have no Sprout or Sapling data
                 // (i.e. are purely transparent), as well as shielding and unshielding
                 // transactions in which we only have transparent addresses involved.
-                if (!(wtx.mapSproutNoteData.empty() && wtx.mapSaplingNoteData.empty())) {
+                // Transactions queued for a batched write go in the same atomic write,
+                // so the best block never gets ahead of them.
+                if (!(wtx.mapSproutNoteData.empty() && wtx.mapSaplingNoteData.empty()) ||
+                    setPendingTxWrites.count(wtxItem.first)) {
                     if (!walletdb.WriteTx(wtxItem.first, wtx)) {
                         LogPrintf("SetBestChain(): Failed to write CWalletTx, aborting atomic write\n");
                         walletdb.TxnAbort();
@@ -825,6 +884,7 @@ protected:
             LogPrintf("SetBestChain(): Couldn't commit atomic write\n");
             return;
         }
+        setPendingTxWrites.clear();
     }
 
 private:
@@ -892,6 +952,7 @@ public:
         nTimeFirstKey = 0;
         fBroadcastTransactions = false;
         nWitnessCacheSize = 0;
+        fSpendableTxsDirty = true;
     }
 
     /**
@@ -1109,8 +1170,12 @@ public:
     void UpdateSaplingNullifierNoteMapWithTx(CWalletTx& wtx);
     void UpdateSaplingNullifierNoteMapForBlock(const CBlock* pblock);
     bool AddToWallet(const CWalletTx& wtxIn, bool fFromLoadWallet, CWalletDB* pwalletdb);
+    /** Queue a wallet transaction for the next batched write */
+    void QueueTxWrite(const uint256& hash);
+    /** Write all queued wallet transactions in one database transaction */
+    bool WritePendingTxs();
     void SyncTransaction(const CTransaction& tx, const CBlock* pblock);
-    bool AddToWalletIfInvolvingMe(const CTransaction& tx, const CBlock* pblock, bool fUpdate);
+    bool AddToWalletIfInvolvingMe(const CTransaction& tx, const CBlock* pblock, bool fUpdate, const CNoteDecryptionHint* pHint = NULL);
     void EraseFromWallet(const uint256 &hash);
     void WitnessNoteCommitment(
          std::vector<uint256> commitments,
@@ -1154,8 +1219,8 @@ public:
         const ZCNoteDecryption& dec,
         const uint256& hSig,
         uint8_t n) const;
-    mapSproutNoteData_t FindMySproutNotes(const CTransaction& tx) const;
-    std::pair<mapSaplingNoteData_t, SaplingIncomingViewingKeyMap> FindMySaplingNotes(const CTransaction& tx) const;
+    mapSproutNoteData_t FindMySproutNotes(const CTransaction& tx, const CNoteDecryptionHint* pHint = NULL) const;
+    std::pair<mapSaplingNoteData_t, SaplingIncomingViewingKeyMap> FindMySaplingNotes(const CTransaction& tx, const CNoteDecryptionHint* pHint = NULL) const;
     bool IsSproutNullifierFromMe(const uint256& nullifier) const;
     bool IsSaplingNullifierFromMe(const uint256& nullifier) const;
 
@@ -1300,6 +1365,45 @@ public:
                           bool ignoreLocked=true);
 };
 
+class CTrialDecryptCheck;
+struct CTrialDecryptKeys;
+template <typename T>
+class CCheckQueue;
+
+/**
+ * Trial-decrypts the shielded outputs of transactions against every key of a
+ * wallet on a pool of threads, one output per job. Outputs are queued while
+ * the caller goes on (e.g. reading the next block), and Wait() joins in until
+ * all of them are done and fills in the hints. The keys are copied when the
+ * queue is created.
+ */
+class CTrialDecryptionQueue
+{
+private:
+    struct CPendingTx
+    {
+        const CTransaction* ptx;
+        CNoteDecryptionHint* pHint;
+        size_t nFirstResult;
+    };
+
+    std::unique_ptr<CTrialDecryptKeys> keys;
+    std::unique_ptr<CCheckQueue<CTrialDecryptCheck> > queue;
+    boost::thread_group threadGroup;
+    //! Index of the key that decrypted each queued output, -1 if none did
+    std::deque<int> vResults;
+    std::vector<CPendingTx> vPending;
+
+public:
+    CTrialDecryptionQueue(const CWallet& wallet, int nThreads);
+    ~CTrialDecryptionQueue();
+
+    /** Queue the shielded outputs of tx; tx and hint must stay valid until Wait() */
+    void Add(const CTransaction& tx, CNoteDecryptionHint& hint);
+    /** Wait for all queued outputs and fill in their hints */
+    void Wait();
+};
+
 /** A key allocated from the key pool. */
 class CReserveKey
 {
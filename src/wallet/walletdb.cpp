@@ -1125,6 +1125,22 @@ void ThreadFlushWalletDB(const string& strFile)
     }
 }
 
+void ThreadWriteWalletTxs(CWallet* pwallet)
+{
+    // Make this thread recognisable as the wallet writer thread
+    RenameThread("pastel-walletwr");
+
+    while (true)
+    {
+        MilliSleep(WALLET_TX_WRITE_INTERVAL);
+
+        // Don't hold up whoever has the wallet, the batch just grows until next time
+        TRY_LOCK(pwallet->cs_wallet, lockWallet);
+        if (lockWallet)
+            pwallet->WritePendingTxs();
+    }
+}
+
 bool BackupWallet(const CWallet& wallet, const string& strDest)
 {
     if (!wallet.fFileBacked)
@@ -209,5 +209,6 @@ private:
 
 bool BackupWallet(const CWallet& wallet, const std::string& strDest);
 void ThreadFlushWalletDB(const std::string& strFile);
+void ThreadWriteWalletTxs(CWallet* pwallet);
 
 #endif // BITCOIN_WALLET_WALLETDB_H
@@ -22,11 +22,13 @@
 #include "script/sign.h"
 #include "sodium.h"
 #include "streams.h"
+#include "transaction_builder.h"
 #include "txdb.h"
 #include "utiltest.h"
 #include "wallet/wallet.h"
 
 #include "zcbenchmarks.h"
+#include "ed448/pastel_key.h"
 
 #include "zcash/Zcash.h"
 #include "zcash/IncrementalMerkleTree.hpp"
@@ -297,6 +299,31 @@ double benchmark_try_decrypt_notes(size_t nAddrs)
     return timer_stop(tv_start);
 }
 
+double benchmark_try_decrypt_notes_threaded(size_t nAddrs, int nThreads)
+{
+    CWallet wallet;
+    for (size_t i = 0; i < nAddrs; i++) {
+        auto sk = libzcash::SproutSpendingKey::random();
+        wallet.AddSproutSpendingKey(sk);
+    }
+
+    auto sk = libzcash::SproutSpendingKey::random();
+    auto tx = GetValidReceive(*pzcashParams, sk, 10, true);
+
+    // Trial-decrypt a block's worth of copies of the transaction the way a
+    // rescan does, with the outputs spread over nThreads threads
+    std::vector<CNoteDecryptionHint> hints(100);
+    CTrialDecryptionQueue queue(wallet, nThreads);
+
+    struct timeval tv_start;
+    timer_start(tv_start);
+    for (auto& hint : hints) {
+        queue.Add(tx, hint);
+    }
+    queue.Wait();
+    return timer_stop(tv_start);
+}
+
 double benchmark_increment_note_witnesses(size_t nTxs)
 {
     CWallet wallet;
@@ -354,6 +381,48 @@ double benchmark_increment_note_witnesses(size_t nTxs)
     return timer_stop(tv_start);
 }
 
+// Transaction with one JoinSplit of random note commitments; witness
+// maintenance never looks at the proof or ciphertexts
+double benchmark_increment_note_witnesses_scaled(size_t nNotes, size_t nBlockTxs)
+{
+    CWallet wallet;
+    SproutMerkleTree sproutTree;
+    SaplingMerkleTree saplingTree;
+
+    auto sk = libzcash::SproutSpendingKey::random();
+    wallet.AddSproutSpendingKey(sk);
+
+    // First block holds the notes of the wallet
+    CBlock block1;
+    for (size_t i = 0; i < nNotes; i++) {
+        CWalletTx wtx(&wallet, GetCommitmentsOnlyTx());
+        mapSproutNoteData_t noteData;
+        JSOutPoint jsoutpt {wtx.GetHash(), 0, 1};
+        noteData[jsoutpt] = SproutNoteData {sk.address()};
+        wtx.SetSproutNoteData(noteData);
+        wallet.AddToWallet(wtx, true, NULL);
+        block1.vtx.push_back(wtx);
+    }
+    CBlockIndex index1(block1);
+    index1.nHeight = 1;
+    wallet.ChainTip(&index1, &block1, sproutTree, saplingTree, true);
+
+    // Second block only has commitments of other wallets, which all
+    // witnesses have to be brought forward over
+    CBlock block2;
+    block2.hashPrevBlock = block1.GetHash();
+    for (size_t i = 0; i < nBlockTxs; i++) {
+        block2.vtx.push_back(GetCommitmentsOnlyTx());
+    }
+    CBlockIndex index2(block2);
+    index2.nHeight = 2;
+
+    struct timeval tv_start;
+    timer_start(tv_start);
+    wallet.ChainTip(&index2, &block2, sproutTree, saplingTree, true);
+    return timer_stop(tv_start);
+}
+
 // Fake the input of a given block
 class FakeCoinsViewDB : public CCoinsViewDB {
     uint256 hash;
@@ -464,6 +533,121 @@ double benchmark_loadwallet()
     return res;
 }
 
+double benchmark_write_wallet_txs(size_t nTxs, bool fBatch)
+{
+    LOCK(pwalletMain->cs_wallet);
+    std::vector<uint256> vHashes;
+    for (const std::pair<const uint256, CWalletTx>& item : pwalletMain->mapWallet) {
+        if (vHashes.size() >= nTxs)
+            break;
+        vHashes.push_back(item.first);
+    }
+    if (vHashes.size() < nTxs) {
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Not enough wallet transactions");
+    }
+
+    struct timeval tv_start;
+    timer_start(tv_start);
+    if (fBatch) {
+        for (const uint256& hash : vHashes)
+            pwalletMain->QueueTxWrite(hash);
+        if (!pwalletMain->WritePendingTxs())
+            throw JSONRPCError(RPC_WALLET_ERROR, "Failed to write wallet transactions");
+    } else {
+        // One write per transaction, as for a transaction seen outside a block
+        for (const uint256& hash : vHashes) {
+            CWalletDB walletdb(pwalletMain->strWalletFile, "r+", false);
+            if (!pwalletMain->mapWallet[hash].WriteToDisk(&walletdb))
+                throw JSONRPCError(RPC_WALLET_ERROR, "Failed to write wallet transaction");
+        }
+    }
+    return timer_stop(tv_start);
+}
+
+double benchmark_coins_cache(size_t nCoins)
+{
+    CCoinsView viewDummy;
+    CCoinsViewCache cache(&viewDummy);
+    std::vector<uint256> vTxids;
+    for (size_t i = 0; i < nCoins; i++)
+        vTxids.push_back(GetRandHash());
+    std::vector<uint256> vLookups(vTxids);
+    std::random_shuffle(vLookups.begin(), vLookups.end(), GetRandInt);
+
+    struct timeval tv_start;
+    timer_start(tv_start);
+    for (const uint256& txid : vTxids) {
+        CCoinsModifier coins = cache.ModifyNewCoins(txid);
+        coins->nVersion = 1;
+        coins->vout.resize(2);
+        coins->vout[0].nValue = 1;
+        coins->vout[1].nValue = 2;
+    }
+    // lookups in random order, as when connecting blocks
+    for (const uint256& txid : vLookups) {
+        if (!cache.AccessCoins(txid))
+            throw JSONRPCError(RPC_INTERNAL_ERROR, "Coins missing from the cache");
+    }
+    double elapsed = timer_stop(tv_start);
+    LogPrint("bench", "%s: %u coins use %u bytes of cache\n", __func__, (unsigned int)nCoins, (unsigned int)cache.DynamicMemoryUsage());
+    return elapsed;
+}
+
+double benchmark_flush_coins(size_t nCoins)
+{
+    CCoinsViewDB db(1 << 23, true, true);
+    std::vector<uint256> vTxids;
+    {
+        CCoinsViewCache cache(&db);
+        for (size_t i = 0; i < nCoins; i++) {
+            vTxids.push_back(GetRandHash());
+            CCoinsModifier coins = cache.ModifyNewCoins(vTxids.back());
+            coins->nVersion = 1;
+            coins->vout.resize(2);
+            coins->vout[0].nValue = 1;
+            coins->vout[1].nValue = 2;
+        }
+        cache.SetBestBlock(GetRandHash());
+        if (!cache.Flush())
+            throw JSONRPCError(RPC_INTERNAL_ERROR, "Failed to write coins");
+    }
+
+    // spend one output of each, which has to take the old version out of the running statistics
+    CCoinsViewCache cache(&db);
+    for (const uint256& txid : vTxids)
+        cache.ModifyCoins(txid)->Spend(0);
+    cache.SetBestBlock(GetRandHash());
+
+    struct timeval tv_start;
+    timer_start(tv_start);
+    if (!cache.Flush())
+        throw JSONRPCError(RPC_INTERNAL_ERROR, "Failed to write coins");
+    return timer_stop(tv_start);
+}
+
+double benchmark_verify_pastelid(size_t nSigs, int nThreads)
+{
+    ed_crypto::key_dsa448 key = ed_crypto::key_dsa448::generate_key();
+    std::string pastelID = CPastelID::EncodePastelID(key.public_key_raw().data());
+    std::vector<CPastelIDSignature> vSigs(nSigs);
+    for (size_t i = 0; i < nSigs; i++) {
+        vSigs[i].text = GetRandHash().GetHex();
+        vSigs[i].signature = ed_crypto::crypto_sign::sign(vSigs[i].text, key).Base64();
+        vSigs[i].pastelID = pastelID;
+    }
+
+    struct timeval tv_start;
+    timer_start(tv_start);
+    std::vector<bool> vValid = CPastelID::VerifyMany(vSigs, nThreads);
+    double elapsed = timer_stop(tv_start);
+    for (bool fValid : vValid) {
+        if (!fValid)
+            throw JSONRPCError(RPC_INTERNAL_ERROR, "PastelID signature failed to verify");
+    }
+    LogPrint("bench", "%s: %u signatures on %d threads, %.0f sigs/sec\n", __func__, (unsigned int)nSigs, nThreads, nSigs / elapsed);
+    return elapsed;
+}
+
 extern UniValue listunspent(const UniValue& params, bool fHelp);
 
 double benchmark_listunspent()
@@ -630,3 +814,51 @@ double benchmark_verify_sapling_output()
     }
     return timer_stop(tv_start);
 }
+
+// Verify the Sapling proofs and binding signatures of a block containing
+// nTxs shielding transactions, one Sapling output each
+double benchmark_verify_sapling_block(size_t nTxs)
+{
+    Consensus::Params consensusParams = Params().GetConsensus();
+    consensusParams.vUpgrades[Consensus::UPGRADE_OVERWINTER].nActivationHeight = Consensus::NetworkUpgrade::ALWAYS_ACTIVE;
+    consensusParams.vUpgrades[Consensus::UPGRADE_SAPLING].nActivationHeight = Consensus::NetworkUpgrade::ALWAYS_ACTIVE;
+    auto consensusBranchId = NetworkUpgradeInfo[Consensus::UPGRADE_SAPLING].nBranchId;
+
+    CKey tsk;
+    tsk.MakeNewKey(true);
+    CBasicKeyStore keystore;
+    keystore.AddKey(tsk);
+    auto scriptPubKey = GetScriptForDestination(tsk.GetPubKey().GetID());
+
+    auto sk = libzcash::SaplingSpendingKey::random();
+    auto fvk = sk.full_viewing_key();
+    auto pa = sk.default_address();
+
+    std::vector<CTransaction> vtx;
+    std::vector<uint256> vDataToBeSigned;
+    for (size_t i = 0; i < nTxs; i++) {
+        auto builder = TransactionBuilder(consensusParams, 1, &keystore);
+        builder.AddTransparentInput(COutPoint(uint256(), i), scriptPubKey, 50000);
+        builder.AddSaplingOutput(fvk.ovk, pa, 40000, {});
+        vtx.push_back(builder.Build().GetTxOrThrow());
+
+        CScript scriptCode;
+        vDataToBeSigned.push_back(SignatureHash(scriptCode, vtx.back(), NOT_AN_INPUT, SIGHASH_ALL, 0, consensusBranchId));
+    }
+
+    struct timeval tv_start;
+    timer_start(tv_start);
+
+    CSaplingDeferredVerifier deferred;
+    for (size_t i = 0; i < nTxs; i++) {
+        deferred.Add(vtx[i], vDataToBeSigned[i]);
+    }
+    CValidationState state;
+    bool result = deferred.Verify(state);
+
+    double t = timer_stop(tv_start);
+    if (!result) {
+        throw JSONRPCError(RPC_INTERNAL_ERROR, "CSaplingDeferredVerifier::Verify() should return true");
+    }
+    return t;
+}
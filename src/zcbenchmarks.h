@@ -14,14 +14,21 @@ extern double benchmark_verify_joinsplit(const JSDescription &joinsplit);
 extern double benchmark_verify_equihash();
 extern double benchmark_large_tx(size_t nInputs);
 extern double benchmark_try_decrypt_notes(size_t nAddrs);
+extern double benchmark_try_decrypt_notes_threaded(size_t nAddrs, int nThreads);
 extern double benchmark_increment_note_witnesses(size_t nTxs);
+extern double benchmark_increment_note_witnesses_scaled(size_t nNotes, size_t nBlockTxs);
 extern double benchmark_connectblock_slow();
 extern double benchmark_sendtoaddress(CAmount amount);
 extern double benchmark_loadwallet();
+extern double benchmark_write_wallet_txs(size_t nTxs, bool fBatch);
+extern double benchmark_coins_cache(size_t nCoins);
+extern double benchmark_flush_coins(size_t nCoins);
+extern double benchmark_verify_pastelid(size_t nSigs, int nThreads);
 extern double benchmark_listunspent();
 extern double benchmark_create_sapling_spend();
 extern double benchmark_create_sapling_output();
 extern double benchmark_verify_sapling_spend();
 extern double benchmark_verify_sapling_output();
+extern double benchmark_verify_sapling_block(size_t nTxs);
 
 #endif